@@ -0,0 +1,527 @@
+/*****************************************************************************************************
+ * File           : analyzer.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Token normalization between the tokenizer and insert_word(), so that "Collaboration,",
+ *      "collaboration" and "collaborations" can be one indexed word. The steps are chosen with
+ *      "-a" (parse_analysis() in validate.c) and recorded in the table and the index file:
+ *          ANALYZE_FOLD - upper case to lower case: ASCII, and the two-byte UTF-8 letters of
+ *                         Latin-1, Latin Extended-A, Greek and Cyrillic;
+ *          ANALYZE_TRIM - punctuation stripped from both ends ("(peer)," -> "peer"), ASCII and
+ *                         the common UTF-8 quotes, dashes and ellipsis; inner punctuation
+ *                         ("don't", "e-mail") is kept;
+ *          ANALYZE_STOP - common English words ("the", "of", ...) dropped;
+ *          ANALYZE_STEM - Porter stemming ("connections", "connected" -> "connect") of words
+ *                         made only of the letters a-z.
+ *
+ *      analyze_token() writes the result into a caller buffer no longer than the token (none of
+ *      the steps lengthens a word), so indexing allocates nothing per token. Search, boolean
+ *      queries and ranking run their words through the same steps, read from the table or the
+ *      index they search, through analyze_query().
+ *
+ *      Dropped words don't count as positions or towards a document's length: a phrase with a
+ *      stopword, "reset by peer", matches "reset peer" once both are analyzed.
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include "inverted_search.h"
+
+
+// Stopwords, sorted (the English list of Lucene's StandardAnalyzer)
+static const char *stopword[] = {
+    "a", "an", "and", "are", "as", "at", "be", "but", "by", "for", "if", "in", "into", "is", "it", "no",
+    "not", "of", "on", "or", "such", "that", "the", "their", "then", "there", "these", "they", "this",
+    "to", "was", "will", "with"
+};
+
+#define STOPWORDS   (sizeof(stopword) / sizeof(stopword[0]))
+#define STOPWORD_MAX 5            // Longest stopword, anything longer is never looked up
+
+
+/*****************************************************************************************************
+ * Function       : fold_letter
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Lower case of a code point between U+0080 and U+07FF. Every result stays in that range,
+ *      so the UTF-8 length of a folded word doesn't change.
+ *
+ * Returns        :
+ *      The folded code point (the same one if it isn't an upper case letter).
+ *****************************************************************************************************/
+static unsigned int fold_letter(unsigned int cp)
+{
+    if ((cp >= 0xC0 && cp <= 0xDE && cp != 0xD7) ||    // Latin-1: À-Þ except ×
+        (cp >= 0x391 && cp <= 0x3AB && cp != 0x3A2) ||  // Greek: Α-Ϋ
+        (cp >= 0x410 && cp <= 0x42F))                   // Cyrillic: А-Я
+        return cp + 0x20;
+    if (cp >= 0x400 && cp <= 0x40F)                     // Cyrillic: Ѐ-Џ
+        return cp + 0x50;
+    if (cp == 0x178)                                    // Ÿ
+        return 0xFF;
+    if ((cp >= 0x100 && cp <= 0x137) || (cp >= 0x14A && cp <= 0x177))
+        return cp | 1;                                  // Latin Extended-A: upper case even
+    if ((cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17E))
+        return cp + (cp & 1);                           // ... or odd in these two runs
+    return cp;
+}
+
+
+/*****************************************************************************************************
+ * Function       : leading_punct / trailing_punct
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Recognize a punctuation character at the start of p[0..end) / at its end: ASCII
+ *      punctuation, « » ¡ ¿, and the UTF-8 dashes, quotes and ellipsis of U+2013..U+2026.
+ *
+ * Returns        :
+ *      Its length in bytes, 0 if the text doesn't start / end with punctuation.
+ *****************************************************************************************************/
+static size_t punct_length(const unsigned char *p, size_t avail)
+{
+    if (*p < 0x80)
+        return (*p >= '!' && *p <= '/') || (*p >= ':' && *p <= '@') || (*p >= '[' && *p <= '`') ||
+               (*p >= '{' && *p <= '~');
+    if (avail >= 2 && *p == 0xC2)
+        return p[1] == 0xAB || p[1] == 0xBB || p[1] == 0xA1 || p[1] == 0xBF ? 2 : 0;
+    if (avail >= 3 && p[0] == 0xE2 && p[1] == 0x80)
+        return (p[2] >= 0x93 && p[2] <= 0x94) || (p[2] >= 0x98 && p[2] <= 0x9F) || p[2] == 0xA6 ? 3 : 0;
+    return 0;
+}
+
+static size_t leading_punct(const unsigned char *p, const unsigned char *end)
+{
+    return punct_length(p, end - p);
+}
+
+static size_t trailing_punct(const unsigned char *p, const unsigned char *end)
+{
+    for (size_t n = 1; n <= 3 && n <= (size_t)(end - p); n++)
+    {
+        if ((end[-n] & 0xC0) == 0x80)
+            continue;                                   // Inside a UTF-8 sequence: back to its start
+        return punct_length(end - n, n) == n ? n : 0;
+    }
+    return 0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : is_stopword
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Binary search of the stopword list.
+ *
+ * Returns        :
+ *      1 if the 'len'-byte word is a stopword, 0 otherwise.
+ *****************************************************************************************************/
+static int is_stopword(const char *word, size_t len)
+{
+    int low = 0, high = STOPWORDS - 1;
+
+    if (len > STOPWORD_MAX)
+        return 0;
+    while (low <= high)
+    {
+        int mid = (low + high) / 2;
+        int cmp = strncmp(stopword[mid], word, len);
+        if (cmp == 0)
+            cmp = stopword[mid][len] != '\0';           // The stopword is longer than the word
+        if (cmp == 0)
+            return 1;
+        if (cmp < 0)
+            low = mid + 1;
+        else
+            high = mid - 1;
+    }
+    return 0;
+}
+
+
+/*****************************************************************************************************
+ * Porter stemmer
+ * ---------------------------------------------------------------------------------------------------
+ *      M.F. Porter, "An algorithm for suffix stripping", 1980, following the structure of the
+ *      author's reference implementation (including its "bli" -> "ble" and "logi" -> "log"
+ *      departures). The word is b[0..k], modified in place; j marks the end of the stem a
+ *      suffix test matched.
+ *****************************************************************************************************/
+typedef struct stemmer
+{
+    char *b;                     // The word
+    int k;                       // Offset of its last letter
+    int j;                       // Offset of the stem's last letter after ends()
+} stemmer;
+
+// 1 if b[i] is a consonant; 'y' is one at the start of the word or after a vowel
+static int consonant(const stemmer *z, int i)
+{
+    switch (z->b[i])
+    {
+        case 'a': case 'e': case 'i': case 'o': case 'u':
+            return 0;
+        case 'y':
+            return i == 0 ? 1 : !consonant(z, i - 1);
+        default:
+            return 1;
+    }
+}
+
+// Number of vowel-consonant sequences in b[0..j] (its "measure")
+static int measure(const stemmer *z)
+{
+    int n = 0, i = 0;
+
+    for (;; i++)
+    {
+        if (i > z->j)
+            return n;
+        if (!consonant(z, i))
+            break;
+    }
+    for (i++;; i++)
+    {
+        for (;; i++)
+        {
+            if (i > z->j)
+                return n;
+            if (consonant(z, i))
+                break;
+        }
+        n++;
+        for (i++;; i++)
+        {
+            if (i > z->j)
+                return n;
+            if (!consonant(z, i))
+                break;
+        }
+    }
+}
+
+// 1 if b[0..j] has a vowel
+static int vowel_in_stem(const stemmer *z)
+{
+    for (int i = 0; i <= z->j; i++)
+        if (!consonant(z, i))
+            return 1;
+    return 0;
+}
+
+// 1 if b[i-1..i] is a double consonant
+static int double_consonant(const stemmer *z, int i)
+{
+    return i >= 1 && z->b[i] == z->b[i - 1] && consonant(z, i);
+}
+
+// 1 if b[i-2..i] is consonant-vowel-consonant and the last one isn't w, x or y ("hop", not "snow")
+static int cvc(const stemmer *z, int i)
+{
+    if (i < 2 || !consonant(z, i) || consonant(z, i - 1) || !consonant(z, i - 2))
+        return 0;
+    return z->b[i] != 'w' && z->b[i] != 'x' && z->b[i] != 'y';
+}
+
+// 1 if the word ends with s (setting j before it)
+static int ends(stemmer *z, const char *s)
+{
+    int length = strlen(s);
+
+    if (s[length - 1] != z->b[z->k] || length > z->k + 1 ||
+        memcmp(z->b + z->k - length + 1, s, length) != 0)
+        return 0;
+    z->j = z->k - length;
+    return 1;
+}
+
+// Replaces b[j+1..k] with s
+static void set_to(stemmer *z, const char *s)
+{
+    int length = strlen(s);
+
+    memmove(z->b + z->j + 1, s, length);
+    z->k = z->j + length;
+}
+
+// set_to() if the stem's measure is positive
+static void replace(stemmer *z, const char *s)
+{
+    if (measure(z) > 0)
+        set_to(z, s);
+}
+
+// Plurals and -ed / -ing: caresses -> caress, ponies -> poni, agreed -> agree, hopping -> hop
+static void step1ab(stemmer *z)
+{
+    if (z->b[z->k] == 's')
+    {
+        if (ends(z, "sses"))
+            z->k -= 2;
+        else if (ends(z, "ies"))
+            set_to(z, "i");
+        else if (z->b[z->k - 1] != 's')
+            z->k--;
+    }
+    if (ends(z, "eed"))
+    {
+        if (measure(z) > 0)
+            z->k--;
+    }
+    else if ((ends(z, "ed") || ends(z, "ing")) && vowel_in_stem(z))
+    {
+        z->k = z->j;
+        if (ends(z, "at"))
+            set_to(z, "ate");
+        else if (ends(z, "bl"))
+            set_to(z, "ble");
+        else if (ends(z, "iz"))
+            set_to(z, "ize");
+        else if (double_consonant(z, z->k))
+        {
+            z->k--;
+            char ch = z->b[z->k];
+            if (ch == 'l' || ch == 's' || ch == 'z')
+                z->k++;
+        }
+        else if (measure(z) == 1 && cvc(z, z->k))
+            set_to(z, "e");
+    }
+}
+
+// Terminal y to i when there is another vowel: happy -> happi
+static void step1c(stemmer *z)
+{
+    if (ends(z, "y") && vowel_in_stem(z))
+        z->b[z->k] = 'i';
+}
+
+// Replaces the first of the (suffix, replacement) pairs, NULL terminated, that the word ends
+// with, if the stem's measure is positive; later pairs aren't tried once a suffix matched
+static void replace_first(stemmer *z, const char *const *rule)
+{
+    for (; rule[0]; rule += 2)
+    {
+        if (ends(z, rule[0]))
+        {
+            replace(z, rule[1]);
+            return;
+        }
+    }
+}
+
+// Double suffixes to single ones: relational -> relate, digitizer -> digitize. As in the
+// reference, the rules tried depend on the second to last letter.
+static void step2(stemmer *z)
+{
+    static const char *const a[] = { "ational", "ate", "tional", "tion", NULL };
+    static const char *const c[] = { "enci", "ence", "anci", "ance", NULL };
+    static const char *const e[] = { "izer", "ize", NULL };
+    static const char *const l[] = { "bli", "ble", "alli", "al", "entli", "ent", "eli", "e", "ousli", "ous", NULL };
+    static const char *const o[] = { "ization", "ize", "ation", "ate", "ator", "ate", NULL };
+    static const char *const s[] = { "alism", "al", "iveness", "ive", "fulness", "ful", "ousness", "ous", NULL };
+    static const char *const t[] = { "aliti", "al", "iviti", "ive", "biliti", "ble", NULL };
+    static const char *const g[] = { "logi", "log", NULL };
+
+    switch (z->b[z->k - 1])
+    {
+        case 'a': replace_first(z, a); break;
+        case 'c': replace_first(z, c); break;
+        case 'e': replace_first(z, e); break;
+        case 'l': replace_first(z, l); break;
+        case 'o': replace_first(z, o); break;
+        case 's': replace_first(z, s); break;
+        case 't': replace_first(z, t); break;
+        case 'g': replace_first(z, g); break;
+    }
+}
+
+// -ic-, -full, -ness etc.: triplicate -> triplic, hopeful -> hope (by the last letter)
+static void step3(stemmer *z)
+{
+    static const char *const e[] = { "icate", "ic", "ative", "", "alize", "al", NULL };
+    static const char *const i[] = { "iciti", "ic", NULL };
+    static const char *const l[] = { "ical", "ic", "ful", "", NULL };
+    static const char *const s[] = { "ness", "", NULL };
+
+    switch (z->b[z->k])
+    {
+        case 'e': replace_first(z, e); break;
+        case 'i': replace_first(z, i); break;
+        case 'l': replace_first(z, l); break;
+        case 's': replace_first(z, s); break;
+    }
+}
+
+// -ant, -ence etc. on a stem of measure > 1: revival -> reviv, adjustment -> adjust (by the
+// second to last letter)
+static void step4(stemmer *z)
+{
+    int found;
+
+    switch (z->b[z->k - 1])
+    {
+        case 'a': found = ends(z, "al"); break;
+        case 'c': found = ends(z, "ance") || ends(z, "ence"); break;
+        case 'e': found = ends(z, "er"); break;
+        case 'i': found = ends(z, "ic"); break;
+        case 'l': found = ends(z, "able") || ends(z, "ible"); break;
+        case 'n': found = ends(z, "ant") || ends(z, "ement") || ends(z, "ment") || ends(z, "ent"); break;
+        case 'o': found = (ends(z, "ion") && z->j >= 0 && (z->b[z->j] == 's' || z->b[z->j] == 't')) ||
+                          ends(z, "ou");
+                  break;
+        case 's': found = ends(z, "ism"); break;
+        case 't': found = ends(z, "ate") || ends(z, "iti"); break;
+        case 'u': found = ends(z, "ous"); break;
+        case 'v': found = ends(z, "ive"); break;
+        case 'z': found = ends(z, "ize"); break;
+        default:  found = 0;
+    }
+    if (found && measure(z) > 1)
+        z->k = z->j;
+}
+
+// Final -e and -ll: probate -> probat, controll -> control
+static void step5(stemmer *z)
+{
+    z->j = z->k;
+    if (z->b[z->k] == 'e')
+    {
+        int m = measure(z);
+        if (m > 1 || (m == 1 && !cvc(z, z->k - 1)))
+            z->k--;
+    }
+    if (z->b[z->k] == 'l' && double_consonant(z, z->k) && measure(z) > 1)
+        z->k--;
+}
+
+
+/*****************************************************************************************************
+ * Function       : stem_word
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Porter-stems a word of lower case letters a-z in place. Words of one or two letters, and
+ *      words with any other byte, are left alone.
+ *
+ * Returns        :
+ *      The stemmed length.
+ *****************************************************************************************************/
+static size_t stem_word(char *word, size_t len)
+{
+    stemmer z = { word, (int)len - 1, 0 };
+
+    if (len <= 2)
+        return len;
+    for (size_t i = 0; i < len; i++)
+        if (word[i] < 'a' || word[i] > 'z')
+            return len;
+
+    step1ab(&z);
+    if (z.k > 0)
+    {
+        step1c(&z);
+        step2(&z);
+        step3(&z);
+        step4(&z);
+        step5(&z);
+    }
+    return z.k + 1;
+}
+
+
+/*****************************************************************************************************
+ * Function       : analyze_token
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Applies the ANALYZE_* steps in 'steps' to a 'len'-byte token and writes the result to
+ *      'out' (at least len + 1 bytes), NUL-terminated: the punctuation ends are skipped and the
+ *      rest is folded as it is copied, then the stopword test and the stemmer run on the copy.
+ *
+ * Returns        :
+ *      Length of the result, 0 if the token is dropped (a stopword, or nothing but punctuation).
+ *****************************************************************************************************/
+size_t analyze_token(unsigned int steps, const char *word, size_t len, char *out)
+{
+    const unsigned char *p = (const unsigned char *)word, *end = p + len;
+    size_t n = 0, cut;
+
+    if (steps & ANALYZE_TRIM)
+    {
+        while (p < end && (cut = leading_punct(p, end)) > 0)
+            p += cut;
+        while (end > p && (cut = trailing_punct(p, end)) > 0)
+            end -= cut;
+    }
+
+    if (steps & ANALYZE_FOLD)
+    {
+        while (p < end)
+        {
+            if (*p >= 'A' && *p <= 'Z')
+                out[n++] = *p++ + ('a' - 'A');
+            else if (*p >= 0xC2 && *p <= 0xDF && p + 1 < end && (p[1] & 0xC0) == 0x80)
+            {
+                unsigned int cp = fold_letter((*p & 0x1F) << 6 | (p[1] & 0x3F));
+                out[n++] = (char)(0xC0 | cp >> 6);
+                out[n++] = (char)(0x80 | (cp & 0x3F));
+                p += 2;
+            }
+            else
+                out[n++] = *p++;
+        }
+    }
+    else
+    {
+        memcpy(out, p, end - p);
+        n = end - p;
+    }
+    out[n] = '\0';
+
+    if (n == 0 || ((steps & ANALYZE_STOP) && is_stopword(out, n)))
+        return 0;
+    if (steps & ANALYZE_STEM)
+        n = stem_word(out, n);
+    out[n] = '\0';
+    return n;
+}
+
+
+/*****************************************************************************************************
+ * Function       : analyze_query
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Prepares a word typed in a search or query for lookup with the steps the table or index
+ *      was built with. Without steps, or for words too long to have been indexed as they are,
+ *      the word is used unchanged.
+ *
+ * Returns        :
+ *      The word to look up ('word' itself or 'buf', which holds at least MAX_TOKEN_LEN + 1
+ *      bytes) with its length in *len, or NULL if the word is dropped by the analysis.
+ *****************************************************************************************************/
+const char* analyze_query(unsigned int steps, const char *word, size_t *len, char *buf)
+{
+    if (steps == 0 || *len > MAX_TOKEN_LEN)
+        return word;
+    *len = analyze_token(steps, word, *len, buf);
+    return *len ? buf : NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : analysis_name
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Names a set of steps for messages and benchmark output, e.g. "fold,trim,stem".
+ *
+ * Returns        :
+ *      'buf' (at least 24 bytes), "none" if no step is set.
+ *****************************************************************************************************/
+const char* analysis_name(unsigned int steps, char *buf)
+{
+    static const char *name[] = { "fold", "trim", "stop", "stem" };
+    size_t n = 0;
+
+    buf[0] = '\0';
+    for (int i = 0; i < 4; i++)
+        if (steps & (1u << i))
+            n += sprintf(buf + n, "%s%s", n ? "," : "", name[i]);
+    return n ? buf : "none";
+}
@@ -0,0 +1,138 @@
+/*****************************************************************************************************
+ * File           : arena.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Region allocator for index nodes. Memory is carved out of large chunks with a bump pointer
+ *      and is never freed piecemeal; arena_free() releases every chunk at once.
+ *
+ * Why it’s needed:
+ *      The index allocates one mainnode per distinct word and a chain of posting blocks
+ *      for the words found in more than one file.
+ *      Allocating each with malloc costs a call and a malloc header per node, and tearing the index
+ *      down would mean walking every chain. Nodes live exactly as long as the index does, so a
+ *      region owned by the hashtable fits them.
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include "inverted_search.h"
+
+#define ARENA_ALIGN sizeof(void *)          // Every allocation is pointer aligned
+
+
+/*****************************************************************************************************
+ * Function       : arena_init
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Sets up an empty arena. No memory is reserved until the first allocation.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void arena_init(arena *pool)
+{
+    pool->head = NULL;
+    pool->chunks = 0;
+    pool->bytes = 0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : arena_alloc
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Returns 'size' bytes from the current chunk, starting a new chunk of ARENA_CHUNK_SIZE bytes
+ *      (or larger, for oversized requests) when the current one is full. Memory is not zeroed.
+ *
+ * Returns        :
+ *      Pointer to the memory, or NULL if a new chunk couldn't be allocated.
+ *****************************************************************************************************/
+void* arena_alloc(arena *pool, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    arena_chunk *chunk = pool->head;
+    if (chunk == NULL || chunk->size - chunk->used < size)
+    {
+        size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+
+        chunk = malloc(sizeof(arena_chunk) + chunk_size);
+        if (chunk == NULL)
+        {
+            printf("ERROR: Couldn't allocate arena chunk\n");
+            return NULL;
+        }
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        chunk->next = pool->head;
+        pool->head = chunk;
+        pool->chunks++;
+        METRIC_COUNT(METRIC_ARENA_CHUNKS, 1);
+    }
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    pool->bytes += size;
+    METRIC_COUNT(METRIC_ARENA_ALLOCS, 1);
+    METRIC_COUNT(METRIC_ARENA_BYTES, size);
+    return ptr;
+}
+
+
+/*****************************************************************************************************
+ * Function       : arena_free
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Releases every chunk and leaves the arena empty and ready for reuse.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void arena_free(arena *pool)
+{
+    arena_chunk *chunk = pool->head;
+
+    while (chunk)
+    {
+        arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena_init(pool);
+}
+
+
+/*****************************************************************************************************
+ * Function       : arena_adopt
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Moves every chunk of 'src' into 'dst', leaving 'src' empty. The adopted chunks are linked
+ *      behind the chunk 'dst' is currently filling, so its bump pointer is undisturbed.
+ *
+ * Why it’s needed:
+ *      Parallel indexing builds partial tables in private arenas and then hands their nodes to the
+ *      shared table; adopting the chunks transfers ownership without copying any node.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void arena_adopt(arena *dst, arena *src)
+{
+    arena_chunk *tail = src->head;
+
+    if (tail == NULL)
+        return;
+    while (tail->next)
+        tail = tail->next;
+
+    if (dst->head == NULL)
+        dst->head = src->head;
+    else
+    {
+        tail->next = dst->head->next;
+        dst->head->next = src->head;
+    }
+
+    dst->chunks += src->chunks;
+    dst->bytes += src->bytes;
+    arena_init(src);
+}
@@ -0,0 +1,3444 @@
+/***************************************************************************************************************************************************
+* PROGRAM        : benchmark
+* --------------------------------------------------------------------------------------------------------------------------------------------------
+* What it does   :
+*       Measures the indexer's building blocks on real input files. Each benchmark prints one line of key=value pairs
+*       so runs can be compared by scripts.
+*
+* Usage          :
+*       ./benchmark dict file1.txt file2.txt ...
+*       ./benchmark build [-j threads] file1.txt file2.txt ...
+*       ./benchmark postings [documents] [tokens_per_document]
+*       ./benchmark tokenize file1.txt file2.txt ...
+*       ./benchmark load [-j threads] file1.txt file2.txt ...
+*       ./benchmark compress file1.txt file2.txt ...
+*       ./benchmark update file1.txt file2.txt ...
+*       ./benchmark query [-j threads] file1.txt file2.txt ...
+*       ./benchmark swap [-j readers] file1.txt file2.txt ...
+*       ./benchmark cache [-s budget_kb] file1.txt file2.txt ...
+*       ./benchmark segments [-b files_per_batch] file1.txt file2.txt ...
+*       ./benchmark rank file1.txt file2.txt ...
+*       ./benchmark phrase [-j threads] file1.txt file2.txt ...
+*       ./benchmark lexicon [words]
+*       ./benchmark analyze [-j threads] file1.txt file2.txt ...
+*       ./benchmark stress [-j threads] [tokens_per_file]
+*       ./benchmark corpus [-n files] [-w words_per_file] [-v vocabulary] [-z zipf_exponent] [-s seed] dir
+*       ./benchmark suite [-j threads] file1.txt file2.txt ...     (make bench runs both on a generated corpus)
+*
+* Benchmarks     :
+*       dict     - Term dictionary insert and lookup throughput. The program is built twice, once per layout
+*                  (benchmark = chained hashtable, benchmark_flat = FLAT_DICT), so both layouts run on the same input.
+*       build    - Full create_database() run: time, node memory, allocations per distinct word and peak RSS, on the
+*                  number of threads given with -j (default 1).
+*       postings - insert_word() throughput on a generated corpus where a few very common words ("the", "and", ...)
+*                  occur in every document, which stresses the per-word postings lists.
+*       tokenize - Tokenizer throughput in MB/s on one core: the old fscanf("%255s") loop against the mapped tokenizer
+*                  with its table classifier and with its SSE2 classifier. A checksum over every token shows that all
+*                  three paths produce the same tokens.
+*       load     - Saves the index as backup.txt and backup.idx in the current directory, then times reloading the
+*                  text backup (on one thread and on -j threads) against mapping the binary index, and checks that
+*                  both reloads and the mapped index give every word the same postings.
+*       compress - Bytes per posting of the compressed postings (in memory and in the index file format) against the
+*                  16-byte linked subnode they replaced, and decode throughput of both forms.
+*       update   - Cost of keeping the index current through sync_database() when one file changes, is removed or is
+*                  added back, against a full rebuild, and a check that the result matches the rebuild.
+*       query    - Boolean query throughput (queries/s) on a fixed batch of generated AND / OR / NOT queries, against
+*                  the in-memory table and the mapped index file, with results checked against a per-document
+*                  brute-force evaluation.
+*       swap     - Query latency on -j reader threads while the index is rebuilt and published through an
+*                  index_snapshot, against no rebuild and against rebuilding under a lock the readers wait on.
+*       cache    - Searches drawn with Zipfian popularity from the indexed words, through search_database() and through
+*                  the result cache: searches/s, latency, hit rate, memory and evictions, and a check that cached
+*                  output matches a plain search before and after an update.
+*       segments - Ingest rate and boolean / ranked query latency p50/p99 as files are ingested into more and more
+*                  segments (-b files per segment), without background merging and with it, against one index of
+*                  every file; answers are checked against that index before and after deleting files and compacting.
+*       rank     - BM25 top-10 throughput with MaxScore pruning against scoring every posting, on the table and the
+*                  mapped index, checking that pruning returns the same scores.
+*       phrase   - Memory and index file size with and without word positions (-p), and latency of phrase and NEAR
+*                  queries taken from the files against the plain AND of the same words, with results checked
+*                  against a scan of every document's words.
+*       lexicon  - Build time and size of the front-coded sorted dictionary over a generated vocabulary (default 1M
+*                  words), and latency of prefix, wildcard and fuzzy (1 and 2 edit) lookups on the table and the mapped
+*                  index, with the matches checked against a scan of every word.
+*       analyze  - Vocabulary size and indexing throughput with token analysis off and with each step added in turn
+*                  (fold+trim, +stopwords, +stemming), and the cost of the analysis alone in ns per token.
+*       stress   - Generated files of long (past MAX_TOKEN_LEN) and multi-byte UTF-8 tokens: checks that every token is
+*                  indexed whole or split at a character boundary, survives backup.idx and backup.txt, and is found
+*                  through the analyzer, and reports the mean mainnode size.
+*       corpus   - Writes a reproducible synthetic corpus: word frequencies follow Zipf's law, file count, file size,
+*                  vocabulary, exponent and seed are options.
+*       suite    - One line per phase with a fixed set of keys (schema=1): create_database(), save_database() and
+*                  save_index(), update_database() and open_index(), and search_database() / search_index() latency
+*                  percentiles, each with the peak RSS, for tracking regressions run over run.
+****************************************************************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include "inverted_search.h"
+
+#ifdef FLAT_DICT
+#define LAYOUT "flat"
+#else
+#define LAYOUT "chained"
+#endif
+
+
+/*****************************************************************************************************
+ * Function       : now_seconds
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Reads the monotonic clock.
+ *
+ * Returns        :
+ *      Current time in seconds.
+ *****************************************************************************************************/
+static double now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*****************************************************************************************************
+ * Function       : load_tokens
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Reads every word of every file into one array, the same way create_database() tokenizes, so
+ *      file I/O stays outside the timed sections.
+ *
+ * Returns        :
+ *      Array of token pointers (count stored in *count), or NULL on failure.
+ *****************************************************************************************************/
+static char **load_tokens(int argc, char *argv[], size_t *count)
+{
+    size_t cap = 1024, n = 0;
+    char **tokens = malloc(cap * sizeof(char *));
+    char word[MAX_TOKEN_LEN + 1];
+
+    if (tokens == NULL)
+        return NULL;
+
+    for (int i = 0; i < argc; i++)
+    {
+        FILE *fp = fopen(argv[i], "r");
+        if (fp == NULL)
+        {
+            printf("ERROR : Cannot open %s\n", argv[i]);
+            continue;
+        }
+
+        while (fscanf(fp, TOKEN_SCAN, word) != EOF)
+        {
+            if (n == cap)
+            {
+                cap *= 2;
+                tokens = realloc(tokens, cap * sizeof(char *));
+                if (tokens == NULL)
+                    return NULL;
+            }
+            tokens[n++] = strdup(word);
+        }
+        fclose(fp);
+    }
+
+    *count = n;
+    return tokens;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_dict
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Times three passes over the token stream:
+ *          insert      - lookup_word() then insert_mainnode() on a miss (the indexing path).
+ *          lookup_hit  - lookup_word() for every token again, all present.
+ *          lookup_miss - lookup_word() for every token with a suffix no token carries.
+ *      Postings are not touched, so only the dictionary layout is measured.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the input couldn't be loaded.
+ *****************************************************************************************************/
+static int bench_dict(int argc, char *argv[])
+{
+    size_t count;
+    char **tokens = load_tokens(argc, argv, &count);
+    hashtable table;
+    size_t found = 0;
+
+    if (tokens == NULL || count == 0 || init_hashtable(&table) == FAILURE)
+    {
+        printf("ERROR : No tokens to benchmark\n");
+        return FAILURE;
+    }
+
+    double start = now_seconds();
+    for (size_t i = 0; i < count; i++)
+    {
+        if (lookup_word(&table, tokens[i]) == NULL)
+            insert_mainnode(&table, tokens[i], strlen(tokens[i]));
+    }
+    double insert_time = now_seconds() - start;
+
+    start = now_seconds();
+    for (size_t i = 0; i < count; i++)
+        found += lookup_word(&table, tokens[i]) != NULL;
+    double hit_time = now_seconds() - start;
+
+    char **missing = malloc(count * sizeof(char *));
+    for (size_t i = 0; i < count; i++)
+    {
+        missing[i] = malloc(strlen(tokens[i]) + 3);
+        sprintf(missing[i], "%s\001\002", tokens[i]);
+    }
+
+    start = now_seconds();
+    for (size_t i = 0; i < count; i++)
+        found += lookup_word(&table, missing[i]) != NULL;
+    double miss_time = now_seconds() - start;
+
+    printf("bench=dict layout=%s tokens=%zu distinct=%u found=%zu "
+           "insert_mops=%.2f lookup_hit_mops=%.2f lookup_miss_mops=%.2f\n",
+           LAYOUT, count, table.count, found,
+           count / insert_time / 1e6, count / hit_time / 1e6, count / miss_time / 1e6);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        free(tokens[i]);
+        free(missing[i]);
+    }
+    free(tokens);
+    free(missing);
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : peak_rss_kb
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Reads the peak resident set size of this process.
+ *
+ * Returns        :
+ *      Peak RSS in kilobytes.
+ *****************************************************************************************************/
+static long peak_rss_kb(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_build
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Indexes the files with create_database() and reports build time, distinct words, postings,
+ *      bytes handed out by the node arena, node allocations (arena chunks) per distinct word and
+ *      the process's peak RSS. Mallocing every node individually would cost one allocation per
+ *      word plus one per posting, which is printed as node_allocs_unpooled for comparison.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if no file could be indexed.
+ *****************************************************************************************************/
+static int bench_build(int argc, char *argv[])
+{
+    int threads = parse_threads(&argc, argv);
+    filenode *head = create_file_linked_list(argc, argv);
+    hashtable table;
+    table_cursor cursor;
+    unsigned long postings = 0;
+
+    if (head == NULL || init_hashtable(&table) == FAILURE)
+        return FAILURE;
+
+    double start = now_seconds();
+    create_database(&table, head, threads);
+    double build_time = now_seconds() - start;
+
+    for (mainnode *m = first_mainnode(&table, &cursor); m != NULL; m = next_mainnode(&table, &cursor))
+        postings += m->file_count;
+
+    printf("bench=build layout=%s threads=%d distinct=%u postings=%lu build_s=%.3f node_bytes=%zu "
+           "node_allocs=%lu node_allocs_unpooled=%lu allocs_per_word=%.4f peak_rss_kb=%ld\n",
+           LAYOUT, threads, table.count, postings, build_time, table.nodes.bytes,
+           table.nodes.chunks, table.count + postings,
+           table.count ? (double)table.nodes.chunks / table.count : 0.0, peak_rss_kb());
+
+    free_hashtable(&table);
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_postings
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Generates 'docs' documents of 'tokens' words each with a fixed xorshift seed: 30% of the
+ *      tokens are one of eight stopwords, the rest are drawn from a 20000-word vocabulary. Every
+ *      token is fed to insert_word() with its document id, document by document, as
+ *      create_database() does. Reports tokens indexed per second and the longest postings list.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+static int bench_postings(int docs, int tokens)
+{
+    static char *common[] = { "the", "and", "of", "a", "to", "in", "is", "that" };
+    enum { VOCABULARY = 20000 };
+    char **vocab = malloc(VOCABULARY * sizeof(char *));
+    int *stream = malloc((size_t)docs * tokens * sizeof(int));
+    unsigned int state = 2463534242u;
+    hashtable table;
+    char name[32];
+
+    if (vocab == NULL || stream == NULL || init_hashtable(&table) == FAILURE)
+        return FAILURE;
+
+    for (int i = 0; i < VOCABULARY; i++)
+    {
+        vocab[i] = malloc(16);
+        sprintf(vocab[i], "w%d", i);
+    }
+
+    for (size_t i = 0; i < (size_t)docs * tokens; i++)  // Negative entries index common[]
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        stream[i] = state % 10 < 3 ? -1 - (int)(state / 10 % 8) : (int)(state / 10 % VOCABULARY);
+    }
+
+    for (int d = 0; d < docs; d++)
+    {
+        sprintf(name, "doc%d.txt", d);
+        add_document(&table, name);
+    }
+
+    double start = now_seconds();
+    for (int d = 0; d < docs; d++)
+    {
+        int *word = stream + (size_t)d * tokens;
+        for (int t = 0; t < tokens; t++)
+        {
+            const char *token = word[t] < 0 ? common[-1 - word[t]] : vocab[word[t]];
+            insert_word(&table, token, strlen(token), d, t);
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("bench=postings layout=%s documents=%d tokens=%zu distinct=%u the_postings=%d "
+           "build_s=%.3f mtokens_per_s=%.2f\n",
+           LAYOUT, docs, (size_t)docs * tokens, table.count, lookup_word(&table, "the")->file_count,
+           elapsed, (double)docs * tokens / elapsed / 1e6);
+
+    free_hashtable(&table);
+    for (int i = 0; i < VOCABULARY; i++)
+        free(vocab[i]);
+    free(vocab);
+    free(stream);
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : tokenize_pass
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Tokenizes every file once with the chosen path (0 = fscanf, 1 = table, 2 = SSE2), hashing each
+ *      token into a running checksum so the work can't be optimized away.
+ *
+ * Returns        :
+ *      Elapsed seconds; token count, byte count and checksum are stored through the pointers.
+ *****************************************************************************************************/
+static double tokenize_pass(int argc, char *argv[], int path, size_t *tokens, size_t *bytes,
+                            unsigned int *checksum)
+{
+    double start = now_seconds();
+
+    *tokens = *bytes = 0;
+    *checksum = 0;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if (path == 0)
+        {
+            char word[MAX_TOKEN_LEN + 1];
+            FILE *fp = fopen(argv[i], "r");
+            if (fp == NULL)
+                continue;
+
+            while (fscanf(fp, TOKEN_SCAN, word) != EOF)
+            {
+                *checksum += hash_word(word);
+                (*tokens)++;
+            }
+            *bytes += ftell(fp);
+            fclose(fp);
+        }
+        else
+        {
+            tokenizer tok;
+            const char *word;
+            size_t len;
+
+            if (open_tokenizer(&tok, argv[i]) == FAILURE)
+                continue;
+            tok.use_simd = path == 2;
+
+            while (next_token(&tok, &word, &len) == SUCCESS)
+            {
+                *checksum += hash_bytes(word, len);
+                (*tokens)++;
+            }
+            *bytes += tok.size;
+            close_tokenizer(&tok);
+        }
+    }
+    return now_seconds() - start;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_tokenize
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Warms the page cache with one untimed pass, then times each tokenizer path and prints one line
+ *      per path.
+ *
+ * Returns        :
+ *      SUCCESS.
+ *****************************************************************************************************/
+static int bench_tokenize(int argc, char *argv[])
+{
+    static const char *paths[] = { "fscanf", "table", "sse2" };
+    size_t tokens, bytes;
+    unsigned int checksum;
+
+    tokenize_pass(argc, argv, 1, &tokens, &bytes, &checksum);
+
+    for (int path = 0; path < 3; path++)
+    {
+#ifndef __SSE2__
+        if (path == 2)
+            break;
+#endif
+        double elapsed = tokenize_pass(argc, argv, path, &tokens, &bytes, &checksum);
+
+        printf("bench=tokenize path=%s bytes=%zu tokens=%zu checksum=%08x mb_per_s=%.1f\n",
+               paths[path], bytes, tokens, checksum, bytes / elapsed / 1e6);
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : compare_tables
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Counts the words whose postings differ between two tables built from the same files. The
+ *      tables may number the documents differently, so documents are matched by name.
+ *
+ * Returns        :
+ *      Number of differing words (words missing from either table included), or -1 if memory ran
+ *      out.
+ *****************************************************************************************************/
+static long compare_tables(hashtable *a, hashtable *b)
+{
+    int *id_in_b = malloc((a->docs.count + 1) * sizeof(int));
+    int *count_in_b = calloc(b->docs.count + 1, sizeof(int));
+    table_cursor cursor;
+    posting_cursor p;
+    long differ = 0;
+
+    if (id_in_b == NULL || count_in_b == NULL)
+    {
+        free(id_in_b);
+        free(count_in_b);
+        return -1;
+    }
+    for (int id = 0; id < a->docs.count; id++)
+        id_in_b[id] = a->docs.name[id] ? find_document(&b->docs, a->docs.name[id]) : -1;
+
+    for (mainnode *m = first_mainnode(a, &cursor); m != NULL; m = next_mainnode(a, &cursor))
+    {
+        mainnode *other = lookup_word(b, m->word);
+        int same = other != NULL && other->file_count == m->file_count;
+
+        if (!same)
+        {
+            differ++;
+            continue;
+        }
+        postings_of(other, &p);
+        while (next_posting(&p) == SUCCESS)
+            count_in_b[p.file_id] = p.word_count;
+        postings_of(m, &p);
+        while (next_posting(&p) == SUCCESS)
+        {
+            int id = id_in_b[p.file_id];
+            if (id < 0 || count_in_b[id] != p.word_count)
+                same = 0;
+        }
+        postings_of(other, &p);
+        while (next_posting(&p) == SUCCESS)
+            count_in_b[p.file_id] = 0;
+        differ += !same;
+    }
+    differ += (long)b->count - (a->count - differ);       // Words only b has
+    if (differ < 0)
+        differ = 0;
+
+    free(id_in_b);
+    free(count_in_b);
+    return differ;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_load
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Indexes the files, writes both save formats, and times update_database() (reload of
+ *      backup.txt, on one thread and on -j threads) against open_index() (mmap + checksum pass of
+ *      backup.idx). Both reloaded tables are compared with the built one. Every word of the
+ *      built table is then looked up in the mapped file and its postings compared; any difference
+ *      is counted in 'mismatches'.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if a step failed.
+ *****************************************************************************************************/
+static int bench_load(int argc, char *argv[])
+{
+    int threads = parse_threads(&argc, argv);
+    filenode *head = create_file_linked_list(argc, argv);
+    hashtable table, reloaded, parallel;
+    disk_index index;
+    table_cursor cursor;
+    struct stat text_st, idx_st;
+    unsigned long mismatches = 0;
+
+    if (head == NULL || init_hashtable(&table) == FAILURE || init_hashtable(&reloaded) == FAILURE ||
+        init_hashtable(&parallel) == FAILURE)
+        return FAILURE;
+    create_database(&table, head, threads);
+
+    double start = now_seconds();
+    save_database(&table);
+    double text_save = now_seconds() - start;
+
+    start = now_seconds();
+    if (save_index(&table, INDEX_FILE) == FAILURE)
+        return FAILURE;
+    double idx_save = now_seconds() - start;
+
+    start = now_seconds();
+    update_database(&reloaded, 1);
+    double text_load = now_seconds() - start;
+
+    start = now_seconds();
+    update_database(&parallel, threads);
+    double text_load_threads = now_seconds() - start;
+    long reload_differ = compare_tables(&table, &reloaded) + compare_tables(&table, &parallel) +
+                         (reloaded.count != table.count) + (parallel.count != table.count);
+
+    start = now_seconds();
+    if (open_index(&index, INDEX_FILE) == FAILURE)
+        return FAILURE;
+    double idx_open = now_seconds() - start;
+
+    start = now_seconds();
+    for (mainnode *m = first_mainnode(&table, &cursor); m != NULL; m = next_mainnode(&table, &cursor))
+    {
+        const disk_term *t = index_lookup(&index, m->word, m->len);
+        if (t == NULL || t->file_count != (uint32_t)m->file_count)
+        {
+            mismatches++;
+            continue;
+        }
+
+        posting_cursor p, s;
+        index_postings(&index, t, &p);
+        postings_of(m, &s);
+        while (next_posting(&s) == SUCCESS)
+        {
+            if (next_posting(&p) == FAILURE || p.file_id != s.file_id || p.word_count != s.word_count)
+            {
+                mismatches++;
+                break;
+            }
+        }
+    }
+    double idx_lookup = now_seconds() - start;
+
+    stat("backup.txt", &text_st);
+    stat(INDEX_FILE, &idx_st);
+    printf("bench=load layout=%s threads=%d terms=%u reloaded_terms=%u text_bytes=%lld idx_bytes=%lld "
+           "text_save_s=%.3f idx_save_s=%.3f text_load_s=%.3f text_load_threads_s=%.3f idx_open_s=%.4f "
+           "idx_lookup_all_s=%.3f reload_differ=%ld mismatches=%lu\n",
+           LAYOUT, threads, table.count, reloaded.count, (long long)text_st.st_size, (long long)idx_st.st_size,
+           text_save, idx_save, text_load, text_load_threads, idx_open, idx_lookup, reload_differ, mismatches);
+
+    close_index(&index);
+    free_hashtable(&parallel);
+    free_hashtable(&reloaded);
+    free_hashtable(&table);
+    return mismatches == 0 && reload_differ == 0 ? SUCCESS : FAILURE;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_compress
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Indexes the files and measures the postings: block bytes (headers and unused tails included)
+ *      and encoded bytes per posting in memory, bytes per posting of the same lists re-encoded as
+ *      one run per word (the index file form), and how many postings per second next_posting()
+ *      decodes from each form. Decoding repeats until at least half a second has passed.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+static int bench_compress(int argc, char *argv[])
+{
+    filenode *head = create_file_linked_list(argc, argv);
+    hashtable table;
+    table_cursor cursor;
+    posting_cursor p;
+    unsigned long postings = 0, blocks = 0;
+    size_t used = 0, allocated = 0, run_bytes = 0;
+
+    if (head == NULL || init_hashtable(&table) == FAILURE)
+        return FAILURE;
+    create_database(&table, head, 1);
+
+    for (mainnode *m = first_mainnode(&table, &cursor); m != NULL; m = next_mainnode(&table, &cursor))
+    {
+        postings += m->file_count;
+        for (posting_block *b = m->block; b != NULL; b = b->next)
+        {
+            blocks++;
+            used += b->used;
+            allocated += sizeof(posting_block) + b->size;
+        }
+    }
+
+    // Index file form: one run per word, gaps from document 0
+    unsigned char *runs = malloc(postings * 10 + 1);
+    size_t *run_end = malloc((table.count + 1) * sizeof(size_t));
+    if (runs == NULL || run_end == NULL)
+        return FAILURE;
+    unsigned int words = 0;
+    for (mainnode *m = first_mainnode(&table, &cursor); m != NULL; m = next_mainnode(&table, &cursor))
+    {
+        int prev = 0;
+        postings_of(m, &p);
+        while (next_posting(&p) == SUCCESS)
+        {
+            run_bytes += encode_posting(runs + run_bytes, p.file_id - prev, p.word_count);
+            prev = p.file_id;
+        }
+        run_end[words++] = run_bytes;
+    }
+
+    unsigned long decoded = 0, checksum = 0;
+    double start = now_seconds(), mem_time;
+    do
+    {
+        for (mainnode *m = first_mainnode(&table, &cursor); m != NULL; m = next_mainnode(&table, &cursor))
+        {
+            postings_of(m, &p);
+            while (next_posting(&p) == SUCCESS)
+            {
+                checksum += p.file_id + p.word_count;
+                decoded++;
+            }
+        }
+        mem_time = now_seconds() - start;
+    } while (mem_time < 0.5);
+    double mem_rate = decoded / mem_time;
+
+    decoded = 0;
+    start = now_seconds();
+    double run_time;
+    do
+    {
+        size_t from = 0;
+        for (unsigned int i = 0; i < words; i++)
+        {
+            postings_in(runs + from, run_end[i] - from, &p);
+            while (next_posting(&p) == SUCCESS)
+            {
+                checksum += p.file_id + p.word_count;
+                decoded++;
+            }
+            from = run_end[i];
+        }
+        run_time = now_seconds() - start;
+    } while (run_time < 0.5);
+
+    printf("bench=compress layout=%s words=%u postings=%lu blocks=%lu subnode_bytes_per_posting=16 "
+           "block_bytes_per_posting=%.2f encoded_bytes_per_posting=%.2f file_bytes_per_posting=%.2f "
+           "decode_mem_mpostings_s=%.1f decode_file_mpostings_s=%.1f checksum=%lu\n",
+           LAYOUT, table.count, postings, blocks,
+           postings ? (double)allocated / postings : 0.0, postings ? (double)used / postings : 0.0,
+           postings ? (double)run_bytes / postings : 0.0, mem_rate / 1e6, decoded / run_time / 1e6,
+           checksum);
+
+    free(runs);
+    free(run_end);
+    free_hashtable(&table);
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_update
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Builds the index once (build_s), then keeps it current through sync_database() as the
+ *      middle file of the list changes (its stamp is cleared, so it is re-indexed: reindex_s),
+ *      disappears from the list (remove_s) and comes back (add_s). The forward index the first
+ *      removal needs is built beforehand and timed on its own (forward_s). The updated table
+ *      is finally compared with a fresh build of the same files.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if a step failed or the tables differ.
+ *****************************************************************************************************/
+static int bench_update(int argc, char *argv[])
+{
+    filenode *head = create_file_linked_list(argc, argv);
+    hashtable table, fresh;
+    int files = 0;
+
+    if (head == NULL || init_hashtable(&table) == FAILURE || init_hashtable(&fresh) == FAILURE)
+        return FAILURE;
+    for (filenode *temp = head; temp != NULL; temp = temp->link)
+        files++;
+
+    double start = now_seconds();
+    create_database(&table, head, 1);
+    double build_time = now_seconds() - start;
+
+    // The middle file is the one that changes
+    filenode *prev = NULL, *target = head;
+    for (int i = 0; i < files / 2; i++)
+    {
+        prev = target;
+        target = target->link;
+    }
+    int id = find_document(&table.docs, target->filename);
+    if (id < 0)
+        return FAILURE;
+
+    start = now_seconds();
+    if (build_forward_index(&table) == FAILURE)
+        return FAILURE;
+    double forward_time = now_seconds() - start;
+
+    table.docs.stamp[id].size = -1;
+    start = now_seconds();
+    int status = sync_database(&table, head, 1);
+    double reindex_time = now_seconds() - start;
+
+    if (prev)                                               // Drop the file from the list
+        prev->link = target->link;
+    else
+        head = target->link;
+    start = now_seconds();
+    status &= sync_database(&table, head, 1);
+    double remove_time = now_seconds() - start;
+
+    if (prev)                                               // And put it back
+        prev->link = target;
+    else
+        head = target;
+    start = now_seconds();
+    status &= sync_database(&table, head, 1);
+    double add_time = now_seconds() - start;
+
+    create_database(&fresh, head, 1);
+    long differ = compare_tables(&table, &fresh);
+
+    printf("bench=update layout=%s files=%d distinct=%u build_s=%.3f forward_s=%.3f reindex_s=%.4f "
+           "remove_s=%.4f add_s=%.4f node_bytes=%zu fresh_node_bytes=%zu mismatches=%ld\n",
+           LAYOUT, files, table.count, build_time, forward_time, reindex_time, remove_time, add_time,
+           table.nodes.bytes, fresh.nodes.bytes, differ);
+
+    free_hashtable(&fresh);
+    free_hashtable(&table);
+    return status == SUCCESS && differ == 0 ? SUCCESS : FAILURE;
+}
+
+
+/*****************************************************************************************************
+ * Function       : compare_frequency
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      qsort() comparator putting the words found in the most files first.
+ *
+ * Returns        :
+ *      <0, 0 or >0.
+ *****************************************************************************************************/
+static int compare_frequency(const void *a, const void *b)
+{
+    const mainnode *x = *(mainnode * const *)a, *y = *(mainnode * const *)b;
+
+    if (x->file_count != y->file_count)
+        return y->file_count - x->file_count;
+    return strcmp(x->word, y->word);
+}
+
+
+/*****************************************************************************************************
+ * Function       : reference_match
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Brute-force check of one document against a parsed query: walks the tree, testing a term
+ *      by scanning its postings for the document.
+ *
+ * Returns        :
+ *      1 if the document matches the sub-tree, 0 if not.
+ *****************************************************************************************************/
+static int reference_match(hashtable *table, const query *q, int node, int doc)
+{
+    const query_node *n = &q->node[node];
+    posting_cursor p;
+
+    switch (n->type)
+    {
+        case QUERY_TERM:
+        {
+            mainnode *m = lookup_term(table, n->word, n->len);
+            if (m == NULL)
+                return 0;
+            postings_of(m, &p);
+            while (next_posting(&p) == SUCCESS)
+                if (p.file_id == doc)
+                    return 1;
+            return 0;
+        }
+        case QUERY_AND:
+            return reference_match(table, q, n->left, doc) && reference_match(table, q, n->right, doc);
+        case QUERY_OR:
+            return reference_match(table, q, n->left, doc) || reference_match(table, q, n->right, doc);
+        default:
+            return !reference_match(table, q, n->left, doc);
+    }
+}
+
+
+/*****************************************************************************************************
+ * Function       : run_batch
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Parses and runs every query of the batch against the table (index NULL) or the mapped index,
+ *      storing each result's size and a checksum of its ids.
+ *
+ * Returns        :
+ *      Seconds taken, or -1 if a query failed.
+ *****************************************************************************************************/
+static double run_batch(char (*text)[96], int count, hashtable *table, disk_index *index,
+                        int *matches, unsigned long *sum)
+{
+    double start = now_seconds();
+
+    for (int i = 0; i < count; i++)
+    {
+        query q;
+        doc_list result;
+
+        if (parse_query(&q, text[i]) == FAILURE || run_query(&q, table, index, &result) == FAILURE)
+            return -1;
+        matches[i] = result.count;
+        sum[i] = 0;
+        for (int j = 0; j < result.count; j++)
+            sum[i] = sum[i] * 31 + result.id[j];
+        free_doc_list(&result);
+    }
+    return now_seconds() - start;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_query
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Indexes the files (on -j threads), saves and maps backup.idx in the current directory, and generates a
+ *      fixed batch of queries (xorshift with a fixed seed) mixing common words (the 200 found in
+ *      the most files) and words drawn from the whole vocabulary:
+ *          "c AND c", "c AND w", "w OR w", "c c NOT c", "(w OR c) AND c", "c AND c AND c NOT w".
+ *      The batch runs against the table and against the mapped index; both must give the same
+ *      ids, and the first 500 queries are also checked against reference_match().
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if a step failed or a result differs.
+ *****************************************************************************************************/
+static int bench_query(int argc, char *argv[])
+{
+    enum { QUERIES = 20000, CHECKED = 500, COMMON = 200 };
+    int threads = parse_threads(&argc, argv);
+    filenode *head = create_file_linked_list(argc, argv);
+    hashtable table;
+    disk_index index;
+    table_cursor cursor;
+    unsigned int state = 2463534242u, n = 0;
+
+    if (head == NULL || init_hashtable(&table) == FAILURE)
+        return FAILURE;
+    create_database(&table, head, threads);
+    if (table.count == 0 || save_index(&table, INDEX_FILE) == FAILURE ||
+        open_index(&index, INDEX_FILE) == FAILURE)
+        return FAILURE;
+
+    mainnode **word = malloc(table.count * sizeof(mainnode *));
+    char (*text)[96] = malloc(QUERIES * sizeof(*text));
+    int *matches[2] = { malloc(QUERIES * sizeof(int)), malloc(QUERIES * sizeof(int)) };
+    unsigned long *sum[2] = { malloc(QUERIES * sizeof(long)), malloc(QUERIES * sizeof(long)) };
+    if (word == NULL || text == NULL || !matches[0] || !matches[1] || !sum[0] || !sum[1])
+        return FAILURE;
+
+    for (mainnode *m = first_mainnode(&table, &cursor); m != NULL; m = next_mainnode(&table, &cursor))
+        word[n++] = m;
+    qsort(word, n, sizeof(mainnode *), compare_frequency);
+    unsigned int common = n < COMMON ? n : COMMON;
+
+    for (int i = 0; i < QUERIES; i++)
+    {
+        const char *pick[4];
+        for (int k = 0; k < 4; k++)
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            pick[k] = word[k == 3 || (i % 6 == 2) ? state % n : state % common]->word;
+        }
+
+        switch (i % 6)
+        {
+            case 0: snprintf(text[i], sizeof(text[i]), "%s AND %s", pick[0], pick[1]); break;
+            case 1: snprintf(text[i], sizeof(text[i]), "%s AND %s", pick[0], pick[3]); break;
+            case 2: snprintf(text[i], sizeof(text[i]), "%s OR %s", pick[0], pick[1]); break;
+            case 3: snprintf(text[i], sizeof(text[i]), "%s %s NOT %s", pick[0], pick[1], pick[2]); break;
+            case 4: snprintf(text[i], sizeof(text[i]), "(%s OR %s) AND %s", pick[3], pick[0], pick[1]); break;
+            default: snprintf(text[i], sizeof(text[i]), "%s AND %s AND %s NOT %s", pick[0], pick[1], pick[2], pick[3]);
+        }
+    }
+
+    double mem_time = run_batch(text, QUERIES, &table, NULL, matches[0], sum[0]);
+    double idx_time = run_batch(text, QUERIES, &table, &index, matches[1], sum[1]);
+    if (mem_time < 0 || idx_time < 0)
+        return FAILURE;
+
+    unsigned long mismatches = 0, total = 0;
+    for (int i = 0; i < QUERIES; i++)
+    {
+        total += matches[0][i];
+        if (matches[0][i] != matches[1][i] || sum[0][i] != sum[1][i])
+            mismatches++;
+    }
+
+    // Brute force over every document for the first queries
+    for (int i = 0; i < CHECKED && i < QUERIES; i++)
+    {
+        query q;
+        int expected = 0;
+        unsigned long expected_sum = 0;
+
+        parse_query(&q, text[i]);
+        for (int doc = 0; doc < table.docs.count; doc++)
+        {
+            if (reference_match(&table, &q, q.root, doc))
+            {
+                expected++;
+                expected_sum = expected_sum * 31 + doc;
+            }
+        }
+        if (expected != matches[0][i] || expected_sum != sum[0][i])
+            mismatches++;
+    }
+
+    printf("bench=query layout=%s threads=%d docs=%d distinct=%u queries=%d avg_matches=%.1f mem_qps=%.0f "
+           "idx_qps=%.0f mismatches=%lu\n",
+           LAYOUT, threads, table.docs.count, table.count, QUERIES, (double)total / QUERIES,
+           QUERIES / mem_time, QUERIES / idx_time, mismatches);
+
+    close_index(&index);
+    free(word);
+    free(text);
+    for (int k = 0; k < 2; k++)
+    {
+        free(matches[k]);
+        free(sum[k]);
+    }
+    free_hashtable(&table);
+    return mismatches == 0 ? SUCCESS : FAILURE;
+}
+
+
+/*****************************************************************************************************
+ * Function       : rank_batch
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Runs every ranked query of the batch, keeping the top RANK_TOP_K of each in results.
+ *
+ * Returns        :
+ *      Seconds taken, or -1 if a query failed.
+ *****************************************************************************************************/
+static double rank_batch(char (*text)[96], int count, hashtable *table, disk_index *index, int prune,
+                         ranked_doc (*results)[RANK_TOP_K], int *found)
+{
+    double start = now_seconds();
+
+    for (int i = 0; i < count; i++)
+    {
+        found[i] = rank_documents(table, index, text[i], RANK_TOP_K, prune, results[i]);
+        if (found[i] < 0)
+            return -1;
+    }
+    return now_seconds() - start;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_rank
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Indexes the files, saves and maps backup.idx in the current directory, and generates a
+ *      fixed batch of 2 to 4 word queries: one word from the 200 found in the most files, the
+ *      rest from the whole vocabulary. Each batch is run with and without MaxScore, on the table
+ *      and on the mapped index; every run must give the same top scores as the unpruned table.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if a step failed or the scores differ.
+ *****************************************************************************************************/
+static int bench_rank(int argc, char *argv[])
+{
+    enum { QUERIES = 20000, COMMON = 200 };
+    filenode *head = create_file_linked_list(argc, argv);
+    hashtable table;
+    disk_index index;
+    table_cursor cursor;
+    unsigned int state = 2463534242u, n = 0;
+
+    if (head == NULL || init_hashtable(&table) == FAILURE)
+        return FAILURE;
+    create_database(&table, head, 1);
+    if (table.count == 0 || save_index(&table, INDEX_FILE) == FAILURE ||
+        open_index(&index, INDEX_FILE) == FAILURE)
+        return FAILURE;
+
+    mainnode **word = malloc(table.count * sizeof(mainnode *));
+    char (*text)[96] = malloc(QUERIES * sizeof(*text));
+    ranked_doc (*results[4])[RANK_TOP_K];
+    int *found[4];
+    for (int r = 0; r < 4; r++)
+    {
+        results[r] = malloc(QUERIES * sizeof(*results[r]));
+        found[r] = malloc(QUERIES * sizeof(int));
+        if (results[r] == NULL || found[r] == NULL)
+            return FAILURE;
+    }
+    if (word == NULL || text == NULL)
+        return FAILURE;
+
+    for (mainnode *m = first_mainnode(&table, &cursor); m != NULL; m = next_mainnode(&table, &cursor))
+        word[n++] = m;
+    qsort(word, n, sizeof(mainnode *), compare_frequency);
+    unsigned int common = n < COMMON ? n : COMMON;
+
+    for (int i = 0; i < QUERIES; i++)
+    {
+        size_t len = 0;
+        for (int k = 0; k < 2 + i % 3; k++)
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            len += snprintf(text[i] + len, sizeof(text[i]) - len, "%s%s", k ? " " : "",
+                            word[k == 0 ? state % common : state % n]->word);
+            if (len >= sizeof(text[i]))
+                break;
+        }
+    }
+
+    // Runs: 0 table exhaustive (reference), 1 table MaxScore, 2 index exhaustive, 3 index MaxScore
+    double seconds[4];
+    for (int r = 0; r < 4; r++)
+    {
+        seconds[r] = rank_batch(text, QUERIES, &table, r >= 2 ? &index : NULL, r & 1, results[r], found[r]);
+        if (seconds[r] < 0)
+            return FAILURE;
+    }
+
+    unsigned long mismatches = 0, total = 0;
+    for (int i = 0; i < QUERIES; i++)
+    {
+        total += found[0][i];
+        for (int r = 1; r < 4; r++)
+        {
+            int same = found[r][i] == found[0][i];
+            for (int j = 0; same && j < found[0][i]; j++)
+                same = fabs(results[r][i][j].score - results[0][i][j].score) < 1e-9;
+            mismatches += !same;
+        }
+    }
+
+    printf("bench=rank layout=%s docs=%d distinct=%u queries=%d k=%d avg_results=%.1f "
+           "mem_full_qps=%.0f mem_maxscore_qps=%.0f idx_full_qps=%.0f idx_maxscore_qps=%.0f mismatches=%lu\n",
+           LAYOUT, table.docs.count, table.count, QUERIES, RANK_TOP_K, (double)total / QUERIES,
+           QUERIES / seconds[0], QUERIES / seconds[1], QUERIES / seconds[2], QUERIES / seconds[3],
+           mismatches);
+
+    close_index(&index);
+    free(word);
+    free(text);
+    for (int r = 0; r < 4; r++)
+    {
+        free(results[r]);
+        free(found[r]);
+    }
+    free_hashtable(&table);
+    return mismatches == 0 ? SUCCESS : FAILURE;
+}
+
+
+// One generated phrase / NEAR query of bench_phrase, kept for the brute-force check
+typedef struct phrase_case
+{
+    mainnode *word[4];           // Words, in phrase order
+    int words;                   // Words used
+    int distance;                // NEAR distance, 0 for a phrase
+} phrase_case;
+
+
+/*****************************************************************************************************
+ * Function       : read_document
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Tokenizes a file the way indexing does and resolves every token to its mainnode, so
+ *      position i of the result is the word indexed at position i.
+ *
+ * Returns        :
+ *      The array (its length in *len), or NULL if the file couldn't be read.
+ *****************************************************************************************************/
+static mainnode **read_document(hashtable *table, const char *filename, int *len)
+{
+    tokenizer tok;
+    const char *word;
+    size_t wlen;
+    int n = 0, cap = 256;
+    mainnode **out = malloc(cap * sizeof(mainnode *));
+
+    if (out == NULL || open_tokenizer(&tok, filename) == FAILURE)
+    {
+        free(out);
+        return NULL;
+    }
+    while (next_token(&tok, &word, &wlen) == SUCCESS)
+    {
+        if (n == cap)
+        {
+            cap *= 2;
+            mainnode **grown = realloc(out, cap * sizeof(mainnode *));
+            if (grown == NULL)
+                break;
+            out = grown;
+        }
+        out[n++] = lookup_term(table, word, wlen);
+    }
+    close_tokenizer(&tok);
+    *len = n;
+    return out;
+}
+
+
+/*****************************************************************************************************
+ * Function       : case_matches
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Brute-force check of a phrase or NEAR case against one document's words.
+ *
+ * Returns        :
+ *      1 if the document matches, 0 otherwise.
+ *****************************************************************************************************/
+static int case_matches(const phrase_case *c, mainnode **doc, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        if (doc[i] != c->word[0])
+            continue;
+        if (c->distance == 0)
+        {
+            int k = 1;
+            while (k < c->words && i + k < len && doc[i + k] == c->word[k])
+                k++;
+            if (k == c->words)
+                return 1;
+            continue;
+        }
+        for (int j = i - c->distance; j <= i + c->distance; j++)
+            if (j >= 0 && j < len && j != i && doc[j] == c->word[1])
+                return 1;
+    }
+    return 0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : compare_doubles
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      qsort() comparator for latencies.
+ *
+ * Returns        :
+ *      <0, 0 or >0.
+ *****************************************************************************************************/
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/*****************************************************************************************************
+ * Function       : time_queries
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Parses and runs every 'step'-th query from 'first', timing each, and keeps a checksum of
+ *      the results of each query in sum[].
+ *
+ * Returns        :
+ *      Mean latency in microseconds (the 99th percentile in *p99), or -1 if a query failed.
+ *****************************************************************************************************/
+static double time_queries(char (*text)[224], int count, int first, int step, hashtable *table,
+                           disk_index *index, unsigned long *sum, double *p99)
+{
+    double *latency = malloc(count * sizeof(double)), total = 0;
+    int n = 0;
+
+    if (latency == NULL)
+        return -1;
+    for (int i = first; i < count; i += step)
+    {
+        query q;
+        doc_list result;
+        double start = now_seconds();
+
+        if (parse_query(&q, text[i]) == FAILURE || run_query(&q, table, index, &result) == FAILURE)
+        {
+            free(latency);
+            return -1;
+        }
+        latency[n] = (now_seconds() - start) * 1e6;
+        total += latency[n++];
+
+        sum[i] = result.count;
+        for (int j = 0; j < result.count; j++)
+            sum[i] = sum[i] * 31 + result.id[j];
+        free_doc_list(&result);
+    }
+
+    qsort(latency, n, sizeof(double), compare_doubles);
+    *p99 = n ? latency[n * 99 / 100] : 0;
+    free(latency);
+    return n ? total / n : 0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_phrase
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Indexes the files without and with word positions, saving each as backup.idx in the
+ *      current directory, and reports the node memory and file size of both. From the words of
+ *      the files it then generates phrases of 2 to 4 words and NEAR/k pairs (k from 1 to 8, the
+ *      words 1 to 6 apart), each with the plain AND of its words. Latencies are taken on the
+ *      positional table and index; the ANDs run on the plain table too, to show that queries
+ *      without positions don't pay for them. The first cases are checked against a scan of
+ *      every document's words, and the index against the table for all of them.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if a step failed or results differ.
+ *****************************************************************************************************/
+static int bench_phrase(int argc, char *argv[])
+{
+    enum { CASES = 5000, CHECKED = 300 };
+    int threads = parse_threads(&argc, argv);
+    filenode *head = create_file_linked_list(argc, argv);
+    hashtable plain, table;
+    disk_index index;
+    struct stat st;
+    unsigned int state = 2463534242u;
+
+    if (head == NULL || init_hashtable(&plain) == FAILURE || init_hashtable(&table) == FAILURE)
+        return FAILURE;
+    create_database(&plain, head, threads);
+    if (plain.count == 0 || save_index(&plain, INDEX_FILE) == FAILURE || stat(INDEX_FILE, &st) != 0)
+        return FAILURE;
+    long long plain_file = st.st_size;
+
+    table.positional = 1;
+    create_database(&table, head, threads);
+    if (save_index(&table, INDEX_FILE) == FAILURE || stat(INDEX_FILE, &st) != 0 ||
+        open_index(&index, INDEX_FILE) == FAILURE)
+        return FAILURE;
+    long long positional_file = st.st_size;
+
+    int docs = table.docs.count;
+    mainnode ***doc = calloc(docs, sizeof(mainnode **));
+    int *len = calloc(docs, sizeof(int));
+    phrase_case *cases = malloc(CASES * sizeof(phrase_case));
+    char (*text)[224] = malloc(2 * CASES * sizeof(*text));        // Case i at 2i, its AND at 2i + 1
+    unsigned long *sum[3];
+    for (int k = 0; k < 3; k++)
+        if ((sum[k] = calloc(2 * CASES, sizeof(unsigned long))) == NULL)
+            return FAILURE;
+    if (doc == NULL || len == NULL || cases == NULL || text == NULL)
+        return FAILURE;
+
+    long long positions = 0;
+    for (int d = 0; d < docs; d++)
+    {
+        doc[d] = read_document(&table, document_name(&table, d), &len[d]);
+        positions += len[d];
+    }
+
+    for (int i = 0; i < CASES; )
+    {
+        phrase_case *c = &cases[i];
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        int d = state % docs, gap = 1 + state / docs % 6;
+
+        c->words = i % 2 ? 2 : 2 + i / 2 % 3;
+        c->distance = i % 2 ? 1 + state / docs / 6 % 8 : 0;
+        int span = c->distance ? gap + 1 : c->words;
+        if (len[d] < span)
+            continue;
+        int start = state / 7919 % (len[d] - span + 1);
+
+        for (int k = 0; k < c->words; k++)
+            c->word[k] = doc[d][c->distance && k ? start + gap : start + k];
+
+        if (c->distance)
+            snprintf(text[2 * i], sizeof(text[0]), "%s NEAR/%d %s", c->word[0]->word, c->distance,
+                     c->word[1]->word);
+        else
+        {
+            size_t n = snprintf(text[2 * i], sizeof(text[0]), "\"%s", c->word[0]->word);
+            for (int k = 1; k < c->words; k++)
+                n += snprintf(text[2 * i] + n, sizeof(text[0]) - n, " %s", c->word[k]->word);
+            snprintf(text[2 * i] + n, sizeof(text[0]) - n, "\"");
+        }
+        size_t n = 0;
+        for (int k = 0; k < c->words; k++)
+            n += snprintf(text[2 * i + 1] + n, sizeof(text[0]) - n, "%s%s", k ? " " : "", c->word[k]->word);
+        i++;
+    }
+
+    // Phrases are the even cases, NEARs the odd ones: text[4j] and text[4j + 2]
+    double p99[7], us[7];
+    us[0] = time_queries(text, 2 * CASES, 0, 4, &table, NULL, sum[0], &p99[0]);      // Phrase, table
+    us[1] = time_queries(text, 2 * CASES, 2, 4, &table, NULL, sum[0], &p99[1]);      // NEAR, table
+    us[2] = time_queries(text, 2 * CASES, 1, 2, &table, NULL, sum[0], &p99[2]);      // AND, table
+    us[3] = time_queries(text, 2 * CASES, 0, 4, &table, &index, sum[1], &p99[3]);    // Phrase, index
+    us[4] = time_queries(text, 2 * CASES, 2, 4, &table, &index, sum[1], &p99[4]);    // NEAR, index
+    us[5] = time_queries(text, 2 * CASES, 1, 2, &table, &index, sum[1], &p99[5]);    // AND, index
+    us[6] = time_queries(text, 2 * CASES, 1, 2, &plain, NULL, sum[2], &p99[6]);      // AND, plain table
+    for (int k = 0; k < 7; k++)
+        if (us[k] < 0)
+            return FAILURE;
+
+    unsigned long mismatches = 0;
+    for (int i = 0; i < 2 * CASES; i++)
+        mismatches += sum[0][i] != sum[1][i] || (i % 2 && sum[0][i] != sum[2][i]);
+
+    for (int i = 0; i < CHECKED && i < CASES; i++)
+    {
+        unsigned long expected = 0;             // time_queries() checksum: count, then the ids
+        for (int d = 0; d < docs; d++)
+            expected += case_matches(&cases[i], doc[d], len[d]);
+        for (int d = 0; d < docs; d++)
+            if (case_matches(&cases[i], doc[d], len[d]))
+                expected = expected * 31 + d;
+        mismatches += expected != sum[0][2 * i];
+    }
+
+    printf("bench=phrase layout=%s threads=%d docs=%d distinct=%u positions=%lld mem_plain_bytes=%zu "
+           "mem_positional_bytes=%zu mem_overhead_pct=%.1f idx_plain_bytes=%lld idx_positional_bytes=%lld "
+           "idx_overhead_pct=%.1f\n",
+           LAYOUT, threads, docs, table.count, positions, plain.nodes.bytes, table.nodes.bytes,
+           100.0 * ((double)table.nodes.bytes - plain.nodes.bytes) / plain.nodes.bytes, plain_file,
+           positional_file, 100.0 * (positional_file - plain_file) / plain_file);
+    printf("bench=phrase_latency layout=%s and_plain_us=%.2f and_us=%.2f phrase_us=%.2f phrase_p99_us=%.2f "
+           "near_us=%.2f near_p99_us=%.2f idx_and_us=%.2f idx_phrase_us=%.2f idx_phrase_p99_us=%.2f "
+           "idx_near_us=%.2f mismatches=%lu\n",
+           LAYOUT, us[6], us[2], us[0], p99[0], us[1], p99[1], us[5], us[3], p99[3], us[4], mismatches);
+
+    close_index(&index);
+    for (int d = 0; d < docs; d++)
+        free(doc[d]);
+    free(doc);
+    free(len);
+    free(cases);
+    free(text);
+    for (int k = 0; k < 3; k++)
+        free(sum[k]);
+    free_hashtable(&plain);
+    free_hashtable(&table);
+    return mismatches == 0 ? SUCCESS : FAILURE;
+}
+
+
+/*****************************************************************************************************
+ * Function       : reference_glob / reference_distance
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Straightforward versions of what lexicon.c computes, for checking it: a recursive '*' / '?'
+ *      match, and the full Levenshtein table of two words.
+ *
+ * Returns        :
+ *      reference_glob(): 1 on a match. reference_distance(): the edit distance.
+ *****************************************************************************************************/
+static int reference_glob(const char *pattern, const char *word)
+{
+    if (*pattern == '\0')
+        return *word == '\0';
+    if (*pattern == '*')
+        return reference_glob(pattern + 1, word) || (*word && reference_glob(pattern, word + 1));
+    return *word && (*pattern == '?' || *pattern == *word) && reference_glob(pattern + 1, word + 1);
+}
+
+static int reference_distance(const char *a, const char *b)
+{
+    int row[64][64];
+    int n = strlen(a), m = strlen(b);
+
+    for (int i = 0; i <= n; i++)
+        for (int j = 0; j <= m; j++)
+        {
+            if (i == 0 || j == 0)
+                row[i][j] = i + j;
+            else
+            {
+                int v = row[i - 1][j - 1] + (a[i - 1] != b[j - 1]);
+                if (row[i - 1][j] + 1 < v)
+                    v = row[i - 1][j] + 1;
+                if (row[i][j - 1] + 1 < v)
+                    v = row[i][j - 1] + 1;
+                row[i][j] = v;
+            }
+        }
+    return row[n][m];
+}
+
+
+/*****************************************************************************************************
+ * Function       : time_matches
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Runs every pattern of a batch through match_terms() on the table or the mapped index,
+ *      storing for each the number of matches and an order-independent hash of the words.
+ *
+ * Returns        :
+ *      Mean microseconds per lookup, or -1 on a failure.
+ *****************************************************************************************************/
+static double time_matches(char (*pattern)[64], int count, hashtable *table, disk_index *index,
+                           int *found, unsigned long *sum)
+{
+    double start = now_seconds();
+
+    for (int i = 0; i < count; i++)
+    {
+        match_list list = { 0 };
+        if (match_terms(table, index, pattern[i], strlen(pattern[i]), &list) == FAILURE)
+            return -1;
+        found[i] = list.count;
+        sum[i] = 0;
+        for (int k = 0; k < list.count; k++)
+            sum[i] += hash_word(list.match[k].word);
+        free_match_list(&list);
+    }
+    return (now_seconds() - start) * 1e6 / count;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_lexicon
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Indexes a generated vocabulary of about 'words' distinct words (2 to 5 syllables, so they
+ *      share prefixes like real words do), then times the lexicon build and four batches of
+ *      lookups: prefix ("bal*"), wildcard ("b?lo*ni"), and a vocabulary word with one or two
+ *      letters changed looked up with "~1" / "~2". Each batch runs on the table and on the mapped
+ *      index; the first lookups of each are checked against a scan of every word.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out or a lookup disagreed with the scan.
+ *****************************************************************************************************/
+static int bench_lexicon(int words)
+{
+    static const char *syllable[] = { "ba", "ce", "di", "fo", "gu", "ha", "ke", "li", "mo", "nu", "pa", "re",
+                                      "si", "to", "va", "we", "xi", "yo", "za", "tr", "st", "ng", "qu", "el" };
+    enum { SYLLABLES = sizeof(syllable) / sizeof(syllable[0]), QUERIES = 200, CHECKED = 20, KINDS = 4 };
+    char (*vocab)[16] = malloc((size_t)words * sizeof(*vocab));
+    char (*pattern)[64] = malloc(KINDS * QUERIES * sizeof(*pattern));
+    int *found[2];
+    unsigned long *sum[2];
+    unsigned int state = 2463534242u;
+    hashtable table;
+    disk_index index;
+
+    found[0] = malloc(KINDS * QUERIES * sizeof(int));
+    found[1] = malloc(KINDS * QUERIES * sizeof(int));
+    sum[0] = malloc(KINDS * QUERIES * sizeof(unsigned long));
+    sum[1] = malloc(KINDS * QUERIES * sizeof(unsigned long));
+    if (vocab == NULL || pattern == NULL || found[0] == NULL || found[1] == NULL || sum[0] == NULL ||
+        sum[1] == NULL || init_hashtable(&table) == FAILURE)
+        return FAILURE;
+
+    for (int d = 0; d < 100; d++)
+    {
+        char name[32];
+        sprintf(name, "doc%d.txt", d);
+        add_document(&table, name);
+    }
+
+    size_t raw_bytes = 0;
+    for (int i = 0; i < words; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        int n = 2 + state % 4;
+        unsigned int pick = state / 4;
+        vocab[i][0] = '\0';
+        for (int k = 0; k < n; k++, pick /= SYLLABLES)
+            strcat(vocab[i], syllable[pick % SYLLABLES]);
+        if (n < 4)                                      // Short words: vary the ending too
+        {
+            size_t len = strlen(vocab[i]);
+            vocab[i][len] = 'a' + pick % 26;
+            vocab[i][len + 1] = '\0';
+        }
+        insert_word(&table, vocab[i], strlen(vocab[i]), (int)((long long)i * 100 / words), 0);
+    }
+
+    double start = now_seconds();
+    lexicon *lex = table_lexicon(&table);
+    double build_ms = (now_seconds() - start) * 1e3;
+    if (lex == NULL || save_index(&table, INDEX_FILE) == FAILURE || open_index(&index, INDEX_FILE) == FAILURE)
+        return FAILURE;
+    for (unsigned int i = 0; i < lex->count; i++)
+        raw_bytes += lex->node[i]->len + 1;
+
+    // Batches: prefix, wildcard, one edit, two edits
+    for (int i = 0; i < QUERIES; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        const char *w = vocab[state % words];
+        size_t len = strlen(w);
+        char edited[16];
+
+        snprintf(pattern[i], sizeof(pattern[0]), "%.3s*", w);
+        snprintf(pattern[QUERIES + i], sizeof(pattern[0]), "%c?%.2s*%s", w[0], w + 2, w + len - 2);
+
+        strcpy(edited, w);
+        edited[state / 7 % len] = 'a' + state / 11 % 26;
+        snprintf(pattern[2 * QUERIES + i], sizeof(pattern[0]), "%s~1", edited);
+        edited[state / 13 % len] = 'a' + state / 17 % 26;
+        snprintf(pattern[3 * QUERIES + i], sizeof(pattern[0]), "%s~2", edited);
+    }
+
+    double us[2][KINDS];
+    for (int k = 0; k < KINDS; k++)
+    {
+        us[0][k] = time_matches(pattern + k * QUERIES, QUERIES, &table, NULL, found[0] + k * QUERIES,
+                                sum[0] + k * QUERIES);
+        us[1][k] = time_matches(pattern + k * QUERIES, QUERIES, &table, &index, found[1] + k * QUERIES,
+                                sum[1] + k * QUERIES);
+        if (us[0][k] < 0 || us[1][k] < 0)
+            return FAILURE;
+    }
+
+    unsigned long mismatches = 0;
+    long matches[KINDS] = { 0 };
+    for (int i = 0; i < KINDS * QUERIES; i++)
+    {
+        mismatches += found[0][i] != found[1][i] || sum[0][i] != sum[1][i];
+        matches[i / QUERIES] += found[0][i];
+    }
+
+    for (int k = 0; k < KINDS; k++)
+        for (int i = k * QUERIES; i < k * QUERIES + CHECKED; i++)
+        {
+            char text[64];
+            int edits = k < 2 ? 0 : k - 1, expected = 0;
+            unsigned long expected_sum = 0;
+
+            strcpy(text, pattern[i]);
+            if (edits)
+                text[strlen(text) - 2] = '\0';          // Drop the "~N"
+            for (unsigned int t = 0; t < lex->count; t++)
+            {
+                const char *word = lex->node[t]->word;
+                if (edits ? reference_distance(text, word) <= edits : reference_glob(text, word))
+                {
+                    expected++;
+                    expected_sum += hash_word(word);
+                }
+            }
+            mismatches += expected != found[0][i] || expected_sum != sum[0][i];
+        }
+
+    size_t lexicon_bytes = lex->size + (lex->count / LEXICON_BLOCK + 1) * sizeof(unsigned int);
+    printf("bench=lexicon layout=%s words=%u raw_bytes=%zu lexicon_bytes=%zu ratio=%.2f build_ms=%.1f\n",
+           LAYOUT, lex->count, raw_bytes, lexicon_bytes, (double)lexicon_bytes / raw_bytes, build_ms);
+    printf("bench=lexicon_lookup layout=%s prefix_us=%.2f prefix_matches=%.1f wildcard_us=%.2f "
+           "wildcard_matches=%.1f fuzzy1_us=%.2f fuzzy1_matches=%.1f fuzzy2_us=%.2f fuzzy2_matches=%.1f "
+           "idx_prefix_us=%.2f idx_wildcard_us=%.2f idx_fuzzy1_us=%.2f idx_fuzzy2_us=%.2f mismatches=%lu\n",
+           LAYOUT, us[0][0], (double)matches[0] / QUERIES, us[0][1], (double)matches[1] / QUERIES, us[0][2],
+           (double)matches[2] / QUERIES, us[0][3], (double)matches[3] / QUERIES, us[1][0], us[1][1], us[1][2],
+           us[1][3], mismatches);
+
+    close_index(&index);
+    free_hashtable(&table);
+    free(vocab);
+    free(pattern);
+    for (int k = 0; k < 2; k++)
+    {
+        free(found[k]);
+        free(sum[k]);
+    }
+    return mismatches == 0 ? SUCCESS : FAILURE;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_analyze
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Indexes the files once per set of analysis steps: none, fold + trim, then adding stopwords,
+ *      then stemming. For each it reports the distinct words, the tokens indexed, the build time
+ *      and throughput in MB/s of input, and the time analyze_token() alone takes per token (a
+ *      tokenizing pass with and without it).
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if no file could be indexed.
+ *****************************************************************************************************/
+static int bench_analyze(int argc, char *argv[])
+{
+    static const unsigned int config[] = { 0, ANALYZE_FOLD | ANALYZE_TRIM,
+                                           ANALYZE_FOLD | ANALYZE_TRIM | ANALYZE_STOP, ANALYZE_ALL };
+    int threads = parse_threads(&argc, argv);
+    filenode *head = create_file_linked_list(argc, argv);
+    long long bytes = 0;
+    unsigned int baseline = 0;
+
+    if (head == NULL)
+        return FAILURE;
+    for (filenode *f = head; f != NULL; f = f->link)
+    {
+        struct stat st;
+        if (stat(f->filename, &st) == 0)
+            bytes += st.st_size;
+    }
+
+    for (size_t c = 0; c < sizeof(config) / sizeof(config[0]); c++)
+    {
+        hashtable table;
+        char name[24], out[MAX_TOKEN_LEN + 1];
+
+        if (init_hashtable(&table) == FAILURE)
+            return FAILURE;
+        table.analysis = config[c];
+
+        double start = now_seconds();
+        create_database(&table, head, threads);
+        double build_time = now_seconds() - start;
+        if (c == 0)
+            baseline = table.count;
+
+        // Tokenize everything twice, the second time through the analysis, to isolate its cost
+        double pass[2] = { 0, 0 };
+        size_t tokens = 0, sink = 0;
+        for (int with = 0; with < 2; with++)
+        {
+            start = now_seconds();
+            for (filenode *f = head; f != NULL; f = f->link)
+            {
+                tokenizer tok;
+                const char *word;
+                size_t len;
+
+                if (open_tokenizer(&tok, f->filename) == FAILURE)
+                    continue;
+                while (next_token(&tok, &word, &len) == SUCCESS)
+                {
+                    sink += with && config[c] ? analyze_token(config[c], word, len, out) : len;
+                    tokens += !with;
+                }
+                close_tokenizer(&tok);
+            }
+            pass[with] = now_seconds() - start;
+        }
+
+        printf("bench=analyze layout=%s threads=%d steps=%s distinct=%u distinct_pct=%.1f tokens=%lld "
+               "build_s=%.3f mb_per_s=%.1f analyze_ns_per_token=%.1f sink=%zu\n",
+               LAYOUT, threads, analysis_name(config[c], name), table.count,
+               baseline ? 100.0 * table.count / baseline : 0.0, table.docs.total_length, build_time,
+               bytes / build_time / 1e6, tokens ? (pass[1] - pass[0]) * 1e9 / tokens : 0.0, sink);
+        free_hashtable(&table);
+    }
+    return SUCCESS;
+}
+
+
+// Characters the stress test builds tokens from: ASCII, then 2-, 3- and 4-byte UTF-8
+static const char *const stress_char[] = { "a", "e", "o", "t", "s", "Q", "-", "'", ".", "7",
+                                           "\xC3\xA9", "\xC3\x9F", "\xD0\xB6", "\xCE\xA9",
+                                           "\xE2\x82\xAC", "\xE4\xB8\xAD", "\xE8\xAA\x9E",
+                                           "\xF0\x9F\x98\x80", "\xF0\x9D\x84\x9E" };
+#define STRESS_CHARS (sizeof(stress_char) / sizeof(stress_char[0]))
+#define STRESS_FILES 8
+#define STRESS_VOCAB 3000
+
+
+// A token of a generated stress file as the tokenizer should return it
+typedef struct stress_piece
+{
+    const char *word;            // Into the file's text
+    size_t len;
+    int doc;                     // File index, which is also its document id
+} stress_piece;
+
+
+/*****************************************************************************************************
+ * Function       : next_random
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Steps an xorshift generator (stress test and corpus generator).
+ *
+ * Returns        :
+ *      The next value.
+ *****************************************************************************************************/
+static unsigned int next_random(unsigned int *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+
+/*****************************************************************************************************
+ * Function       : stress_token
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Writes a random token to 'out': 80% are 1 to 8 characters, 15% up to 80 and 5% up to 600
+ *      (up to 2400 bytes, several times MAX_TOKEN_LEN), each character drawn from stress_char[].
+ *
+ * Returns        :
+ *      Bytes written (no NUL is added).
+ *****************************************************************************************************/
+static size_t stress_token(char *out, unsigned int *state)
+{
+    unsigned int kind = next_random(state) % 100;
+    unsigned int chars = 1 + next_random(state) % (kind < 80 ? 8 : kind < 95 ? 80 : 600);
+    size_t len = 0;
+
+    for (unsigned int i = 0; i < chars; i++)
+    {
+        const char *c = stress_char[next_random(state) % STRESS_CHARS];
+        size_t n = strlen(c);
+        memcpy(out + len, c, n);
+        len += n;
+    }
+    return len;
+}
+
+
+/*****************************************************************************************************
+ * Function       : valid_utf8
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Checks that a word is well-formed UTF-8: lead bytes followed by the right number of
+ *      continuation bytes, nothing cut off at either end.
+ *
+ * Returns        :
+ *      1 if it is, 0 if not.
+ *****************************************************************************************************/
+static int valid_utf8(const char *word, size_t len)
+{
+    for (size_t i = 0; i < len; )
+    {
+        unsigned char c = word[i];
+        size_t n = c < 0x80 ? 1 : (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 0;
+
+        if (n == 0 || i + n > len)
+            return 0;
+        for (size_t k = 1; k < n; k++)
+            if (((unsigned char)word[i + k] & 0xC0) != 0x80)
+                return 0;
+        i += n;
+    }
+    return 1;
+}
+
+
+/*****************************************************************************************************
+ * Function       : compare_pieces
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      qsort() comparator ordering stress pieces bytewise, so equal words end up adjacent.
+ *
+ * Returns        :
+ *      <0, 0 or >0.
+ *****************************************************************************************************/
+static int compare_pieces(const void *a, const void *b)
+{
+    const stress_piece *x = a, *y = b;
+    int cmp = memcmp(x->word, y->word, x->len < y->len ? x->len : y->len);
+
+    return cmp ? cmp : (x->len > y->len) - (x->len < y->len);
+}
+
+
+/*****************************************************************************************************
+ * Function       : has_posting
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Checks whether a word has a posting for a document.
+ *
+ * Returns        :
+ *      1 if it has, 0 if not (or the word is NULL).
+ *****************************************************************************************************/
+static int has_posting(const mainnode *m, int doc)
+{
+    posting_cursor p;
+
+    if (m == NULL)
+        return 0;
+    postings_of(m, &p);
+    while (next_posting(&p) == SUCCESS)
+        if (p.file_id == doc)
+            return 1;
+    return 0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_stress
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Writes STRESS_FILES files of 'tokens' tokens each in the current directory (stress_N.txt),
+ *      drawn from a vocabulary of generated tokens, some many times longer than MAX_TOKEN_LEN and
+ *      most of them multi-byte UTF-8 (stress_token()), and indexes them on -j threads. The tokens
+ *      are also split the way the tokenizer should split them (at most MAX_TOKEN_LEN bytes, never
+ *      inside a character), and the index is checked against that:
+ *          missing       - pieces whose word isn't found or has no posting for the file,
+ *          count_errors  - the distinct words and the total of all counts against the pieces,
+ *          invalid_utf8  - stored words that aren't well-formed UTF-8 or are too long,
+ *          index_differ  - words whose file count differs in the saved and mapped backup.idx,
+ *          reload_differ - words that differ after exporting backup.txt and loading it back,
+ *          analyzed_missing - pieces not found through analyze_query() in a table built with
+ *                             every analysis step (-a all).
+ *      mean_node_bytes is the arena memory of a mainnode with its word, averaged over the words.
+ *      The generated files are removed at the end.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if a step failed or any check found a difference.
+ *****************************************************************************************************/
+static int bench_stress(int argc, char *argv[])
+{
+    int threads = parse_threads(&argc, argv);
+    int tokens = argc >= 2 ? atoi(argv[1]) : 20000;
+    unsigned int state = 2463534242u;
+    char *vocab[STRESS_VOCAB], *text[STRESS_FILES];
+    size_t vocab_len[STRESS_VOCAB], text_len[STRESS_FILES];
+    char name[STRESS_FILES][24], *names[STRESS_FILES + 1];
+    stress_piece *piece = NULL;
+    size_t pieces = 0, piece_cap = 0, multibyte = 0;
+    long missing = 0, count_errors = 0, invalid = 0, index_differ = 0, reload_differ = 0, analyzed_missing = 0;
+    int status = SUCCESS;
+
+    if (tokens <= 0)
+        tokens = 20000;
+    for (int v = 0; v < STRESS_VOCAB; v++)
+    {
+        char buf[2400];
+        vocab_len[v] = stress_token(buf, &state);
+        vocab[v] = malloc(vocab_len[v]);
+        if (vocab[v] == NULL)
+            return FAILURE;
+        memcpy(vocab[v], buf, vocab_len[v]);
+    }
+
+    // Write the files, keeping their text to split the reference pieces from
+    names[0] = "benchmark";
+    for (int f = 0; f < STRESS_FILES; f++)
+    {
+        size_t cap = 4096, len = 0;
+        char *out = malloc(cap);
+
+        for (int t = 0; out != NULL && t < tokens; t++)
+        {
+            char fresh[2400];
+            const char *word = fresh;
+            size_t n;
+
+            if (next_random(&state) % 10 == 0)                // One token in ten is new
+                n = stress_token(fresh, &state);
+            else
+            {
+                unsigned int v = next_random(&state) % STRESS_VOCAB;
+                word = vocab[v];
+                n = vocab_len[v];
+            }
+            if (len + n + 1 > cap)
+            {
+                while (len + n + 1 > cap)
+                    cap *= 2;
+                char *grown = realloc(out, cap);
+                if (grown == NULL)
+                {
+                    free(out);
+                    out = NULL;
+                    break;
+                }
+                out = grown;
+            }
+            memcpy(out + len, word, n);
+            len += n;
+            out[len++] = next_random(&state) % 8 ? ' ' : '\n';
+        }
+        if (out == NULL)
+            return FAILURE;
+
+        snprintf(name[f], sizeof(name[f]), "stress_%d.txt", f);
+        FILE *fp = fopen(name[f], "wb");
+        if (fp == NULL || fwrite(out, 1, len, fp) != len)
+        {
+            printf("ERROR : Couldn't write %s\n", name[f]);
+            return FAILURE;
+        }
+        fclose(fp);
+        text[f] = out;
+        text_len[f] = len;
+        names[f + 1] = name[f];
+    }
+
+    // Reference split: whitespace runs, cut into MAX_TOKEN_LEN-byte pieces at character starts
+    for (int f = 0; f < STRESS_FILES; f++)
+    {
+        for (size_t i = 0; i < text_len[f]; )
+        {
+            if (text[f][i] == ' ' || text[f][i] == '\n')
+            {
+                i++;
+                continue;
+            }
+            size_t end = i;
+            while (end < text_len[f] && text[f][end] != ' ' && text[f][end] != '\n')
+                end++;
+            while (i < end)
+            {
+                size_t cut = end - i > MAX_TOKEN_LEN ? MAX_TOKEN_LEN : end - i;
+                while (i + cut < end && ((unsigned char)text[f][i + cut] & 0xC0) == 0x80)
+                    cut--;
+
+                if (pieces == piece_cap)
+                {
+                    piece_cap = piece_cap ? piece_cap * 2 : 4096;
+                    stress_piece *grown = realloc(piece, piece_cap * sizeof(stress_piece));
+                    if (grown == NULL)
+                        return FAILURE;
+                    piece = grown;
+                }
+                piece[pieces].word = text[f] + i;
+                piece[pieces].len = cut;
+                piece[pieces++].doc = f;
+                for (size_t k = 0; k < cut; k++)
+                    if ((unsigned char)text[f][i + k] >= 0x80)
+                    {
+                        multibyte++;
+                        break;
+                    }
+                i += cut;
+            }
+        }
+    }
+
+    filenode *head = create_file_linked_list(STRESS_FILES + 1, names);
+    hashtable table, reloaded, analyzed;
+    table_cursor cursor;
+    disk_index index;
+
+    if (head == NULL || init_hashtable(&table) == FAILURE || init_hashtable(&reloaded) == FAILURE ||
+        init_hashtable(&analyzed) == FAILURE)
+        return FAILURE;
+
+    double start = now_seconds();
+    create_database(&table, head, threads);
+    double build_time = now_seconds() - start;
+
+    // Every piece must be a word with a posting for its file
+    long long total = 0;
+    for (size_t i = 0; i < pieces; i++)
+        missing += !has_posting(lookup_term(&table, piece[i].word, piece[i].len), piece[i].doc);
+
+    size_t longest = 0;
+    double node_bytes = 0;
+    for (mainnode *m = first_mainnode(&table, &cursor); m != NULL; m = next_mainnode(&table, &cursor))
+    {
+        posting_cursor p;
+        postings_of(m, &p);
+        while (next_posting(&p) == SUCCESS)
+            total += p.word_count;
+        if (!valid_utf8(m->word, m->len) || m->len > MAX_TOKEN_LEN || strlen(m->word) != m->len)
+            invalid++;
+        if (m->len > longest)
+            longest = m->len;
+        node_bytes += (offsetof(mainnode, word) + m->len + 1 + 7) & ~(size_t)7;
+    }
+
+    // Distinct pieces, for the word count
+    stress_piece *sorted = malloc((pieces ? pieces : 1) * sizeof(stress_piece));
+    size_t distinct = 0;
+    if (sorted == NULL)
+        return FAILURE;
+    memcpy(sorted, piece, pieces * sizeof(stress_piece));
+    qsort(sorted, pieces, sizeof(stress_piece), compare_pieces);
+    for (size_t i = 0; i < pieces; i++)
+        distinct += i == 0 || compare_pieces(&sorted[i - 1], &sorted[i]) != 0;
+    free(sorted);
+    count_errors = (total != (long long)pieces) + (distinct != table.count);
+
+    // The mapped index and the text export must hold the same words
+    if (save_index(&table, INDEX_FILE) == FAILURE || open_index(&index, INDEX_FILE) == FAILURE)
+        return FAILURE;
+    for (mainnode *m = first_mainnode(&table, &cursor); m != NULL; m = next_mainnode(&table, &cursor))
+    {
+        const disk_term *t = index_lookup(&index, m->word, m->len);
+        index_differ += t == NULL || t->file_count != (uint32_t)m->file_count;
+    }
+    close_index(&index);
+    save_database(&table);
+    update_database(&reloaded, threads);
+    reload_differ = compare_tables(&table, &reloaded);
+
+    // With every analysis step, each piece that isn't dropped must be found as its analyzed form
+    analyzed.analysis = ANALYZE_ALL;
+    create_database(&analyzed, head, threads);
+    for (size_t i = 0; i < pieces; i++)
+    {
+        char buf[MAX_TOKEN_LEN + 1];
+        size_t len = piece[i].len;
+        const char *word = analyze_query(ANALYZE_ALL, piece[i].word, &len, buf);
+        if (word != NULL && !has_posting(lookup_term(&analyzed, word, len), piece[i].doc))
+            analyzed_missing++;
+    }
+    for (mainnode *m = first_mainnode(&analyzed, &cursor); m != NULL; m = next_mainnode(&analyzed, &cursor))
+        if (!valid_utf8(m->word, m->len))
+            invalid++;
+
+    printf("bench=stress layout=%s threads=%d files=%d tokens=%d pieces=%zu distinct=%u analyzed_distinct=%u "
+           "longest=%zu multibyte_pct=%.1f mean_node_bytes=%.1f build_s=%.3f missing=%ld count_errors=%ld "
+           "invalid_utf8=%ld index_differ=%ld reload_differ=%ld analyzed_missing=%ld\n",
+           LAYOUT, threads, STRESS_FILES, tokens, pieces, table.count, analyzed.count, longest,
+           pieces ? 100.0 * multibyte / pieces : 0.0, table.count ? node_bytes / table.count : 0.0,
+           build_time, missing, count_errors, invalid, index_differ, reload_differ, analyzed_missing);
+
+    if (missing || count_errors || invalid || index_differ || reload_differ || analyzed_missing)
+        status = FAILURE;
+
+    free_hashtable(&analyzed);
+    free_hashtable(&reloaded);
+    free_hashtable(&table);
+    for (int f = 0; f < STRESS_FILES; f++)
+    {
+        remove(name[f]);
+        free(text[f]);
+    }
+    for (int v = 0; v < STRESS_VOCAB; v++)
+        free(vocab[v]);
+    free(piece);
+    return status;
+}
+
+
+/*****************************************************************************************************
+ * Function       : corpus_word
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Spells vocabulary word 'rank' (0 = most frequent) as syllables: the digits of rank + 24 in
+ *      base 24, so every rank gives a different word and frequent words are the short ones, as in
+ *      natural text.
+ *
+ * Returns        :
+ *      Nothing; the word is stored NUL-terminated in out (at least 32 bytes).
+ *****************************************************************************************************/
+static void corpus_word(unsigned int rank, char *out)
+{
+    static const char *syllable[] = { "ba", "ce", "di", "fo", "gu", "ha", "ke", "li", "mo", "nu", "pa", "re",
+                                      "si", "to", "va", "we", "xi", "yo", "za", "tr", "st", "ng", "qu", "el" };
+    enum { SYLLABLES = sizeof(syllable) / sizeof(syllable[0]) };
+    unsigned long long value = (unsigned long long)rank + SYLLABLES;
+    size_t len = 0;
+
+    for (; value; value /= SYLLABLES, len += 2)
+        memcpy(out + len, syllable[value % SYLLABLES], 2);
+    out[len] = '\0';
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_corpus
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Writes a synthetic corpus to 'dir' (created if missing) as doc00000.txt, doc00001.txt, ...:
+ *      -n files of about -w words each (uniformly between half and one and a half times that),
+ *      twelve words to a line, drawn from a -v word vocabulary with Zipf's law of exponent -z
+ *      (word of rank r has weight 1 / r^z). The xorshift generator is seeded with -s, so the same
+ *      options always give the same bytes. Prints the corpus's settings, bytes and the number of
+ *      vocabulary words it uses.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out or a file couldn't be written.
+ *****************************************************************************************************/
+static int bench_corpus(int argc, char *argv[])
+{
+    int files = 200, words = 5000, vocab = 50000;
+    double exponent = 1.0;
+    unsigned int seed = 1;
+    const char *dir = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 < argc && strcmp(argv[i], "-n") == 0)
+            files = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "-w") == 0)
+            words = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "-v") == 0)
+            vocab = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "-z") == 0)
+            exponent = atof(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "-s") == 0)
+            seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+        else
+            dir = argv[i];
+    }
+    if (dir == NULL || files <= 0 || words <= 0 || vocab <= 0 || exponent < 0)
+    {
+        printf("USAGE : corpus [-n files] [-w words_per_file] [-v vocabulary] [-z zipf_exponent] [-s seed] dir\n");
+        return FAILURE;
+    }
+
+    // Cumulative Zipf weights, searched with a uniform draw to pick a rank
+    double *cdf = malloc((size_t)vocab * sizeof(double));
+    unsigned char *used = calloc(vocab, 1);
+    if (cdf == NULL || used == NULL)
+        return FAILURE;
+    double sum = 0;
+    for (int r = 0; r < vocab; r++)
+        cdf[r] = sum += pow(r + 1, -exponent);
+
+    mkdir(dir, 0755);
+    unsigned int state = seed ? seed : 1;
+    long long bytes = 0;
+    int distinct = 0;
+    for (int f = 0; f < files; f++)
+    {
+        char path[4096], word[32];
+        snprintf(path, sizeof(path), "%s/doc%05d.txt", dir, f);
+        FILE *fp = fopen(path, "w");
+        if (fp == NULL)
+        {
+            printf("ERROR : Couldn't write %s\n", path);
+            free(cdf);
+            free(used);
+            return FAILURE;
+        }
+
+        int count = words / 2 + (int)(next_random(&state) % (unsigned int)(words + 1));
+        for (int w = 0; w < count; w++)
+        {
+            double target = (next_random(&state) / 4294967296.0) * sum;
+            int lo = 0, hi = vocab - 1;
+            while (lo < hi)                             // First rank whose cumulative weight passes target
+            {
+                int mid = lo + (hi - lo) / 2;
+                if (cdf[mid] <= target)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            distinct += !used[lo];
+            used[lo] = 1;
+            corpus_word(lo, word);
+            fputs(word, fp);
+            putc(w % 12 == 11 || w == count - 1 ? '\n' : ' ', fp);
+        }
+        bytes += ftell(fp);
+        fclose(fp);
+    }
+
+    printf("bench=corpus files=%d words_per_file=%d vocab=%d zipf=%.2f seed=%u bytes=%lld vocab_used=%d dir=%s\n",
+           files, words, vocab, exponent, seed, bytes, distinct, dir);
+    free(cdf);
+    free(used);
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : time_searches
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Calls search_database() (table) or search_index() (mapped index), or search_cached() on
+ *      either when a cache is given, for every word, with standard output sent to /dev/null so
+ *      the printing is done but not shown, and stores each call's latency in microseconds,
+ *      sorted, in 'latency'.
+ *
+ * Returns        :
+ *      Seconds taken by all the calls.
+ *****************************************************************************************************/
+static double time_searches(hashtable *table, disk_index *index, result_cache *cache, char **word, int count,
+                            double *latency)
+{
+    int saved = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+
+    fflush(stdout);
+    if (saved >= 0 && null_fd >= 0)
+        dup2(null_fd, STDOUT_FILENO);
+
+    double start = now_seconds();
+    for (int i = 0; i < count; i++)
+    {
+        double t = now_seconds();
+        if (cache)
+            search_cached(cache, table, index, word[i]);
+        else if (index)
+            search_index(index, word[i]);
+        else
+            search_database(table, word[i]);
+        latency[i] = (now_seconds() - t) * 1e6;
+    }
+    fflush(stdout);
+    double elapsed = now_seconds() - start;
+
+    if (saved >= 0 && null_fd >= 0)
+        dup2(saved, STDOUT_FILENO);
+    if (saved >= 0)
+        close(saved);
+    if (null_fd >= 0)
+        close(null_fd);
+    qsort(latency, count, sizeof(double), compare_doubles);
+    return elapsed;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_suite
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      The standard run behind "make bench", over any files (normally a bench corpus). Measures, in
+ *      the current directory:
+ *          build  - create_database() on -j threads: seconds, MB/s and tokens/s of input, words,
+ *                   node memory;
+ *          save   - save_database() (backup.txt) and save_index() (backup.idx): seconds and bytes;
+ *          load   - update_database() reloading backup.txt, and open_index() mapping backup.idx;
+ *          search - search_database() on the table and search_index() on the mapped index for
+ *                   SUITE_SEARCHES words, taken from the files at random positions (so frequent
+ *                   words are searched more often, as they would be) with one in ten replaced by a
+ *                   word that isn't indexed: searches/s and latency percentiles.
+ *      Each phase prints one line. The keys and their order are fixed (schema=1); a change to
+ *      them bumps the schema number, so lines from different runs can be compared by scripts.
+ *      peak_rss_kb is the process's peak RSS when the phase ends.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if a step failed.
+ *****************************************************************************************************/
+static int bench_suite(int argc, char *argv[])
+{
+    enum { SUITE_SEARCHES = 20000 };
+    int threads = parse_threads(&argc, argv);
+    filenode *head = create_file_linked_list(argc, argv);
+    long long bytes = 0;
+    int files = 0;
+
+    if (head == NULL)
+        return FAILURE;
+    for (filenode *f = head; f != NULL; f = f->link, files++)
+    {
+        struct stat st;
+        if (stat(f->filename, &st) == 0)
+            bytes += st.st_size;
+    }
+
+    hashtable table, reloaded;
+    disk_index index;
+    struct stat st;
+    if (init_hashtable(&table) == FAILURE || init_hashtable(&reloaded) == FAILURE)
+        return FAILURE;
+
+    double start = now_seconds();
+    if (index_files(&table, head, threads) < 0)
+        return FAILURE;
+    double build = now_seconds() - start;
+    printf("bench=suite schema=1 phase=build layout=%s threads=%d files=%d bytes=%lld tokens=%lld words=%u "
+           "seconds=%.4f mb_per_s=%.2f mtokens_per_s=%.3f node_bytes=%zu peak_rss_kb=%ld\n",
+           LAYOUT, threads, files, bytes, table.docs.total_length, table.count, build, bytes / build / 1e6,
+           table.docs.total_length / build / 1e6, table.nodes.bytes, peak_rss_kb());
+
+    start = now_seconds();
+    save_database(&table);
+    double text_save = now_seconds() - start;
+    long long text_bytes = stat("backup.txt", &st) == 0 ? (long long)st.st_size : 0;
+    start = now_seconds();
+    if (save_index(&table, INDEX_FILE) == FAILURE)
+        return FAILURE;
+    double idx_save = now_seconds() - start;
+    long long idx_bytes = stat(INDEX_FILE, &st) == 0 ? (long long)st.st_size : 0;
+    printf("bench=suite schema=1 phase=save layout=%s text_seconds=%.4f text_bytes=%lld idx_seconds=%.4f "
+           "idx_bytes=%lld peak_rss_kb=%ld\n",
+           LAYOUT, text_save, text_bytes, idx_save, idx_bytes, peak_rss_kb());
+
+    start = now_seconds();
+    update_database(&reloaded, threads);
+    double text_load = now_seconds() - start;
+    start = now_seconds();
+    if (open_index(&index, INDEX_FILE) == FAILURE)
+        return FAILURE;
+    double idx_open = now_seconds() - start;
+    printf("bench=suite schema=1 phase=load layout=%s text_seconds=%.4f text_words=%u idx_seconds=%.5f "
+           "idx_words=%u peak_rss_kb=%ld\n",
+           LAYOUT, text_load, reloaded.count, idx_open, index.term_count, peak_rss_kb());
+    free_hashtable(&reloaded);
+
+    // Search words: tokens at random places of random files, one in ten made absent
+    char **word = malloc(SUITE_SEARCHES * sizeof(char *));
+    double *latency = malloc(SUITE_SEARCHES * sizeof(double));
+    filenode **list = malloc(files * sizeof(filenode *));
+    unsigned int state = 1;
+    int n = 0;
+    if (word == NULL || latency == NULL || list == NULL)
+        return FAILURE;
+    files = 0;
+    for (filenode *f = head; f != NULL; f = f->link)
+        list[files++] = f;
+    while (n < SUITE_SEARCHES)
+    {
+        tokenizer tok;
+        const char *token;
+        size_t len;
+        filenode *f = list[next_random(&state) % files];
+
+        if (open_tokenizer(&tok, f->filename) == FAILURE)
+            break;
+        tok.pos = tok.size ? next_random(&state) % tok.size : 0;
+        next_token(&tok, &token, &len);                 // Most likely the rest of a word: skip it
+        if (next_token(&tok, &token, &len) == SUCCESS)
+        {
+            int absent = next_random(&state) % 10 == 0;
+            word[n] = malloc(len + 3);
+            if (word[n] == NULL)
+                break;
+            memcpy(word[n], token, len);
+            strcpy(word[n] + len, absent ? "zq" : "");
+            n++;
+        }
+        close_tokenizer(&tok);
+    }
+
+    for (int source = 0; source < 2; source++)
+    {
+        double elapsed = time_searches(&table, source ? &index : NULL, NULL, word, n, latency);
+        printf("bench=suite schema=1 phase=search layout=%s source=%s searches=%d seconds=%.4f searches_per_s=%.0f "
+               "p50_us=%.2f p90_us=%.2f p99_us=%.2f max_us=%.2f peak_rss_kb=%ld\n",
+               LAYOUT, source ? "index" : "table", n, elapsed, n / elapsed,
+               n ? latency[(n - 1) * 50 / 100] : 0.0, n ? latency[(n - 1) * 90 / 100] : 0.0,
+               n ? latency[(n - 1) * 99 / 100] : 0.0, n ? latency[n - 1] : 0.0, peak_rss_kb());
+    }
+
+    for (int i = 0; i < n; i++)
+        free(word[i]);
+    free(word);
+    free(latency);
+    free(list);
+    close_index(&index);
+    free_hashtable(&table);
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : capture_search
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Runs one search on the table, through the cache if one is given, and captures what it
+ *      prints.
+ *
+ * Returns        :
+ *      The output (malloc'ed, NUL-terminated), or NULL on failure.
+ *****************************************************************************************************/
+static char* capture_search(result_cache *cache, hashtable *table, const char *word)
+{
+    FILE *tmp = tmpfile();
+    int saved = dup(STDOUT_FILENO);
+    char *text = NULL;
+
+    if (tmp == NULL || saved < 0)
+    {
+        if (tmp)
+            fclose(tmp);
+        if (saved >= 0)
+            close(saved);
+        return NULL;
+    }
+    fflush(stdout);
+    dup2(fileno(tmp), STDOUT_FILENO);
+    if (cache)
+        search_cached(cache, table, NULL, word);
+    else
+        search_database(table, word);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    fseek(tmp, 0, SEEK_END);
+    long len = ftell(tmp);
+    rewind(tmp);
+    if (len >= 0 && (text = malloc(len + 1)) != NULL)
+        text[fread(text, 1, len, tmp)] = '\0';
+    fclose(tmp);
+    return text;
+}
+
+
+/*****************************************************************************************************
+ * Function       : check_cached
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Searches each of the first 'count' words without and then with the cache, and compares
+ *      what the two print.
+ *
+ * Returns        :
+ *      Number of words whose output differs.
+ *****************************************************************************************************/
+static long check_cached(result_cache *cache, hashtable *table, char **word, int count)
+{
+    long mismatches = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        char *plain = capture_search(NULL, table, word[i]);
+        char *cached = capture_search(cache, table, word[i]);
+        mismatches += plain == NULL || cached == NULL || strcmp(plain, cached) != 0;
+        free(plain);
+        free(cached);
+    }
+    return mismatches;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_cache
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Indexes the files and draws a stream of searches from the indexed words with Zipfian
+ *      popularity (exponent 1.0, most frequent words first), so a small set of words makes up
+ *      most searches, as in a real query log. The stream is timed through search_database() and
+ *      through search_cached() with a cache of -s KB (default CACHE_BYTES), reporting searches/s,
+ *      latency, hit rate, memory and evictions. Then checks, for the first searches, that the
+ *      cache prints exactly what a plain search does, both as filled and after sync_database()
+ *      has dropped the first file (which bumps the table's generation).
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if a step failed or an output differed.
+ *****************************************************************************************************/
+static int bench_cache(int argc, char *argv[])
+{
+    enum { SEARCHES = 200000, CHECKED = 2000 };
+    long budget_kb = CACHE_BYTES >> 10;
+    hashtable table;
+    table_cursor cursor;
+    unsigned int state = 2463534242u, n = 0;
+
+    int kept = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            budget_kb = atol(argv[++i]);
+        else
+            argv[kept++] = argv[i];
+    }
+    argc = kept;
+
+    filenode *head = create_file_linked_list(argc, argv);
+    if (head == NULL || budget_kb < 0 || init_hashtable(&table) == FAILURE)
+        return FAILURE;
+    create_database(&table, head, 1);
+
+    mainnode **node = malloc((table.count ? table.count : 1) * sizeof(mainnode *));
+    char **word = malloc(SEARCHES * sizeof(char *));
+    double *latency = malloc(SEARCHES * sizeof(double));
+    if (node == NULL || word == NULL || latency == NULL)
+        return FAILURE;
+    for (mainnode *m = first_mainnode(&table, &cursor); m != NULL; m = next_mainnode(&table, &cursor))
+    {
+        if (!is_term_pattern(m->word, m->len))          // A pattern would be expanded, never cached
+            node[n++] = m;
+    }
+    if (n == 0)
+        return FAILURE;
+    qsort(node, n, sizeof(mainnode *), compare_frequency);
+
+    double *cdf = malloc(n * sizeof(double)), sum = 0;
+    unsigned char *used = calloc(n, 1);
+    if (cdf == NULL || used == NULL)
+        return FAILURE;
+    for (unsigned int r = 0; r < n; r++)
+        cdf[r] = sum += 1.0 / (r + 1);
+    int distinct = 0;
+    for (int i = 0; i < SEARCHES; i++)
+    {
+        double target = (next_random(&state) / 4294967296.0) * sum;
+        unsigned int lo = 0, hi = n - 1;
+        while (lo < hi)                                 // First rank whose cumulative weight passes target
+        {
+            unsigned int mid = lo + (hi - lo) / 2;
+            if (cdf[mid] <= target)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        distinct += !used[lo];
+        used[lo] = 1;
+        if ((word[i] = strdup(node[lo]->word)) == NULL)
+            return FAILURE;
+    }
+    free(cdf);
+    free(used);
+    free(node);
+
+    result_cache cache;
+    if (init_cache(&cache, (size_t)budget_kb << 10) == FAILURE)
+        return FAILURE;
+    double plain = time_searches(&table, NULL, NULL, word, SEARCHES, latency);
+    double plain_p50 = latency[(SEARCHES - 1) / 2], plain_p99 = latency[(SEARCHES - 1) * 99 / 100];
+    double cached = time_searches(&table, NULL, &cache, word, SEARCHES, latency);
+
+    unsigned long lookups = cache.hits + cache.misses;
+    char line[768];                                     // Printed whole: the update below prints too
+    snprintf(line, sizeof(line), "bench=cache layout=%s docs=%d searches=%d distinct=%d budget_kb=%ld "
+             "plain_per_s=%.0f cached_per_s=%.0f plain_p50_us=%.2f plain_p99_us=%.2f cached_p50_us=%.2f "
+             "cached_p99_us=%.2f hit_rate=%.3f entries=%lu bytes=%zu evictions=%lu ",
+             LAYOUT, table.docs.count, SEARCHES, distinct, budget_kb, SEARCHES / plain, SEARCHES / cached,
+             plain_p50, plain_p99, latency[(SEARCHES - 1) / 2], latency[(SEARCHES - 1) * 99 / 100],
+             lookups ? (double)cache.hits / lookups : 0.0, cache.count, cache.bytes, cache.evictions);
+
+    // The cache must print what a plain search prints, before and after the index changes
+    long mismatches = check_cached(&cache, &table, word, CHECKED);
+    int changed = head->link != NULL && sync_database(&table, head->link, 1) == SUCCESS;
+    long after = changed ? check_cached(&cache, &table, word, CHECKED) : 0;
+    printf("%sstale=%lu mismatches=%ld mismatches_after_update=%ld\n", line, cache.stale, mismatches, after);
+
+    for (int i = 0; i < SEARCHES; i++)
+        free(word[i]);
+    free(word);
+    free(latency);
+    free_cache(&cache);
+    free_hashtable(&table);
+    while (head)
+    {
+        filenode *next = head->link;
+        free(head);
+        head = next;
+    }
+    return mismatches == 0 && after == 0 ? SUCCESS : FAILURE;
+}
+
+
+// One reader thread of bench_swap
+typedef struct swap_reader
+{
+    index_snapshot *snap;        // Versions entered per query (NULL in the locked mode)
+    pthread_rwlock_t *lock;      // Locked mode: held for reading around each query
+    disk_index **locked;         // Locked mode: the version in use
+    char (*text)[96];            // Queries, taken in turn from 'first'
+    const int *expected;         // Matches of each query on the first version
+    int count;
+    int id;                      // Reader slot in snap
+    double *latency;             // Microseconds of each query
+    long cap;                    // Entries latency has room for
+    long done;
+    long mismatches;             // Queries whose match count differs from expected
+    int *stop;                   // Set by bench_swap when the phase is over
+    pthread_t tid;
+} swap_reader;
+
+// The thread rebuilding the index during a phase of bench_swap
+typedef struct swap_writer
+{
+    swap_reader *mode;           // Any reader: its snap / lock say how to publish
+    filenode *head;              // Files each rebuild indexes
+    long rebuilds;               // Versions published
+    double grace;                // Seconds spent in publish_snapshot() waiting for readers
+    int failed;                  // 1 if a rebuild failed
+    int *stop;
+    pthread_t tid;
+} swap_writer;
+
+
+/*****************************************************************************************************
+ * Function       : swap_read
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Thread body of a bench_swap reader: runs queries one after another until the phase stops
+ *      (or its latency array is full), each against the version current when it starts, and
+ *      checks each result size against the first version's.
+ *
+ * Returns        :
+ *      NULL.
+ *****************************************************************************************************/
+static void* swap_read(void *arg)
+{
+    swap_reader *r = arg;
+
+    for (int i = r->id * 7919 % r->count; r->done < r->cap && !__atomic_load_n(r->stop, __ATOMIC_RELAXED);
+         i = (i + 1) % r->count)
+    {
+        double start = now_seconds();
+        disk_index *index;
+        query q;
+        doc_list result;
+
+        if (r->lock)
+        {
+            pthread_rwlock_rdlock(r->lock);
+            index = *r->locked;
+        }
+        else
+            index = enter_snapshot(r->snap, r->id);
+
+        if (parse_query(&q, r->text[i]) == FAILURE || run_query(&q, NULL, index, &result) == FAILURE)
+            r->mismatches++;
+        else
+        {
+            r->mismatches += result.count != r->expected[i];
+            free_doc_list(&result);
+        }
+
+        if (r->lock)
+            pthread_rwlock_unlock(r->lock);
+        else
+            leave_snapshot(r->snap, r->id);
+        r->latency[r->done++] = (now_seconds() - start) * 1e6;
+    }
+    return NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : swap_write
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Thread body of the bench_swap writer: rebuilds the index from the files and publishes it,
+ *      again and again until the phase stops. With a snapshot the version is built on the side
+ *      and swapped in; in the locked mode the write lock is held for the whole rebuild, which is
+ *      what serving from one shared index without versions amounts to.
+ *
+ * Returns        :
+ *      NULL.
+ *****************************************************************************************************/
+static void* swap_write(void *arg)
+{
+    swap_writer *w = arg;
+    swap_reader *mode = w->mode;
+
+    while (!__atomic_load_n(w->stop, __ATOMIC_RELAXED))
+    {
+        disk_index *index;
+
+        if (mode->lock)
+        {
+            pthread_rwlock_wrlock(mode->lock);
+            index = build_version(w->head, INDEX_FILE, *mode->locked, 1);
+            if (index != NULL)
+            {
+                close_index(*mode->locked);
+                free(*mode->locked);
+                *mode->locked = index;
+            }
+            pthread_rwlock_unlock(mode->lock);
+        }
+        else
+        {
+            index = build_version(w->head, INDEX_FILE, mode->snap->current, 1);
+            if (index != NULL)
+            {
+                double start = now_seconds();
+                publish_snapshot(mode->snap, index);
+                w->grace += now_seconds() - start;
+            }
+        }
+        if (index == NULL)
+        {
+            w->failed = 1;
+            break;
+        }
+        w->rebuilds++;
+    }
+    return NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : swap_phase
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Runs the readers for 'seconds', with the writer rebuilding alongside them if 'writer' is
+ *      given, and appends the phase's latency to 'line' as "<name>_qps=x <name>_p50_us=x
+ *      <name>_p99_us=x <name>_max_us=x " (the rebuilds print as they save, so the line is printed
+ *      whole at the end).
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if a thread couldn't start, a rebuild failed or a result differed.
+ *****************************************************************************************************/
+static int swap_phase(const char *name, swap_reader *reader, int readers, swap_writer *writer,
+                      double seconds, int *stop, char *line, size_t size)
+{
+    long done = 0, mismatches = 0, started = 0;
+    int status = SUCCESS;
+
+    *stop = 0;
+    if (writer && pthread_create(&writer->tid, NULL, swap_write, writer) != 0)
+        return FAILURE;
+    double start = now_seconds();
+    for (int t = 0; t < readers; t++, started++)
+    {
+        reader[t].done = reader[t].mismatches = 0;
+        if (pthread_create(&reader[t].tid, NULL, swap_read, &reader[t]) != 0)
+            break;
+    }
+    usleep((useconds_t)(seconds * 1e6));
+    __atomic_store_n(stop, 1, __ATOMIC_RELAXED);
+    for (int t = 0; t < started; t++)
+        pthread_join(reader[t].tid, NULL);
+    double elapsed = now_seconds() - start;
+    if (writer)
+        pthread_join(writer->tid, NULL);
+
+    // Pack every reader's latencies behind the first one's
+    double *latency = reader[0].latency;
+    for (int t = 0; t < started; t++)
+    {
+        memmove(latency + done, reader[t].latency, reader[t].done * sizeof(double));
+        done += reader[t].done;
+        mismatches += reader[t].mismatches;
+    }
+    qsort(latency, done, sizeof(double), compare_doubles);
+#define PERCENTILE(p) (done ? latency[(done - 1) * (p) / 100] : 0.0)
+    size_t used = strlen(line);
+    snprintf(line + used, size - used, "%s_qps=%.0f %s_p50_us=%.1f %s_p99_us=%.1f %s_max_us=%.1f ",
+             name, done / elapsed, name, PERCENTILE(50), name, PERCENTILE(99), name, PERCENTILE(100));
+#undef PERCENTILE
+
+    if (started < readers || mismatches || (writer && writer->failed))
+        status = FAILURE;
+    return status;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_swap
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Query latency while the index is rebuilt. Indexes the files, saves and maps backup.idx in
+ *      the current directory, and generates a fixed batch of boolean queries (as bench_query).
+ *      Then -j reader threads (default 1) run the queries for three phases of equal length:
+ *          steady - nothing else runs;
+ *          swap   - a writer rebuilds the index over and over on one thread, publishing each
+ *                   version through an index_snapshot (snapshot.c) while the readers continue;
+ *          locked - the same rebuilds, but under a write lock that readers take for reading, as
+ *                   if queries had to wait for the index to be rebuilt in place.
+ *      Every rebuild indexes the same files, so every query must match the same number of files
+ *      in every version. Each phase lasts three rebuilds (at least a second). The line reports
+ *      queries/s and latency percentiles per phase, rebuilds published, and the mean wait of a
+ *      publish for the readers of the version it replaced.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if a step failed or a result differed.
+ *****************************************************************************************************/
+static int bench_swap(int argc, char *argv[])
+{
+    enum { QUERIES = 20000, COMMON = 200, LATENCIES = 1 << 21 };
+    int readers = parse_threads(&argc, argv);
+    filenode *head = create_file_linked_list(argc, argv);
+    hashtable table;
+    table_cursor cursor;
+    unsigned int state = 2463534242u, n = 0;
+    int stop = 0, status = SUCCESS;
+
+    if (head == NULL || init_hashtable(&table) == FAILURE)
+        return FAILURE;
+    create_database(&table, head, 1);
+    disk_index *first = table.count && save_index(&table, INDEX_FILE) == SUCCESS ? open_version(INDEX_FILE) : NULL;
+    if (first == NULL)
+        return FAILURE;
+
+    mainnode **word = malloc(table.count * sizeof(mainnode *));
+    char (*text)[96] = malloc(QUERIES * sizeof(*text));
+    int *expected = malloc(QUERIES * sizeof(int));
+    swap_reader *reader = calloc(readers, sizeof(swap_reader));
+    double *latency = malloc((size_t)readers * LATENCIES * sizeof(double));
+    if (word == NULL || text == NULL || expected == NULL || reader == NULL || latency == NULL)
+        return FAILURE;
+
+    for (mainnode *m = first_mainnode(&table, &cursor); m != NULL; m = next_mainnode(&table, &cursor))
+    {
+        if (strspn(m->word, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789") == strlen(m->word) &&
+            strcmp(m->word, "AND") && strcmp(m->word, "OR") && strcmp(m->word, "NOT") && strncmp(m->word, "NEAR", 4))
+            word[n++] = m;                              // Only words that read as words in a query
+    }
+    if (n == 0)
+        return FAILURE;
+    qsort(word, n, sizeof(mainnode *), compare_frequency);
+    unsigned int common = n < COMMON ? n : COMMON;
+    for (int i = 0; i < QUERIES; i++)
+    {
+        const char *pick[3];
+        for (int k = 0; k < 3; k++)
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            pick[k] = word[k == 2 ? state % n : state % common]->word;
+        }
+        switch (i % 3)
+        {
+            case 0: snprintf(text[i], sizeof(text[i]), "%s AND %s", pick[0], pick[1]); break;
+            case 1: snprintf(text[i], sizeof(text[i]), "%s OR %s", pick[0], pick[2]); break;
+            default: snprintf(text[i], sizeof(text[i]), "%s NOT %s", pick[0], pick[1]);
+        }
+    }
+    int docs = table.docs.count;
+    free(word);
+    free_hashtable(&table);
+
+    // Expected sizes from the first version, and the time of one rebuild
+    for (int i = 0; i < QUERIES; i++)
+    {
+        query q;
+        doc_list result;
+
+        if (parse_query(&q, text[i]) == FAILURE || run_query(&q, NULL, first, &result) == FAILURE)
+            return FAILURE;
+        expected[i] = result.count;
+        free_doc_list(&result);
+    }
+    double start = now_seconds();
+    disk_index *rebuilt = build_version(head, INDEX_FILE, first, 1);
+    double rebuild = now_seconds() - start;
+    if (rebuilt == NULL)
+        return FAILURE;
+    close_index(first);
+    free(first);
+    double seconds = rebuild * 3 > 1.0 ? rebuild * 3 : 1.0;
+
+    index_snapshot snap;
+    pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+    disk_index *locked = NULL;
+    if (init_snapshot(&snap, rebuilt, readers) == FAILURE)
+        return FAILURE;
+    for (int t = 0; t < readers; t++)
+    {
+        reader[t] = (swap_reader){ .snap = &snap, .text = text, .expected = expected, .count = QUERIES, .id = t,
+                                   .latency = latency + (size_t)t * LATENCIES, .cap = LATENCIES, .stop = &stop };
+    }
+    swap_writer writer = { .mode = &reader[0], .head = head, .stop = &stop };
+
+    char line[512];
+    snprintf(line, sizeof(line), "bench=swap layout=%s readers=%d docs=%d queries=%d rebuild_s=%.3f phase_s=%.2f ",
+             LAYOUT, readers, docs, QUERIES, rebuild, seconds);
+    if (swap_phase("steady", reader, readers, NULL, seconds, &stop, line, sizeof(line)) == FAILURE)
+        status = FAILURE;
+    if (swap_phase("swap", reader, readers, &writer, seconds, &stop, line, sizeof(line)) == FAILURE)
+        status = FAILURE;
+    long swaps = writer.rebuilds;
+    double grace = writer.grace;
+
+    // Locked mode: the same readers and writer around one plain pointer
+    locked = open_version(INDEX_FILE);
+    for (int t = 0; t < readers; t++)
+    {
+        reader[t].lock = &lock;
+        reader[t].locked = &locked;
+    }
+    writer.rebuilds = 0;
+    if (locked == NULL || swap_phase("locked", reader, readers, &writer, seconds, &stop, line, sizeof(line)) == FAILURE)
+        status = FAILURE;
+    printf("%sswaps=%ld grace_us=%.1f locked_rebuilds=%ld failed=%s\n", line, swaps,
+           swaps ? grace / swaps * 1e6 : 0.0, writer.rebuilds, status == SUCCESS ? "no" : "yes");
+
+    if (locked)
+    {
+        close_index(locked);
+        free(locked);
+    }
+    free_snapshot(&snap);
+    free(text);
+    free(expected);
+    free(reader);
+    free(latency);
+    while (head)
+    {
+        filenode *next = head->link;
+        free(head);
+        head = next;
+    }
+    return status;
+}
+
+
+#define SEGMENT_BENCH_DIR "bench_segments"     // Segment directory of bench_segments, removed after
+#define SEGMENT_BENCH_REMOVE 10                 // bench_segments deletes every 10th file
+
+
+// Queries and expected answers shared by the runs of bench_segments
+typedef struct segment_bench
+{
+    filenode **file;             // The files, in ingest order
+    int files;
+    int batch;                   // Files per ingest_files() call
+    char (*text)[96];            // Boolean queries
+    char (*words)[96];           // Ranked queries
+    int queries;                 // Entries in text and in words
+    double *latency;             // Scratch for the percentiles
+    unsigned long *sum[2];       // result_sum() of each boolean query: all files, kept files
+    ranked_doc (*top[2])[RANK_TOP_K];   // Best scores of each ranked query: all files, kept files
+    int *found[2];               // Results of each ranked query: all files, kept files
+} segment_bench;
+
+
+/*****************************************************************************************************
+ * Function       : link_files
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Chains file[from] to file[to - 1] into a list. With 'every' > 0 only the files whose index
+ *      is a multiple of it are taken if 'pick' is 1, only the others if it is 0.
+ *
+ * Returns        :
+ *      Head of the list, or NULL if no file was taken.
+ *****************************************************************************************************/
+static filenode* link_files(filenode **file, int from, int to, int every, int pick)
+{
+    filenode *head = NULL, **tail = &head;
+
+    for (int i = from; i < to; i++)
+    {
+        if (every == 0 || (i % every == 0) == pick)
+        {
+            *tail = file[i];
+            tail = &file[i]->link;
+        }
+    }
+    *tail = NULL;
+    return head;
+}
+
+
+/*****************************************************************************************************
+ * Function       : remove_segment_dir
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Deletes the files of a segment directory and the directory itself.
+ *
+ * Returns        :
+ *      Nothing. A directory that doesn't exist is left alone.
+ *****************************************************************************************************/
+static void remove_segment_dir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    char path[4096 + 256];
+
+    if (d == NULL)
+        return;
+    while ((e = readdir(d)) != NULL)
+    {
+        if (e->d_name[0] != '.' && (size_t)snprintf(path, sizeof(path), "%s/%s", dir, e->d_name) < sizeof(path))
+            unlink(path);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+
+/*****************************************************************************************************
+ * Function       : result_sum
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Checksum of a query result that doesn't depend on document ids or their order: the number of
+ *      matches and the sum of hash_word() of their file names, looked up in the view, or in the
+ *      table if 'view' is NULL. Segments and a table number the same files differently.
+ *
+ * Returns        :
+ *      The checksum.
+ *****************************************************************************************************/
+static unsigned long result_sum(const doc_list *result, segment_view *view, hashtable *table)
+{
+    unsigned long sum = 0;
+
+    for (int j = 0; j < result->count; j++)
+        sum += hash_word(view ? segment_document(view, result->id[j]) : table->docs.name[result->id[j]]);
+    return sum + result->count * 2654435761ul;
+}
+
+
+/*****************************************************************************************************
+ * Function       : query_word
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Tells whether a word of the table can be put in a query as it is: not an operator, and
+ *      without quotes, parentheses or pattern characters (files indexed without -a keep them).
+ *
+ * Returns        :
+ *      1 if it can, 0 if not.
+ *****************************************************************************************************/
+static int query_word(const mainnode *m)
+{
+    return strpbrk(m->word, "\"()") == NULL && !is_term_pattern(m->word, m->len) &&
+           strcmp(m->word, "AND") != 0 && strcmp(m->word, "OR") != 0 && strcmp(m->word, "NOT") != 0 &&
+           strncmp(m->word, "NEAR", 4) != 0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : time_segments
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Runs the boolean queries of the bench ('ranked' 0) or its ranked ones (top RANK_TOP_K with
+ *      MaxScore) one at a time on a view, or on the table / mapped index if 'view' is NULL, and
+ *      takes the median and 99th percentile of their latencies.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if a query failed.
+ *****************************************************************************************************/
+static int time_segments(segment_bench *b, segment_view *view, hashtable *table, disk_index *index, int ranked,
+                         double *p50, double *p99)
+{
+    ranked_doc top[RANK_TOP_K];
+
+    for (int i = 0; i < b->queries; i++)
+    {
+        double start = now_seconds();
+        query q;
+        doc_list result;
+
+        if (ranked)
+        {
+            int found = view ? rank_segments(view, b->words[i], RANK_TOP_K, 1, top)
+                             : rank_documents(table, index, b->words[i], RANK_TOP_K, 1, top);
+            if (found < 0)
+                return FAILURE;
+        }
+        else
+        {
+            if (parse_query(&q, b->text[i]) == FAILURE ||
+                (view ? query_segments(&q, view, &result) : run_query(&q, table, index, &result)) == FAILURE)
+                return FAILURE;
+            free_doc_list(&result);
+        }
+        b->latency[i] = (now_seconds() - start) * 1e6;
+    }
+    qsort(b->latency, b->queries, sizeof(double), compare_doubles);
+    *p50 = b->latency[(b->queries - 1) / 2];
+    *p99 = b->latency[(b->queries - 1) * 99 / 100];
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : check_segments
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Checks a view against the answers of a table over the same files ('kept' 0: all of them,
+ *      1: all but the deleted ones): the matches of every boolean query and, if 'ranked', the
+ *      best scores of every ranked query.
+ *
+ * Returns        :
+ *      Number of queries that differ, or -1 if a query failed.
+ *****************************************************************************************************/
+static long check_segments(segment_bench *b, segment_view *view, int kept, int ranked)
+{
+    ranked_doc top[RANK_TOP_K];
+    long mismatches = 0;
+
+    for (int i = 0; i < b->queries; i++)
+    {
+        query q;
+        doc_list result;
+
+        if (parse_query(&q, b->text[i]) == FAILURE || query_segments(&q, view, &result) == FAILURE)
+            return -1;
+        mismatches += result_sum(&result, view, NULL) != b->sum[kept][i];
+        free_doc_list(&result);
+        if (!ranked)
+            continue;
+
+        int found = rank_segments(view, b->words[i], RANK_TOP_K, 1, top);
+        int same = found == b->found[kept][i];
+        for (int j = 0; same && j < found; j++)
+            same = fabs(top[j].score - b->top[kept][i][j].score) < 1e-9;
+        mismatches += !same;
+    }
+    return mismatches;
+}
+
+
+/*****************************************************************************************************
+ * Function       : expect_answers
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Indexes the files into a table and records its answers to the bench's queries as the
+ *      expected ones ('kept' 0: every file, 1: the files bench_segments doesn't delete).
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if a step failed.
+ *****************************************************************************************************/
+static int expect_answers(segment_bench *b, hashtable *table, int kept)
+{
+    create_database(table, link_files(b->file, 0, b->files, kept ? SEGMENT_BENCH_REMOVE : 0, 0), 1);
+    for (int i = 0; i < b->queries; i++)
+    {
+        query q;
+        doc_list result;
+
+        if (parse_query(&q, b->text[i]) == FAILURE || run_query(&q, table, NULL, &result) == FAILURE)
+            return FAILURE;
+        b->sum[kept][i] = result_sum(&result, NULL, table);
+        free_doc_list(&result);
+        b->found[kept][i] = rank_documents(table, NULL, b->words[i], RANK_TOP_K, 1, b->top[kept][i]);
+        if (b->found[kept][i] < 0)
+            return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : segment_run
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      One run of bench_segments in a fresh SEGMENT_BENCH_DIR, with the merger thread ('merge' 1)
+ *      or without. Ingests the files 'batch' at a time, each call making a segment; after 1, 2,
+ *      4, 8, ... calls and after the last it prints the segments in the view, the ingest rate
+ *      since the previous line and the boolean and ranked query latencies on that view. Then it
+ *      lets the merger finish, checks the view against the table of all files, deletes every
+ *      SEGMENT_BENCH_REMOVE-th file and checks the boolean answers against the table of the kept
+ *      files, compacts, and checks ranked answers too (deleted documents no longer count in the
+ *      statistics).
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if a step failed or an answer differs.
+ *****************************************************************************************************/
+static int segment_run(segment_bench *b, int merge)
+{
+    const char *mode = merge ? "on" : "off";
+    segment_set set;
+    segment_view *view;
+    int batches = 0, report = 1, reported = 0;
+    double ingest = 0, reported_ingest = 0, p[4];
+
+    remove_segment_dir(SEGMENT_BENCH_DIR);
+    if (open_segments(&set, SEGMENT_BENCH_DIR, 0, 0, merge) == FAILURE)
+        return FAILURE;
+    for (int from = 0; from < b->files; from += b->batch)
+    {
+        int to = from + b->batch < b->files ? from + b->batch : b->files;
+        double start = now_seconds();
+
+        if (ingest_files(&set, link_files(b->file, from, to, 0, 0), 1) < 0)
+            return FAILURE;
+        ingest += now_seconds() - start;
+        if (++batches != report && to < b->files)
+            continue;
+        report *= 2;
+
+        view = acquire_segments(&set);
+        if (time_segments(b, view, NULL, NULL, 0, &p[0], &p[1]) == FAILURE ||
+            time_segments(b, view, NULL, NULL, 1, &p[2], &p[3]) == FAILURE)
+            return FAILURE;
+        pthread_mutex_lock(&set.lock);
+        unsigned long merges = set.merges;
+        pthread_mutex_unlock(&set.lock);
+        printf("bench=segments merge=%s batches=%d files=%d segments=%d ingest_files_per_s=%.0f "
+               "bool_p50_us=%.2f bool_p99_us=%.2f rank_p50_us=%.2f rank_p99_us=%.2f merges=%lu\n",
+               mode, batches, to, view->count, (to - reported) / (ingest - reported_ingest),
+               p[0], p[1], p[2], p[3], merges);
+        release_segments(&set, view);
+        reported = to;
+        reported_ingest = ingest;
+    }
+
+    double start = now_seconds();
+    stop_merging(&set);                                 // Lets the merges due finish
+    double drain = now_seconds() - start;
+    view = acquire_segments(&set);
+    int segments = view->count;
+    long mismatches = check_segments(b, view, 0, 1);
+    release_segments(&set, view);
+
+    start = now_seconds();
+    int removed = remove_files(&set, link_files(b->file, 0, b->files, SEGMENT_BENCH_REMOVE, 1));
+    double remove_time = now_seconds() - start;
+    view = acquire_segments(&set);
+    long after_remove = check_segments(b, view, 1, 0);  // Scores still count the deleted documents
+    release_segments(&set, view);
+
+    start = now_seconds();
+    int compacted = compact_segments(&set);
+    double compact_time = now_seconds() - start;
+    view = acquire_segments(&set);
+    long after_compact = check_segments(b, view, 1, 1);
+    release_segments(&set, view);
+
+    if (mismatches < 0 || after_remove < 0 || after_compact < 0 || removed < 0 || compacted == FAILURE)
+        mismatches = -1;
+    else
+        mismatches += after_remove + after_compact;
+    printf("bench=segments merge=%s files=%d batches=%d ingest_s=%.3f ingest_files_per_s=%.0f drain_s=%.3f "
+           "merges=%lu merged=%lu merge_s=%.3f segments=%d removed=%d remove_ms=%.2f compact_s=%.3f mismatches=%ld\n",
+           mode, b->files, batches, ingest, b->files / ingest, drain, set.merges, set.merged, set.merge_seconds,
+           segments, removed, remove_time * 1e3, compact_time, mismatches);
+
+    close_segments(&set);
+    remove_segment_dir(SEGMENT_BENCH_DIR);
+    return mismatches == 0 ? SUCCESS : FAILURE;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bench_segments
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Builds the files into one table, saved and mapped as backup.idx in the current directory,
+ *      and generates boolean queries as bench_query does and ranked ones as bench_rank does. Their
+ *      latency on the mapped index is the baseline; then segment_run() ingests the files into
+ *      segments, 'batch' files at a time (-b, default 4), without the merger and with it, so the
+ *      cost of fanning out over a growing number of segments shows against the fan-out the
+ *      tiered merges keep.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if a step failed or an answer differs.
+ *****************************************************************************************************/
+static int bench_segments(int argc, char *argv[])
+{
+    enum { QUERIES = 2000, COMMON = 200 };
+    segment_bench b = { .batch = 4, .queries = QUERIES };
+    hashtable table, kept;
+    disk_index index;
+    table_cursor cursor;
+    unsigned int state = 2463534242u, n = 0;
+
+    int args = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            b.batch = atoi(argv[++i]);
+        else
+            argv[args++] = argv[i];
+    }
+    argc = args;
+
+    filenode *head = create_file_linked_list(argc, argv);
+    if (head == NULL || b.batch < 1 || init_hashtable(&table) == FAILURE || init_hashtable(&kept) == FAILURE)
+        return FAILURE;
+    for (filenode *f = head; f != NULL; f = f->link)
+        b.files++;
+    b.file = malloc(b.files * sizeof(filenode *));
+    if (b.file == NULL)
+        return FAILURE;
+    b.files = 0;
+    for (filenode *f = head; f != NULL; f = f->link)
+        b.file[b.files++] = f;
+
+    b.text = malloc(QUERIES * sizeof(*b.text));
+    b.words = malloc(QUERIES * sizeof(*b.words));
+    b.latency = malloc(QUERIES * sizeof(double));
+    for (int k = 0; k < 2; k++)
+    {
+        b.sum[k] = malloc(QUERIES * sizeof(unsigned long));
+        b.top[k] = malloc(QUERIES * sizeof(*b.top[k]));
+        b.found[k] = malloc(QUERIES * sizeof(int));
+        if (b.sum[k] == NULL || b.top[k] == NULL || b.found[k] == NULL)
+            return FAILURE;
+    }
+    if (b.text == NULL || b.words == NULL || b.latency == NULL)
+        return FAILURE;
+
+    // Queries over the words of every file
+    create_database(&table, head, 1);
+    mainnode **word = malloc((table.count ? table.count : 1) * sizeof(mainnode *));
+    if (word == NULL)
+        return FAILURE;
+    for (mainnode *m = first_mainnode(&table, &cursor); m != NULL; m = next_mainnode(&table, &cursor))
+    {
+        if (query_word(m))
+            word[n++] = m;
+    }
+    if (n == 0)
+        return FAILURE;
+    qsort(word, n, sizeof(mainnode *), compare_frequency);
+    unsigned int common = n < COMMON ? n : COMMON;
+
+    for (int i = 0; i < QUERIES; i++)
+    {
+        const char *pick[4];
+        for (int k = 0; k < 4; k++)
+            pick[k] = word[k == 3 || (i % 6 == 2) ? next_random(&state) % n : next_random(&state) % common]->word;
+
+        switch (i % 6)
+        {
+            case 0: snprintf(b.text[i], sizeof(b.text[i]), "%s AND %s", pick[0], pick[1]); break;
+            case 1: snprintf(b.text[i], sizeof(b.text[i]), "%s AND %s", pick[0], pick[3]); break;
+            case 2: snprintf(b.text[i], sizeof(b.text[i]), "%s OR %s", pick[0], pick[1]); break;
+            case 3: snprintf(b.text[i], sizeof(b.text[i]), "%s %s NOT %s", pick[0], pick[1], pick[2]); break;
+            case 4: snprintf(b.text[i], sizeof(b.text[i]), "(%s OR %s) AND %s", pick[3], pick[0], pick[1]); break;
+            default: snprintf(b.text[i], sizeof(b.text[i]), "%s AND %s AND %s NOT %s", pick[0], pick[1], pick[2], pick[3]);
+        }
+
+        size_t len = 0;
+        for (int k = 0; k < 2 + i % 3 && len < sizeof(b.words[i]); k++)
+            len += snprintf(b.words[i] + len, sizeof(b.words[i]) - len, "%s%s", k ? " " : "",
+                            word[k == 0 ? next_random(&state) % common : next_random(&state) % n]->word);
+    }
+    free(word);
+    free_hashtable(&table);
+
+    // Expected answers, and the baseline: one index of every file
+    double p[4];
+    if (init_hashtable(&table) == FAILURE || expect_answers(&b, &table, 0) == FAILURE ||
+        expect_answers(&b, &kept, 1) == FAILURE || save_index(&table, INDEX_FILE) == FAILURE ||
+        open_index(&index, INDEX_FILE) == FAILURE)
+        return FAILURE;
+    if (time_segments(&b, NULL, &table, &index, 0, &p[0], &p[1]) == FAILURE ||
+        time_segments(&b, NULL, &table, &index, 1, &p[2], &p[3]) == FAILURE)
+        return FAILURE;
+    printf("bench=segments merge=single files=%d queries=%d segments=1 bool_p50_us=%.2f bool_p99_us=%.2f "
+           "rank_p50_us=%.2f rank_p99_us=%.2f\n", b.files, QUERIES, p[0], p[1], p[2], p[3]);
+    close_index(&index);
+    free_hashtable(&table);
+    free_hashtable(&kept);
+
+    int status = segment_run(&b, 0) == SUCCESS && segment_run(&b, 1) == SUCCESS ? SUCCESS : FAILURE;
+
+    free(b.text);
+    free(b.words);
+    free(b.latency);
+    for (int k = 0; k < 2; k++)
+    {
+        free(b.sum[k]);
+        free(b.top[k]);
+        free(b.found[k]);
+    }
+    for (int i = 0; i < b.files; i++)
+        free(b.file[i]);
+    free(b.file);
+    return status;
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 3 && strcmp(argv[1], "dict") == 0)
+        return bench_dict(argc - 2, argv + 2) == SUCCESS ? 0 : 1;
+
+    if (argc >= 3 && strcmp(argv[1], "build") == 0)
+        return bench_build(argc - 1, argv + 1) == SUCCESS ? 0 : 1;
+
+    if (argc >= 3 && strcmp(argv[1], "tokenize") == 0)
+        return bench_tokenize(argc - 2, argv + 2) == SUCCESS ? 0 : 1;
+
+    if (argc >= 3 && strcmp(argv[1], "compress") == 0)
+        return bench_compress(argc - 1, argv + 1) == SUCCESS ? 0 : 1;
+
+    if (argc >= 3 && strcmp(argv[1], "load") == 0)
+        return bench_load(argc - 1, argv + 1) == SUCCESS ? 0 : 1;
+
+    if (argc >= 3 && strcmp(argv[1], "query") == 0)
+        return bench_query(argc - 1, argv + 1) == SUCCESS ? 0 : 1;
+
+    if (argc >= 3 && strcmp(argv[1], "rank") == 0)
+        return bench_rank(argc - 1, argv + 1) == SUCCESS ? 0 : 1;
+
+    if (argc >= 3 && strcmp(argv[1], "phrase") == 0)
+        return bench_phrase(argc - 1, argv + 1) == SUCCESS ? 0 : 1;
+
+    if (argc >= 3 && strcmp(argv[1], "analyze") == 0)
+        return bench_analyze(argc - 1, argv + 1) == SUCCESS ? 0 : 1;
+
+    if (argc >= 2 && strcmp(argv[1], "corpus") == 0)
+        return bench_corpus(argc - 1, argv + 1) == SUCCESS ? 0 : 1;
+
+    if (argc >= 3 && strcmp(argv[1], "suite") == 0)
+        return bench_suite(argc - 1, argv + 1) == SUCCESS ? 0 : 1;
+
+    if (argc >= 2 && strcmp(argv[1], "stress") == 0)
+        return bench_stress(argc - 1, argv + 1) == SUCCESS ? 0 : 1;
+
+    if (argc >= 3 && strcmp(argv[1], "update") == 0)
+        return bench_update(argc - 1, argv + 1) == SUCCESS ? 0 : 1;
+
+    if (argc >= 3 && strcmp(argv[1], "swap") == 0)
+        return bench_swap(argc - 1, argv + 1) == SUCCESS ? 0 : 1;
+
+    if (argc >= 3 && strcmp(argv[1], "cache") == 0)
+        return bench_cache(argc - 1, argv + 1) == SUCCESS ? 0 : 1;
+
+    if (argc >= 3 && strcmp(argv[1], "segments") == 0)
+        return bench_segments(argc - 1, argv + 1) == SUCCESS ? 0 : 1;
+
+    if (argc >= 2 && strcmp(argv[1], "lexicon") == 0)
+    {
+        int words = argc >= 3 ? atoi(argv[2]) : 1000000;
+        return bench_lexicon(words > 0 ? words : 1000000) == SUCCESS ? 0 : 1;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "postings") == 0)
+    {
+        int docs = argc >= 3 ? atoi(argv[2]) : 2000;
+        int tokens = argc >= 4 ? atoi(argv[3]) : 2000;
+        return bench_postings(docs > 0 ? docs : 2000, tokens > 0 ? tokens : 2000) == SUCCESS ? 0 : 1;
+    }
+
+    printf("USAGE : %s dict|build|tokenize|load|compress|update|query|rank|phrase|analyze|suite file1.txt file2.txt ...\n", argv[0]);
+    printf("        %s build|query|swap -j threads file1.txt file2.txt ...\n", argv[0]);
+    printf("        %s segments [-b files_per_batch] file1.txt file2.txt ...\n", argv[0]);
+    printf("        %s postings [documents] [tokens_per_document]\n", argv[0]);
+    printf("        %s lexicon [words]\n", argv[0]);
+    printf("        %s stress [-j threads] [tokens_per_file]\n", argv[0]);
+    printf("        %s corpus [-n files] [-w words_per_file] [-v vocabulary] [-z zipf_exponent] [-s seed] dir\n", argv[0]);
+    return 1;
+}
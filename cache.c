@@ -0,0 +1,356 @@
+/*****************************************************************************************************
+ * File           : cache.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Result cache for repeated searches and queries: maps a normalized request (the analyzed
+ *      word of a search, the whitespace-collapsed text of a query) to the bytes of its answer,
+ *      within a budget of bytes.
+ *
+ * Invalidation   :
+ *      Every entry records the generation of the index it was computed on: hashtable.generation,
+ *      bumped by every build, update and reload of the table, or the snapshot epoch of a mapped
+ *      version (snapshot.c). A lookup names the generation it is answering from; an entry of
+ *      another generation is dropped instead of returned, so a result is never served after the
+ *      index changed under it.
+ *
+ * Eviction       :
+ *      CLOCK. The entries sit on a circular list in insertion order, each with a referenced bit
+ *      set by a hit. To make room, the hand walks the circle: a referenced entry loses its bit
+ *      and is passed over, the first unreferenced one is evicted. Hot entries survive any number
+ *      of passes while a burst of one-off requests is flushed, and a hit only sets a bit rather
+ *      than relinking the entry as LRU would.
+ *
+ *      An entry is charged its key, its value and its header. A value larger than an eighth of the
+ *      budget is not cached, so one large result can't flush everything else.
+ *
+ * Threads        :
+ *      One mutex guards the whole cache; the critical sections are a bucket walk and a copy.
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "inverted_search.h"
+
+
+/*****************************************************************************************************
+ * Function       : cache_hash
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      FNV-1a hash of a key.
+ *
+ * Returns        :
+ *      The 64-bit hash.
+ *****************************************************************************************************/
+static uint64_t cache_hash(const char *key, size_t len)
+{
+    uint64_t h = 14695981039346656037ull;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)key[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+
+/*****************************************************************************************************
+ * Function       : init_cache
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Prepares an empty cache of at most 'limit' bytes. A limit of 0 gives a cache that stores
+ *      nothing (every lookup misses).
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the buckets couldn't be allocated.
+ *****************************************************************************************************/
+int init_cache(result_cache *cache, size_t limit)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->limit = limit;
+    cache->buckets = CACHE_BUCKETS;
+    cache->bucket = calloc(cache->buckets, sizeof(cache_entry *));
+    pthread_mutex_init(&cache->lock, NULL);
+    if (cache->bucket == NULL)
+    {
+        printf("ERROR : Couldn't allocate the result cache\n");
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : unlink_entry
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Removes an entry from its bucket and the clock circle and frees it. The lock is held.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void unlink_entry(result_cache *cache, cache_entry *e)
+{
+    cache_entry **link = &cache->bucket[e->hash & (cache->buckets - 1)];
+
+    while (*link != e)
+        link = &(*link)->chain;
+    *link = e->chain;
+
+    if (e->next == e)
+        cache->hand = NULL;                             // It was the last one
+    else
+    {
+        e->prev->next = e->next;
+        e->next->prev = e->prev;
+        if (cache->hand == e)
+            cache->hand = e->next;
+    }
+    cache->bytes -= sizeof(cache_entry) + e->key_len + 1 + e->value_len;
+    cache->count--;
+    free(e);
+}
+
+
+/*****************************************************************************************************
+ * Function       : grow_buckets
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Doubles the bucket array once there are more entries than buckets. The lock is held.
+ *
+ * Returns        :
+ *      Nothing. If memory runs out the chains just get longer.
+ *****************************************************************************************************/
+static void grow_buckets(result_cache *cache)
+{
+    unsigned int buckets = cache->buckets * 2;
+    cache_entry **bucket = calloc(buckets, sizeof(cache_entry *));
+
+    if (bucket == NULL)
+        return;
+    for (unsigned int b = 0; b < cache->buckets; b++)
+    {
+        for (cache_entry *e = cache->bucket[b], *next; e != NULL; e = next)
+        {
+            next = e->chain;
+            e->chain = bucket[e->hash & (buckets - 1)];
+            bucket[e->hash & (buckets - 1)] = e;
+        }
+    }
+    free(cache->bucket);
+    cache->bucket = bucket;
+    cache->buckets = buckets;
+}
+
+
+/*****************************************************************************************************
+ * Function       : find_entry
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Looks a key up in its bucket. The lock is held.
+ *
+ * Returns        :
+ *      The entry, or NULL.
+ *****************************************************************************************************/
+static cache_entry* find_entry(result_cache *cache, const char *key, size_t len, uint64_t hash)
+{
+    for (cache_entry *e = cache->bucket[hash & (cache->buckets - 1)]; e != NULL; e = e->chain)
+    {
+        if (e->hash == hash && e->key_len == len && memcmp(e->data, key, len) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : cache_get
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Looks up the result of 'key' computed on index generation 'generation' and copies it into
+ *      *value (realloc'ed to fit; *cap is its size). An entry from another generation is dropped
+ *      and counted as stale.
+ *
+ * Returns        :
+ *      Length of the value, or -1 on a miss (or if the copy couldn't be allocated).
+ *****************************************************************************************************/
+long cache_get(result_cache *cache, const char *key, unsigned long generation, char **value, size_t *cap)
+{
+    size_t len = strlen(key);
+    uint64_t hash = cache_hash(key, len);
+    long found = -1;
+
+    pthread_mutex_lock(&cache->lock);
+    cache_entry *e = find_entry(cache, key, len, hash);
+    if (e != NULL && e->generation != generation)
+    {
+        unlink_entry(cache, e);
+        cache->stale++;
+        e = NULL;
+    }
+    if (e != NULL && *cap < e->value_len + 1)
+    {
+        char *grown = realloc(*value, e->value_len + 1);
+        if (grown != NULL)
+        {
+            *value = grown;
+            *cap = e->value_len + 1;
+        }
+    }
+    if (e != NULL && *cap >= e->value_len + 1)
+    {
+        memcpy(*value, e->data + e->key_len + 1, e->value_len);
+        (*value)[e->value_len] = '\0';
+        e->referenced = 1;
+        found = (long)e->value_len;
+        cache->hits++;
+    }
+    else
+        cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+    return found;
+}
+
+
+/*****************************************************************************************************
+ * Function       : cache_put
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Stores the result of 'key' on index generation 'generation', replacing any older entry for
+ *      the key, and evicts by CLOCK until the cache is back within its budget.
+ *
+ * Returns        :
+ *      Nothing. A value too large to cache, or one that can't be allocated, is not stored.
+ *****************************************************************************************************/
+void cache_put(result_cache *cache, const char *key, unsigned long generation, const char *value, size_t value_len)
+{
+    size_t len = strlen(key);
+    size_t charge = sizeof(cache_entry) + len + 1 + value_len;
+    uint64_t hash = cache_hash(key, len);
+
+    if (charge > cache->limit / 8)
+        return;
+    cache_entry *e = malloc(charge);
+    if (e == NULL)
+        return;
+    e->hash = hash;
+    e->generation = generation;
+    e->key_len = len;
+    e->value_len = value_len;
+    e->referenced = 0;
+    memcpy(e->data, key, len + 1);
+    memcpy(e->data + len + 1, value, value_len);
+
+    pthread_mutex_lock(&cache->lock);
+    cache_entry *old = find_entry(cache, key, len, hash);
+    if (old != NULL)
+        unlink_entry(cache, old);
+
+    while (cache->hand != NULL && cache->bytes + charge > cache->limit)
+    {
+        cache_entry *victim = cache->hand;
+        if (victim->referenced)
+        {
+            victim->referenced = 0;                     // Second chance
+            cache->hand = victim->next;
+            continue;
+        }
+        unlink_entry(cache, victim);
+        cache->evictions++;
+    }
+
+    if (cache->count >= cache->buckets)
+        grow_buckets(cache);
+    e->chain = cache->bucket[hash & (cache->buckets - 1)];
+    cache->bucket[hash & (cache->buckets - 1)] = e;
+    if (cache->hand == NULL)
+    {
+        e->next = e->prev = e;
+        cache->hand = e;
+    }
+    else                                                // Just behind the hand: the last it reaches
+    {
+        e->next = cache->hand;
+        e->prev = cache->hand->prev;
+        e->prev->next = e;
+        cache->hand->prev = e;
+    }
+    cache->bytes += charge;
+    cache->count++;
+    cache->inserts++;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+
+/*****************************************************************************************************
+ * Function       : normalize_request
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Builds a cache key: 'kind' followed by the text with leading and trailing whitespace
+ *      removed and every run of whitespace inside it made one space, so requests that differ only
+ *      in spacing share an entry. The key is truncated to fit 'size' bytes.
+ *
+ * Returns        :
+ *      'key'.
+ *****************************************************************************************************/
+char* normalize_request(const char *kind, const char *text, char *key, size_t size)
+{
+    size_t used = snprintf(key, size, "%s", kind);
+    int space = 0;
+
+    for (; *text && used + 1 < size; text++)
+    {
+        if (*text == ' ' || *text == '\t' || *text == '\r' || *text == '\n')
+        {
+            space = 1;
+            continue;
+        }
+        if (space && used > strlen(kind) && used + 2 < size)
+            key[used++] = ' ';
+        space = 0;
+        key[used++] = *text;
+    }
+    key[used < size ? used : size - 1] = '\0';
+    return key;
+}
+
+
+/*****************************************************************************************************
+ * Function       : print_cache_stats
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Writes the cache's counters as one line of key=value pairs: entries, bytes in use and the
+ *      budget, hits, misses, hit rate, entries dropped as stale, inserts and evictions.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void print_cache_stats(result_cache *cache, FILE *out)
+{
+    pthread_mutex_lock(&cache->lock);
+    unsigned long lookups = cache->hits + cache->misses;
+    fprintf(out, "cache entries=%lu bytes=%zu limit=%zu hits=%lu misses=%lu hit_rate=%.3f stale=%lu "
+                 "inserts=%lu evictions=%lu\n",
+            cache->count, cache->bytes, cache->limit, cache->hits, cache->misses,
+            lookups ? (double)cache->hits / lookups : 0.0, cache->stale, cache->inserts, cache->evictions);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+
+/*****************************************************************************************************
+ * Function       : free_cache
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Frees every entry and the buckets.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void free_cache(result_cache *cache)
+{
+    while (cache->hand != NULL)
+        unlink_entry(cache, cache->hand);
+    free(cache->bucket);
+    cache->bucket = NULL;
+    pthread_mutex_destroy(&cache->lock);
+}
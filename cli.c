@@ -0,0 +1,824 @@
+/*****************************************************************************************************
+ * File           : cli.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Non-interactive commands, run by main() instead of the menu when the first argument names
+ *      one, so indexes can be built and queried from scripts and pipelines:
+ *
+ *          output index [-j N] [-p] [-a steps] [-o file.idx] [--json] [--metrics file] file1.txt ...
+ *          output query [-i file.idx] [--rank [-k N]] [--json] [--metrics file] "query"
+ *          output query [-i file.idx] [--rank [-k N]] [--json] [--metrics file] --batch queries.txt
+ *          output ingest [-d dir] [-j N] [-p] [-a steps] [--remove] [--compact] [--json] file1.txt ...
+ *          output query -d dir [--rank [-k N]] [--json] [--metrics file] "query" | --batch queries.txt
+ *          output serve [-i file.idx] [-S socket] [-j threads] [--cache MB] [file1.txt ...]
+ *          output loadgen [-S socket] [-c 1,4,16] [-n requests] [--rank [-k N]] queries.txt
+ *
+ *      'index' builds the index of the files and saves it (default backup.idx). 'query' maps a
+ *      saved index once and runs a boolean query (query.c syntax) or, with --rank, a BM25 ranked
+ *      search (rank.c) for the best k files. With --batch every non-empty line of the file ("-"
+ *      for standard input) is a query, all answered from the same mapping. --metrics writes the
+ *      metrics of the run (metrics.c) as JSON to the file ("-" for standard error) at the end.
+ *      'ingest' adds the new and changed files to a segmented index (segment.c, default directory
+ *      "segments") as one new segment, or with --remove deletes the files from it; its merges run
+ *      in the background meanwhile and are finished before it exits, and --compact then merges
+ *      every segment into one. 'query -d' queries the segments of such a directory instead of an
+ *      index file.
+ *      'serve' maps a saved index and answers queries from a Unix socket (server.c) until it is
+ *      interrupted, making a new version of the index in the background on a RELOAD request or
+ *      SIGHUP (from the files given, if any), and caching responses in --cache MB (default 16, 0
+ *      for none); 'loadgen' sends the lines of a query file to it from each number of concurrent
+ *      clients in turn (-n requests each time) and reports the throughput and latency.
+ *
+ * Output         :
+ *      Results go to standard output, as tab-separated rows (the default, after a '#' line naming
+ *      the columns) or with --json as one JSON object per line. Everything the modules print
+ *      (file validation, errors) is sent to standard error instead, so standard output holds
+ *      only results. A batch ends with a summary line on standard error: queries per second and
+ *      the 50th, 90th, 99th percentile and largest latency of one query (parsing and running it,
+ *      without printing).
+ *
+ *      index  TSV : file  files  words  postings  build_s  save_s  bytes
+ *             JSON: {"index": ..., "files": ..., "words": ..., "postings": ..., "build_s": ...,
+ *                    "save_s": ..., "bytes": ...}
+ *      ingest TSV : dir  files  removed  ingest_s  segments  docs  live  merges  merge_s
+ *             JSON: the same keys, {"dir": ..., "files": ..., ...}
+ *      query  TSV : query  file                   (boolean; query = line number, 1 for one query)
+ *                   query  rank  score  file      (--rank)
+ *             JSON: {"query": n, "text": "...", "hits": n, "latency_us": x,
+ *                    "files": ["...", ...]}       (--rank: "results": [{"file": ..., "score": ...}])
+ *                   A query that fails gives {"query": n, "text": "...", "error": true} and is
+ *                   counted as an error in the summary.
+ *      loadgen    : bench=serve clients=N requests=N errors=N seconds=x qps=x p50_us=x p90_us=x
+ *                   p99_us=x max_us=x                (one line per client count)
+ *
+ * Returns        :
+ *      Exit status 0 on success, 1 if a step failed or any query of a batch failed.
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "inverted_search.h"
+
+
+// Options of the 'query' command
+typedef struct query_options
+{
+    const char *index_file;      // -i, default INDEX_FILE
+    const char *segments;        // -d, a segment directory queried instead of the index file
+    const char *batch;           // --batch file, NULL for a single query
+    const char *text;            // The query when there is no batch
+    int rank;                    // --rank: BM25 top k instead of a boolean query
+    int k;                       // -k, files listed by a ranked search
+    int json;                    // --json instead of TSV
+    const char *metrics;         // --metrics file, NULL for none
+} query_options;
+
+
+/*****************************************************************************************************
+ * Function       : now_seconds
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Reads the monotonic clock.
+ *
+ * Returns        :
+ *      Current time in seconds.
+ *****************************************************************************************************/
+static double now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*****************************************************************************************************
+ * Function       : results_stream
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Keeps a private copy of standard output for the results and points file descriptor 1 at
+ *      standard error, so every printf() of the other modules becomes a diagnostic.
+ *
+ * Returns        :
+ *      The stream to write results to (stdout itself if the descriptor couldn't be duplicated).
+ *****************************************************************************************************/
+static FILE* results_stream(void)
+{
+    int fd;
+    FILE *out;
+
+    fflush(stdout);
+    fd = dup(STDOUT_FILENO);
+    if (fd < 0)
+        return stdout;
+    out = fdopen(fd, "w");
+    if (out == NULL)
+    {
+        close(fd);
+        return stdout;
+    }
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    setvbuf(stdout, NULL, _IOLBF, 0);                   // Diagnostics appear as they happen
+    return out;
+}
+
+
+/*****************************************************************************************************
+ * Function       : put_json_string
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Writes a string as a JSON string literal: quotes, backslashes and control characters are
+ *      escaped, other bytes (UTF-8 included) are copied.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void put_json_string(FILE *out, const char *text)
+{
+    putc('"', out);
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            fprintf(out, "\\%c", *c);
+        else if (*c < 0x20)
+            fprintf(out, "\\u%04x", *c);
+        else
+            putc(*c, out);
+    }
+    putc('"', out);
+}
+
+
+/*****************************************************************************************************
+ * Function       : command_index
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      'index': validates the files like the menu does, builds the index on -j threads (with
+ *      positions for -p and the -a analysis steps) and saves it to the -o file.
+ *
+ * Returns        :
+ *      Exit status.
+ *****************************************************************************************************/
+static int command_index(int argc, char *argv[])
+{
+    int threads = parse_threads(&argc, argv);
+    int positions = parse_positions(&argc, argv);
+    unsigned int analysis = parse_analysis(&argc, argv);
+    const char *index_file = INDEX_FILE;
+    const char *metrics = NULL;
+    int json = 0, files = 0;
+
+    // Take out the command's own options; what remains are the files
+    int kept = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            index_file = argv[++i];
+        else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc)
+            metrics = argv[++i];
+        else if (strcmp(argv[i], "--json") == 0)
+            json = 1;
+        else
+            argv[kept++] = argv[i];
+    }
+    argc = kept;
+
+    FILE *out = results_stream();
+    if (validate(argc, argv) == FAILURE)
+        return 1;
+    filenode *head = create_file_linked_list(argc, argv);
+    if (head == NULL)
+    {
+        printf("ERROR : No valid files to index\n");
+        return 1;
+    }
+
+    hashtable table;
+    if (init_hashtable(&table) == FAILURE)
+        return 1;
+    table.positional = positions;
+    table.analysis = analysis;
+
+    double start = now_seconds();
+    files = index_files(&table, head, threads);
+    double build_time = now_seconds() - start;
+    if (files < 0)
+        return 1;
+
+    start = now_seconds();
+    int saved = save_index(&table, index_file);
+    double save_time = now_seconds() - start;
+
+    long long postings = 0;
+    table_cursor cursor;
+    for (mainnode *m = first_mainnode(&table, &cursor); m != NULL; m = next_mainnode(&table, &cursor))
+        postings += m->file_count;
+
+    struct stat st;
+    long long bytes = saved == SUCCESS && stat(index_file, &st) == 0 ? (long long)st.st_size : 0;
+    if (saved == SUCCESS && json)
+    {
+        fprintf(out, "{\"index\": ");
+        put_json_string(out, index_file);
+        fprintf(out, ", \"files\": %d, \"words\": %u, \"postings\": %lld, \"build_s\": %.6f, "
+                     "\"save_s\": %.6f, \"bytes\": %lld}\n",
+                files, table.count, postings, build_time, save_time, bytes);
+    }
+    else if (saved == SUCCESS)
+    {
+        fprintf(out, "#index\tfiles\twords\tpostings\tbuild_s\tsave_s\tbytes\n");
+        fprintf(out, "%s\t%d\t%u\t%lld\t%.6f\t%.6f\t%lld\n",
+                index_file, files, table.count, postings, build_time, save_time, bytes);
+    }
+    fclose(out);
+    if (metrics && save_metrics(metrics, &table, NULL) == FAILURE)
+        saved = FAILURE;
+
+    free_hashtable(&table);
+    while (head)
+    {
+        filenode *next = head->link;
+        free(head);
+        head = next;
+    }
+    return saved == SUCCESS ? 0 : 1;
+}
+
+
+/*****************************************************************************************************
+ * Function       : run_one
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Runs one query against the mapped index, or the segments of 'view' if it is given, times
+ *      it, and writes its results in the chosen format; 'number' identifies the query in the
+ *      output.
+ *
+ * Returns        :
+ *      Latency in microseconds, or -1 if the query failed (its error is on standard error).
+ *****************************************************************************************************/
+static double run_one(disk_index *index, segment_view *view, const query_options *opt, const char *text,
+                      long number, ranked_doc *top, FILE *out)
+{
+    query q;
+    doc_list result;
+    int count = 0;
+
+    double start = now_seconds();
+    if (opt->rank)
+        count = view ? rank_segments(view, text, opt->k, 1, top) : rank_documents(NULL, index, text, opt->k, 1, top);
+    else if (parse_query(&q, text) == FAILURE ||
+             (view ? query_segments(&q, view, &result) : run_query(&q, NULL, index, &result)) == FAILURE)
+        count = -1;
+    else
+        count = result.count;
+    double latency = (now_seconds() - start) * 1e6;
+
+    if (count < 0)
+    {
+        if (opt->rank)
+            printf("ERROR : A ranked search takes at most %d words\n", RANK_MAX_TERMS);
+        if (opt->json)
+        {
+            fprintf(out, "{\"query\": %ld, \"text\": ", number);
+            put_json_string(out, text);
+            fprintf(out, ", \"error\": true}\n");
+        }
+        return -1;
+    }
+
+    if (opt->json)
+    {
+        fprintf(out, "{\"query\": %ld, \"text\": ", number);
+        put_json_string(out, text);
+        fprintf(out, ", \"hits\": %d, \"latency_us\": %.1f, \"%s\": [", count, latency,
+                opt->rank ? "results" : "files");
+    }
+    for (int i = 0; i < count; i++)
+    {
+        int id = opt->rank ? top[i].file_id : result.id[i];
+        const char *name = view ? segment_document(view, id) : index_document(index, id);
+
+        if (opt->json && opt->rank)
+        {
+            fprintf(out, "%s{\"file\": ", i ? ", " : "");
+            put_json_string(out, name);
+            fprintf(out, ", \"score\": %.4f}", top[i].score);
+        }
+        else if (opt->json)
+        {
+            fprintf(out, "%s", i ? ", " : "");
+            put_json_string(out, name);
+        }
+        else if (opt->rank)
+            fprintf(out, "%ld\t%d\t%.4f\t%s\n", number, i + 1, top[i].score, name);
+        else
+            fprintf(out, "%ld\t%s\n", number, name);
+    }
+    if (opt->json)
+        fprintf(out, "]}\n");
+
+    if (!opt->rank)
+        free_doc_list(&result);
+    return latency;
+}
+
+
+/*****************************************************************************************************
+ * Function       : compare_latencies
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      qsort() comparator for latencies.
+ *
+ * Returns        :
+ *      <0, 0 or >0.
+ *****************************************************************************************************/
+static int compare_latencies(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/*****************************************************************************************************
+ * Function       : run_batch
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Runs every non-empty line of the batch file as a query (numbered by its line; a line of
+ *      BATCH_LINE_MAX characters or more is counted as an error without being parsed), then prints
+ *      the summary line on standard error: queries, errors, load and total time, queries per second
+ *      and latency percentiles (nearest rank) in microseconds.
+ *
+ * Returns        :
+ *      Exit status: 1 if the file can't be read or a query failed.
+ *****************************************************************************************************/
+static int run_batch(disk_index *index, segment_view *view, const query_options *opt, ranked_doc *top,
+                     FILE *out, double load_time)
+{
+    FILE *fp = strcmp(opt->batch, "-") == 0 ? stdin : fopen(opt->batch, "r");
+    char *line = NULL;
+    size_t line_cap = 0;
+    double *latency = NULL;
+    size_t count = 0, cap = 0;
+    long number = 0, errors = 0;
+
+    if (fp == NULL)
+    {
+        printf("ERROR : Cannot open %s\n", opt->batch);
+        return 1;
+    }
+
+    double start = now_seconds();
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, fp)) >= 0)
+    {
+        number++;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (strspn(line, " \t") == (size_t)len)
+            continue;                                   // Blank line
+        if (len >= BATCH_LINE_MAX)
+        {
+            printf("ERROR : Query on line %ld is longer than %d characters\n", number, BATCH_LINE_MAX - 1);
+            errors++;
+            continue;
+        }
+
+        double us = run_one(index, view, opt, line, number, top, out);
+        if (us < 0)
+        {
+            errors++;
+            continue;
+        }
+        if (count == cap)
+        {
+            cap = cap ? cap * 2 : 1024;
+            double *grown = realloc(latency, cap * sizeof(double));
+            if (grown == NULL)
+                break;
+            latency = grown;
+        }
+        latency[count++] = us;
+    }
+    double total = now_seconds() - start;
+    fflush(out);
+
+    qsort(latency, count, sizeof(double), compare_latencies);
+#define PERCENTILE(p) (count ? latency[((p) * count + 99) / 100 - 1] : 0.0)   // Nearest rank
+    fprintf(stderr, "queries=%zu errors=%ld load_s=%.6f total_s=%.3f qps=%.0f p50_us=%.1f p90_us=%.1f "
+                    "p99_us=%.1f max_us=%.1f\n",
+            count, errors, load_time, total, total > 0 ? count / total : 0.0,
+            PERCENTILE(50), PERCENTILE(90), PERCENTILE(99), PERCENTILE(100));
+#undef PERCENTILE
+
+    free(latency);
+    free(line);
+    if (fp != stdin)
+        fclose(fp);
+    return errors ? 1 : 0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : command_query
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      'query': maps the index (or with -d, the segments) once, then runs the one query given or
+ *      every query of the batch.
+ *
+ * Returns        :
+ *      Exit status.
+ *****************************************************************************************************/
+static int command_query(int argc, char *argv[])
+{
+    query_options opt = { INDEX_FILE, NULL, NULL, NULL, 0, RANK_TOP_K, 0, NULL };
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            opt.index_file = argv[++i];
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+            opt.segments = argv[++i];
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+            opt.batch = argv[++i];
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+            opt.k = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--rank") == 0)
+            opt.rank = 1;
+        else if (strcmp(argv[i], "--json") == 0)
+            opt.json = 1;
+        else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc)
+            opt.metrics = argv[++i];
+        else if (opt.text == NULL && argv[i][0] != '-')
+            opt.text = argv[i];
+        else
+        {
+            printf("ERROR : Unexpected argument '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+    if ((opt.text == NULL) == (opt.batch == NULL) || opt.k <= 0)
+    {
+        printf("USAGE : query [-i file.idx | -d dir] [--rank [-k N]] [--json] [--metrics file] \"query\" | --batch queries.txt\n");
+        return 1;
+    }
+
+    FILE *out = results_stream();
+    disk_index index;
+    segment_set set;
+    segment_view *view = NULL;
+    struct stat st;
+    double start = now_seconds();
+    if (opt.segments && (stat(opt.segments, &st) != 0 || !S_ISDIR(st.st_mode) ||
+                         open_segments(&set, opt.segments, 0, 0, 0) == FAILURE))
+    {
+        printf("ERROR : Couldn't open the segments in %s\n", opt.segments);
+        return 1;
+    }
+    if (opt.segments)
+        view = acquire_segments(&set);
+    else if (open_index(&index, opt.index_file) == FAILURE)
+    {
+        printf("ERROR : Couldn't open the index %s\n", opt.index_file);   // Missing files are silent
+        return 1;
+    }
+    double load_time = now_seconds() - start;
+
+    ranked_doc *top = malloc(opt.k * sizeof(ranked_doc));
+    int status = 1;
+    if (top == NULL)
+        printf("ERROR : Couldn't allocate %d results\n", opt.k);
+    else
+    {
+        if (!opt.json)
+            fprintf(out, opt.rank ? "#query\trank\tscore\tfile\n" : "#query\tfile\n");
+        if (opt.batch)
+            status = run_batch(view ? NULL : &index, view, &opt, top, out, load_time);
+        else
+            status = run_one(view ? NULL : &index, view, &opt, opt.text, 1, top, out) < 0;
+    }
+    fclose(out);
+    if (opt.metrics && save_metrics(opt.metrics, NULL, view ? NULL : &index) == FAILURE)
+        status = 1;
+
+    free(top);
+    if (view)
+    {
+        release_segments(&set, view);
+        close_segments(&set);
+    }
+    else
+        close_index(&index);
+    return status;
+}
+
+
+/*****************************************************************************************************
+ * Function       : command_ingest
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      'ingest': opens the segmented index in the -d directory (created with the -p and -a
+ *      settings if it is new) with its merger running, adds the new and changed files as one
+ *      segment or, with --remove, deletes them (they need not exist any more), lets the merger
+ *      finish, optionally compacts, and reports the segments left.
+ *
+ * Returns        :
+ *      Exit status.
+ *****************************************************************************************************/
+static int command_ingest(int argc, char *argv[])
+{
+    int threads = parse_threads(&argc, argv);
+    int positions = parse_positions(&argc, argv);
+    unsigned int analysis = parse_analysis(&argc, argv);
+    const char *dir = SEGMENT_DIR;
+    int remove = 0, compact = 0, json = 0;
+
+    // Take out the command's own options; what remains are the files
+    int kept = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+            dir = argv[++i];
+        else if (strcmp(argv[i], "--remove") == 0)
+            remove = 1;
+        else if (strcmp(argv[i], "--compact") == 0)
+            compact = 1;
+        else if (strcmp(argv[i], "--json") == 0)
+            json = 1;
+        else
+            argv[kept++] = argv[i];
+    }
+    argc = kept;
+
+    FILE *out = results_stream();
+    filenode *head = NULL;
+    if (remove)
+    {
+        for (int i = argc - 1; i >= 1; i--)             // Removed files may be gone: take the names as they are
+        {
+            size_t len = strlen(argv[i]) + 1;
+            filenode *node = malloc(sizeof(filenode) + len);
+            if (node == NULL)
+                break;
+            memcpy(node->filename, argv[i], len);
+            node->link = head;
+            head = node;
+        }
+    }
+    else if (validate(argc, argv) == SUCCESS)
+        head = create_file_linked_list(argc, argv);
+    if (head == NULL && !compact)
+    {
+        printf("ERROR : No valid files to %s\n", remove ? "remove" : "ingest");
+        return 1;
+    }
+
+    segment_set set;
+    if (open_segments(&set, dir, positions, analysis, 1) == FAILURE)
+        return 1;
+
+    double start = now_seconds();
+    int files = 0, removed = 0;
+    if (head && remove)
+        removed = remove_files(&set, head);
+    else if (head)
+        files = ingest_files(&set, head, threads);
+    double ingest_time = now_seconds() - start;
+
+    stop_merging(&set);
+    int status = files >= 0 && removed >= 0 && (!compact || compact_segments(&set) == SUCCESS) ? 0 : 1;
+
+    segment_view *view = acquire_segments(&set);
+    if (json)
+    {
+        fprintf(out, "{\"dir\": ");
+        put_json_string(out, dir);
+        fprintf(out, ", \"files\": %d, \"removed\": %d, \"ingest_s\": %.6f, \"segments\": %d, \"docs\": %u, "
+                     "\"live\": %u, \"merges\": %lu, \"merge_s\": %.6f}\n",
+                files, removed, ingest_time, view->count, view->docs, view->live, set.merges, set.merge_seconds);
+    }
+    else
+    {
+        fprintf(out, "#dir\tfiles\tremoved\tingest_s\tsegments\tdocs\tlive\tmerges\tmerge_s\n");
+        fprintf(out, "%s\t%d\t%d\t%.6f\t%d\t%u\t%u\t%lu\t%.6f\n", dir, files, removed, ingest_time,
+                view->count, view->docs, view->live, set.merges, set.merge_seconds);
+    }
+    fclose(out);
+    release_segments(&set, view);
+    close_segments(&set);
+
+    while (head)
+    {
+        filenode *next = head->link;
+        free(head);
+        head = next;
+    }
+    return status;
+}
+
+
+/*****************************************************************************************************
+ * Function       : command_serve
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      'serve': maps the index and serves it on the socket with -j worker threads (default
+ *      SERVER_THREADS) until SIGINT or SIGTERM. Files given after the options are what a reload
+ *      (RELOAD request or SIGHUP) indexes into a new version of the index file.
+ *
+ * Returns        :
+ *      Exit status.
+ *****************************************************************************************************/
+static int command_serve(int argc, char *argv[])
+{
+    const char *index_file = INDEX_FILE, *path = SERVER_SOCKET;
+    int threads = SERVER_THREADS;
+    long cache_mb = CACHE_BYTES >> 20;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "-j", 2) == 0)
+            threads = parse_threads(&argc, argv);
+    }
+
+    // Take out the command's own options; what remains are the files
+    int kept = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            index_file = argv[++i];
+        else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc)
+            path = argv[++i];
+        else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            cache_mb = atol(argv[++i]);
+        else if (argv[i][0] == '-')
+        {
+            printf("USAGE : serve [-i file.idx] [-S socket] [-j threads] [--cache MB] [file1.txt ...]\n");
+            return 1;
+        }
+        else
+            argv[kept++] = argv[i];
+    }
+    argc = kept;
+    if (cache_mb < 0)
+    {
+        printf("ERROR : --cache takes a size in MB, 0 for no cache\n");
+        return 1;
+    }
+
+    filenode *head = NULL;
+    if (argc > 1 && (validate(argc, argv) == FAILURE || (head = create_file_linked_list(argc, argv)) == NULL))
+    {
+        printf("ERROR : No valid files to reload from\n");
+        return 1;
+    }
+
+    int status = serve_index(index_file, head, path, threads, (size_t)cache_mb << 20);
+    while (head)
+    {
+        filenode *next = head->link;
+        free(head);
+        head = next;
+    }
+    return status == SUCCESS ? 0 : 1;
+}
+
+
+/*****************************************************************************************************
+ * Function       : command_loadgen
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      'loadgen': reads the queries (one per non-empty line, "-" for standard input), turns them
+ *      into QUERY or, with --rank, "RANK k" requests, and runs the load generator once for every
+ *      client count of -c (default 1,4,16).
+ *
+ * Returns        :
+ *      Exit status: 1 if the queries can't be read or any request failed.
+ *****************************************************************************************************/
+static int command_loadgen(int argc, char *argv[])
+{
+    const char *path = SERVER_SOCKET, *counts = "1,4,16", *file = NULL;
+    long requests = LOADGEN_REQUESTS;
+    int rank = 0, k = RANK_TOP_K;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-S") == 0 && i + 1 < argc)
+            path = argv[++i];
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            counts = argv[++i];
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            requests = atol(argv[++i]);
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+            k = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--rank") == 0)
+            rank = 1;
+        else if (file == NULL)
+            file = argv[i];
+        else
+            file = NULL, i = argc;                      // Too many arguments: fall to the usage
+    }
+    if (file == NULL || requests <= 0 || k <= 0 || k > SERVER_TOP_K)
+    {
+        printf("USAGE : loadgen [-S socket] [-c 1,4,16] [-n requests] [--rank [-k N]] queries.txt\n");
+        return 1;
+    }
+
+    FILE *fp = strcmp(file, "-") == 0 ? stdin : fopen(file, "r");
+    if (fp == NULL)
+    {
+        printf("ERROR : Cannot open %s\n", file);
+        return 1;
+    }
+    char **request = NULL, *line = NULL;
+    size_t line_cap = 0;
+    int count = 0, cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, fp)) >= 0)
+    {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (strspn(line, " \t") == (size_t)len)
+            continue;                                   // Blank line
+        if (count == cap)
+        {
+            cap = cap ? cap * 2 : 256;
+            char **grown = realloc(request, cap * sizeof(char *));
+            if (grown == NULL)
+                break;
+            request = grown;
+        }
+        char prefix[32];
+        snprintf(prefix, sizeof(prefix), rank ? "RANK %d " : "QUERY ", k);
+        if ((request[count] = malloc(strlen(prefix) + len + 2)) == NULL)
+            break;
+        sprintf(request[count++], "%s%s\n", prefix, line);
+    }
+    free(line);
+    if (fp != stdin)
+        fclose(fp);
+
+    FILE *out = results_stream();
+    int status = count > 0 ? 0 : 1;
+    if (count == 0)
+        printf("ERROR : No queries in %s\n", file);
+    for (const char *c = counts; count > 0 && *c; c += strcspn(c, ","), c += *c == ',')
+    {
+        int clients = atoi(c);
+        if (clients < 1)
+        {
+            printf("ERROR : Invalid client count in '%s'\n", counts);
+            status = 1;
+            break;
+        }
+        if (run_load(path, request, count, clients, requests, out) == FAILURE)
+            status = 1;
+    }
+    fclose(out);
+
+    for (int i = 0; i < count; i++)
+        free(request[i]);
+    free(request);
+    return status;
+}
+
+
+/*****************************************************************************************************
+ * Function       : is_command
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Checks whether a first argument names one of the non-interactive commands.
+ *
+ * Returns        :
+ *      1 if it does, 0 if not (the arguments are then files for the menu).
+ *****************************************************************************************************/
+int is_command(const char *name)
+{
+    return strcmp(name, "index") == 0 || strcmp(name, "query") == 0 || strcmp(name, "serve") == 0 ||
+           strcmp(name, "loadgen") == 0 || strcmp(name, "ingest") == 0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : run_command
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Runs the command named by argv[0] with the arguments after it.
+ *
+ * Returns        :
+ *      Exit status for main().
+ *****************************************************************************************************/
+int run_command(int argc, char *argv[])
+{
+    if (strcmp(argv[0], "index") == 0)
+        return command_index(argc, argv);
+    if (strcmp(argv[0], "serve") == 0)
+        return command_serve(argc, argv);
+    if (strcmp(argv[0], "loadgen") == 0)
+        return command_loadgen(argc, argv);
+    if (strcmp(argv[0], "ingest") == 0)
+        return command_ingest(argc, argv);
+    return command_query(argc, argv);
+}
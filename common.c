@@ -5,12 +5,47 @@
 #include "inverted_search.h"
 
 
+/* =========================================================================================
+ * Function: hash_bytes / hash_word
+ * -----------------------------------------------------------------------------------------
+ * What it does:
+ *     Computes the 32-bit FNV-1a hash of every byte of the word. hash_bytes takes an
+ *     explicit length, so tokens can be hashed in place inside the input buffer;
+ *     hash_word is the same hash for NUL-terminated strings.
+ *
+ * Why it’s required:
+ *     Hashing on the first letter alone piles whole vocabularies into a handful of chains.
+ *     Mixing in every byte spreads words evenly, so chains stay short as the table grows.
+ *
+ * Returns:
+ *     The hash value. The bucket is the hash masked by the (power of two) table size.
+ * ========================================================================================= */
+unsigned int hash_bytes(const char *word, size_t len)
+{
+    unsigned int hash = 2166136261u;
+
+    while (len--)
+    {
+        hash ^= (unsigned char)*word++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+unsigned int hash_word(const char *word)
+{
+    return hash_bytes(word, strlen(word));
+}
+
+
+#ifndef FLAT_DICT
+
 /* =========================================================================================
  * Function: init_hashtable
  * -----------------------------------------------------------------------------------------
  * What it does:
- *     Initializes the hash table with 27 buckets (indices 0–25 for 'a'–'z', index 26 for
- *     non-alphabetic words). Each bucket starts with a NULL linked list.
+ *     Allocates HASH_INITIAL_SIZE empty buckets and resets the word count. No resize is in
+ *     progress on a fresh table.
  *
  * Why it’s required:
  *     Establishes a clean baseline data structure so the inverted index can store and
@@ -18,47 +53,146 @@
  *     workflow would collapse.
  *
  * Returns:
+ *     SUCCESS, or FAILURE if the buckets couldn't be allocated.
+ * ========================================================================================= */
+int init_hashtable(hashtable *table)
+{
+    table->bucket[0] = calloc(HASH_INITIAL_SIZE, sizeof(mainnode *));
+    table->bucket[1] = NULL;
+    table->size[0] = HASH_INITIAL_SIZE;
+    table->size[1] = 0;
+    table->count = 0;
+    table->rehash_index = -1;
+    table->positional = 0;
+    table->analysis = 0;
+    table->sorted = NULL;
+    table->generation = 0;
+    arena_init(&table->nodes);
+    init_doctable(&table->docs);
+
+    if (table->bucket[0] == NULL)
+    {
+        printf("ERROR: Couldn't allocate hash table\n");
+        table->size[0] = 0;
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
+/* =========================================================================================
+ * Function: free_hashtable
+ * -----------------------------------------------------------------------------------------
+ * What it does:
+ *     Frees both bucket arrays, the document table and, through the arena, every mainnode,
+ *     posting block and file name in one call. The table must be initialized again before reuse.
+ *
+ * Why it’s required:
+ *     Lets the database be rebuilt or reloaded without leaking the previous generation.
+ *
+ * Returns:
+ *     Nothing.
+ * ========================================================================================= */
+void free_hashtable(hashtable *table)
+{
+    drop_lexicon(table);
+    free(table->bucket[0]);
+    free(table->bucket[1]);
+    table->bucket[0] = table->bucket[1] = NULL;
+    table->size[0] = table->size[1] = 0;
+    table->count = 0;
+    table->rehash_index = -1;
+    free_doctable(&table->docs);
+    arena_free(&table->nodes);
+}
+
+
+/* =========================================================================================
+ * Function: rehash_step
+ * -----------------------------------------------------------------------------------------
+ * What it does:
+ *     Moves up to 'steps' buckets of the old array into the resize target. Once every old
+ *     bucket has been moved, the target becomes the live array and the old one is freed.
+ *
+ * Why it’s required:
+ *     Spreads the cost of a resize across many inserts instead of stalling one of them for
+ *     a full pass over the table.
+ *
+ * Returns:
  *     Nothing.
  * ========================================================================================= */
-void init_hashtable(hashtable *table)
+static void rehash_step(hashtable *table, int steps)
 {
-    for (int i = 0; i < 27; i++)
+    unsigned int mask = table->size[1] - 1;
+
+    while (steps-- > 0 && table->rehash_index < (long)table->size[0])
+    {
+        mainnode *m = table->bucket[0][table->rehash_index];
+
+        while (m)                                   // Relink every word of this bucket
+        {
+            mainnode *next = m->main_next_link;
+            unsigned int index = m->hash & mask;
+
+            m->main_next_link = table->bucket[1][index];
+            table->bucket[1][index] = m;
+            m = next;
+        }
+        table->bucket[0][table->rehash_index++] = NULL;
+    }
+
+    if (table->rehash_index == (long)table->size[0])    // Resize finished
     {
-        table[i].index = i;
-        table[i].link = NULL;
+        free(table->bucket[0]);
+        table->bucket[0] = table->bucket[1];
+        table->size[0] = table->size[1];
+        table->bucket[1] = NULL;
+        table->size[1] = 0;
+        table->rehash_index = -1;
     }
 }
 
 
 /* =========================================================================================
- * Function: get_index
+ * Function: start_rehash
  * -----------------------------------------------------------------------------------------
  * What it does:
- *     Determines the hash table index for a given word. Alphabetic words are mapped to
- *     0–25 based on their first letter. Any word starting with a non-alphabetic character
- *     is sent to index 26.
+ *     Allocates a bucket array twice the current size and marks a resize as in progress.
  *
  * Why it’s required:
- *     Provides deterministic placement of words into the appropriate bucket so operations
- *     like search and insert remain efficient.
+ *     Keeps the load factor bounded so lookups stay close to constant time as words are
+ *     added. If the allocation fails the table simply keeps its current size.
  *
  * Returns:
- *     Integer index (0–26) indicating the bucket in which the word belongs.
+ *     Nothing.
  * ========================================================================================= */
-int get_index(const char *word)
+static void start_rehash(hashtable *table)
 {
-    if(isalpha(word[0]))
-        return tolower(word[0]) - 'a';
-    return 26;
+    unsigned int size = table->size[0] * 2;
+    mainnode **bucket = calloc(size, sizeof(mainnode *));
+
+    if (bucket == NULL)
+        return;
+
+    table->bucket[1] = bucket;
+    table->size[1] = size;
+    table->rehash_index = 0;
+    METRIC_COUNT(METRIC_RESIZES, 1);
 }
 
 
+#endif
+
+
 /* =========================================================================================
  * Function: create_mainnode
  * -----------------------------------------------------------------------------------------
  * What it does:
- *     Allocates memory and initializes a mainnode structure that represents a unique word
- *     in the inverted index. Sets its counters and links to default values.
+ *     Allocates a mainnode from the table's arena and initializes it to represent a unique
+ *     word in the inverted index. The word is given as 'len' bytes, not necessarily
+ *     NUL-terminated, and is copied right behind the node's fields in the same allocation
+ *     (length first), so a short word costs a few bytes and a long one can't overflow. Sets
+ *     its counters and links to default values.
  *
  * Why it’s required:
  *     Every distinct word in the dataset needs a dedicated node to track all file-related
@@ -69,116 +203,294 @@ int get_index(const char *word)
  *     Pointer to the newly allocated mainnode.
  *     Returns FAILURE (your macro) if memory allocation fails.
  * ========================================================================================= */
-mainnode* create_mainnode(char *word)
+mainnode* create_mainnode(arena *pool, const char *word, size_t len)
 {
-    mainnode *new = malloc(sizeof(mainnode));
+    mainnode *new = arena_alloc(pool, offsetof(mainnode, word) + len + 1);
     if(new == NULL)
     {
         printf("ERROR: Couldn't allocate mainnode\n");
         return FAILURE;
     }
 
-    strcpy(new->word, word);
+    new->len = len;
+    memcpy(new->word, word, len);
+    new->word[len] = '\0';
+    new->hash = hash_bytes(word, len);
     new->file_count = 0;
-    new->sublink = NULL;
+    new->last_id = 0;
+    new->last_count = 0;
+    new->coded_id = 0;
+    new->max_count = 0;
+    new->block = NULL;
+    new->tail = NULL;
+    new->positions = NULL;
     new->main_next_link = NULL;
 
     return new;
 }
 
 
+#ifndef FLAT_DICT
+
 /* =========================================================================================
- * Function: create_subnode
+ * Function: search_mainnode
  * -----------------------------------------------------------------------------------------
  * What it does:
- *     Allocates memory and initializes a subnode structure representing a file in which
- *     the word appears. Sets default word count and link pointer.
+ *     Traverses the linked list of mainnodes (words) in a hash bucket and finds the node
+ *     corresponding to the 'len'-byte word. The stored hash is compared first so the bytes
+ *     are only compared on likely matches.
  *
  * Why it’s required:
- *     Allows tracking of how many times a word appears in a particular file and supports
- *     the multi-file nature of the inverted index.
+ *     Prevents the creation of duplicate word entries and enables efficient lookup during
+ *     insertion or display operations.
  *
  * Returns:
- *     Pointer to the newly created subnode.
- *     Returns FAILURE if memory allocation fails.
+ *     Pointer to the matching mainnode if found.
+ *     Returns NULL if the word does not exist in the list.
  * ========================================================================================= */
-subnode* create_subnode(char *filename)
+mainnode* search_mainnode(mainnode *head, const char *word, size_t len, unsigned int hash)
 {
-    subnode *new = malloc(sizeof(subnode));
-    if(new == NULL)
+    unsigned int links = 0;              // Nodes visited, for the probe length metric
+
+    while (head)
     {
-        printf("ERROR: Couldn't allocate subnode\n");
-        return FAILURE;
+        links++;
+        if (head->hash == hash && head->len == len)
+        {
+            METRIC_COUNT(METRIC_KEY_COMPARES, 1);
+            if (memcmp(head->word, word, len) == 0)
+                break;
+        }
+        head = head->main_next_link;
     }
+    METRIC_SAMPLE(METRIC_PROBE_LENGTH, links);
+    return head;
+}
 
-    strcpy(new->file_name, filename);
-    new->word_count = 1;
-    new->sub_sublink = NULL;
 
-    return new;
+/* =========================================================================================
+ * Function: lookup_term
+ * -----------------------------------------------------------------------------------------
+ * What it does:
+ *     Hashes the 'len'-byte word and searches its bucket. While a resize is in progress the word may
+ *     still sit in the old array or already have moved to the new one, so both are checked.
+ *
+ * Why it’s required:
+ *     Single entry point for finding a word, so callers never deal with bucket arrays.
+ *
+ * Returns:
+ *     Pointer to the matching mainnode, or NULL if the word is not in the table.
+ * ========================================================================================= */
+mainnode* lookup_term(hashtable *table, const char *word, size_t len)
+{
+    METRIC_COUNT(METRIC_LOOKUPS, 1);
+
+    unsigned int hash = hash_bytes(word, len);
+    mainnode *m = search_mainnode(table->bucket[0][hash & (table->size[0] - 1)], word, len, hash);
+
+    if (m == NULL && table->rehash_index >= 0)
+        m = search_mainnode(table->bucket[1][hash & (table->size[1] - 1)], word, len, hash);
+
+    return m;
 }
 
 
 /* =========================================================================================
- * Function: search_mainnode
+ * Function: first_mainnode / next_mainnode
  * -----------------------------------------------------------------------------------------
  * What it does:
- *     Traverses the linked list of mainnodes (words) in a hash bucket and finds the node
- *     corresponding to the given word.
+ *     Walk every word in the table, bucket by bucket, through both bucket arrays. The
+ *     cursor's bucket field tells the caller which bucket the current word lives in.
  *
  * Why it’s required:
- *     Prevents the creation of duplicate word entries and enables efficient lookup during
- *     insertion or display operations.
+ *     Display and save need to visit every word without knowing how many buckets exist or
+ *     whether a resize is half done.
  *
  * Returns:
- *     Pointer to the matching mainnode if found.
- *     Returns NULL if the word does not exist in the list.
+ *     The next mainnode, or NULL once the walk is complete.
  * ========================================================================================= */
-mainnode* search_mainnode(mainnode *head, char *word)
+mainnode* first_mainnode(hashtable *table, table_cursor *cursor)
 {
-    while (head)
+    cursor->array = 0;
+    cursor->bucket = 0;
+    cursor->node = NULL;
+
+    return next_mainnode(table, cursor);
+}
+
+mainnode* next_mainnode(hashtable *table, table_cursor *cursor)
+{
+    if (cursor->node)                                   // Continue along the current chain
+        cursor->node = cursor->node->main_next_link;
+    else if (cursor->array < 2 && cursor->bucket < table->size[cursor->array])
+        cursor->node = table->bucket[cursor->array][cursor->bucket];
+
+    while (cursor->node == NULL)                        // Find the next non-empty bucket
     {
-        if (strcmp(head->word, word) == 0)
-            return head;
-        head = head->main_next_link;
+        if (++cursor->bucket >= table->size[cursor->array])
+        {
+            cursor->bucket = 0;
+            if (++cursor->array == 2 || table->size[cursor->array] == 0)
+            {
+                cursor->array = 2;
+                return NULL;
+            }
+        }
+        cursor->node = table->bucket[cursor->array][cursor->bucket];
     }
-    return NULL;
+    return cursor->node;
 }
 
 
 /* =========================================================================================
- * Function: insert_subnode
+ * Function: link_mainnode
  * -----------------------------------------------------------------------------------------
  * What it does:
- *     Checks if the word already appears in the given file. If yes, increments word count.
- *     If not, creates a new subnode and links it into the subnode list of the mainnode.
+ *     Links an existing mainnode whose word is not yet in the table at the head of its
+ *     bucket. While a resize is in progress new words go straight into the resize target,
+ *     and every link moves the resize along by HASH_REHASH_STEP buckets.
  *
  * Why it’s required:
- *     Maintains accurate per-file word counts and ensures that each file is tracked exactly
- *     once under a specific word.
+ *     Keeps bucket selection and growth in one place for indexing, reloading and merging
+ *     the partial tables built by parallel indexing, which hand over nodes they created.
  *
  * Returns:
- *     Nothing.
+ *     SUCCESS (linking a node can't fail; a failed resize just keeps the current size).
  * ========================================================================================= */
-void insert_subnode(mainnode *mnode, char *filename)
+int link_mainnode(hashtable *table, mainnode *mnode)
 {
-    subnode *temp = mnode->sublink;
+    drop_lexicon(table);                                // The sorted words no longer cover the table
+    if (table->rehash_index >= 0)
+        rehash_step(table, HASH_REHASH_STEP);
+
+    int array = table->rehash_index >= 0 ? 1 : 0;
+    unsigned int index = mnode->hash & (table->size[array] - 1);
+
+    mnode->main_next_link = table->bucket[array][index];
+    table->bucket[array][index] = mnode;
 
-    while (temp)
+    if (++table->count > table->size[0] * HASH_MAX_LOAD && table->rehash_index < 0)
+        start_rehash(table);
+
+    return SUCCESS;
+}
+
+
+/* =========================================================================================
+ * Function: unlink_mainnode
+ * -----------------------------------------------------------------------------------------
+ * What it does:
+ *     Takes a word out of its bucket chain. During a resize the word may be in either
+ *     bucket array, so both are searched. The node itself stays in the arena.
+ *
+ * Why it’s required:
+ *     Removing a document can leave words that no other document contains; they must
+ *     disappear from search, display and save.
+ *
+ * Returns:
+ *     Nothing.
+ * ========================================================================================= */
+void unlink_mainnode(hashtable *table, mainnode *mnode)
+{
+    drop_lexicon(table);
+    for (int array = 0; array < 2 && table->size[array]; array++)
     {
-        if (strcmp(temp->file_name, filename) == 0)
+        mainnode **link = &table->bucket[array][mnode->hash & (table->size[array] - 1)];
+
+        while (*link && *link != mnode)
+            link = &(*link)->main_next_link;
+        if (*link)
         {
-            temp->word_count++;
+            *link = mnode->main_next_link;
+            mnode->main_next_link = NULL;
+            table->count--;
             return;
         }
-        temp = temp->sub_sublink;
     }
+}
 
-    subnode *new = create_subnode(filename);
+#endif
 
-    new->sub_sublink = mnode->sublink;
-    mnode->sublink = new;
-    mnode->file_count++;
+
+/* =========================================================================================
+ * Function: lookup_word
+ * -----------------------------------------------------------------------------------------
+ * What it does:
+ *     lookup_term() for a NUL-terminated word.
+ *
+ * Why it’s required:
+ *     Search and the benchmarks work with C strings rather than slices of an input buffer.
+ *
+ * Returns:
+ *     Pointer to the matching mainnode, or NULL if the word is not in the table.
+ * ========================================================================================= */
+mainnode* lookup_word(hashtable *table, const char *word)
+{
+    return lookup_term(table, word, strlen(word));
+}
+
+
+/* =========================================================================================
+ * Function: insert_mainnode
+ * -----------------------------------------------------------------------------------------
+ * What it does:
+ *     Creates a mainnode for a 'len'-byte word that is not yet in the table and links it in
+ *     with link_mainnode().
+ *
+ * Why it’s required:
+ *     One call for the indexing and reloading paths, whichever table layout is built.
+ *
+ * Returns:
+ *     Pointer to the new mainnode, or NULL if it couldn't be allocated.
+ * ========================================================================================= */
+mainnode* insert_mainnode(hashtable *table, const char *word, size_t len)
+{
+    mainnode *mnode = create_mainnode(&table->nodes, word, len);
+
+    if (mnode == NULL || link_mainnode(table, mnode) == FAILURE)
+        return NULL;
+    return mnode;
+}
+
+
+/* =========================================================================================
+ * Function: insert_posting
+ * -----------------------------------------------------------------------------------------
+ * What it does:
+ *     Records one occurrence of the word in the given file. create_database() indexes one
+ *     file at a time, so the file is almost always the word's newest posting: that case is
+ *     a single compare and an increment of the unencoded count (see postings.c). A new
+ *     posting is also noted in the forward index, once one has been built (doctable.c).
+ *     In a positional table the occurrence's position is appended too (positions.c).
+ *
+ * Why it’s required:
+ *     Maintains accurate per-file word counts and ensures that each file is tracked exactly
+ *     once under a specific word. Very common words appear in nearly every file, so a full
+ *     scan per occurrence would grow with the number of files indexed.
+ *
+ * Returns:
+ *     Nothing.
+ * ========================================================================================= */
+void insert_posting(hashtable *table, mainnode *mnode, int file_id, int position)
+{
+    if (table->positional && add_position(&table->nodes, mnode, file_id, position) == FAILURE)
+    {
+        printf("ERROR: Couldn't add position for %s\n", mnode->word);
+        return;
+    }
+
+    if (mnode->file_count && mnode->last_id == file_id)     // Fast path: current file
+    {
+        mnode->last_count++;
+        return;
+    }
+
+    int files = mnode->file_count;
+
+    if (add_posting(&table->nodes, mnode, file_id, 1) == FAILURE)
+        printf("ERROR: Couldn't add posting for %s\n", mnode->word);
+    else if (mnode->file_count > files)                     // New document for this word
+        note_document_word(&table->docs, file_id, mnode);
 }
 
 
@@ -187,7 +499,9 @@ void insert_subnode(mainnode *mnode, char *filename)
  * -----------------------------------------------------------------------------------------
  * What it does:
  *     High-level control function that inserts a word from a specific file into the hash
- *     table. Locates or creates its mainnode, then adds or updates its subnode.
+ *     table. Locates or creates its mainnode, then adds or updates its posting. The word is
+ *     'len' bytes and need not be NUL-terminated, so the tokenizer can pass slices of the
+ *     mapped file without copying them.
  *
  * Why it’s required:
  *     Orchestrates the full insertion flow and maintains the integrity of the inverted
@@ -196,19 +510,16 @@ void insert_subnode(mainnode *mnode, char *filename)
  * Returns:
  *     Nothing.
  * ========================================================================================= */
-void insert_word(hashtable *table, char *word, char *filename)
+void insert_word(hashtable *table, const char *word, size_t len, int file_id, int position)
 {
-    int index = get_index(word);
-
-    mainnode *mnode = search_mainnode(table[index].link, word);
+    mainnode *mnode = lookup_term(table, word, len);
 
     if (mnode == NULL)
     {
-        mnode = create_mainnode(word);
-
-        mnode->main_next_link = table[index].link;
-        table[index].link = mnode;
+        mnode = insert_mainnode(table, word, len);
+        if (mnode == NULL)
+            return;
     }
 
-    insert_subnode(mnode, filename);
+    insert_posting(table, mnode, file_id, position);
 }
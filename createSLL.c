@@ -133,8 +133,13 @@ filenode *create_file_linked_list(int argc, char *argv[])
             continue;
         }
 
-        // Create a new filenode for the validated file
-        new = malloc(sizeof(filenode));
+        // Create a new filenode for the validated file, with room for its whole name
+        new = malloc(sizeof(filenode) + strlen(argv[i]) + 1);
+        if (new == NULL)
+        {
+            printf("ERROR : Couldn't allocate a node for %s\n", argv[i]);
+            continue;
+        }
         strcpy(new->filename, argv[i]);
         new->link = NULL;
 
@@ -4,21 +4,34 @@
 * What it does   :
 *       Iterates through the list of files (provided via the filenode linked list), opens each file, reads every
 *       word inside it, and inserts those words into the hash table by calling insert_word(). This is the core
-*       routine that builds the entire inverted index from scratch.
+*       routine that builds the entire inverted index from scratch. Files are mapped and tokenized in place
+*       (tokenizer.c), so each word reaches insert_word() as a slice of the file without being copied.
+*
+*       With more than one thread, the file list is cut into contiguous ranges of roughly equal size in bytes. Each
+*       worker indexes its range into a private partial table, and the partial tables are merged into the shared
+*       one in file order once every worker is done.
 *
 * Why it’s needed:
 *       This function performs the initial full indexing operation. Without this step, the hash table remains empty
 *       and no search or update operation can function. It converts raw file content into structured searchable data.
 *
 * Workflow       :
-*       1. Traverse the file list beginning at 'head'.
-*       2. For each file:
-*              - Attempt to open it.
+*       1. Register every file in the document table, in list order, to fix the document ids.
+*       2. For each file (serially, or per worker over its range):
+*              - Attempt to open it with open_tokenizer().
 *              - If opening fails, skip to next file.
-*              - Extract words using fscanf().
-*              - Pass each word to insert_word() for hashing and node handling.
-*       3. Close each file after processing.
-*       4. Continue until all files are indexed.
+*              - Extract words using next_token().
+*              - Pass each word and the file id to insert_word() for hashing and node handling.
+*       3. Close each tokenizer after processing.
+*       4. With workers: merge each partial table into the shared table, first range first.
+*
+*       The work is done by index_files(), which update also calls for added and changed files.
+*
+* Determinism    :
+*       A worker logs the words it creates in creation order. Merging the logs range by range links new words into
+*       the shared table in exactly the order a serial build would have created them, so bucket layout and resize
+*       history match too; postings of a word are spliced on in document order. save_database() therefore writes
+*       the same bytes whatever the thread count.
 *
 * Returns        :
 *       Nothing. All updates happen directly on the passed hash table.
@@ -27,33 +40,301 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include "inverted_search.h"
 
-void create_database(hashtable *table, filenode *head)
+
+// One worker's share of a parallel build
+typedef struct index_job
+{
+    filenode *first;             // First file of this worker's range
+    int files;                   // Number of files in the range
+    int *file_id;                // Document id of each file in the range
+    int *length;                 // Words read from each file in the range
+    hashtable partial;           // Private table the range is indexed into
+    mainnode **created;          // Words created in 'partial', in creation order
+    size_t created_count;        // Entries used in created
+    size_t created_cap;          // Entries allocated in created
+    pthread_t tid;               // Worker thread
+    int running;                 // 1 if tid must be joined
+} index_job;
+
+
+/*****************************************************************************************************
+ * Function       : index_file
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Tokenizes one file into 'table', each word at its position (the number of words before
+ *      it). With analysis steps set on the table, each token is first normalized into a local
+ *      buffer (analyzer.c); tokens it drops are not counted. For a worker ('job' set), every
+ *      word created is appended to the job's creation log for the merge.
+ *
+ * Returns        :
+ *      Number of words read (the document's length for ranking). Prints an error if the file
+ *      can't be opened.
+ *****************************************************************************************************/
+static int index_file(hashtable *table, const char *filename, int file_id, index_job *job)
+{
+    tokenizer tok;                   // Mapped contents of the file
+    const char *word;                // Current word, pointing into the file contents
+    size_t len;                      // Length of the current word
+    int words = 0;                   // Words read so far
+    char term[MAX_TOKEN_LEN + 1];    // Normalized token, when the table has analysis steps
+    METRIC_START(started);
+
+    if (open_tokenizer(&tok, filename) == FAILURE)
+    {
+        printf("ERROR : Cannot open the file !\n");
+        return 0;
+    }
+    METRIC_COUNT(METRIC_FILES, 1);
+    METRIC_COUNT(METRIC_BYTES, tok.size);
+
+    // Read each word until EOF, max MAX_TOKEN_LEN chars per word
+    while (next_token(&tok, &word, &len) == SUCCESS)
+    {
+        METRIC_COUNT(METRIC_TOKENS, 1);
+        if (table->analysis)
+        {
+            len = analyze_token(table->analysis, word, len, term);
+            if (len == 0)
+                continue;                                   // Stopword or bare punctuation
+            word = term;
+        }
+        words++;
+        if (job == NULL)
+        {
+            insert_word(table, word, len, file_id, words - 1);   // Insert extracted word into the inverted index
+            continue;
+        }
+
+        mainnode *m = lookup_term(table, word, len);
+        if (m == NULL)
+        {
+            if (job->created_count == job->created_cap)
+            {
+                size_t cap = job->created_cap ? job->created_cap * 2 : 1024;
+                mainnode **grown = realloc(job->created, cap * sizeof(mainnode *));
+                if (grown == NULL)
+                    break;
+                job->created = grown;
+                job->created_cap = cap;
+            }
+
+            m = insert_mainnode(table, word, len);
+            if (m == NULL)
+                break;
+            job->created[job->created_count++] = m;
+        }
+        insert_posting(table, m, file_id, words - 1);
+    }
+
+    close_tokenizer(&tok);
+    METRIC_STOP(PHASE_FILE, started);
+    return words;
+}
+
+
+/*****************************************************************************************************
+ * Function       : index_worker
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Thread body: indexes the job's range of files into its partial table.
+ *
+ * Returns        :
+ *      NULL.
+ *****************************************************************************************************/
+static void* index_worker(void *arg)
+{
+    index_job *job = arg;
+    filenode *temp = job->first;
+
+    for (int i = 0; i < job->files; i++, temp = temp->link)
+    {
+        if (job->file_id[i] >= 0)
+            job->length[i] = index_file(&job->partial, temp->filename, job->file_id[i], job);
+    }
+    return NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : merge_partial
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Replays a worker's creation log against the shared table. A word the table doesn't have yet
+ *      is linked in as is; otherwise the worker's posting blocks are spliced onto the end of the
+ *      existing ones (the worker's documents all come after the ones already merged). The partial
+ *      table's arena is then adopted by the shared table, so no node is copied.
+ *
+ * Returns        :
+ *      Nothing. The job's partial table is released.
+ *****************************************************************************************************/
+static void merge_partial(hashtable *table, index_job *job)
+{
+    METRIC_START(started);
+
+    for (size_t i = 0; i < job->created_count; i++)
+    {
+        mainnode *m = job->created[i];
+        mainnode *shared = lookup_term(table, m->word, m->len);
+
+        if (shared == NULL)
+        {
+            if (link_mainnode(table, m) == FAILURE)
+                printf("ERROR : Couldn't merge word %s\n", m->word);
+            continue;
+        }
+
+        if (splice_postings(&table->nodes, shared, m) == FAILURE)
+            printf("ERROR : Couldn't merge postings of %s\n", m->word);
+    }
+
+    arena_adopt(&table->nodes, &job->partial.nodes);
+    free_hashtable(&job->partial);
+    free(job->created);
+    METRIC_STOP(PHASE_MERGE, started);
+}
+
+
+/*****************************************************************************************************
+ * Function       : file_size
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Returns the size of a file in bytes, used to balance the workers' ranges.
+ *
+ * Returns        :
+ *      Size in bytes, or 0 if the file can't be examined.
+ *****************************************************************************************************/
+static long long file_size(const char *filename)
 {
-    filenode *temp = head;           // Start from the first file in the filenode list
-    char word[50];                   // Buffer to store each extracted word
+    struct stat st;
+
+    return stat(filename, &st) == 0 ? (long long)st.st_size : 0;
+}
 
-    while (temp != NULL)             // Loop through all files in the linked list
+
+/*****************************************************************************************************
+ * Function       : index_files
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      The indexing pass behind create_database(), also used by sync_database() to index added
+ *      and changed files into a table that already holds documents. Each file's size and
+ *      modification time are recorded as it is registered, so a later update can tell whether
+ *      it changed. New files always get ids after every existing document, so their postings
+ *      append to the words' lists.
+ *
+ * Returns        :
+ *      Number of files registered, or -1 if the indexing state couldn't be allocated.
+ *****************************************************************************************************/
+int index_files(hashtable *table, filenode *head, int threads)
+{
+    int files = 0;
+    long long total = 0;
+    METRIC_START(started);
+
+    for (filenode *temp = head; temp != NULL; temp = temp->link)
     {
-        FILE *fp = fopen(temp->filename, "r");   // Open the current file in read mode
-        if (fp == NULL)                           // If file cannot be opened
+        files++;
+        total += file_size(temp->filename);
+    }
+
+    table->generation++;                                        // Cached results are stale from here
+    int *file_id = malloc((files ? files : 1) * sizeof(int));
+    int *length = calloc(files ? files : 1, sizeof(int));   // Filled by the workers, recorded after
+    index_job *jobs = threads > 1 ? calloc(threads, sizeof(index_job)) : NULL;
+
+    if (file_id == NULL || length == NULL || (threads > 1 && jobs == NULL))
+    {
+        printf("ERROR : Couldn't allocate indexing state\n");
+        free(file_id);
+        free(length);
+        free(jobs);
+        return -1;
+    }
+
+    int i = 0;
+    for (filenode *temp = head; temp != NULL; temp = temp->link, i++)
+    {
+        file_id[i] = add_document(table, temp->filename);     // Id stored in this file's postings
+        if (file_id[i] >= 0)
+            read_stamp(temp->filename, &table->docs.stamp[file_id[i]]);
+    }
+
+    if (threads <= 1 || files <= 1)                             // Serial build
+    {
+        i = 0;
+        for (filenode *temp = head; temp != NULL; temp = temp->link, i++)
+        {
+            if (file_id[i] >= 0)
+                length[i] = index_file(table, temp->filename, file_id[i], NULL);
+        }
+    }
+    else
+    {
+        if (threads > files)
+            threads = files;
+
+        // Cut the list into contiguous ranges of about total/threads bytes each
+        filenode *temp = head;
+        long long done = 0;
+        i = 0;
+        for (int t = 0; t < threads; t++)
         {
-            printf("ERROR : Cannot open the file !\n");
-            temp = temp->link;                    // Move to next file
-            continue;                             // Skip processing this file
+            jobs[t].first = temp;
+            jobs[t].file_id = file_id + i;
+            jobs[t].length = length + i;
+            while (temp != NULL && (jobs[t].files == 0 || t == threads - 1 ||
+                                    (done < total * (t + 1) / threads && files - i > threads - t - 1)))
+            {
+                done += file_size(temp->filename);
+                jobs[t].files++;
+                temp = temp->link;
+                i++;
+            }
         }
 
-        // Read each word until EOF, max 49 chars per word
-        while (fscanf(fp, "%49s", word) != EOF)
+        for (int t = 0; t < threads; t++)
         {
-            // Insert extracted word into the inverted index
-            insert_word(table, word, temp->filename);
+            if (init_hashtable(&jobs[t].partial) == FAILURE)
+            {
+                jobs[t].files = 0;
+                continue;
+            }
+            jobs[t].partial.positional = table->positional;     // Workers record positions too
+            jobs[t].partial.analysis = table->analysis;         // ... and normalize alike
+            if (pthread_create(&jobs[t].tid, NULL, index_worker, &jobs[t]) == 0)
+                jobs[t].running = 1;
+            else
+                index_worker(&jobs[t]);                         // Run inline if no thread
         }
 
-        fclose(fp);                    // Close current file after processing all words
-        temp = temp->link;             // Move to the next file in the list
+        for (int t = 0; t < threads; t++)
+        {
+            if (jobs[t].running)
+                pthread_join(jobs[t].tid, NULL);
+            merge_partial(table, &jobs[t]);
+        }
+        drop_forward_index(&table->docs);                 // Merged postings bypassed insert_posting()
+    }
+
+    for (i = 0; i < files; i++)
+    {
+        if (file_id[i] >= 0)
+            set_document_length(&table->docs, file_id[i], length[i]);
     }
 
-    printf("Database created Successfully!\n");   // Final confirmation message
+    free(file_id);
+    free(length);
+    free(jobs);
+    METRIC_STOP(PHASE_INDEX, started);
+    return files;
+}
+
+
+void create_database(hashtable *table, filenode *head, int threads)
+{
+    if (index_files(table, head, threads) >= 0)
+        printf("Database created Successfully!\n");   // Final confirmation message
 }
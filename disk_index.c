@@ -0,0 +1,750 @@
+/*****************************************************************************************************
+ * File           : disk_index.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Binary index file ("backup.idx"). save_index() writes the table as a versioned file of
+ *      fixed-width sections; open_index() maps it read-only and the index_* functions answer
+ *      lookups straight from the mapping, so loading is an mmap plus a checksum pass instead of
+ *      re-parsing text and rebuilding every mainnode and postings list.
+ *
+ * Why it’s needed:
+ *      Reloading backup.txt with fscanf takes about as long as indexing the files again. The text
+ *      format is still written by save_database() as an export.
+ *
+ * File layout    :
+ *      index_header              - Magic, version, byte order, counts, flags, offset/length/checksum
+ *                                  of each section, and a checksum of the header itself.
+ *      SECTION_TERMS             - One disk_term per word, sorted by word (bytewise), so lookups
+ *                                  are a binary search.
+ *      SECTION_WORDS             - The words, NUL-terminated, in term order.
+ *      SECTION_POSTINGS          - The postings of each term, in document id order, as document id
+ *                                  gaps + counts in varints (the encoding of postings.c).
+ *      SECTION_POSITIONS         - With INDEX_POSITIONS: the word positions of each term, as
+ *                                  positions.c encodes them. Empty otherwise.
+ *      SECTION_DOCS / _NAMES     - One disk_doc per document id (name offset, number of words,
+ *                                  and the size and mtime the file had when indexed), and the
+ *                                  names.
+ *
+ *      Sections start on 8-byte boundaries and may appear in any order; the dictionary is written
+ *      after the postings, whose run offsets it records. Integers are stored in the writer's byte order; a file
+ *      from a host of the other endianness is rejected by the byte order check. Documents removed
+ *      from the table are left out and the remaining ids renumbered densely, in order.
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "inverted_search.h"
+
+#define CHECKSUM_SEED  0xcbf29ce484222325ull   // FNV-1a 64-bit offset basis
+#define CHECKSUM_PRIME 0x100000001b3ull         // FNV-1a 64-bit prime
+#define WRITE_BUFFER   (1 << 20)                // stdio buffer for save_index
+
+
+// Running checksum: FNV-1a over 8-byte words, so a section is checked at memory speed
+typedef struct checksum_state
+{
+    uint64_t sum;                // Checksum of the whole words seen so far
+    unsigned char tail[8];       // Bytes of an incomplete word
+    unsigned int tail_len;       // Bytes in tail
+    uint64_t length;             // Bytes seen
+} checksum_state;
+
+
+// Output state of save_index: current offset and the section being written
+typedef struct index_writer
+{
+    FILE *fp;                    // Index file
+    uint64_t pos;                // Bytes written so far
+    index_section *section;      // Section receiving the bytes (checksummed)
+    checksum_state sum;          // Checksum of that section so far
+    int error;                   // Set once a write fails
+} index_writer;
+
+
+/*****************************************************************************************************
+ * Function       : checksum_update / checksum_final
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Feed bytes into a running checksum in pieces of any size; checksum_final() pads the last
+ *      word with zeros and mixes in the length. The result only depends on the bytes, not on how
+ *      they were split up, so the writer can checksum as it goes and the reader in one call.
+ *
+ * Returns        :
+ *      checksum_final() returns the checksum.
+ *****************************************************************************************************/
+static void checksum_update(checksum_state *state, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    uint64_t sum = state->sum, word;
+
+    state->length += len;
+    while (state->tail_len && len)                  // Complete a word started earlier
+    {
+        state->tail[state->tail_len++] = *p++;
+        len--;
+        if (state->tail_len == 8)
+        {
+            memcpy(&word, state->tail, 8);
+            sum = (sum ^ word) * CHECKSUM_PRIME;
+            state->tail_len = 0;
+        }
+    }
+
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        memcpy(&word, p, 8);
+        sum = (sum ^ word) * CHECKSUM_PRIME;
+    }
+
+    memcpy(state->tail + state->tail_len, p, len);
+    state->tail_len += len;
+    state->sum = sum;
+}
+
+static uint64_t checksum_final(checksum_state *state)
+{
+    uint64_t word, sum = state->sum;
+
+    if (state->tail_len)
+    {
+        memset(state->tail + state->tail_len, 0, 8 - state->tail_len);
+        memcpy(&word, state->tail, 8);
+        sum = (sum ^ word) * CHECKSUM_PRIME;
+    }
+    return (sum ^ state->length) * CHECKSUM_PRIME;
+}
+
+
+/*****************************************************************************************************
+ * Function       : checksum_bytes
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Checksum of one block of memory.
+ *
+ * Returns        :
+ *      The checksum.
+ *****************************************************************************************************/
+static uint64_t checksum_bytes(const void *data, size_t len)
+{
+    checksum_state state = { CHECKSUM_SEED, { 0 }, 0, 0 };
+
+    checksum_update(&state, data, len);
+    return checksum_final(&state);
+}
+
+
+/*****************************************************************************************************
+ * Function       : write_bytes
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Appends bytes to the file and to the checksum of the current section.
+ *
+ * Returns        :
+ *      Nothing. A failed write sets writer->error.
+ *****************************************************************************************************/
+static void write_bytes(index_writer *w, const void *data, size_t len)
+{
+    if (len && fwrite(data, 1, len, w->fp) != len)
+        w->error = 1;
+    if (w->section)
+        checksum_update(&w->sum, data, len);
+    w->pos += len;
+}
+
+
+/*****************************************************************************************************
+ * Function       : begin_section / end_section
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      begin_section() pads the file to the next 8-byte boundary and starts recording 'section'
+ *      there; end_section() stores the length and checksum of the section being recorded.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void end_section(index_writer *w)
+{
+    if (w->section)
+    {
+        w->section->length = w->sum.length;
+        w->section->checksum = checksum_final(&w->sum);
+        w->section = NULL;
+    }
+}
+
+static void begin_section(index_writer *w, index_section *section)
+{
+    static const char zero[8];
+
+    end_section(w);
+    write_bytes(w, zero, (8 - (w->pos & 7)) & 7);
+
+    section->offset = w->pos;
+    memset(&w->sum, 0, sizeof(w->sum));
+    w->sum.sum = CHECKSUM_SEED;
+    w->section = section;
+}
+
+
+/*****************************************************************************************************
+ * Function       : term_prefix
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Packs the first 8 bytes of a word, zero padded, into an integer whose numeric order is the
+ *      bytewise order of those bytes (first byte most significant).
+ *
+ * Returns        :
+ *      The prefix key.
+ *****************************************************************************************************/
+uint64_t term_prefix(const char *word, size_t len)
+{
+    uint64_t key = 0;
+
+    for (size_t i = 0; i < 8; i++)
+        key = key << 8 | (i < len ? (unsigned char)word[i] : 0);
+    return key;
+}
+
+
+/*****************************************************************************************************
+ * Function       : save_index
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Writes the index file, words in the order of the table's lexicon (lexicon.c): a placeholder
+ *      header, each section in turn, then the final header with the section offsets and checksums. Removed documents
+ *      are skipped and the others renumbered through doc_id[], which keeps them in order, so the
+ *      re-encoded gaps stay positive. The file is written under a temporary name and renamed over
+ *      'filename' once synced, so a failed save keeps the previous index, and a mapping of it
+ *      stays valid.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out or the file couldn't be written.
+ *****************************************************************************************************/
+int save_index(hashtable *table, const char *filename)
+{
+    METRIC_START(started);
+    lexicon *lex = table_lexicon(table);
+    uint64_t *run = malloc((table->count + 1) * sizeof(uint64_t));   // Postings offset of each term
+    uint64_t *at = malloc((table->count + 1) * sizeof(uint64_t));    // Positions offset of each term
+    int *doc_id = malloc((table->docs.count + 1) * sizeof(int));      // Saved id of each document
+    if (lex == NULL || run == NULL || at == NULL || doc_id == NULL)
+    {
+        printf("ERROR : Couldn't allocate index buffers\n");
+        free(run);
+        free(at);
+        free(doc_id);
+        return FAILURE;
+    }
+
+    uint32_t docs = 0;
+    for (int id = 0; id < table->docs.count; id++)
+        doc_id[id] = table->docs.name[id] ? (int)docs++ : -1;
+
+    mainnode **sorted = lex->node;
+    unsigned int terms = lex->count;
+    uint64_t postings = 0;
+    for (unsigned int i = 0; i < terms; i++)
+        postings += sorted[i]->file_count;
+
+    index_writer w;
+    char temp[4096];                                      // Renamed over filename once complete
+    int fd = create_replacement(filename, temp, sizeof(temp));
+    memset(&w, 0, sizeof(w));
+    w.fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (w.fp == NULL)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(temp);
+        }
+        free(run);
+        free(at);
+        free(doc_id);
+        return FAILURE;
+    }
+    setvbuf(w.fp, NULL, _IOFBF, WRITE_BUFFER);
+
+    index_header header;
+    memset(&header, 0, sizeof(header));
+    write_bytes(&w, &header, sizeof(header));             // Rewritten once the offsets are known
+
+    begin_section(&w, &header.section[SECTION_WORDS]);
+    for (unsigned int i = 0; i < terms; i++)
+        write_bytes(&w, sorted[i]->word, sorted[i]->len + 1);
+
+    // Postings are re-encoded as one run per term, gaps starting from document 0; the start of
+    // each run is kept for the dictionary, which is written after them
+    begin_section(&w, &header.section[SECTION_POSTINGS]);
+    uint64_t start = w.pos;
+    for (unsigned int i = 0; i < terms; i++)
+    {
+        posting_cursor p;
+        unsigned char buf[16];
+        int prev = 0;
+
+        run[i] = w.pos - start;
+        postings_of(sorted[i], &p);
+        while (next_posting(&p) == SUCCESS)
+        {
+            int id = doc_id[p.file_id];
+            write_bytes(&w, buf, encode_posting(buf, id - prev, p.word_count));
+            prev = id;
+        }
+    }
+    run[terms] = w.pos - start;
+
+    // Positions hold no document ids, so each word's chain is copied as it is
+    begin_section(&w, &header.section[SECTION_POSITIONS]);
+    start = w.pos;
+    for (unsigned int i = 0; i < terms; i++)
+    {
+        at[i] = w.pos - start;
+        if (table->positional && sorted[i]->positions)
+        {
+            for (const posting_block *b = sorted[i]->positions->block; b; b = b->next)
+                write_bytes(&w, b->data, b->used);
+        }
+    }
+    at[terms] = w.pos - start;
+
+    // Dictionary: word offsets follow from the running word lengths
+    begin_section(&w, &header.section[SECTION_TERMS]);
+    uint32_t word_off = 0;
+    for (unsigned int i = 0; i < terms; i++)
+    {
+        disk_term t;
+        t.word_len = sorted[i]->len;
+        t.prefix = term_prefix(sorted[i]->word, t.word_len);
+        t.postings_off = run[i];
+        t.word_off = word_off;
+        t.file_count = sorted[i]->file_count;
+        t.postings_len = run[i + 1] - run[i];
+        t.max_count = term_max_count(sorted[i]);
+        t.positions_len = at[i + 1] - at[i];
+        t.positions_off = at[i];
+        write_bytes(&w, &t, sizeof(t));
+
+        word_off += t.word_len + 1;
+    }
+
+    begin_section(&w, &header.section[SECTION_DOCS]);
+    uint32_t name_off = 0;
+    for (int id = 0; id < table->docs.count; id++)
+    {
+        if (doc_id[id] < 0)
+            continue;
+
+        disk_doc d;
+        d.name_off = name_off;
+        d.length = table->docs.length[id];
+        d.size = table->docs.stamp[id].size;
+        d.mtime = table->docs.stamp[id].mtime;
+        write_bytes(&w, &d, sizeof(d));
+        name_off += strlen(table->docs.name[id]) + 1;
+    }
+
+    begin_section(&w, &header.section[SECTION_NAMES]);
+    for (int id = 0; id < table->docs.count; id++)
+    {
+        if (doc_id[id] >= 0)
+            write_bytes(&w, table->docs.name[id], strlen(table->docs.name[id]) + 1);
+    }
+    end_section(&w);
+
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.byte_order = INDEX_BYTE_ORDER;
+    header.term_count = terms;
+    header.doc_count = docs;
+    header.posting_count = postings;
+    header.flags = (table->positional ? INDEX_POSITIONS : 0) | table->analysis << INDEX_ANALYSIS_SHIFT;
+    header.checksum = checksum_bytes(&header, offsetof(index_header, checksum));
+
+    if (fseek(w.fp, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, w.fp) != 1)
+        w.error = 1;
+    if (fflush(w.fp) != 0 || fsync(fileno(w.fp)) != 0)   // On disk before it replaces the old file
+        w.error = 1;
+    if (fclose(w.fp) != 0)
+        w.error = 1;
+    free(run);
+    free(at);
+    free(doc_id);
+
+    if (replace_file(temp, filename, !w.error) == FAILURE)
+    {
+        printf("ERROR : Couldn't write %s, the previous file is unchanged\n", filename);
+        return FAILURE;
+    }
+    METRIC_STOP(PHASE_SAVE_INDEX, started);
+    printf("Saved Successfully in %s\n", filename);
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : check_index
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Validates a mapped file: magic, version, byte order, header checksum, that every section
+ *      lies inside the file with the length its counts imply, every section checksum, and that
+ *      every term and document entry points inside its section. Accessors can then index the
+ *      mapping without further bounds checks.
+ *
+ * Returns        :
+ *      NULL if the file is usable, otherwise a message describing the first problem found.
+ *****************************************************************************************************/
+static const char* check_index(const unsigned char *base, size_t size)
+{
+    index_header header;
+
+    if (size < sizeof(header))
+        return "file too short";
+    memcpy(&header, base, sizeof(header));
+
+    if (memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0)
+        return "not an index file";
+    if (header.byte_order != INDEX_BYTE_ORDER)
+        return "written on a host of the other byte order";
+    if (header.version != INDEX_VERSION)
+        return "unsupported version";
+    if (header.checksum != checksum_bytes(&header, offsetof(index_header, checksum)))
+        return "header checksum mismatch";
+
+    if (header.section[SECTION_TERMS].length != (uint64_t)header.term_count * sizeof(disk_term) ||
+        header.section[SECTION_DOCS].length != (uint64_t)header.doc_count * sizeof(disk_doc))
+        return "section length doesn't match the counts";
+
+    for (int i = 0; i < INDEX_SECTIONS; i++)
+    {
+        const index_section *s = &header.section[i];
+
+        if ((s->offset & 7) || s->offset > size || s->length > size - s->offset)
+            return "section outside the file";
+        if (s->checksum != checksum_bytes(base + s->offset, s->length))
+            return "section checksum mismatch";
+    }
+
+    const disk_term *term = (const disk_term *)(base + header.section[SECTION_TERMS].offset);
+    const char *words = (const char *)(base + header.section[SECTION_WORDS].offset);
+    uint64_t words_len = header.section[SECTION_WORDS].length;
+    uint64_t postings_len = header.section[SECTION_POSTINGS].length;
+    uint64_t positions_len = header.section[SECTION_POSITIONS].length;
+    for (uint32_t i = 0; i < header.term_count; i++)
+    {
+        uint64_t end = (uint64_t)term[i].word_off + term[i].word_len;
+
+        if (end >= words_len || words[end] != '\0' || term[i].postings_off > postings_len ||
+            term[i].postings_len > postings_len - term[i].postings_off ||
+            term[i].positions_off > positions_len ||
+            term[i].positions_len > positions_len - term[i].positions_off)
+            return "term entry outside its section";
+    }
+
+    const disk_doc *doc = (const disk_doc *)(base + header.section[SECTION_DOCS].offset);
+    const char *names = (const char *)(base + header.section[SECTION_NAMES].offset);
+    uint64_t names_len = header.section[SECTION_NAMES].length;
+    if (header.doc_count && (names_len == 0 || names[names_len - 1] != '\0'))
+        return "document names not terminated";
+    for (uint32_t i = 0; i < header.doc_count; i++)
+    {
+        if (doc[i].name_off >= names_len)
+            return "document entry outside its section";
+    }
+    return NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : open_index
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Maps the index file read-only, validates it and points the disk_index at its sections.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE (with a message) if the file is missing, unreadable or damaged.
+ *****************************************************************************************************/
+int open_index(disk_index *index, const char *filename)
+{
+    struct stat st;
+    METRIC_START(started);
+    int fd = open(filename, O_RDONLY);
+
+    memset(index, 0, sizeof(*index));
+    if (fd < 0)
+        return FAILURE;
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        printf("ERROR : %s is empty\n", filename);
+        return FAILURE;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        printf("ERROR : Couldn't map %s\n", filename);
+        return FAILURE;
+    }
+
+    const char *problem = check_index(map, st.st_size);
+    if (problem)
+    {
+        printf("ERROR : %s: %s\n", filename, problem);
+        munmap(map, st.st_size);
+        return FAILURE;
+    }
+
+    const index_header *header = map;
+    index->base = map;
+    index->size = st.st_size;
+    index->term = (const disk_term *)(index->base + header->section[SECTION_TERMS].offset);
+    index->term_count = header->term_count;
+    index->words = (const char *)(index->base + header->section[SECTION_WORDS].offset);
+    index->words_len = header->section[SECTION_WORDS].length;
+    index->postings = index->base + header->section[SECTION_POSTINGS].offset;
+    index->postings_len = header->section[SECTION_POSTINGS].length;
+    index->positions = index->base + header->section[SECTION_POSITIONS].offset;
+    index->positions_len = header->section[SECTION_POSITIONS].length;
+    index->positional = (header->flags & INDEX_POSITIONS) != 0;
+    index->analysis = header->flags >> INDEX_ANALYSIS_SHIFT & ANALYZE_ALL;
+    index->posting_count = header->posting_count;
+    index->doc = (const disk_doc *)(index->base + header->section[SECTION_DOCS].offset);
+    index->doc_count = header->doc_count;
+    index->names = (const char *)(index->base + header->section[SECTION_NAMES].offset);
+    index->names_len = header->section[SECTION_NAMES].length;
+
+    long long total = 0;
+    for (unsigned int id = 0; id < index->doc_count; id++)
+        total += index->doc[id].length;
+    index->avg_length = index->doc_count ? (double)total / index->doc_count : 0.0;
+    METRIC_STOP(PHASE_OPEN_INDEX, started);
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : close_index
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Unmaps the file. Pointers obtained from the index become invalid.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void close_index(disk_index *index)
+{
+    if (index->base)
+        munmap((void *)index->base, index->size);
+    memset(index, 0, sizeof(*index));
+}
+
+
+/*****************************************************************************************************
+ * Function       : index_word
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Returns the word of a dictionary entry.
+ *
+ * Returns        :
+ *      NUL-terminated word inside the mapping.
+ *****************************************************************************************************/
+const char* index_word(disk_index *index, const disk_term *term)
+{
+    return index->words + term->word_off;
+}
+
+
+/*****************************************************************************************************
+ * Function       : index_lookup
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Binary search of the sorted dictionary. Prefix keys are compared first, inside the term
+ *      array; only words sharing their first 8 bytes, and both longer than 8, are finished off in
+ *      the words section. Ties break on length, the order the writer's lexicon sorts by (a word
+ *      may hold NUL bytes, so that is bytewise, not strcmp()).
+ *
+ * Returns        :
+ *      The dictionary entry, or NULL if the word isn't in the index.
+ *****************************************************************************************************/
+const disk_term* index_lookup(disk_index *index, const char *word, size_t len)
+{
+    uint64_t prefix = term_prefix(word, len);
+    unsigned int low = 0, high = index->term_count;
+
+    while (low < high)
+    {
+        unsigned int mid = low + (high - low) / 2;
+        const disk_term *t = &index->term[mid];
+        int cmp;
+
+        if (t->prefix != prefix)
+            cmp = t->prefix < prefix ? -1 : 1;
+        else
+        {
+            size_t n = t->word_len < len ? t->word_len : len;
+            cmp = n > 8 ? memcmp(index_word(index, t) + 8, word + 8, n - 8) : 0;
+            if (cmp == 0)                                   // One is a prefix of the other
+                cmp = t->word_len < len ? -1 : t->word_len > len;
+        }
+        if (cmp == 0)
+            return t;
+        if (cmp < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : index_postings
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Starts a walk over the encoded postings run of a dictionary entry; next_posting() decodes
+ *      them straight from the mapping.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void index_postings(disk_index *index, const disk_term *term, posting_cursor *cursor)
+{
+    postings_in(index->postings + term->postings_off, term->postings_len, cursor);
+}
+
+
+/*****************************************************************************************************
+ * Function       : index_positions
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Starts a walk over the positions run of a dictionary entry (empty unless the file has
+ *      INDEX_POSITIONS).
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void index_positions(disk_index *index, const disk_term *term, position_cursor *cursor)
+{
+    positions_in(index->positions + term->positions_off, term->positions_len, cursor);
+}
+
+
+/*****************************************************************************************************
+ * Function       : index_document
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Resolves a document id to its file name.
+ *
+ * Returns        :
+ *      The file name, or "?" for an id the file doesn't cover.
+ *****************************************************************************************************/
+const char* index_document(disk_index *index, uint32_t file_id)
+{
+    if (file_id >= index->doc_count)
+        return "?";
+    return index->names + index->doc[file_id].name_off;
+}
+
+
+/*****************************************************************************************************
+ * Function       : load_index
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Builds mainnodes and posting blocks for every entry of a mapped index in an empty table, keeping
+ *      the document ids and stamps of the file, and its word positions if it has them (the table
+ *      is then positional). Used when the index has to become mutable again (exporting it as
+ *      text, or updating it with added, changed or removed files).
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out or a word is longer than MAX_TOKEN_LEN.
+ *****************************************************************************************************/
+int load_index(hashtable *table, disk_index *index)
+{
+    table->positional = index->positional;
+    table->analysis = index->analysis;                  // Files added later are analyzed alike
+    table->generation++;
+    for (unsigned int id = 0; id < index->doc_count; id++)
+    {
+        if (add_document(table, index_document(index, id)) != (int)id)
+            return FAILURE;
+        table->docs.stamp[id].size = index->doc[id].size;
+        table->docs.stamp[id].mtime = index->doc[id].mtime;
+        set_document_length(&table->docs, id, index->doc[id].length);
+    }
+
+    for (unsigned int i = 0; i < index->term_count; i++)
+    {
+        const disk_term *t = &index->term[i];
+        posting_cursor p;
+        mainnode *m;
+
+        if (t->word_len > MAX_TOKEN_LEN)
+            return FAILURE;
+        m = insert_mainnode(table, index_word(index, t), t->word_len);
+        if (m == NULL)
+            return FAILURE;
+
+        index_postings(index, t, &p);
+        while (next_posting(&p) == SUCCESS)
+        {
+            if (add_posting(&table->nodes, m, p.file_id, p.word_count) == FAILURE)
+                return FAILURE;
+        }
+
+        if (index->positional &&
+            append_positions(&table->nodes, m, index->positions + t->positions_off, t->positions_len) == FAILURE)
+            return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : index_out_of_date
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Compares the files given on the command line with the documents of a mapped index: a file
+ *      the index doesn't have, a document whose file is gone or not given any more, or one whose
+ *      size or modification time differs from its stamp all make the index out of date.
+ *
+ * Why it’s needed:
+ *      Update (menu option 5) keeps the index mapped when nothing changed, and only rebuilds the
+ *      nodes to apply changes when there are some.
+ *
+ * Returns        :
+ *      1 if the index needs updating, 0 if it matches the files.
+ *****************************************************************************************************/
+int index_out_of_date(disk_index *index, filenode *head)
+{
+    hashtable scratch;                   // Only its document table is used, to look names up
+    unsigned int files = 0;
+    int stale = 0;
+
+    if (init_hashtable(&scratch) == FAILURE)
+        return 1;
+    for (unsigned int id = 0; id < index->doc_count; id++)
+        add_document(&scratch, index_document(index, id));
+
+    for (filenode *temp = head; temp != NULL && !stale; temp = temp->link)
+    {
+        int id = find_document(&scratch.docs, temp->filename);
+        doc_stamp now;
+
+        files++;
+        if (id < 0 || read_stamp(temp->filename, &now) == FAILURE ||
+            now.size != index->doc[id].size || now.mtime != index->doc[id].mtime)
+            stale = 1;
+    }
+    if (files != index->doc_count)
+        stale = 1;
+
+    free_hashtable(&scratch);
+    return stale;
+}
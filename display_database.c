@@ -2,8 +2,8 @@
 * Function       : display_database
 * --------------------------------------------------------------------------------------------------------------------------------------------------
 * What it does   :
-*       Prints the entire inverted index in a structured tabular format. It walks through all 27 hash table
-*       indices and displays each word, the number of files it appears in, and detailed per-file occurrence counts.
+*       Prints the entire inverted index in a structured tabular format. It walks through every hash table
+*       bucket and displays each word, the number of files it appears in, and detailed per-file occurrence counts.
 *
 * Why it’s needed:
 *       Provides a complete visualization of the database, making it easier to debug, verify, and understand
@@ -11,11 +11,11 @@
 *
 * Workflow       :
 *       1. Print table headers.
-*       2. Loop through all hash indices.
+*       2. Walk every word with first_mainnode()/next_mainnode().
 *       3. For each mainnode (word):
 *               - Print its index, word, and file count.
-*               - Print all subnodes (files) where the word appears and how many times.
-*       4. If all buckets were empty, display "Database is empty!".
+*               - Print all postings (files) where the word appears and how many times.
+*       4. If the table holds no words, display "Database is empty!".
 *
 * Returns        :
 *       Nothing. Only prints output to console.
@@ -34,53 +34,44 @@ void display_database(hashtable *table)
     printf("---------------------------------------------------------------------\n");
 
     int empty = 1;                                      // Track whether any data exists
+    table_cursor cursor;                                // Position of the walk over all words
 
-    for (int i = 0; i < 27; i++)                        // Loop through all hash buckets
+    for (mainnode *temp1 = first_mainnode(table, &cursor); temp1 != NULL;
+         temp1 = next_mainnode(table, &cursor))         // Traverse each mainnode (each word)
     {
-        mainnode *temp1 = table[i].link;                // Points to the word list in current bucket
-
-        if (temp1 == NULL)                              // If bucket empty, skip
-            continue;
+        posting_cursor temp2;                           // Walk over this word's postings
+        postings_of(temp1, &temp2);
 
         empty = 0;                                      // At least one entry exists
 
-        while (temp1 != NULL)                           // Traverse each mainnode (each word)
+        // Print primary row for the word (first file only)
+        printf("[%-2u]   %-20s %-10d",
+               cursor.bucket,                           // Bucket the word hashed to
+               temp1->word,                             // The word
+               temp1->file_count);                      // Number of files containing this word
+
+        if (next_posting(&temp2) == SUCCESS)            // If at least one file entry exists
+        {
+            printf(" | File:%-15s : %d\n",
+                   document_name(table, temp2.file_id),   // File name
+                   temp2.word_count);                   // Count in that file
+        }
+        else
+        {
+            printf("\n");                               // No postings, end row
+        }
+
+        // Print additional file entries for same word
+        while (next_posting(&temp2) == SUCCESS)
         {
-            subnode *temp2 = temp1->sublink;            // First subnode for this word
-
-            // Print primary row for the word (first file only)
-            printf("[%-2d]   %-20s %-10d",
-                   table[i].index,                      // Index (0-26)
-                   temp1->word,                         // The word
-                   temp1->file_count);                  // Number of files containing this word
-
-            if (temp2)                                  // If at least one file entry exists
-            {
-                printf(" | File:%-15s : %d\n",
-                       temp2->file_name,                // File name
-                       temp2->word_count);              // Count in that file
-                temp2 = temp2->sub_sublink;             // Move to next subnode
-            }
-            else
-            {
-                printf("\n");                           // No subnodes, end row
-            }
-
-            // Print additional file entries for same word
-            while (temp2 != NULL)
-            {
-                printf("       %-20s %-10s | File:%-15s : %d\n",
-                       "",                              // Indentation placeholders
-                       "",
-                       temp2->file_name,                // File name
-                       temp2->word_count);              // Word count in that file
-
-                temp2 = temp2->sub_sublink;             // Move to next file
-            }
-
-            printf("\n");                               // Blank line between words
-            temp1 = temp1->main_next_link;              // Move to next word in the bucket
+            printf("       %-20s %-10s | File:%-15s : %d\n",
+                   "",                                  // Indentation placeholders
+                   "",
+                   document_name(table, temp2.file_id),   // File name
+                   temp2.word_count);                   // Word count in that file
         }
+
+        printf("\n");                                   // Blank line between words
     }
 
     if (empty)
@@ -88,3 +79,48 @@ void display_database(hashtable *table)
 
     printf("---------------------------------------------------------------------\n");
 }
+
+
+/*****************************************************************************************************
+ * Function       : display_index
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Same table as display_database(), read from a mapped index file. Words come out in sorted
+ *      order and the index column is the word's position in the dictionary.
+ *
+ * Returns        :
+ *      Nothing. Only prints output to console.
+ *****************************************************************************************************/
+void display_index(disk_index *index)
+{
+    printf("--------------------------->> DATABASE <<----------------------------\n");
+    printf("---------------------------------------------------------------------\n");
+    printf("Index   Word         File Count          File Details\n");
+    printf("---------------------------------------------------------------------\n");
+
+    for (unsigned int i = 0; i < index->term_count; i++)
+    {
+        const disk_term *t = &index->term[i];
+        posting_cursor p;
+
+        printf("[%-2u]   %-20s %-10u", i, index_word(index, t), t->file_count);
+
+        index_postings(index, t, &p);
+        if (next_posting(&p) == SUCCESS)
+            printf(" | File:%-15s : %d\n", index_document(index, p.file_id), p.word_count);
+        else
+            printf("\n");
+        while (next_posting(&p) == SUCCESS)
+        {
+            printf("       %-20s %-10s | File:%-15s : %d\n", "", "",
+                   index_document(index, p.file_id), p.word_count);
+        }
+
+        printf("\n");                                   // Blank line between words
+    }
+
+    if (index->term_count == 0)
+        printf("Database is empty!\n");
+
+    printf("---------------------------------------------------------------------\n");
+}
@@ -0,0 +1,467 @@
+/*****************************************************************************************************
+ * File           : doctable.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Document table of the database. Every indexed file is given a small integer id in the order
+ *      it is registered; postings store that id instead of a copy of the file name, and the name is
+ *      looked up only when something is printed or saved.
+ *
+ * Why it’s needed:
+ *      A posting used to carry a 100-byte file name and was matched with strcmp. With an id, a
+ *      posting is a few bytes and matching the current file is an integer compare.
+ *
+ * Layout         :
+ *      name[]  - File name of each id, allocated from the table's arena; NULL once the document
+ *                has been removed. Ids are never reused.
+ *      stamp[] - Size and modification time of each file when it was indexed, compared against
+ *                the file on disk to find documents that need re-indexing.
+ *      length[]- Number of words in each document, for BM25 length normalization (rank.c);
+ *                total_length sums them over the documents not removed.
+ *      slot[]  - Linear-probing index from name hash to id, so reloading a backup can map the
+ *                names it reads back to ids without scanning the whole table.
+ *      words[] - Forward index: the words each document contains. Only built the first time a
+ *                document is removed (one pass over the postings, one pointer per posting),
+ *                then kept up to date by insert_posting(), so later removals only touch the
+ *                removed documents' words.
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "inverted_search.h"
+
+
+/*****************************************************************************************************
+ * Function       : init_doctable
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Sets up an empty document table. Arrays are allocated on the first add_document().
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void init_doctable(doctable *docs)
+{
+    docs->name = NULL;
+    docs->stamp = NULL;
+    docs->length = NULL;
+    docs->words = NULL;
+    docs->slot = NULL;
+    docs->count = 0;
+    docs->live = 0;
+    docs->total_length = 0;
+    docs->capacity = 0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : free_doctable
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Frees the id arrays and the forward index. The names themselves live in the table's arena
+ *      and go with it.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void free_doctable(doctable *docs)
+{
+    drop_forward_index(docs);
+    free(docs->name);
+    free(docs->stamp);
+    free(docs->length);
+    free(docs->slot);
+    init_doctable(docs);
+}
+
+
+/*****************************************************************************************************
+ * Function       : find_document
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Probes the name index for the file name.
+ *
+ * Returns        :
+ *      The document id, or -1 if the file is not in the table.
+ *****************************************************************************************************/
+int find_document(doctable *docs, const char *filename)
+{
+    if (docs->count == 0)
+        return -1;
+
+    unsigned int mask = docs->capacity * 2 - 1;
+    unsigned int pos = hash_word(filename) & mask;
+
+    while (docs->slot[pos] >= 0)
+    {
+        if (strcmp(docs->name[docs->slot[pos]], filename) == 0)
+            return docs->slot[pos];
+        pos = (pos + 1) & mask;
+    }
+    return -1;
+}
+
+
+/*****************************************************************************************************
+ * Function       : index_names
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Fills a name index of 'size' slots (a power of two) with every document not removed.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void index_names(doctable *docs, int *slot, int size)
+{
+    unsigned int mask = size - 1;
+
+    for (int i = 0; i < size; i++)
+        slot[i] = -1;
+
+    for (int id = 0; id < docs->count; id++)
+    {
+        if (docs->name[id] == NULL)
+            continue;
+        unsigned int pos = hash_word(docs->name[id]) & mask;
+        while (slot[pos] >= 0)
+            pos = (pos + 1) & mask;
+        slot[pos] = id;
+    }
+}
+
+
+/*****************************************************************************************************
+ * Function       : grow_doctable
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Doubles the per-id arrays and rebuilds the name index at twice that size, which keeps the
+ *      index at most half full.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if an allocation failed (the table is left usable).
+ *****************************************************************************************************/
+static int grow_doctable(doctable *docs)
+{
+    int capacity = docs->capacity ? docs->capacity * 2 : 16;
+    int *slot = malloc(capacity * 2 * sizeof(int));
+    char **name = realloc(docs->name, capacity * sizeof(char *));
+    if (name)
+        docs->name = name;
+    doc_stamp *stamp = realloc(docs->stamp, capacity * sizeof(doc_stamp));
+    if (stamp)
+        docs->stamp = stamp;
+    int *length = realloc(docs->length, capacity * sizeof(int));
+    if (length)
+        docs->length = length;
+
+    if (slot == NULL || name == NULL || stamp == NULL || length == NULL)
+    {
+        free(slot);
+        return FAILURE;
+    }
+
+    if (docs->words)
+    {
+        doc_words *words = realloc(docs->words, capacity * sizeof(doc_words));
+        if (words == NULL)
+        {
+            free(slot);
+            return FAILURE;
+        }
+        memset(words + docs->capacity, 0, (capacity - docs->capacity) * sizeof(doc_words));
+        docs->words = words;
+    }
+
+    index_names(docs, slot, capacity * 2);
+    free(docs->slot);
+    docs->slot = slot;
+    docs->capacity = capacity;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : add_document
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Returns the id of the file, registering it with the next free id if it isn't known yet. The
+ *      name is copied into the table's arena; the stamp is left unknown (size -1) until the
+ *      caller records one.
+ *
+ * Returns        :
+ *      The document id, or -1 if memory ran out.
+ *****************************************************************************************************/
+int add_document(hashtable *table, const char *filename)
+{
+    doctable *docs = &table->docs;
+    int id = find_document(docs, filename);
+
+    if (id >= 0)
+        return id;
+
+    if (docs->count == docs->capacity && grow_doctable(docs) == FAILURE)
+    {
+        printf("ERROR: Couldn't grow document table\n");
+        return -1;
+    }
+
+    size_t len = strlen(filename) + 1;
+    char *copy = arena_alloc(&table->nodes, len);
+    if (copy == NULL)
+        return -1;
+    memcpy(copy, filename, len);
+
+    unsigned int mask = docs->capacity * 2 - 1;
+    unsigned int pos = hash_word(filename) & mask;
+    while (docs->slot[pos] >= 0)
+        pos = (pos + 1) & mask;
+
+    id = docs->count++;
+    docs->live++;
+    docs->name[id] = copy;
+    docs->stamp[id].size = -1;
+    docs->stamp[id].mtime = -1;
+    docs->length[id] = 0;
+    docs->slot[pos] = id;
+    return id;
+}
+
+
+/*****************************************************************************************************
+ * Function       : document_name
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Resolves a document id back to its file name.
+ *
+ * Returns        :
+ *      The file name, or "?" for an id the table doesn't know or a removed document.
+ *****************************************************************************************************/
+const char* document_name(hashtable *table, int file_id)
+{
+    if (file_id < 0 || file_id >= table->docs.count || table->docs.name[file_id] == NULL)
+        return "?";
+    return table->docs.name[file_id];
+}
+
+
+/*****************************************************************************************************
+ * Function       : set_document_length
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Records the number of words of a document, keeping total_length in step.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void set_document_length(doctable *docs, int file_id, int length)
+{
+    docs->total_length += (long long)length - docs->length[file_id];
+    docs->length[file_id] = length;
+}
+
+
+/*****************************************************************************************************
+ * Function       : read_stamp
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Reads the size and modification time (in nanoseconds) of a file.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the file can't be examined (for instance, it was deleted).
+ *****************************************************************************************************/
+int read_stamp(const char *filename, doc_stamp *stamp)
+{
+    struct stat st;
+
+    if (stat(filename, &st) != 0)
+        return FAILURE;
+    stamp->size = st.st_size;
+    stamp->mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : note_document_word
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Appends a word to a document's forward index entry. Does nothing while the forward index
+ *      hasn't been built.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out (the forward index is then dropped, to be rebuilt
+ *      when next needed).
+ *****************************************************************************************************/
+int note_document_word(doctable *docs, int file_id, mainnode *mnode)
+{
+    if (docs->words == NULL || file_id < 0 || file_id >= docs->count)
+        return SUCCESS;
+
+    doc_words *list = &docs->words[file_id];
+    if (list->count == list->capacity)
+    {
+        unsigned int capacity = list->capacity ? list->capacity * 2 : 64;
+        mainnode **word = realloc(list->word, capacity * sizeof(mainnode *));
+        if (word == NULL)
+        {
+            drop_forward_index(docs);
+            return FAILURE;
+        }
+        list->word = word;
+        list->capacity = capacity;
+    }
+    list->word[list->count++] = mnode;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : drop_forward_index
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Frees the forward index. Anything that adds postings without going through
+ *      insert_posting() (the parallel merge) drops it so it is never stale.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void drop_forward_index(doctable *docs)
+{
+    if (docs->words == NULL)
+        return;
+    for (int id = 0; id < docs->count; id++)
+        free(docs->words[id].word);
+    free(docs->words);
+    docs->words = NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : build_forward_index
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Decodes every word's postings once and records the word under each document it lists.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+int build_forward_index(hashtable *table)
+{
+    doctable *docs = &table->docs;
+    table_cursor cursor;
+    posting_cursor p;
+
+    if (docs->words)
+        return SUCCESS;
+
+    docs->words = calloc(docs->capacity ? docs->capacity : 1, sizeof(doc_words));
+    if (docs->words == NULL)
+        return FAILURE;
+
+    for (mainnode *m = first_mainnode(table, &cursor); m != NULL; m = next_mainnode(table, &cursor))
+    {
+        postings_of(m, &p);
+        while (next_posting(&p) == SUCCESS)
+        {
+            if (note_document_word(docs, p.file_id, m) == FAILURE)
+                return FAILURE;
+        }
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : compare_nodes
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      qsort() comparator ordering mainnode pointers by address, so duplicates end up adjacent.
+ *
+ * Returns        :
+ *      <0, 0 or >0.
+ *****************************************************************************************************/
+static int compare_nodes(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)*(mainnode * const *)a;
+    uintptr_t y = (uintptr_t)*(mainnode * const *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/*****************************************************************************************************
+ * Function       : remove_documents
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Drops 'n' documents from the index. The words they contain are gathered from the forward
+ *      index and deduplicated, each word's postings are re-encoded once without any of the
+ *      documents, words left without postings are unlinked from the table, and the ids are
+ *      retired. A file name can be registered again afterwards under a new id, which is how a
+ *      changed file is re-indexed.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out (the documents are then not retired).
+ *****************************************************************************************************/
+int remove_documents(hashtable *table, const int *ids, int n)
+{
+    doctable *docs = &table->docs;
+    size_t total = 0;
+
+    if (n == 0)
+        return SUCCESS;
+    if (build_forward_index(table) == FAILURE)
+    {
+        printf("ERROR: Couldn't build forward index\n");
+        return FAILURE;
+    }
+
+    unsigned char *removed = calloc(docs->count, 1);
+    for (int i = 0; i < n; i++)
+        total += docs->words[ids[i]].count;
+    mainnode **word = malloc((total ? total : 1) * sizeof(mainnode *));
+    if (removed == NULL || word == NULL)
+    {
+        printf("ERROR: Couldn't allocate removal state\n");
+        free(removed);
+        free(word);
+        return FAILURE;
+    }
+
+    total = 0;
+    for (int i = 0; i < n; i++)
+    {
+        doc_words *list = &docs->words[ids[i]];
+
+        removed[ids[i]] = 1;
+        memcpy(word + total, list->word, list->count * sizeof(mainnode *));
+        total += list->count;
+    }
+    qsort(word, total, sizeof(mainnode *), compare_nodes);
+
+    int status = SUCCESS;
+    for (size_t i = 0; i < total && status == SUCCESS; i++)
+    {
+        if (i && word[i] == word[i - 1])
+            continue;
+        status = remove_postings(&table->nodes, word[i], removed);
+        if (word[i]->file_count == 0)
+            unlink_mainnode(table, word[i]);
+    }
+
+    for (int i = 0; i < n && status == SUCCESS; i++)
+    {
+        doc_words *list = &docs->words[ids[i]];
+
+        free(list->word);
+        memset(list, 0, sizeof(*list));
+        docs->name[ids[i]] = NULL;
+        docs->live--;
+        docs->total_length -= docs->length[ids[i]];
+    }
+    if (status == SUCCESS)
+        index_names(docs, docs->slot, docs->capacity * 2);
+
+    free(removed);
+    free(word);
+    return status;
+}
@@ -1,94 +1,1038 @@
 #ifndef INVERTED_SEARCH_H
 #define INVERTED_SEARCH_H
 
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
 #define SUCCESS 1     // Indicates successful operation
 #define FAILURE 0     // Indicates failed operation
 
+#define HASH_INITIAL_SIZE 16   // Buckets allocated by init_hashtable (power of two)
+#define HASH_MAX_LOAD     1    // Grow once words per bucket exceeds this
+#define HASH_REHASH_STEP  4    // Buckets migrated per insert while a resize is in progress
+
+#define DICT_INITIAL_SLOTS 64  // Probe slots allocated by init_hashtable (FLAT_DICT build)
+#define DICT_PREFIX_LEN    8   // Leading word bytes kept inline in each probe slot
+#define DICT_SECTION_SHIFT 12  // Words per save-file section is 1 << this (FLAT_DICT build)
+
+#define ARENA_CHUNK_SIZE (256 * 1024)   // Bytes per arena chunk
+
+#define MAX_TOKEN_LEN 255      // Longer runs are split, at a UTF-8 character boundary
+#define TOKEN_SCAN "%255s"     // scanf() conversion reading at most MAX_TOKEN_LEN bytes
+
+#define ANALYZE_FOLD  0x1u      // Token analysis: fold upper case to lower case
+#define ANALYZE_TRIM  0x2u      // Token analysis: strip punctuation from both ends
+#define ANALYZE_STOP  0x4u      // Token analysis: drop stopwords
+#define ANALYZE_STEM  0x8u      // Token analysis: Porter stemming
+#define ANALYZE_ALL   0xFu      // Every step ("-a all")
+
+#define QUERY_MAX_NODES  64     // Words and operators in one boolean query
+#define QUERY_MAX_LEN    256    // Characters of a query read at the menu
+#define BATCH_LINE_MAX   65536  // Longest line of a "query --batch" file
+#define QUERY_MAX_PHRASE 16     // Words in one quoted phrase
+#define QUERY_NEAR_DEFAULT 10   // Distance of a NEAR written without "/k"
+
+#define LEXICON_BLOCK    16     // Words per front-coded block of the sorted dictionary
+#define FUZZY_MAX_LEN    64     // Longest word a fuzzy lookup takes
+#define FUZZY_MAX_EDITS  3      // Most edits a fuzzy lookup allows
+#define MATCHES_SHOWN    30     // Words listed by a pattern search at the menu
+
+#define METRIC_BUCKETS   40     // Histogram buckets: 0, 1, 2-3, 4-7, ... up to 2^38 and above
+#define METRICS_FILE     "metrics.json" // Written by the menu's metrics option
+
+#define SERVER_SOCKET    "inverted_search.sock" // Default Unix socket of the query server (server.c)
+#define SERVER_THREADS   4      // Default worker threads of the query server
+#define SERVER_LINE_MAX  4096   // Longest request line, newline included
+#define SERVER_TOP_K     100    // Most files a RANK request can ask for
+#define SERVER_TURN_LINES 64    // Requests of one connection a worker answers before serving others
+#define SERVER_TURN_BYTES 65536 // Response bytes after which a worker sends and moves on
+#define LOADGEN_REQUESTS 20000  // Requests sent per client count by the load generator
+
+#define CACHE_BYTES      (16 << 20) // Default budget of a result cache (cache.c)
+#define CACHE_BUCKETS    256    // Initial buckets of a result cache (power of two)
+#define CACHE_KEY_MAX    (SERVER_LINE_MAX + 16) // Longest cache key of a server request
+
+#define SEGMENT_DIR      "segments"     // Default directory of a segmented index (segment.c)
+#define SEGMENT_MANIFEST "MANIFEST"     // File naming the live segments and their deleted documents
+#define SEGMENT_FANIN    4      // Segments of one tier merged into one
+#define SEGMENT_TIER_BASE 4096  // Postings of a tier-0 segment; each tier is SEGMENT_FANIN times larger
+
+#define RANK_TOP_K       10     // Files listed by a ranked search at the menu
+#define RANK_MAX_TERMS   32     // Words in one ranked search
+#define BM25_K1          1.2    // Term frequency saturation
+#define BM25_B           0.75   // Document length normalization
+
+#define INDEX_FILE       "backup.idx"   // Binary index written by save_index()
+#define TEXT_FILE        "backup.txt"   // Text export written by save_database()
+#define SAVE_BUFFER      (1 << 20)      // Output buffer of save_database()
+#define INDEX_MAGIC      "INVINDEX"     // First 8 bytes of every index file
+#define INDEX_VERSION    5              // Bumped whenever the layout changes
+#define INDEX_BYTE_ORDER 0x01020304u    // Read back byte-swapped on a host of the other endianness
+#define INDEX_POSITIONS  0x1u           // Header flag: SECTION_POSITIONS holds word positions
+#define INDEX_ANALYSIS_SHIFT 8          // Header flags: the ANALYZE_* steps of the words, from this bit
+
 
 // Node storing a single file name in a linked list of files
 typedef struct filenode
 {
-    char filename[100];         // File name
     struct filenode *link;      // Pointer to next file
+    char filename[];            // File name, allocated with the node
 } filenode;
 
 
-// One bucket of the hash table (0–26)
+// One block of arena memory; allocations are bump-allocated from data[]
+typedef struct arena_chunk
+{
+    struct arena_chunk *next;    // Previously filled chunk
+    size_t size;                 // Usable bytes in data[]
+    size_t used;                 // Bytes handed out so far
+    char data[];
+} arena_chunk;
+
+
+// Region allocator: nodes are carved out of chunks and freed all at once
+typedef struct arena
+{
+    arena_chunk *head;           // Chunk currently being filled
+    unsigned long chunks;        // Chunks allocated (malloc calls made)
+    size_t bytes;                // Bytes handed out
+} arena;
+
+
+// Input file opened for zero-copy tokenizing (see tokenizer.c)
+typedef struct tokenizer
+{
+    const char *data;            // File contents (mapped or read into memory)
+    size_t size;                 // Bytes in data
+    size_t pos;                  // Scan position
+    int mapped;                  // 1 if data is an mmap, 0 if it is a heap buffer
+    int use_simd;                // Use the SSE2 classifier when compiled in
+} tokenizer;
+
+
+// Size and modification time of a file when it was indexed
+typedef struct doc_stamp
+{
+    long long size;              // Bytes, -1 when unknown (the file is then re-indexed on update)
+    long long mtime;             // Nanoseconds since the epoch
+} doc_stamp;
+
+
+// Words of one document (forward index entry, see doctable.c)
+typedef struct doc_words
+{
+    struct mainnode **word;      // Every word with a posting for the document
+    unsigned int count;          // Entries used in word
+    unsigned int capacity;       // Entries allocated in word
+} doc_words;
+
+
+// Document table: maps file names to small integer ids and back
+typedef struct doctable
+{
+    char **name;                 // File name of each document id, NULL once removed
+    doc_stamp *stamp;            // File state of each document when indexed
+    int *length;                 // Words in each document
+    doc_words *words;            // Forward index, NULL until a document is removed
+    int *slot;                   // Name hash index into name[], -1 when free
+    int count;                   // Number of document ids handed out
+    int live;                    // Documents not removed
+    long long total_length;      // Words in the documents not removed
+    int capacity;                // Entries allocated in name (slot has twice as many)
+} doctable;
+
+
+// Words of a table in bytewise order, front coded (see lexicon.c). Built when a pattern
+// lookup or a save needs it, and dropped as soon as a word is added or removed.
+typedef struct lexicon
+{
+    struct mainnode **node;      // Mainnode of each word, in order
+    unsigned int count;          // Words
+    unsigned char *bytes;        // Entries: shared prefix length, suffix length, suffix bytes
+    size_t size;                 // Bytes used in bytes
+    unsigned int *block;         // Offset in bytes of every LEXICON_BLOCK-th entry (a whole word)
+} lexicon;
+
+
+#ifdef FLAT_DICT
+
+// One probe slot of the open-addressing term dictionary. Slots are 16 bytes, so
+// a probe sequence stays within one or two cache lines; the leading bytes of
+// the word let most comparisons finish without touching the string pool.
+typedef struct dict_slot
+{
+    unsigned int hash;           // hash_word() of the term
+    unsigned int id;             // Term id (index into node/word_off), DICT_EMPTY if free
+    char prefix[DICT_PREFIX_LEN];  // First bytes of the word, zero padded
+} dict_slot;
+
+#define DICT_EMPTY 0xFFFFFFFFu
+
+
+// Word hash table, FLAT_DICT layout. A Robin Hood probe array maps hashes to
+// term ids; term ids index the mainnode pointers and the word bytes, which are
+// packed back to back in a string pool. Ids are handed out in insertion order.
+typedef struct hashtable
+{
+    dict_slot *slot;             // Probe array, a power of two in length
+    unsigned int mask;           // Number of slots - 1
+    struct mainnode **node;      // Mainnode of each term id, NULL once unlinked
+    unsigned int *word_off;      // Offset of each term's bytes in pool
+    unsigned int capacity;       // Entries allocated in node/word_off
+    char *pool;                  // NUL-terminated words, back to back
+    size_t pool_len;             // Bytes used in pool
+    size_t pool_cap;             // Bytes allocated for pool
+    unsigned int count;          // Number of distinct words stored
+    unsigned int next_id;        // Term ids handed out (count plus unlinked words)
+    int positional;              // 1 if word positions are recorded (see positions.c)
+    unsigned int analysis;       // ANALYZE_* steps applied to tokens before indexing (see analyzer.c)
+    lexicon *sorted;             // Sorted words, NULL until needed and after any word change
+    unsigned long generation;    // Bumped by every build, update and reload (see cache.c)
+    arena nodes;                 // Owns every mainnode, posting block and file name of the table
+    doctable docs;               // Ids of the indexed files
+} hashtable;
+
+#else
+
+// Word hash table. Buckets are chains of mainnodes selected by a hash over the
+// whole word. The table doubles once the load factor passes HASH_MAX_LOAD; the
+// old buckets are migrated a few at a time by later inserts, so no single
+// insert pays for a full rehash.
 typedef struct hashtable
 {
-    int index;                  // Bucket index
-    struct mainnode *link;      // Pointer to first word in this bucket
+    struct mainnode **bucket[2]; // [0] live buckets, [1] resize target while rehashing
+    unsigned int size[2];        // Number of buckets in each array (powers of two)
+    unsigned int count;          // Number of distinct words stored
+    long rehash_index;           // Next bucket of bucket[0] to migrate, -1 when idle
+    int positional;              // 1 if word positions are recorded (see positions.c)
+    unsigned int analysis;       // ANALYZE_* steps applied to tokens before indexing (see analyzer.c)
+    lexicon *sorted;             // Sorted words, NULL until needed and after any word change
+    unsigned long generation;    // Bumped by every build, update and reload (see cache.c)
+    arena nodes;                 // Owns every mainnode, posting block and file name of the table
+    doctable docs;               // Ids of the indexed files
 } hashtable;
 
+#endif
+
+
+// Sections of a binary index file
+enum
+{
+    SECTION_TERMS,               // disk_term per word, sorted by word
+    SECTION_WORDS,               // NUL-terminated words, in term order
+    SECTION_POSTINGS,            // Encoded postings, one run per term
+    SECTION_POSITIONS,           // Encoded word positions, one run per term (INDEX_POSITIONS only)
+    SECTION_DOCS,                // disk_doc per document, in id order
+    SECTION_NAMES,               // NUL-terminated document names, in id order
+    INDEX_SECTIONS
+};
+
+
+// Where a section lies in the index file and the checksum of its bytes
+typedef struct index_section
+{
+    uint64_t offset;             // From the start of the file, 8-byte aligned
+    uint64_t length;             // In bytes
+    uint64_t checksum;           // Checksum of the section's bytes (see disk_index.c)
+} index_section;
+
+
+// Fixed header at offset 0 of an index file
+typedef struct index_header
+{
+    char magic[8];               // INDEX_MAGIC
+    uint32_t version;            // INDEX_VERSION
+    uint32_t byte_order;         // INDEX_BYTE_ORDER as stored by the writer
+    uint32_t term_count;         // Distinct words
+    uint32_t doc_count;          // Documents
+    uint64_t posting_count;      // (word, document) pairs
+    uint32_t flags;              // INDEX_POSITIONS, analysis steps << INDEX_ANALYSIS_SHIFT
+    uint32_t reserved;           // Zero
+    index_section section[INDEX_SECTIONS];
+    uint64_t checksum;           // Checksum of every header byte before this field
+} index_header;
+
+
+// Dictionary entry of one word in an index file
+typedef struct disk_term
+{
+    uint64_t prefix;             // First 8 word bytes as a big-endian key, zero padded
+    uint64_t postings_off;       // Offset of the first posting in SECTION_POSTINGS
+    uint32_t word_off;           // Offset of the word in SECTION_WORDS
+    uint32_t word_len;           // Length of the word, without the NUL
+    uint32_t file_count;         // Number of postings
+    uint32_t postings_len;       // Bytes of encoded postings
+    uint32_t max_count;          // Largest occurrence count among the postings
+    uint32_t positions_len;      // Bytes of encoded positions
+    uint64_t positions_off;      // Offset of the first position in SECTION_POSITIONS
+} disk_term;
+
+
+// Document entry in an index file
+typedef struct disk_doc
+{
+    uint32_t name_off;           // Offset of the name in SECTION_NAMES
+    uint32_t length;             // Words in the document
+    int64_t size;                // doc_stamp of the file when indexed
+    int64_t mtime;
+} disk_doc;
+
+
+// Index file mapped read-only; queried in place without building any nodes
+typedef struct disk_index
+{
+    const unsigned char *base;   // Start of the mapping
+    size_t size;                 // Bytes mapped
+    const disk_term *term;       // Sorted dictionary
+    unsigned int term_count;     // Entries in term
+    const char *words;           // SECTION_WORDS
+    size_t words_len;            // Bytes in words
+    const unsigned char *postings; // SECTION_POSTINGS
+    size_t postings_len;         // Bytes in postings
+    const unsigned char *positions; // SECTION_POSITIONS
+    size_t positions_len;        // Bytes in positions
+    int positional;              // 1 if the file has word positions
+    unsigned int analysis;       // ANALYZE_* steps its words went through
+    uint64_t posting_count;      // (word, document) pairs
+    const disk_doc *doc;         // SECTION_DOCS
+    unsigned int doc_count;      // Entries in doc
+    const char *names;           // SECTION_NAMES
+    size_t names_len;            // Bytes in names
+    double avg_length;           // Mean words per document
+} disk_index;
+
 
-// Stores a unique word and the list of files containing it
+// Slot of one reader thread of an index_snapshot, alone on its cache line
+typedef struct snapshot_reader
+{
+    unsigned long epoch;         // Epoch the reader entered at, 0 while it holds no version
+    char pad[64 - sizeof(unsigned long)];
+} snapshot_reader;
+
+
+// One cached result: key and value stored behind the header (see cache.c)
+typedef struct cache_entry
+{
+    struct cache_entry *chain;   // Next entry in the same bucket
+    struct cache_entry *next;    // Clock circle, in insertion order
+    struct cache_entry *prev;
+    uint64_t hash;               // Of the key
+    unsigned long generation;    // Index generation the result was computed on
+    size_t key_len;              // Key bytes, NUL not counted
+    size_t value_len;            // Value bytes
+    int referenced;              // CLOCK bit: set by a hit, cleared as the hand passes
+    char data[];                 // Key, NUL, value
+} cache_entry;
+
+
+// Results of recent requests within a budget of bytes, evicted by CLOCK (see cache.c)
+typedef struct result_cache
+{
+    cache_entry **bucket;        // Chained hash of the keys
+    unsigned int buckets;        // Power of two
+    cache_entry *hand;           // Next entry the clock looks at, NULL when empty
+    unsigned long count;         // Entries
+    size_t bytes;                // Charged to the entries (headers, keys, values)
+    size_t limit;                // Budget of bytes
+    unsigned long hits, misses;  // Lookups answered and not
+    unsigned long stale;         // Entries dropped because the index changed
+    unsigned long inserts, evictions;
+    pthread_mutex_t lock;
+} result_cache;
+
+
+// Current version of a mapped index, replaced while readers run (see snapshot.c)
+typedef struct index_snapshot
+{
+    disk_index *current;         // Version readers enter (swapped atomically)
+    unsigned long epoch;         // Bumped by every publish; starts at 1
+    snapshot_reader *reader;     // One slot per reader thread
+    int readers;                 // Entries in reader
+} index_snapshot;
+
+
+// Deleted documents of one segment, shared by the views that agree on them (see segment.c)
+typedef struct tombstones
+{
+    int refs;                    // Views pointing here
+    unsigned int count;          // Documents flagged
+    long long length;            // Words in those documents
+    unsigned char flag[];        // 1 for each deleted document id of the segment
+} tombstones;
+
+
+// Immutable part of a segmented index: one index file, mapped (see segment.c)
+typedef struct segment
+{
+    unsigned long id;            // Names its file, seg_<id>.idx
+    disk_index index;
+    long long length;            // Words in all its documents
+    int refs;                    // Views holding it
+    int obsolete;                // Merged away: the file is removed when the last view lets go
+} segment;
+
+
+// A segment as one view sees it
+typedef struct segment_part
+{
+    segment *seg;
+    tombstones *deleted;         // NULL while none of its documents is deleted
+    int base;                    // View id of the segment's document 0
+} segment_part;
+
+
+// The segments of a segmented index at one moment. Never changed once published; a commit
+// publishes a new view, and a view is freed when the last reader holding it lets go.
+typedef struct segment_view
+{
+    int refs;                    // The set while it is current, plus every reader holding it
+    int count;                   // Segments
+    unsigned int docs;           // View ids handed out (deleted documents included)
+    unsigned int live;           // Documents not deleted
+    double avg_length;           // Mean words per live document
+    unsigned long generation;    // Bumped by every commit
+    segment_part part[];         // In view id order
+} segment_view;
+
+
+// Index made of immutable segments: new files are added as a new segment, deleted ones are
+// flagged in their segment, and a merger thread combines segments of one tier (see segment.c)
+typedef struct segment_set
+{
+    char dir[4096];              // Directory of the segment files and the manifest
+    int positional;              // Segments record word positions
+    unsigned int analysis;       // ANALYZE_* steps of every segment
+    unsigned long next_id;       // Id of the next segment file
+    segment_view *current;       // View new readers get
+    pthread_mutex_t lock;        // Guards current and every reference count
+    pthread_mutex_t commit;      // One commit (ingest, removal, merge) at a time; the manifest
+    pthread_cond_t wake;         // Signals the merger that a commit happened or it must stop
+    pthread_t merger;
+    int merging;                 // 1 while the merger thread runs
+    int stopping;                // close_segments() asked the merger to finish
+    unsigned long merges;        // Merges committed
+    unsigned long merged;        // Segments they replaced
+    double merge_seconds;        // Time spent merging
+} segment_set;
+
+
+// Position of a walk over every word in the table (see first_mainnode)
+typedef struct table_cursor
+{
+    int array;                   // Which bucket array is being walked (0 or 1)
+    unsigned int bucket;         // Current bucket (FLAT_DICT: section of term ids)
+    unsigned int position;       // Current term id (FLAT_DICT only)
+    struct mainnode *node;       // Current word
+} table_cursor;
+
+
+// Block of compressed postings: (document id gap, count) varint pairs (see postings.c)
+typedef struct posting_block
+{
+    struct posting_block *next;  // Next block of the same word
+    int base;                    // Document id the block's first gap is relative to
+    unsigned short size;         // Bytes allocated in data[]
+    unsigned short used;         // Bytes filled
+    unsigned char data[];
+} posting_block;
+
+
+// Word positions of one word: for each of its postings in document order, as many varints as
+// the posting's count, the first position in the document and then the gaps (see positions.c)
+typedef struct position_list
+{
+    posting_block *block;        // Encoded bytes; a varint may continue in the next block
+    posting_block *tail;         // Block being appended to
+    int last_doc;                // Document of the newest position, -1 if none
+    int last_pos;                // Newest position in that document
+} position_list;
+
+
+// Stores a unique word and the list of files containing it. The word's bytes follow the node
+// in the same arena allocation, so a node takes only as much room as its word needs.
 typedef struct mainnode
 {
-    char word[30];              // The word being indexed
+    unsigned int hash;          // hash_word(word), kept for rehashing and fast compares
     int file_count;             // Number of files containing this word
-    struct subnode *sublink;    // Linked list of file details
+    int last_id;                // Document id of the newest posting, kept unencoded
+    int last_count;             // Occurrences in that document
+    int coded_id;               // Document id of the last posting encoded in the blocks
+    int max_count;              // Largest count among the encoded postings (see term_max_count)
+    posting_block *block;       // Encoded postings before the newest one, in document id order
+    posting_block *tail;        // Block being appended to
+    position_list *positions;   // Word positions, NULL unless the table is positional
     struct mainnode *main_next_link;   // Next word in same hash bucket
+    unsigned int len;           // Length of the word, without the NUL
+    char word[];                // The word being indexed, NUL-terminated
 } mainnode;
 
 
-// Stores file-specific details for a word
-typedef struct subnode
+// Position of a walk over one word's postings (see postings_of / next_posting)
+typedef struct posting_cursor
+{
+    const posting_block *block;  // Next block to decode
+    const unsigned char *pos;    // Next encoded byte
+    const unsigned char *end;    // End of the bytes being decoded
+    int prev;                    // Document id the next gap is added to
+    int tail_id;                 // Unencoded newest posting, returned last
+    int tail_count;
+    int has_tail;                // 1 until the newest posting has been returned
+    int file_id;                 // Current posting: document id
+    int word_count;              // Current posting: occurrences in that document
+} posting_cursor;
+
+
+// Position of a walk over a word's positions (see positions_of / read_positions)
+typedef struct position_cursor
+{
+    const posting_block *block;  // Next block to read
+    const unsigned char *pos;    // Next encoded byte
+    const unsigned char *end;    // End of the bytes being read
+} position_cursor;
+
+
+// Node types of a parsed boolean query
+enum { QUERY_TERM, QUERY_AND, QUERY_OR, QUERY_NOT, QUERY_PHRASE, QUERY_NEAR, QUERY_PATTERN };
+
+
+// One word or operator of a parsed query
+typedef struct query_node
+{
+    int type;                    // QUERY_TERM, ..., QUERY_PATTERN (a wildcard or fuzzy word)
+    int left;                    // Operand (node index); the only one of QUERY_NOT
+    int right;                   // Second operand of QUERY_AND / QUERY_OR
+    const char *word;            // QUERY_TERM: the word; QUERY_PHRASE / QUERY_NEAR: the words
+    size_t len;                  // Length of 'word'
+    int distance;                // QUERY_NEAR: largest number of positions between the two words
+} query_node;
+
+
+// Boolean query parsed into an operator tree held in one array (see query.c)
+typedef struct query
+{
+    query_node node[QUERY_MAX_NODES];
+    int count;                   // Nodes used
+    int root;                    // Top node
+} query;
+
+
+// Sorted document ids matching a query
+typedef struct doc_list
+{
+    int *id;                     // Ascending document ids
+    int count;                   // Entries used
+    int capacity;                // Entries allocated
+} doc_list;
+
+
+// A word found by a prefix, wildcard or fuzzy lookup
+typedef struct term_match
+{
+    const char *word;            // The word, in its mainnode or in the mapped file
+    mainnode *node;              // Table lookups: the word's mainnode
+    const disk_term *term;       // Index lookups: the word's dictionary entry
+    int file_count;              // Files containing the word
+    int distance;                // Fuzzy lookups: edits from the word looked up
+} term_match;
+
+
+// Words found by a lookup, in dictionary order
+typedef struct match_list
 {
-    char file_name[100];        // Name of file
-    int word_count;             // Number of occurrences in that file
-    struct subnode *sub_sublink; // Next file entry for same word
-} subnode;
+    term_match *match;
+    int count;                   // Entries used
+    int capacity;                // Entries allocated
+} match_list;
 
 
-// Initializes all 27 hash table buckets
-void init_hashtable(hashtable *table);
+// Document and BM25 score of a ranked search result
+typedef struct ranked_doc
+{
+    int file_id;
+    double score;
+} ranked_doc;
+
+
+// Counters of the metrics layer (see metrics.c)
+enum
+{
+    METRIC_FILES,                // Files indexed
+    METRIC_BYTES,                // Input bytes indexed
+    METRIC_TOKENS,               // Tokens read, before the analysis drops any
+    METRIC_LOOKUPS,              // Dictionary lookups (lookup_term)
+    METRIC_KEY_COMPARES,         // Stored words compared byte by byte during lookups
+    METRIC_RESIZES,              // Dictionary resizes started
+    METRIC_ARENA_ALLOCS,         // arena_alloc() calls
+    METRIC_ARENA_CHUNKS,         // Arena chunks malloc'ed
+    METRIC_ARENA_BYTES,          // Bytes handed out by arenas
+    METRIC_COUNTERS
+};
 
-// Computes hash index for a word based on first character
-int get_index(const char *word);
 
+// Histograms of the metrics layer: a timed phase each (nanoseconds per call), then the rest
+enum
+{
+    PHASE_INDEX,                 // index_files(): a whole build or the indexing part of an update
+    PHASE_FILE,                  // index_file(): reading and indexing one file
+    PHASE_MERGE,                 // Merging one worker's partial table
+    PHASE_SYNC,                  // sync_database()
+    PHASE_SAVE_INDEX,            // save_index()
+    PHASE_SAVE_TEXT,             // save_database()
+    PHASE_LOAD_TEXT,             // update_database()
+    PHASE_OPEN_INDEX,            // open_index()
+    PHASE_SEARCH,                // One word looked up by search_database() / search_index()
+    PHASE_QUERY,                 // run_query()
+    PHASE_RANK,                  // rank_documents()
+    PHASE_GRACE,                 // publish_snapshot() waiting for readers of the old version
+    PHASE_FLUSH,                 // ingest_files(): indexing new files into a segment
+    PHASE_COMPACT,               // Merging segments into one
+    METRIC_PHASES,
+    METRIC_PROBE_LENGTH = METRIC_PHASES,   // Chain links / probe slots visited per lookup
+    METRIC_HISTOGRAMS
+};
+
+
+// Distribution of a measurement in power-of-two buckets
+typedef struct metric_histogram
+{
+    uint64_t bucket[METRIC_BUCKETS];   // [0] = 0, [1] = 1, [b] = 2^(b-1) .. 2^b - 1
+    uint64_t count;              // Values recorded
+    uint64_t sum;                // Their total
+    uint64_t max;                // The largest
+} metric_histogram;
+
+
+// Metrics recorded by one thread; the blocks of all threads are summed when reported
+typedef struct metrics_block
+{
+    uint64_t counter[METRIC_COUNTERS];
+    metric_histogram histogram[METRIC_HISTOGRAMS];
+    struct metrics_block *next;  // Block of another thread
+} metrics_block;
+
+
+#ifdef METRICS
+extern __thread metrics_block *metrics_mine;
+#define METRICS_LOCAL()           (metrics_mine ? metrics_mine : metrics_register())
+#define METRIC_COUNT(id, n)       (METRICS_LOCAL()->counter[id] += (n))
+#define METRIC_SAMPLE(id, value)  metric_record(&METRICS_LOCAL()->histogram[id], (value))
+#define METRIC_START(name)        uint64_t name = metric_clock()
+#define METRIC_STOP(phase, name)  metric_record(&METRICS_LOCAL()->histogram[phase], metric_clock() - (name))
+#else
+#define METRIC_COUNT(id, n)       ((void)sizeof(n))          // Not evaluated: no code, no unused warnings
+#define METRIC_SAMPLE(id, value)  ((void)sizeof(value))
+#define METRIC_START(name)
+#define METRIC_STOP(phase, name)  ((void)0)
+#endif
+
+
+// Gives the calling thread its metrics block (METRICS builds)
+metrics_block* metrics_register(void);
+
+// Adds a value to a histogram
+void metric_record(metric_histogram *h, uint64_t value);
+
+// Monotonic clock in nanoseconds
+uint64_t metric_clock(void);
+
+// Prints the metrics, with the shape of the table or mapped index when one is given
+void print_metrics(hashtable *table, disk_index *index);
+
+// Writes the metrics as JSON to a file ("-" for standard error)
+int save_metrics(const char *filename, hashtable *table, disk_index *index);
+
+// Sets up an empty arena
+void arena_init(arena *pool);
+
+// Hands out memory from the arena's current chunk
+void* arena_alloc(arena *pool, size_t size);
+
+// Releases everything allocated from the arena
+void arena_free(arena *pool);
+
+// Moves every chunk of one arena into another
+void arena_adopt(arena *dst, arena *src);
+
+// Sets up an empty document table
+void init_doctable(doctable *docs);
+
+// Frees the document table's arrays
+void free_doctable(doctable *docs);
+
+// Finds the id of a registered file
+int find_document(doctable *docs, const char *filename);
+
+// Returns the id of a file, registering it if needed
+int add_document(hashtable *table, const char *filename);
+
+// Resolves a document id to its file name
+const char* document_name(hashtable *table, int file_id);
+
+// Records the number of words of a document
+void set_document_length(doctable *docs, int file_id, int length);
+
+// Reads the size and modification time of a file
+int read_stamp(const char *filename, doc_stamp *stamp);
+
+// Adds a word to a document's forward index entry, if the forward index exists
+int note_document_word(doctable *docs, int file_id, mainnode *mnode);
+
+// Frees the forward index
+void drop_forward_index(doctable *docs);
+
+// Builds the forward index from the postings
+int build_forward_index(hashtable *table);
+
+// Removes documents' postings and retires their ids
+int remove_documents(hashtable *table, const int *ids, int n);
+
+// Returns the table's words sorted and front coded, building them if needed
+lexicon* table_lexicon(hashtable *table);
+
+// Frees the table's sorted words; called whenever a word is added or removed
+void drop_lexicon(hashtable *table);
+
+// Checks whether a word is a wildcard ('*', '?') or fuzzy ("word~N") pattern; -1 if malformed
+int is_term_pattern(const char *word, size_t len);
+
+// Finds the words of the table or mapped index matching a wildcard or fuzzy pattern
+int match_terms(hashtable *table, disk_index *index, const char *pattern, size_t len, match_list *out);
+
+// Finds the words within max_edits edits of a word
+int match_fuzzy(hashtable *table, disk_index *index, const char *word, size_t len, int max_edits,
+                match_list *out);
+
+// Releases a lookup result
+void free_match_list(match_list *list);
+
+// Prints the words matching a pattern typed at the menu
+void expand_terms(hashtable *table, disk_index *index, const char *pattern);
+
+// Prints the words close to a word that isn't indexed
+void suggest_terms(hashtable *table, disk_index *index, const char *word);
+
+// Allocates the initial buckets of an empty hash table
+int init_hashtable(hashtable *table);
+
+// Releases the buckets and every node of the table
+void free_hashtable(hashtable *table);
+
+// Computes the hash of a word over all of its bytes
+unsigned int hash_bytes(const char *word, size_t len);
+
+// hash_bytes() of a NUL-terminated word
+unsigned int hash_word(const char *word);
+
+#ifndef FLAT_DICT
 // Searches for a word in a linked list of mainnodes
-mainnode* search_mainnode(mainnode *head, char *word);
+mainnode* search_mainnode(mainnode *head, const char *word, size_t len, unsigned int hash);
+#endif
+
+// Finds the mainnode for a 'len'-byte word anywhere in the table
+mainnode* lookup_term(hashtable *table, const char *word, size_t len);
+
+// Finds the mainnode for a NUL-terminated word
+mainnode* lookup_word(hashtable *table, const char *word);
+
+// Starts a walk over every word in the table
+mainnode* first_mainnode(hashtable *table, table_cursor *cursor);
+
+// Advances a walk started by first_mainnode
+mainnode* next_mainnode(hashtable *table, table_cursor *cursor);
 
 // Creates a new mainnode for a word
-mainnode* create_mainnode(char *word);
+mainnode* create_mainnode(arena *pool, const char *word, size_t len);
+
+// Links an existing mainnode for a new word into the table
+int link_mainnode(hashtable *table, mainnode *mnode);
+
+// Creates a mainnode for a new word and links it into the table
+mainnode* insert_mainnode(hashtable *table, const char *word, size_t len);
+
+// Takes a word out of the table (its node stays in the arena)
+void unlink_mainnode(hashtable *table, mainnode *mnode);
 
-// Creates a new subnode for a filename
-subnode* create_subnode(char *filename);
+// Encodes one posting as gap + count varints
+size_t encode_posting(unsigned char *out, uint32_t gap, uint32_t count);
 
-// Inserts or updates a subnode under a mainnode
-void insert_subnode(mainnode *mnode, char *filename);
+// Adds occurrences in a document to a word's postings
+int add_posting(arena *pool, mainnode *mnode, int file_id, int word_count);
+
+// Removes flagged documents from a word's postings
+int remove_postings(arena *pool, mainnode *mnode, const unsigned char *removed);
+
+// Appends postings of later documents from another node
+int splice_postings(arena *pool, mainnode *dst, mainnode *src);
+
+// Starts a walk over a word's postings
+void postings_of(const mainnode *mnode, posting_cursor *cursor);
+
+// Starts a walk over an encoded run of postings
+void postings_in(const unsigned char *data, size_t len, posting_cursor *cursor);
+
+// Largest occurrence count among a word's postings
+int term_max_count(const mainnode *mnode);
+
+// Decodes the next posting of a walk
+int next_posting(posting_cursor *cursor);
+
+// Moves a walk to its first posting at or after a document id, skipping blocks
+int seek_posting(posting_cursor *cursor, int target);
+
+// Adds a word's position in a document to its position list
+int add_position(arena *pool, mainnode *mnode, int file_id, int position);
+
+// Appends encoded positions (as saved in an index file) to a word's position list
+int append_positions(arena *pool, mainnode *mnode, const unsigned char *data, size_t len);
+
+// Drops flagged documents from a word's positions (before remove_postings() re-encodes its postings)
+int remove_positions(arena *pool, mainnode *mnode, const unsigned char *removed);
+
+// Appends the positions of later documents from another node
+void splice_positions(mainnode *dst, mainnode *src);
+
+// Starts a walk over a word's positions
+void positions_of(const mainnode *mnode, position_cursor *cursor);
+
+// Starts a walk over an encoded run of positions
+void positions_in(const unsigned char *data, size_t len, position_cursor *cursor);
+
+// Skips 'skip' positions, then decodes the 'count' positions of one posting
+int read_positions(position_cursor *cursor, long skip, int count, int *out);
+
+// Records one occurrence of a word in a document, at a word position
+void insert_posting(hashtable *table, mainnode *mnode, int file_id, int position);
 
 // Inserts a word (creates/updates nodes)
-void insert_word(hashtable *table, char *word, char *filename);
+void insert_word(hashtable *table, const char *word, size_t len, int file_id, int position);
+
+// Maps or reads a file for tokenizing
+int open_tokenizer(tokenizer *tok, const char *filename);
+
+// Returns the next token as a slice of the file contents
+int next_token(tokenizer *tok, const char **word, size_t *len);
+
+// Releases the file contents
+void close_tokenizer(tokenizer *tok);
+
+// Normalizes a token into out (at least len + 1 bytes); returns its length, 0 if it is dropped
+size_t analyze_token(unsigned int steps, const char *word, size_t len, char *out);
+
+// Normalizes a searched word like the indexed ones; NULL if it is dropped
+const char* analyze_query(unsigned int steps, const char *word, size_t *len, char *buf);
+
+// Names a set of analysis steps ("fold,trim,stem")
+const char* analysis_name(unsigned int steps, char *buf);
+
+// Writes the table as a binary index file
+int save_index(hashtable *table, const char *filename);
+
+// Maps an index file and checks its header and checksums
+int open_index(disk_index *index, const char *filename);
+
+// Unmaps an index file
+void close_index(disk_index *index);
+
+// Finds the dictionary entry of a 'len'-byte word
+const disk_term* index_lookup(disk_index *index, const char *word, size_t len);
+
+// Packs the first 8 bytes of a word into an integer key in bytewise order
+uint64_t term_prefix(const char *word, size_t len);
+
+// Returns the word of a dictionary entry
+const char* index_word(disk_index *index, const disk_term *term);
+
+// Starts a walk over the postings of a dictionary entry
+void index_postings(disk_index *index, const disk_term *term, posting_cursor *cursor);
+
+// Starts a walk over the positions of a dictionary entry
+void index_positions(disk_index *index, const disk_term *term, position_cursor *cursor);
+
+// Resolves a document id of the index to its file name
+const char* index_document(disk_index *index, uint32_t file_id);
+
+// Rebuilds the nodes of a mapped index in an empty table
+int load_index(hashtable *table, disk_index *index);
+
+// Checks whether the files given differ from the documents of an index
+int index_out_of_date(disk_index *index, filenode *head);
+
+// Makes a mapped index (malloc'ed) the first version of a snapshot with 'readers' reader slots
+int init_snapshot(index_snapshot *snap, disk_index *index, int readers);
+
+// Starts a read: returns the current version, kept mapped until leave_snapshot()
+disk_index* enter_snapshot(index_snapshot *snap, int reader);
+
+// Ends a read started by enter_snapshot()
+void leave_snapshot(index_snapshot *snap, int reader);
+
+// Swaps in a new version, waits for the readers of the old one and unmaps it; returns the new epoch
+unsigned long publish_snapshot(index_snapshot *snap, disk_index *index);
+
+// Unmaps the current version and frees the reader slots
+void free_snapshot(index_snapshot *snap);
+
+// Maps an index file as a malloc'ed version; NULL on failure
+disk_index* open_version(const char *filename);
+
+// Indexes the files like an existing version, saves them over 'filename' and maps the result
+disk_index* build_version(filenode *head, const char *filename, const disk_index *like, int threads);
+
+// Opens (or creates) the segmented index in a directory, with a merger thread if 'merge'
+int open_segments(segment_set *set, const char *dir, int positional, unsigned int analysis, int merge);
+
+// Takes a reference to the current view of the segments (release it with release_segments)
+segment_view* acquire_segments(segment_set *set);
+
+// Drops a reference taken by acquire_segments()
+void release_segments(segment_set *set, segment_view *view);
+
+// Indexes the new and changed files into a new segment, deleting their older copies
+int ingest_files(segment_set *set, filenode *head, int threads);
+
+// Deletes the files from the segments holding them
+int remove_files(segment_set *set, filenode *head);
+
+// Merges every segment into one, dropping the deleted documents
+int compact_segments(segment_set *set);
+
+// Lets the merger finish the merges due, then stops it
+void stop_merging(segment_set *set);
+
+// Stops the merger once it has done the merges due, and closes every segment
+void close_segments(segment_set *set);
+
+// Runs a parsed boolean query on every segment of a view
+int query_segments(const query *q, segment_view *view, doc_list *result);
+
+// Segment and document id within it of a view id
+const segment_part* segment_of(segment_view *view, int file_id, int *local);
+
+// Name of a document of a view
+const char* segment_document(segment_view *view, int file_id);
+
+// Number of documents of every segment of a view holding an analyzed word
+int segment_frequency(segment_view *view, const char *word, size_t len);
 
 // Validates command-line arguments
 int validate(int argc, char *argv[]);
 
+// Checks whether the first argument names a non-interactive command ("index", "query")
+int is_command(const char *name);
+
+// Runs a non-interactive command (see cli.c); returns the exit status
+int run_command(int argc, char *argv[]);
+
+// Serves queries on an index file from a Unix socket until SIGINT / SIGTERM, reloading it on
+// SIGHUP or a RELOAD request (see server.c)
+int serve_index(const char *index_file, filenode *files, const char *path, int threads, size_t cache_bytes);
+
+// Sends requests to the query server from 'clients' connections and reports QPS and latency
+int run_load(const char *path, char **request, int count, int clients, long requests, FILE *out);
+
 // Creates linked list of validated files
 filenode* create_file_linked_list(int argc, char *argv[]);
 
 // Checks if file has .txt extension
 int check_txt_file(const char *filename);
 
+// Removes "-j N" from the arguments and returns N (default 1)
+int parse_threads(int *argc, char *argv[]);
+
+// Removes "-p" from the arguments and returns 1 if it was given
+int parse_positions(int *argc, char *argv[]);
+
+// Removes "-a steps" from the arguments and returns the ANALYZE_* steps named
+unsigned int parse_analysis(int *argc, char *argv[]);
+
 // Checks for duplicate filenames
 int is_duplicate_file(filenode *head, char *filename);
 
 // Checks whether a file exists on disk
 int check_file_exists(char *filename);
 
-// Builds the database by reading all files
-void create_database(hashtable *table, filenode *head);
+// Builds the database by reading all files, on 'threads' worker threads
+void create_database(hashtable *table, filenode *head, int threads);
+
+// Indexes files into the table without any message; returns the number indexed
+int index_files(hashtable *table, filenode *head, int threads);
 
 // Prints all words and file details
 void display_database(hashtable *table);
 
-// Saves entire database to file
-void save_database(hashtable *table);
+// Saves entire database to file, replacing the previous one only once it is complete
+int save_database(hashtable *table);
+
+// Creates a temporary file next to 'filename' to be renamed over it; returns its descriptor or -1
+int create_replacement(const char *filename, char *temp, size_t size);
+
+// Renames the finished temporary file over 'filename' if 'ok', otherwise removes it
+int replace_file(const char *temp, const char *filename, int ok);
 
 // Searches for a word in the database
 void search_database(hashtable *table, const char *word);
 
-// Updates an existing database by adding more files
-void update_database(hashtable *table);
+// Prints every word of a mapped index file
+void display_index(disk_index *index);
+
+// Searches for a word in a mapped index file
+void search_index(disk_index *index, const char *word);
+
+// Searches for a word in the table or a mapped index through a result cache
+void search_cached(result_cache *cache, hashtable *table, disk_index *index, const char *word);
+
+// Prepares an empty result cache of at most 'limit' bytes
+int init_cache(result_cache *cache, size_t limit);
+
+// Copies the cached result of a key on an index generation into *value; -1 on a miss
+long cache_get(result_cache *cache, const char *key, unsigned long generation, char **value, size_t *cap);
+
+// Stores the result of a key on an index generation, evicting to stay within the budget
+void cache_put(result_cache *cache, const char *key, unsigned long generation, const char *value, size_t value_len);
+
+// Builds a cache key: 'kind' + the text with its whitespace collapsed
+char* normalize_request(const char *kind, const char *text, char *key, size_t size);
+
+// Writes the cache's entries, bytes, hit rate and evictions as one key=value line
+void print_cache_stats(result_cache *cache, FILE *out);
+
+// Frees every entry of a result cache
+void free_cache(result_cache *cache);
+
+// Parses a boolean query
+int parse_query(query *q, const char *text);
+
+// Parses a boolean query without printing; on failure 'error' says what is wrong
+int compile_query(query *q, const char *text, char *error, size_t size);
+
+// 1 if a parsed query has a phrase or NEAR (needs word positions)
+int query_positional(const query *q);
+
+// Evaluates a parsed query against a mapped index, or the table if index is NULL
+int run_query(const query *q, hashtable *table, disk_index *index, doc_list *result);
+
+// Releases a query result
+void free_doc_list(doc_list *list);
+
+// Runs a query and prints the matching files
+void query_database(hashtable *table, disk_index *index, const char *text);
+
+// Scores documents with BM25 and keeps the best k (MaxScore pruning if 'prune')
+int rank_documents(hashtable *table, disk_index *index, const char *text, int k, int prune,
+                   ranked_doc *top);
+
+// Ranked search over every segment of a view, with the collection statistics of the whole view
+int rank_segments(segment_view *view, const char *text, int k, int prune, ranked_doc *top);
+
+// Runs a ranked search and prints the best files
+void rank_database(hashtable *table, disk_index *index, const char *text);
+
+// Reloads the database from backup.txt, parsing it on up to 'threads' threads
+void update_database(hashtable *table, int threads);
+
+// Brings the index in line with the files: adds new ones, re-indexes changed ones, removes missing ones
+int sync_database(hashtable *table, filenode *head, int threads);
 
 #endif
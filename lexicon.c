@@ -0,0 +1,749 @@
+/*****************************************************************************************************
+ * File           : lexicon.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Lookups by pattern rather than by exact word: wildcards ("connect*", "c?nnect") and fuzzy
+ *      matches ("conection~", up to FUZZY_MAX_EDITS insertions, deletions or substitutions).
+ *      The hash table can only answer exact words, so these walk the words in sorted order: the
+ *      table's through its lexicon, a mapped index's through its dictionary, which is already
+ *      sorted the same way.
+ *
+ * Lexicon        :
+ *      table_lexicon() sorts the table's words once and keeps them front coded: each entry is the
+ *      length of the prefix it shares with the word before, the length of the rest, and the rest.
+ *      Every LEXICON_BLOCK-th entry shares nothing, so a binary search over those block heads
+ *      finds any word after decoding at most one block. The lexicon stays valid until a word is
+ *      added or removed (link_mainnode / unlink_mainnode drop it); save_index() also writes its
+ *      dictionary in lexicon order.
+ *
+ * Matching       :
+ *      A wildcard only visits the words starting with its literal prefix (the characters before
+ *      the first '*' or '?'), found by a seek.
+ *
+ *      A fuzzy lookup runs the Levenshtein dynamic program over the sorted words as over a trie:
+ *      one row per character of the word, and a word sharing its first n characters with the
+ *      word before reuses those n rows. Once every entry of a row exceeds the allowed edits, no
+ *      word with that prefix can match, and the walk seeks straight past all of them. The work
+ *      grows with the prefixes that stay within reach, not with the size of the dictionary.
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "inverted_search.h"
+
+#define WORD_BUFFER (MAX_TOKEN_LEN + 1)   // Longest word a walk holds; also what an entry's length bytes can count
+
+
+// Sort entry of a lexicon build: the two keys decide most comparisons without touching the node
+typedef struct sort_word
+{
+    uint64_t prefix;             // Bytes 0..7 of the word as a big-endian key, zero padded
+    uint64_t next;               // Bytes 8..15 the same way
+    mainnode *node;              // The word's mainnode
+} sort_word;
+
+
+// Sorted walk over the words of a lexicon, or of a mapped index if 'lex' is NULL
+typedef struct lexicon_walk
+{
+    const lexicon *lex;
+    disk_index *index;
+    unsigned int pos;            // Ordinal of the current word, the word count once past the end
+    unsigned int count;          // Words
+    size_t off;                  // Lexicon: offset of the entry after the current one
+    char word[WORD_BUFFER];      // Current word
+    size_t len;                  // Its length
+    size_t shared;               // Bytes it shares with the word current before the last move
+} lexicon_walk;
+
+
+/*****************************************************************************************************
+ * Function       : compare_sort_words
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      qsort() comparator ordering words bytewise: the term_prefix() keys of bytes 0..7 and 8..15
+ *      first, then the whole words when those are equal, a word before the longer ones it starts.
+ *
+ * Returns        :
+ *      <0, 0 or >0.
+ *****************************************************************************************************/
+static int compare_sort_words(const void *a, const void *b)
+{
+    const sort_word *x = a, *y = b;
+
+    if (x->prefix != y->prefix)
+        return x->prefix < y->prefix ? -1 : 1;
+    if (x->next != y->next)
+        return x->next < y->next ? -1 : 1;
+
+    size_t n = x->node->len < y->node->len ? x->node->len : y->node->len;
+    int cmp = memcmp(x->node->word, y->node->word, n);  // Not strcmp(): a word may hold NUL bytes
+    if (cmp != 0)
+        return cmp;
+    return x->node->len < y->node->len ? -1 : x->node->len > y->node->len;
+}
+
+
+/*****************************************************************************************************
+ * Function       : drop_lexicon
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Frees the table's lexicon, if it has one.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void drop_lexicon(hashtable *table)
+{
+    if (table->sorted == NULL)
+        return;
+    free(table->sorted->node);
+    free(table->sorted->bytes);
+    free(table->sorted->block);
+    free(table->sorted);
+    table->sorted = NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : table_lexicon
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Returns the table's lexicon, sorting and front coding its words first if there is none.
+ *
+ * Returns        :
+ *      The lexicon, or NULL if memory ran out.
+ *****************************************************************************************************/
+lexicon* table_lexicon(hashtable *table)
+{
+    if (table->sorted)
+        return table->sorted;
+
+    unsigned int count = table->count;
+    sort_word *sorted = malloc((count ? count : 1) * sizeof(sort_word));
+    lexicon *lex = calloc(1, sizeof(lexicon));
+    size_t bytes = 0;
+
+    if (sorted == NULL || lex == NULL)
+    {
+        free(sorted);
+        free(lex);
+        return NULL;
+    }
+
+    table_cursor cursor;
+    unsigned int n = 0;
+    for (mainnode *m = first_mainnode(table, &cursor); m != NULL && n < count; m = next_mainnode(table, &cursor))
+    {
+        size_t len = m->len;
+        sorted[n].prefix = term_prefix(m->word, len);
+        sorted[n].next = len > 8 ? term_prefix(m->word + 8, len - 8) : 0;
+        sorted[n++].node = m;
+        bytes += len + 2;                               // Upper bound: no prefix shared
+    }
+    qsort(sorted, n, sizeof(sort_word), compare_sort_words);
+
+    lex->count = n;
+    lex->node = malloc((n ? n : 1) * sizeof(mainnode *));
+    lex->bytes = malloc(bytes ? bytes : 1);
+    lex->block = malloc((n / LEXICON_BLOCK + 1) * sizeof(unsigned int));
+    if (lex->node == NULL || lex->bytes == NULL || lex->block == NULL)
+    {
+        table->sorted = lex;
+        drop_lexicon(table);
+        free(sorted);
+        return NULL;
+    }
+
+    const char *prev = "";
+    for (unsigned int i = 0; i < n; i++)
+    {
+        const char *word = sorted[i].node->word;
+        size_t len = sorted[i].node->len, shared = 0;
+
+        if (i % LEXICON_BLOCK == 0)
+            lex->block[i / LEXICON_BLOCK] = lex->size;
+        else
+            while (shared < len && word[shared] == prev[shared])
+                shared++;
+
+        lex->bytes[lex->size++] = (unsigned char)shared;
+        lex->bytes[lex->size++] = (unsigned char)(len - shared);
+        memcpy(lex->bytes + lex->size, word + shared, len - shared);
+        lex->size += len - shared;
+        lex->node[i] = sorted[i].node;
+        prev = word;
+    }
+
+    free(sorted);
+    table->sorted = lex;
+    return lex;
+}
+
+
+/*****************************************************************************************************
+ * Function       : walk_load
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Makes word 'pos' the walk's current word: for a lexicon, decodes the entry at w->off on
+ *      top of the current word (which must be the word before it, unless the entry heads a
+ *      block); for an index, copies the word out of the mapping. w->shared is set from the
+ *      word current before.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE past the last word.
+ *****************************************************************************************************/
+static int walk_load(lexicon_walk *w, unsigned int pos)
+{
+    const char *rest;                                   // The word from byte 'keep' on
+    size_t len, keep = 0;
+
+    w->pos = pos;
+    if (pos >= w->count)
+        return FAILURE;
+
+    if (w->lex)
+    {
+        const unsigned char *entry = w->lex->bytes + w->off;
+        keep = entry[0];
+        len = keep + entry[1];
+        rest = (const char *)entry + 2;
+        w->off += 2 + entry[1];
+    }
+    else
+    {
+        const disk_term *t = &w->index->term[pos];
+        rest = index_word(w->index, t);
+        len = t->word_len;
+    }
+    if (len >= WORD_BUFFER)
+        len = WORD_BUFFER - 1;
+    if (keep > len)
+        keep = len;
+
+    size_t shared = keep < w->len ? keep : w->len;
+    while (shared < len && shared < w->len && rest[shared - keep] == w->word[shared])
+        shared++;
+
+    memcpy(w->word + keep, rest, len - keep);
+    w->word[len] = '\0';
+    w->len = len;
+    w->shared = shared;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : walk_next
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Moves the walk to the next word.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE past the last word.
+ *****************************************************************************************************/
+static int walk_next(lexicon_walk *w)
+{
+    return walk_load(w, w->pos + 1);
+}
+
+
+/*****************************************************************************************************
+ * Function       : compare_key
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Bytewise comparison of a word with a key, the shorter one first on a tie.
+ *
+ * Returns        :
+ *      <0, 0 or >0.
+ *****************************************************************************************************/
+static int compare_key(const char *word, size_t len, const char *key, size_t key_len)
+{
+    int cmp = memcmp(word, key, len < key_len ? len : key_len);
+
+    if (cmp)
+        return cmp;
+    return (len > key_len) - (len < key_len);
+}
+
+
+/*****************************************************************************************************
+ * Function       : walk_seek
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Moves the walk to the first word >= key (bytewise). A lexicon is searched over its block
+ *      heads and then decoded from the block found; an index is searched directly.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if every word is below the key.
+ *****************************************************************************************************/
+static int walk_seek(lexicon_walk *w, const char *key, size_t key_len)
+{
+    if (w->lex == NULL)
+    {
+        unsigned int low = 0, high = w->count;
+        while (low < high)
+        {
+            unsigned int mid = low + (high - low) / 2;
+            const disk_term *t = &w->index->term[mid];
+            if (compare_key(index_word(w->index, t), t->word_len, key, key_len) < 0)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        return walk_load(w, low);
+    }
+
+    // Last block whose head is <= key (block 0 if none), then decode forward from it
+    unsigned int low = 0, high = (w->count + LEXICON_BLOCK - 1) / LEXICON_BLOCK;
+    while (high - low > 1)
+    {
+        unsigned int mid = low + (high - low) / 2;
+        const unsigned char *head = w->lex->bytes + w->lex->block[mid];
+        if (compare_key((const char *)head + 2, head[1], key, key_len) <= 0)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    if (w->count == 0)
+        return walk_load(w, 0);
+
+    char before[WORD_BUFFER];                           // w->shared is relative to the word before the seek
+    size_t before_len = w->len;
+    memcpy(before, w->word, before_len);
+
+    w->off = w->lex->block[low];
+    int status = walk_load(w, low * LEXICON_BLOCK);
+    while (status == SUCCESS && compare_key(w->word, w->len, key, key_len) < 0)
+        status = walk_next(w);
+
+    size_t shared = 0;
+    while (shared < before_len && shared < w->len && before[shared] == w->word[shared])
+        shared++;
+    w->shared = shared;
+    return status;
+}
+
+
+/*****************************************************************************************************
+ * Function       : start_walk
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Sets up a walk over the mapped index if one is given, otherwise over the table's lexicon.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the lexicon couldn't be built.
+ *****************************************************************************************************/
+static int start_walk(lexicon_walk *w, hashtable *table, disk_index *index)
+{
+    memset(w, 0, sizeof(*w));
+    if (index)
+    {
+        w->index = index;
+        w->count = index->term_count;
+        return SUCCESS;
+    }
+
+    w->lex = table_lexicon(table);
+    if (w->lex == NULL)
+        return FAILURE;
+    w->count = w->lex->count;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : add_match
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Appends the walk's current word to a result list (growing it by doubling), unless no
+ *      document holds it any more.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+static int add_match(match_list *out, const lexicon_walk *w, int distance)
+{
+    if (w->lex && w->lex->node[w->pos]->file_count == 0)
+        return SUCCESS;                                 // Word left without documents by an update
+    if (out->count == out->capacity)
+    {
+        int capacity = out->capacity ? out->capacity * 2 : 32;
+        term_match *grown = realloc(out->match, capacity * sizeof(term_match));
+        if (grown == NULL)
+            return FAILURE;
+        out->match = grown;
+        out->capacity = capacity;
+    }
+
+    term_match *m = &out->match[out->count++];
+    m->distance = distance;
+    if (w->lex)
+    {
+        m->node = w->lex->node[w->pos];
+        m->term = NULL;
+        m->word = m->node->word;
+        m->file_count = m->node->file_count;
+    }
+    else
+    {
+        m->node = NULL;
+        m->term = &w->index->term[w->pos];
+        m->word = index_word(w->index, m->term);
+        m->file_count = m->term->file_count;
+    }
+    return SUCCESS;
+}
+
+
+void free_match_list(match_list *list)
+{
+    free(list->match);
+    list->match = NULL;
+    list->count = list->capacity = 0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : glob_match
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Matches a word against a pattern where '*' stands for any run of bytes and '?' for any one
+ *      byte. On a mismatch after a '*', the '*' is retried one byte further along; only the
+ *      latest '*' needs retrying, so the match is linear in most cases.
+ *
+ * Returns        :
+ *      1 if the whole word matches, 0 otherwise.
+ *****************************************************************************************************/
+static int glob_match(const char *pattern, size_t plen, const char *word, size_t len)
+{
+    size_t p = 0, w = 0, star = (size_t)-1, resume = 0;
+
+    while (w < len)
+    {
+        if (p < plen && (pattern[p] == '?' || pattern[p] == word[w]))
+        {
+            p++;
+            w++;
+        }
+        else if (p < plen && pattern[p] == '*')
+        {
+            star = p++;
+            resume = w;
+        }
+        else if (star != (size_t)-1)
+        {
+            p = star + 1;
+            w = ++resume;
+        }
+        else
+            return 0;
+    }
+    while (p < plen && pattern[p] == '*')
+        p++;
+    return p == plen;
+}
+
+
+/*****************************************************************************************************
+ * Function       : match_wildcard
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Collects the words matching a '*' / '?' pattern, visiting only those that start with the
+ *      pattern's literal prefix.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+static int match_wildcard(lexicon_walk *w, const char *pattern, size_t len, match_list *out)
+{
+    size_t literal = strcspn(pattern, "*?");
+
+    if (literal > len)
+        literal = len;
+    for (int status = walk_seek(w, pattern, literal); status == SUCCESS; status = walk_next(w))
+    {
+        if (w->len < literal || memcmp(w->word, pattern, literal) != 0)
+            break;                                      // Past the words with the literal prefix
+        if (glob_match(pattern, len, w->word, w->len) && add_match(out, w, 0) == FAILURE)
+            return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : match_fuzzy
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Collects the words within 'max_edits' (at most FUZZY_MAX_EDITS) insertions, deletions or
+ *      substitutions of a word of at most FUZZY_MAX_LEN bytes, with their distance, from the
+ *      mapped index if one is given, otherwise from the table. row[d] is the edit distance
+ *      row of the current word's first d characters against the query word.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out or the word is too long.
+ *****************************************************************************************************/
+int match_fuzzy(hashtable *table, disk_index *index, const char *word, size_t len, int max_edits,
+                match_list *out)
+{
+    int row[FUZZY_MAX_LEN + FUZZY_MAX_EDITS + 2][FUZZY_MAX_LEN + 1];
+    size_t depth_limit = len + max_edits;               // Longer words are too far off
+    size_t valid = 0;                                   // row[0..valid] hold the current word's prefix
+    lexicon_walk w;
+
+    if (len > FUZZY_MAX_LEN || max_edits < 0 || max_edits > FUZZY_MAX_EDITS ||
+        start_walk(&w, table, index) == FAILURE)
+        return FAILURE;
+
+    for (size_t j = 0; j <= len; j++)
+        row[0][j] = j;
+
+    int status = walk_seek(&w, "", 0);
+    while (status == SUCCESS)
+    {
+        size_t depth = w.shared < valid ? w.shared : valid;
+        size_t dead = 0;                                // Length of a prefix no word can extend to a match
+
+        while (depth < w.len)
+        {
+            if (depth + 1 > depth_limit)
+            {
+                dead = depth + 1;
+                break;
+            }
+
+            const int *above = row[depth];
+            int *cur = row[depth + 1], best;
+            char c = w.word[depth];
+
+            cur[0] = best = depth + 1;
+            for (size_t j = 1; j <= len; j++)
+            {
+                int v = above[j - 1] + (word[j - 1] != c);
+                if (above[j] + 1 < v)
+                    v = above[j] + 1;
+                if (cur[j - 1] + 1 < v)
+                    v = cur[j - 1] + 1;
+                cur[j] = v;
+                if (v < best)
+                    best = v;
+            }
+            depth++;
+            if (best > max_edits)
+            {
+                dead = depth;
+                break;
+            }
+        }
+        valid = depth;
+
+        if (!dead)
+        {
+            if (row[w.len][len] <= max_edits && add_match(out, &w, row[w.len][len]) == FAILURE)
+                return FAILURE;
+            status = walk_next(&w);
+            continue;
+        }
+
+        // Seek past every word starting with w.word[0..dead): bump its last byte that can be
+        char key[WORD_BUFFER];
+        size_t key_len = dead;
+        memcpy(key, w.word, key_len);
+        while (key_len > 0 && (unsigned char)key[key_len - 1] == 0xFF)
+            key_len--;
+        if (key_len == 0)
+            break;
+        key[key_len - 1]++;
+        status = walk_seek(&w, key, key_len);
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : pattern_edits
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Recognizes the fuzzy form "word~" (one edit) or "word~N".
+ *
+ * Returns        :
+ *      N (1 for a bare '~'), or -1 if the text isn't in the fuzzy form. *word_len is set to the
+ *      length of the word before the '~'.
+ *****************************************************************************************************/
+static int pattern_edits(const char *text, size_t len, size_t *word_len)
+{
+    const char *tilde = memchr(text, '~', len);
+
+    if (tilde == NULL || tilde == text)
+        return -1;
+    size_t at = tilde - text;
+    if (at + 1 == len)
+    {
+        *word_len = at;
+        return 1;
+    }
+    if (at + 2 == len && tilde[1] >= '0' && tilde[1] <= '9')
+    {
+        *word_len = at;
+        return tilde[1] - '0';
+    }
+    return -1;
+}
+
+
+/*****************************************************************************************************
+ * Function       : is_term_pattern
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Tells a pattern from a plain word: a pattern has a '*' or '?', or ends in "~" or "~N".
+ *
+ * Returns        :
+ *      1 for a pattern, 0 for a plain word, -1 for a fuzzy pattern out of range (N not 1 to
+ *      FUZZY_MAX_EDITS, or a word longer than FUZZY_MAX_LEN).
+ *****************************************************************************************************/
+int is_term_pattern(const char *word, size_t len)
+{
+    size_t word_len;
+    int edits = pattern_edits(word, len, &word_len);
+
+    if (edits >= 0)
+        return edits >= 1 && edits <= FUZZY_MAX_EDITS && word_len <= FUZZY_MAX_LEN ? 1 : -1;
+    return memchr(word, '*', len) || memchr(word, '?', len);
+}
+
+
+/*****************************************************************************************************
+ * Function       : match_terms
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Finds the words matching a pattern in the mapped index if one is given, otherwise in the
+ *      table: "word~N" is a fuzzy lookup, anything else a wildcard (a plain word matches
+ *      itself). If the words were case folded (analyzer.c), so is the pattern; the other
+ *      analysis steps would eat its '*', '?' and '~', and are not applied.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out or a fuzzy pattern is out of range (the message is
+ *      printed).
+ *****************************************************************************************************/
+int match_terms(hashtable *table, disk_index *index, const char *pattern, size_t len, match_list *out)
+{
+    char folded[QUERY_MAX_LEN];
+    size_t word_len;
+
+    if (((index ? index->analysis : table->analysis) & ANALYZE_FOLD) && len < sizeof(folded))
+    {
+        analyze_token(ANALYZE_FOLD, pattern, len, folded);     // Same length, folding only
+        pattern = folded;
+    }
+
+    int edits = pattern_edits(pattern, len, &word_len);
+
+    if (edits >= 0)
+    {
+        if (edits == 0 || edits > FUZZY_MAX_EDITS || word_len > FUZZY_MAX_LEN)
+        {
+            printf("ERROR : A fuzzy word takes 1 to %d edits and at most %d characters\n",
+                   FUZZY_MAX_EDITS, FUZZY_MAX_LEN);
+            return FAILURE;
+        }
+        if (match_fuzzy(table, index, pattern, word_len, edits, out) == FAILURE)
+        {
+            printf("ERROR : Out of memory while matching words\n");
+            return FAILURE;
+        }
+        return SUCCESS;
+    }
+
+    lexicon_walk w;
+    if (start_walk(&w, table, index) == FAILURE || match_wildcard(&w, pattern, len, out) == FAILURE)
+    {
+        printf("ERROR : Out of memory while matching words\n");
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : compare_closest
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      qsort() comparator putting the fewest edits first, then the word in the most files, then
+ *      dictionary order.
+ *
+ * Returns        :
+ *      <0, 0 or >0.
+ *****************************************************************************************************/
+static int compare_closest(const void *a, const void *b)
+{
+    const term_match *x = a, *y = b;
+
+    if (x->distance != y->distance)
+        return x->distance - y->distance;
+    if (x->file_count != y->file_count)
+        return y->file_count - x->file_count;
+    return strcmp(x->word, y->word);
+}
+
+
+/*****************************************************************************************************
+ * Function       : expand_terms
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Prints the words matching a pattern typed at the menu with the number of files holding
+ *      each: all of them in dictionary order for a wildcard, closest first for a fuzzy word.
+ *      At most MATCHES_SHOWN are listed.
+ *
+ * Returns        :
+ *      Nothing. Prints directly to console.
+ *****************************************************************************************************/
+void expand_terms(hashtable *table, disk_index *index, const char *pattern)
+{
+    match_list found = { 0 };
+    size_t word_len;
+
+    if (match_terms(table, index, pattern, strlen(pattern), &found) == FAILURE)
+        return;
+    if (pattern_edits(pattern, strlen(pattern), &word_len) >= 0)
+        qsort(found.match, found.count, sizeof(term_match), compare_closest);
+
+    printf("%d word(s) match %s\n", found.count, pattern);
+    for (int i = 0; i < found.count && i < MATCHES_SHOWN; i++)
+        printf(" | %-20s %-10d\n", found.match[i].word, found.match[i].file_count);
+    if (found.count > MATCHES_SHOWN)
+        printf(" | ... and %d more\n", found.count - MATCHES_SHOWN);
+    free_match_list(&found);
+}
+
+
+/*****************************************************************************************************
+ * Function       : suggest_terms
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      After a search for a word that isn't indexed, lists up to 5 indexed words within 2 edits
+ *      of it (1 edit for words of 4 characters or less), closest first.
+ *
+ * Returns        :
+ *      Nothing. Prints directly to console.
+ *****************************************************************************************************/
+void suggest_terms(hashtable *table, disk_index *index, const char *word)
+{
+    match_list found = { 0 };
+    size_t len = strlen(word);
+
+    if (len > FUZZY_MAX_LEN || match_fuzzy(table, index, word, len, len <= 4 ? 1 : 2, &found) == FAILURE ||
+        found.count == 0)
+    {
+        free_match_list(&found);
+        return;
+    }
+
+    qsort(found.match, found.count, sizeof(term_match), compare_closest);
+    printf("Did you mean:");
+    for (int i = 0; i < found.count && i < 5; i++)
+        printf("%s %s", i ? "," : "", found.match[i].word);
+    printf(" ?\n");
+    free_match_list(&found);
+}
@@ -10,27 +10,61 @@
 *
 *  DATA STRUCTURE SUMMARY :
 *      filenode   - Linked list storing valid .txt file names.
-*      hashtable  - 27 buckets (a–z + non-alphabet bucket).
+*      hashtable  - Full-word hash buckets that grow as words are added.
 *      mainnode   - Stores unique word + count of files containing that word.
-*      subnode    - Stores filename + how many times word appears in that file.
+*      postings   - Compressed (file id, count) pairs of each word (postings.c).
 *
 *  FEATURES :
 *      1. Create Database       – Reads words from files and builds inverted index.
 *      2. Display Database      – Prints in formatted table style.
-*      3. Search a Word         – Shows all files containing the word.
-*      4. Save Database         – Saves entire structure to "backup.txt".
-*      5. Update Database       – Rebuilds DB from backup.txt.
+*      3. Search a Word         – Shows all files containing the word; "con*", "c?t" and "conection~2"
+*                                 list matching words, and a missing word gets suggestions.
+*      4. Save Database         – Saves entire structure to the binary index "backup.idx".
+*      5. Update Database       – Maps backup.idx (or rebuilds DB from backup.txt if there is none), then
+*                                 indexes new and changed files and removes files no longer given.
 *      6. Exit
+*      7. Export Database       – Writes the text backup "backup.txt".
+*      8. Query                 – Boolean query over the files, e.g. "error AND timeout NOT debug"; with -p
+*                                 also phrases ("connection reset by peer") and NEAR/k.
+*      9. Ranked Search         – Best matching files for a few words, scored with BM25.
+*     10. Metrics               – Phase timings, counters and lookup probe lengths (built with
+*                                 "make METRICS=1"), dictionary shape and postings lengths; also
+*                                 written as JSON to "metrics.json".
+*     11. Cache Statistics      – Entries, memory, hit rate and evictions of the search result cache.
+*
+*  COMMANDS (no menu, for scripts) :
+*      index [-j N] [-p] [-a steps] [-o file.idx] files...    – Builds and saves an index.
+*      query [-i file.idx] [--rank] [--json] "query"          – Queries a saved index.
+*      query [-i file.idx] [--rank] [--json] --batch file     – Runs a file of queries, with latency percentiles.
+*      --metrics file (either command)                        – Writes the run's metrics as JSON.
+*      serve [-i file.idx] [-S socket] [-j N] [files...]      – Answers queries on a Unix socket; RELOAD
+*                                                               or SIGHUP swaps in a rebuilt index.
+*      loadgen [-S socket] [-c 1,4,16] [-n N] [--rank] file   – Measures a running server (QPS, p50/p99).
+*      ingest [-d dir] [-j N] [--remove] [--compact] files... – Adds files to a segmented index (or deletes
+*                                                               them); query -d dir queries it.
 *
 *  FILE STRUCTURE :
 *      main.c                  → Menu + driver
+*      cli.c                   → Non-interactive index / query commands (TSV or JSON output)
+*      server.c                → Query server on a Unix socket (epoll + worker threads), load generator
 *      create_database.c       → Reads files & builds DB
 *      createSLL.c             → Builds linked list of files
-*      display_output.c        → Prints DB
-*      search.c                → Searches a word
-*      save.c                  → Saves DB to file
-*      update.c                → Loads DB from file
+*      display_database.c      → Prints DB
+*      search_database.c       → Searches a word
+*      lexicon.c               → Sorted words: wildcard / fuzzy lookups and suggestions
+*      query.c                 → Parses and runs AND / OR / NOT, phrase and NEAR queries
+*      positions.c             → Word positions of each posting (-p)
+*      rank.c                  → BM25 ranked search with a top-k heap
+*      save_database.c         → Saves DB to file (text export)
+*      disk_index.c            → Binary index file: save, map, lookup
+*      update_database.c       → Loads DB from file
+*      common.c                → Hash table + node helpers
+*      analyzer.c              → Case folding, punctuation trimming, stopwords, stemming (-a)
 *      validate.c              → Validates arguments
+*      cache.c                 → Result cache (CLOCK, byte budget, generation checked)
+*      snapshot.c              → Index versions swapped in while queries run (epoch-based reclaim)
+*      segment.c               → Segmented index: immutable segments, tombstones, background tiered merges
+*      metrics.c               → Phase timers, counters, histograms (METRICS builds) and their report
 *      inverted_search.h       → Structures + prototypes
 *
 * Name          : C Chandana
@@ -41,14 +75,13 @@
 #include <stdlib.h>
 #include "inverted_search.h"
 
-#define SIZE 27
-
 
 /*****************************************************************************************************
  * Function       : main
  * ---------------------------------------------------------------------------------------------------
  * What it does   :
  *      Acts as the driver for the entire inverted search system. It:
+ *          - Hands over to cli.c when the first argument is a command (see COMMANDS above)
  *          - Validates command-line arguments
  *          - Creates the file linked list
  *          - Initializes the hash table
@@ -64,11 +97,19 @@
 int main(int argc, char *argv[])
 {
     filenode *head = NULL;              // Head for linked list of file names
-    hashtable table[27];                // Hash table with 27 buckets
+    hashtable table;                    // Hash table of indexed words
     int choice;                         // Menu choice
     int db_flag = 0;                    // Indicates if DB is created or loaded
-    int created_flag = 0;               // Prevents double creation
-    int updated_flag = 0;               // Prevents update → create conflicts
+
+    if (argc >= 2 && is_command(argv[1]))   // "index ..." / "query ...": run it, no menu
+        return run_command(argc - 1, argv + 1);
+
+    int threads = parse_threads(&argc, argv);   // Indexing threads ("-j N")
+    int positions = parse_positions(&argc, argv);   // Record word positions ("-p")
+    unsigned int analysis = parse_analysis(&argc, argv);   // Token normalization ("-a steps")
+    disk_index index;                   // Mapped backup.idx, when loaded from it
+    int on_disk = 0;                    // 1 while queries are answered from 'index'
+    result_cache cache;                 // Lines of recently searched words
 
     // Validate command-line arguments and create file list
     if (validate(argc, argv) == SUCCESS)
@@ -86,7 +127,10 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    init_hashtable(table);              // Initialize hash table before any operation
+    if (init_hashtable(&table) == FAILURE || init_cache(&cache, CACHE_BYTES) == FAILURE)
+        return 0;                       // Initialize hash table and cache before any operation
+    table.positional = positions;
+    table.analysis = analysis;
 
     // -------------------------- MENU LOOP --------------------------
     do
@@ -101,6 +145,11 @@ int main(int argc, char *argv[])
         printf("4. Save Database\n");
         printf("5. Update Database\n");
         printf("6. Exit\n");
+        printf("7. Export Database (text)\n");
+        printf("8. Query (AND / OR / NOT)\n");
+        printf("9. Ranked Search (BM25)\n");
+        printf("10. Metrics\n");
+        printf("11. Cache Statistics\n");
         printf("\n-----------------------------------------\n");
         printf("Enter your choice: ");
         scanf("%d", &choice);
@@ -109,25 +158,21 @@ int main(int argc, char *argv[])
         {
             // ---------------- CREATE DATABASE ----------------
             case 1:
-                if (created_flag == 1)
-                {
-                    printf("ERROR : Database already created. Cannot create again!\n");
-                    break;
-                }
-                if (updated_flag == 1 && created_flag == 1)
+                if (db_flag == 1)
                 {
-                    printf("ERROR : Cannot Create again!\n");
+                    printf("ERROR : Database already exists. Use Update to index changed files!\n");
                     break;
                 }
-                create_database(table, head);   // Build inverted index
+                create_database(&table, head, threads);   // Build inverted index
                 db_flag = 1;
-                created_flag = 1;
                 break;
 
             // ---------------- DISPLAY DATABASE ----------------
             case 2:
-                if (db_flag)
-                    display_database(table);
+                if (on_disk)
+                    display_index(&index);
+                else if (db_flag)
+                    display_database(&table);
                 else
                     printf("Please create the database first!\n");
                 break;
@@ -136,10 +181,10 @@ int main(int argc, char *argv[])
             case 3:
                 if (db_flag)
                 {
-                    char word[50];
+                    char word[MAX_TOKEN_LEN + 1];
                     printf("Enter the word to search: ");
-                    scanf("%49s", word);
-                    search_database(table, word);
+                    scanf(TOKEN_SCAN, word);
+                    search_cached(&cache, &table, on_disk ? &index : NULL, word);
                 }
                 else
                     printf("Please create the database first!\n");
@@ -147,9 +192,11 @@ int main(int argc, char *argv[])
 
             // ---------------- SAVE DATABASE ----------------
             case 4:
-                if (db_flag)
+                if (on_disk)
+                    printf("Database is already saved in %s\n", INDEX_FILE);
+                else if (db_flag)
                 {
-                    save_database(table);
+                    save_index(&table, INDEX_FILE);
                 }
                 else
                     printf("Please create the database first!\n");
@@ -157,21 +204,95 @@ int main(int argc, char *argv[])
 
             // ---------------- UPDATE DATABASE ----------------
             case 5:
-                if(updated_flag == 1)
+                if (db_flag == 0)                    // Nothing loaded yet: start from the saved index
                 {
-                    printf("ERROR: Database already updated once. Cannot update again!\n");
-                    break;
+                    if (open_index(&index, INDEX_FILE) == SUCCESS)
+                    {
+                        on_disk = 1;             // Query the mapped file in place
+                        printf("Database mapped from %s\n", INDEX_FILE);
+                    }
+                    else
+                        update_database(&table, threads); // Reload from backup.txt
+                    db_flag = 1;
                 }
-                if(created_flag == 1)
+
+                if (on_disk)
                 {
-                    printf("ERROR : Cannot Create after update!\n");
-                    break;
+                    if (!index_out_of_date(&index, head))
+                    {
+                        printf("Database is up to date with the files.\n");
+                        break;
+                    }
+                    // Changes are applied to nodes, so build them from the mapped file first
+                    if (load_index(&table, &index) == FAILURE)
+                    {
+                        printf("ERROR : Couldn't load %s\n", INDEX_FILE);
+                        break;
+                    }
+                    close_index(&index);
+                    on_disk = 0;
                 }
-                
-                update_database(table);         // Reload from backup.txt
-                db_flag = 1;
-                updated_flag = 1;
-                printf("Database updated successfully.\n");
+
+                if (sync_database(&table, head, threads) == SUCCESS)
+                    printf("Database updated successfully.\n");
+                break;
+
+            // ---------------- EXPORT DATABASE ----------------
+            case 7:
+                if (on_disk)
+                {
+                    // The text writer walks nodes, so build them from the mapped file first
+                    if (load_index(&table, &index) == FAILURE)
+                    {
+                        printf("ERROR : Couldn't load %s\n", INDEX_FILE);
+                        break;
+                    }
+                    close_index(&index);
+                    on_disk = 0;
+                }
+                if (db_flag)
+                    save_database(&table);
+                else
+                    printf("Please create the database first!\n");
+                break;
+
+            // ---------------- BOOLEAN QUERY ----------------
+            case 8:
+                if (db_flag)
+                {
+                    char line[QUERY_MAX_LEN];
+                    printf("Enter the query: ");
+                    if (scanf(" %255[^\n]", line) == 1)
+                        query_database(&table, on_disk ? &index : NULL, line);
+                }
+                else
+                    printf("Please create the database first!\n");
+                break;
+
+            // ---------------- RANKED SEARCH ----------------
+            case 9:
+                if (db_flag)
+                {
+                    char line[QUERY_MAX_LEN];
+                    printf("Enter the words to rank files by: ");
+                    if (scanf(" %255[^\n]", line) == 1)
+                        rank_database(&table, on_disk ? &index : NULL, line);
+                }
+                else
+                    printf("Please create the database first!\n");
+                break;
+
+            // ---------------- METRICS ----------------
+            case 10:
+                print_metrics(db_flag && !on_disk ? &table : NULL, on_disk ? &index : NULL);
+                if (save_metrics(METRICS_FILE, db_flag && !on_disk ? &table : NULL,
+                                 on_disk ? &index : NULL) == SUCCESS)
+                    printf("Metrics written to %s\n", METRICS_FILE);
+                break;
+
+            // ---------------- CACHE STATISTICS ----------------
+            case 11:
+                print_cache_stats(&cache, stdout);
                 break;
 
             // ---------------- EXIT ----------------
@@ -186,5 +307,9 @@ int main(int argc, char *argv[])
 
     } while (choice != 6);              // Loop until user selects exit
 
+    if (on_disk)
+        close_index(&index);
+    free_hashtable(&table);             // Release buckets and every node at once
+    free_cache(&cache);
     return 0;
 }
@@ -0,0 +1,450 @@
+/*****************************************************************************************************
+ * File           : metrics.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Instrumentation of the indexer: per-phase timings, counters of bytes, tokens, lookups, key
+ *      comparisons and allocations, and a histogram of the chain links (chained table) or probe
+ *      slots (FLAT_DICT) each lookup visits. The shape of the dictionary (bucket occupancy or probe
+ *      displacement) and the distribution of postings lengths are read from the table or mapped
+ *      index when the metrics are reported.
+ *
+ * Switching      :
+ *      The recording macros (METRIC_COUNT, METRIC_SAMPLE, METRIC_START / METRIC_STOP in
+ *      inverted_search.h) only do something when built with -DMETRICS ("make METRICS=1"); in a
+ *      normal build they compile to nothing and only the shape and postings sections are
+ *      reported.
+ *
+ * Threads        :
+ *      Every thread records into its own metrics_block, found through a thread-local pointer, so
+ *      indexing workers never share a cache line or take a lock. A block is linked into a global
+ *      list once, when its thread first records; blocks outlive their threads and are summed
+ *      when the metrics are printed.
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "inverted_search.h"
+
+
+__thread metrics_block *metrics_mine;                  // Block of the calling thread, NULL until it records
+static metrics_block *metrics_all;                     // Every thread's block
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *counter_name[METRIC_COUNTERS] = {
+    "files", "bytes", "tokens", "lookups", "key_compares", "resizes", "arena_allocs", "arena_chunks",
+    "arena_bytes"
+};
+
+static const char *histogram_name[METRIC_HISTOGRAMS] = {
+    "index", "file", "merge", "sync", "save_index", "save_text", "load_text", "open_index", "search",
+    "query", "rank", "grace", "flush", "compact", "probe_length"
+};
+
+
+/*****************************************************************************************************
+ * Function       : metrics_register
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Allocates the calling thread's block and links it into the global list. Called by
+ *      METRICS_LOCAL() the first time a thread records something.
+ *
+ * Returns        :
+ *      The block. If it can't be allocated, a shared fallback block is returned (its counts may
+ *      then race, which only costs accuracy).
+ *****************************************************************************************************/
+metrics_block* metrics_register(void)
+{
+    static metrics_block fallback;
+    metrics_block *block = calloc(1, sizeof(metrics_block));
+
+    pthread_mutex_lock(&metrics_lock);
+    if (block == NULL)
+    {
+        block = &fallback;
+        if (fallback.next == NULL && metrics_all != &fallback)
+        {
+            fallback.next = metrics_all;
+            metrics_all = &fallback;
+        }
+    }
+    else
+    {
+        block->next = metrics_all;
+        metrics_all = block;
+    }
+    pthread_mutex_unlock(&metrics_lock);
+
+    metrics_mine = block;
+    return block;
+}
+
+
+/*****************************************************************************************************
+ * Function       : bucket_of
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Histogram bucket of a value: 0 for 0, otherwise one more than its highest set bit, capped
+ *      at the last bucket.
+ *
+ * Returns        :
+ *      The bucket index.
+ *****************************************************************************************************/
+static int bucket_of(uint64_t value)
+{
+    int b = value ? 64 - __builtin_clzll(value) : 0;
+
+    return b < METRIC_BUCKETS ? b : METRIC_BUCKETS - 1;
+}
+
+
+/*****************************************************************************************************
+ * Function       : metric_record
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Adds a value to a histogram.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void metric_record(metric_histogram *h, uint64_t value)
+{
+    h->bucket[bucket_of(value)]++;
+    h->count++;
+    h->sum += value;
+    if (value > h->max)
+        h->max = value;
+}
+
+
+/*****************************************************************************************************
+ * Function       : metric_clock
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Reads the monotonic clock.
+ *
+ * Returns        :
+ *      Nanoseconds since an arbitrary start.
+ *****************************************************************************************************/
+uint64_t metric_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+
+/*****************************************************************************************************
+ * Function       : merge_histogram
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Adds every value of one histogram to another.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void merge_histogram(metric_histogram *dst, const metric_histogram *src)
+{
+    for (int b = 0; b < METRIC_BUCKETS; b++)
+        dst->bucket[b] += src->bucket[b];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+
+/*****************************************************************************************************
+ * Function       : percentile
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Estimates a percentile of a histogram as the upper end of the bucket holding it (capped at
+ *      the largest value seen).
+ *
+ * Returns        :
+ *      The estimate, 0 for an empty histogram.
+ *****************************************************************************************************/
+static uint64_t percentile(const metric_histogram *h, int p)
+{
+    uint64_t rank = (h->count * p + 99) / 100, seen = 0;
+
+    for (int b = 0; b < METRIC_BUCKETS && h->count; b++)
+    {
+        seen += h->bucket[b];
+        if (seen >= rank && seen > 0)
+        {
+            uint64_t top = b == 0 ? 0 : b >= 64 ? UINT64_MAX : (((uint64_t)1 << b) - 1);
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+}
+
+
+// Everything a report shows: the summed blocks and the shape of the table or index
+typedef struct metrics_report
+{
+    metrics_block total;
+    metric_histogram shape;      // Chained: words per bucket; FLAT_DICT: slots from home per word
+    metric_histogram postings;   // Files per word
+    const char *shape_name;
+    unsigned long long slots;    // Buckets or probe slots
+    unsigned long long words;
+    int source;                  // 0 none, 1 table, 2 mapped index
+} metrics_report;
+
+
+/*****************************************************************************************************
+ * Function       : collect_metrics
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Sums every thread's block and measures the table (bucket occupancy or probe displacement,
+ *      and postings lengths) or, if given, the mapped index (postings lengths).
+ *
+ * Returns        :
+ *      Nothing; the report is filled in.
+ *****************************************************************************************************/
+static void collect_metrics(metrics_report *r, hashtable *table, disk_index *index)
+{
+    memset(r, 0, sizeof(*r));
+
+    pthread_mutex_lock(&metrics_lock);
+    for (const metrics_block *b = metrics_all; b != NULL; b = b->next)
+    {
+        for (int i = 0; i < METRIC_COUNTERS; i++)
+            r->total.counter[i] += b->counter[i];
+        for (int i = 0; i < METRIC_HISTOGRAMS; i++)
+            merge_histogram(&r->total.histogram[i], &b->histogram[i]);
+    }
+    pthread_mutex_unlock(&metrics_lock);
+
+    if (index)
+    {
+        r->source = 2;
+        r->words = index->term_count;
+        for (unsigned int i = 0; i < index->term_count; i++)
+            metric_record(&r->postings, index->term[i].file_count);
+        return;
+    }
+    if (table == NULL)
+        return;
+
+    r->source = 1;
+    r->words = table->count;
+#ifdef FLAT_DICT
+    r->shape_name = "probe_distance";
+    r->slots = (unsigned long long)table->mask + 1;
+    for (unsigned int pos = 0; pos <= table->mask; pos++)
+    {
+        if (table->slot[pos].id != DICT_EMPTY)
+            metric_record(&r->shape, (pos - table->slot[pos].hash) & table->mask);
+    }
+#else
+    r->shape_name = "bucket_occupancy";
+    for (int a = 0; a < 2; a++)
+    {
+        if (a == 1 && table->rehash_index < 0)
+            break;
+        r->slots += table->size[a];
+        for (unsigned int i = 0; i < table->size[a]; i++)
+        {
+            unsigned int n = 0;
+            for (mainnode *m = table->bucket[a][i]; m != NULL; m = m->main_next_link)
+                n++;
+            metric_record(&r->shape, n);
+        }
+    }
+#endif
+
+    table_cursor cursor;
+    for (mainnode *m = first_mainnode(table, &cursor); m != NULL; m = next_mainnode(table, &cursor))
+        metric_record(&r->postings, m->file_count);
+}
+
+
+/*****************************************************************************************************
+ * Function       : print_histogram
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Prints a histogram's non-empty buckets as "low-high : count" lines with a bar.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void print_histogram(const char *title, const metric_histogram *h)
+{
+    uint64_t most = 0;
+
+    printf("%s: %llu values, mean %.2f, max %llu\n", title, (unsigned long long)h->count,
+           h->count ? (double)h->sum / h->count : 0.0, (unsigned long long)h->max);
+    for (int b = 0; b < METRIC_BUCKETS; b++)
+        if (h->bucket[b] > most)
+            most = h->bucket[b];
+    for (int b = 0; b < METRIC_BUCKETS; b++)
+    {
+        if (h->bucket[b] == 0)
+            continue;
+        unsigned long long low = b ? 1ull << (b - 1) : 0, high = b ? (1ull << b) - 1 : 0;
+        char range[48];
+        if (low == high)
+            snprintf(range, sizeof(range), "%llu", low);
+        else
+            snprintf(range, sizeof(range), "%llu-%llu", low, high);
+        printf("    %-14s %12llu  ", range, (unsigned long long)h->bucket[b]);
+        for (int i = 0; i < (int)(40 * h->bucket[b] / most); i++)
+            putchar('#');
+        printf("\n");
+    }
+}
+
+
+/*****************************************************************************************************
+ * Function       : print_metrics
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Prints the phase timings (calls, total, mean, estimated p50 / p99 and max), the counters
+ *      and the lookup probe lengths when the build records them, then the dictionary shape and
+ *      postings lengths of the table or mapped index.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void print_metrics(hashtable *table, disk_index *index)
+{
+    metrics_report r;
+
+    collect_metrics(&r, table, index);
+
+#ifdef METRICS
+    printf("%-12s %10s %12s %12s %12s %12s %12s\n", "Phase", "calls", "total ms", "mean us", "p50 us",
+           "p99 us", "max us");
+    for (int i = 0; i < METRIC_PHASES; i++)
+    {
+        const metric_histogram *h = &r.total.histogram[i];
+        if (h->count == 0)
+            continue;
+        printf("%-12s %10llu %12.3f %12.2f %12.2f %12.2f %12.2f\n", histogram_name[i],
+               (unsigned long long)h->count, h->sum / 1e6, h->sum / 1e3 / h->count,
+               percentile(h, 50) / 1e3, percentile(h, 99) / 1e3, h->max / 1e3);
+    }
+    printf("\n");
+    for (int i = 0; i < METRIC_COUNTERS; i++)
+        printf("%-14s %llu\n", counter_name[i], (unsigned long long)r.total.counter[i]);
+    printf("\n");
+    print_histogram("Lookup probe length", &r.total.histogram[METRIC_PROBE_LENGTH]);
+#else
+    printf("Timings and counters are not compiled in: rebuild with \"make clean; make METRICS=1\".\n");
+#endif
+
+    if (r.source == 1)
+    {
+        printf("\nDictionary: %llu words in %llu %s, load %.2f\n", r.words, r.slots,
+#ifdef FLAT_DICT
+               "probe slots",
+#else
+               "buckets",
+#endif
+               r.slots ? (double)r.words / r.slots : 0.0);
+        print_histogram(r.shape_name, &r.shape);
+    }
+    if (r.source)
+    {
+        printf("\n");
+        print_histogram("Postings length (files per word)", &r.postings);
+    }
+}
+
+
+/*****************************************************************************************************
+ * Function       : json_histogram
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Writes a histogram as a JSON object: count, sum, mean, p50, p99, max, and its non-empty
+ *      buckets as [low, high, count] triples.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void json_histogram(FILE *fp, const metric_histogram *h)
+{
+    int first = 1;
+
+    fprintf(fp, "{\"count\": %llu, \"sum\": %llu, \"mean\": %.3f, \"p50\": %llu, \"p99\": %llu, \"max\": %llu, "
+                "\"buckets\": [",
+            (unsigned long long)h->count, (unsigned long long)h->sum, h->count ? (double)h->sum / h->count : 0.0,
+            (unsigned long long)percentile(h, 50), (unsigned long long)percentile(h, 99),
+            (unsigned long long)h->max);
+    for (int b = 0; b < METRIC_BUCKETS; b++)
+    {
+        if (h->bucket[b] == 0)
+            continue;
+        fprintf(fp, "%s[%llu, %llu, %llu]", first ? "" : ", ", b ? 1ull << (b - 1) : 0ull,
+                b ? (1ull << b) - 1 : 0ull, (unsigned long long)h->bucket[b]);
+        first = 0;
+    }
+    fprintf(fp, "]}");
+}
+
+
+/*****************************************************************************************************
+ * Function       : save_metrics
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Writes everything print_metrics() shows as one JSON object. Phase histograms are in
+ *      nanoseconds. "recorded" is false in a build without METRICS, whose phases, counters and
+ *      probe lengths are then all zero.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the file couldn't be written.
+ *****************************************************************************************************/
+int save_metrics(const char *filename, hashtable *table, disk_index *index)
+{
+    metrics_report r;
+    FILE *fp = strcmp(filename, "-") == 0 ? stderr : fopen(filename, "w");
+
+    if (fp == NULL)
+    {
+        printf("ERROR : Couldn't open %s for writing\n", filename);
+        return FAILURE;
+    }
+    collect_metrics(&r, table, index);
+
+#ifdef METRICS
+    fprintf(fp, "{\"recorded\": true, \"phases_ns\": {");
+#else
+    fprintf(fp, "{\"recorded\": false, \"phases_ns\": {");
+#endif
+    for (int i = 0; i < METRIC_PHASES; i++)
+    {
+        fprintf(fp, "%s\"%s\": ", i ? ", " : "", histogram_name[i]);
+        json_histogram(fp, &r.total.histogram[i]);
+    }
+    fprintf(fp, "}, \"counters\": {");
+    for (int i = 0; i < METRIC_COUNTERS; i++)
+        fprintf(fp, "%s\"%s\": %llu", i ? ", " : "", counter_name[i], (unsigned long long)r.total.counter[i]);
+    fprintf(fp, "}, \"probe_length\": ");
+    json_histogram(fp, &r.total.histogram[METRIC_PROBE_LENGTH]);
+
+    fprintf(fp, ", \"source\": \"%s\", \"words\": %llu", r.source == 2 ? "index" : r.source ? "table" : "none",
+            r.words);
+    if (r.source == 1)
+    {
+        fprintf(fp, ", \"slots\": %llu, \"%s\": ", r.slots, r.shape_name);
+        json_histogram(fp, &r.shape);
+    }
+    if (r.source)
+    {
+        fprintf(fp, ", \"postings_length\": ");
+        json_histogram(fp, &r.postings);
+    }
+    fprintf(fp, "}\n");
+
+    if (fp != stderr && fclose(fp) != 0)
+    {
+        printf("ERROR : Couldn't write %s\n", filename);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
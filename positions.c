@@ -0,0 +1,328 @@
+/*****************************************************************************************************
+ * File           : positions.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Word positions for phrase and NEAR queries, recorded when the table is positional (menu
+ *      program started with -p). A word's position in a document is the number of words before
+ *      it in the file.
+ *
+ * Layout         :
+ *      Positions are kept apart from the postings, in a second chain of blocks per word, so
+ *      walking the postings (search, AND / OR / NOT, ranking) reads exactly the same bytes as
+ *      without them. For each posting, in document order, the list holds as many varints as the
+ *      posting's count: the first position in the document, then the gap to each next one.
+ *      Nothing marks where a document's run starts; a reader walks the postings alongside and
+ *      skips the counts of the postings it passes over (read_positions).
+ *
+ *      The chain is a byte stream: blocks are filled to the last byte and a varint may continue
+ *      in the next block, so a saved run can be loaded back in block-sized pieces. Blocks are
+ *      posting_blocks ('base' unused) that grow up to POSITION_BLOCK_MAX bytes, larger than
+ *      postings blocks since a word has a position per occurrence rather than per document.
+ *
+ *      The index file stores each word's stream as one run in SECTION_POSITIONS (disk_index.c).
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "inverted_search.h"
+
+#define POSITION_BLOCK_MIN 16     // Data bytes of a word's first block
+#define POSITION_BLOCK_MAX 1008   // Data bytes blocks grow to (block + header = 1024)
+
+
+/*****************************************************************************************************
+ * Function       : append_bytes
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Appends bytes to the end of a position list, filling the tail block and starting new
+ *      (larger) blocks as needed.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if a block couldn't be allocated.
+ *****************************************************************************************************/
+static int append_bytes(arena *pool, position_list *list, const unsigned char *data, size_t len)
+{
+    while (len > 0)
+    {
+        posting_block *block = list->tail;
+
+        if (block == NULL || block->used == block->size)
+        {
+            unsigned int size = block ? block->size * 2 + 16 : POSITION_BLOCK_MIN;
+            if (size > POSITION_BLOCK_MAX)
+                size = POSITION_BLOCK_MAX;
+
+            posting_block *fresh = arena_alloc(pool, sizeof(posting_block) + size);
+            if (fresh == NULL)
+                return FAILURE;
+            fresh->next = NULL;
+            fresh->base = 0;
+            fresh->size = size;
+            fresh->used = 0;
+
+            if (block)
+                block->next = fresh;
+            else
+                list->block = fresh;
+            list->tail = block = fresh;
+        }
+
+        size_t n = block->size - block->used;
+        if (n > len)
+            n = len;
+        memcpy(block->data + block->used, data, n);
+        block->used += n;
+        data += n;
+        len -= n;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : list_of
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Returns the word's position list, allocating an empty one on first use.
+ *
+ * Returns        :
+ *      The list, or NULL if memory ran out.
+ *****************************************************************************************************/
+static position_list* list_of(arena *pool, mainnode *mnode)
+{
+    if (mnode->positions == NULL)
+    {
+        mnode->positions = arena_alloc(pool, sizeof(position_list));
+        if (mnode->positions == NULL)
+            return NULL;
+        mnode->positions->block = mnode->positions->tail = NULL;
+        mnode->positions->last_doc = -1;
+        mnode->positions->last_pos = 0;
+    }
+    return mnode->positions;
+}
+
+
+/*****************************************************************************************************
+ * Function       : add_position
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Appends one occurrence of the word at 'position' in document 'file_id'. Occurrences must
+ *      arrive as indexing produces them: documents in id order, positions increasing within a
+ *      document, one call per count added to the posting.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+int add_position(arena *pool, mainnode *mnode, int file_id, int position)
+{
+    position_list *list = list_of(pool, mnode);
+    unsigned char buf[5];
+    size_t n = 0;
+
+    if (list == NULL)
+        return FAILURE;
+
+    uint32_t value = list->last_doc == file_id ? (uint32_t)(position - list->last_pos) : (uint32_t)position;
+    while (value >= 0x80)
+    {
+        buf[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = (unsigned char)value;
+
+    list->last_doc = file_id;
+    list->last_pos = position;
+    return append_bytes(pool, list, buf, n);
+}
+
+
+/*****************************************************************************************************
+ * Function       : append_positions
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Appends an encoded run, as stored in an index file, to the word's positions. Used by
+ *      load_index() right after the word's postings are loaded.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+int append_positions(arena *pool, mainnode *mnode, const unsigned char *data, size_t len)
+{
+    position_list *list = list_of(pool, mnode);
+
+    if (list == NULL)
+        return FAILURE;
+    list->last_doc = -1;                                // New documents start from absolute positions
+    return append_bytes(pool, list, data, len);
+}
+
+
+/*****************************************************************************************************
+ * Function       : remove_positions
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Copies the word's positions into a new chain without the runs of the documents flagged in
+ *      removed[], walking the postings (still the old ones) to know each run's length. The old
+ *      blocks are abandoned in the arena like remove_postings() abandons its own.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out or the positions don't match the postings.
+ *****************************************************************************************************/
+int remove_positions(arena *pool, mainnode *mnode, const unsigned char *removed)
+{
+    if (mnode->positions == NULL)
+        return SUCCESS;
+
+    position_list *list = mnode->positions;
+    posting_cursor postings;
+    position_cursor cursor;
+
+    positions_of(mnode, &cursor);                       // Walk the old chain while building the new one
+    list->block = list->tail = NULL;
+    postings_of(mnode, &postings);
+
+    while (next_posting(&postings) == SUCCESS)
+    {
+        for (int i = 0; i < postings.word_count; i++)
+        {
+            unsigned char buf[5];
+            size_t n = 0;
+
+            do                                          // Copy one varint byte by byte
+            {
+                while (cursor.pos == cursor.end)
+                {
+                    if (cursor.block == NULL)
+                        return FAILURE;
+                    cursor.pos = cursor.block->data;
+                    cursor.end = cursor.block->data + cursor.block->used;
+                    cursor.block = cursor.block->next;
+                }
+                buf[n++] = *cursor.pos;
+            } while ((*cursor.pos++ & 0x80) && n < sizeof(buf));
+
+            if (!removed[postings.file_id] && append_bytes(pool, list, buf, n) == FAILURE)
+                return FAILURE;
+        }
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : splice_positions
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Links the position blocks of 'src' after those of 'dst', which splice_postings() does for
+ *      the postings: the runs stay in document order, and being self-delimiting (through the
+ *      counts) they need no re-encoding.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void splice_positions(mainnode *dst, mainnode *src)
+{
+    if (src->positions == NULL || src->positions->block == NULL)
+        return;
+    if (dst->positions == NULL || dst->positions->block == NULL)
+    {
+        dst->positions = src->positions;
+        return;
+    }
+
+    dst->positions->tail->next = src->positions->block;
+    dst->positions->tail = src->positions->tail;
+    dst->positions->last_doc = src->positions->last_doc;
+    dst->positions->last_pos = src->positions->last_pos;
+}
+
+
+/*****************************************************************************************************
+ * Function       : positions_of / positions_in
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Start a walk over positions: positions_of() over a word's block chain, positions_in()
+ *      over one encoded run, as stored in the index file.
+ *
+ * Returns        :
+ *      Nothing. Call read_positions() for each posting.
+ *****************************************************************************************************/
+void positions_of(const mainnode *mnode, position_cursor *cursor)
+{
+    cursor->block = mnode->positions ? mnode->positions->block : NULL;
+    cursor->pos = cursor->end = NULL;
+}
+
+void positions_in(const unsigned char *data, size_t len, position_cursor *cursor)
+{
+    cursor->block = NULL;
+    cursor->pos = data;
+    cursor->end = data + len;
+}
+
+
+/*****************************************************************************************************
+ * Function       : read_positions
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Skips the varints of 'skip' occurrences (those of postings the caller passed over; only
+ *      their last bytes are counted, nothing is decoded), then decodes the 'count' positions of
+ *      the next posting into out[], as positions in the document, increasing.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the positions run out first.
+ *****************************************************************************************************/
+int read_positions(position_cursor *cursor, long skip, int count, int *out)
+{
+    const unsigned char *p = cursor->pos, *end = cursor->end;
+    int position = 0;
+
+    while (skip > 0 || count > 0)
+    {
+        if (p == end)
+        {
+            if (cursor->block == NULL)
+                return FAILURE;
+            p = cursor->block->data;
+            end = p + cursor->block->used;
+            cursor->block = cursor->block->next;
+            continue;
+        }
+
+        if (skip > 0)
+        {
+            for (; p < end && skip > 0; p++)
+                skip -= !(*p & 0x80);
+            continue;
+        }
+
+        uint32_t value = 0;
+        int shift = 0;
+        for (;;)
+        {
+            while (p == end)                            // The varint goes on in the next block
+            {
+                if (cursor->block == NULL || shift > 28)
+                    return FAILURE;
+                p = cursor->block->data;
+                end = p + cursor->block->used;
+                cursor->block = cursor->block->next;
+            }
+            unsigned char byte = *p++;
+            value |= (uint32_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                break;
+            if ((shift += 7) > 28)
+                return FAILURE;
+        }
+
+        position += value;
+        *out++ = position;
+        count--;
+    }
+
+    cursor->pos = p;
+    cursor->end = end;
+    return SUCCESS;
+}
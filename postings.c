@@ -0,0 +1,413 @@
+/*****************************************************************************************************
+ * File           : postings.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Compressed postings lists. The documents of a word are kept in increasing id order, so a
+ *      posting is stored as the gap to the previous document id followed by the occurrence count,
+ *      both as variable-byte integers (7 bits per byte, high bit set on all but the last byte).
+ *      A posting of a small gap and count takes 2 bytes, against 16 for a linked subnode.
+ *
+ * Layout         :
+ *      The encoded bytes live in a chain of posting_blocks allocated from the table's arena. Blocks
+ *      start small and double up to POSTING_BLOCK_MAX bytes, so rare words stay compact and common
+ *      ones don't pay a header per few postings. A posting never straddles two blocks, and each
+ *      block records the id its first gap is relative to ('base'), so chains built separately can
+ *      be joined by linking blocks (see splice_postings).
+ *
+ *      The newest posting of a word is held unencoded in the mainnode (last_id, last_count): while
+ *      a file is being indexed its count keeps changing, and it is only encoded once a later file
+ *      adds a posting. Encoding a posting also updates max_count, the bound ranked search uses.
+ *
+ *      The saved index (disk_index.c) uses the same gap + count varints, one run per word.
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "inverted_search.h"
+
+#define POSTING_BLOCK_MIN 24      // Data bytes of a word's first block (block + header = 40)
+#define POSTING_BLOCK_MAX 240     // Data bytes blocks grow to (block + header = 256)
+#define POSTING_MAX_BYTES 10      // Longest encoded posting: two 5-byte varints
+
+
+/*****************************************************************************************************
+ * Function       : encode_posting
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Writes the gap and count of one posting as two varints.
+ *
+ * Returns        :
+ *      Number of bytes written (at most POSTING_MAX_BYTES).
+ *****************************************************************************************************/
+size_t encode_posting(unsigned char *out, uint32_t gap, uint32_t count)
+{
+    size_t n = 0;
+
+    while (gap >= 0x80)
+    {
+        out[n++] = (unsigned char)(gap | 0x80);
+        gap >>= 7;
+    }
+    out[n++] = (unsigned char)gap;
+
+    while (count >= 0x80)
+    {
+        out[n++] = (unsigned char)(count | 0x80);
+        count >>= 7;
+    }
+    out[n++] = (unsigned char)count;
+    return n;
+}
+
+
+/*****************************************************************************************************
+ * Function       : decode_varint
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Reads one varint at *pos, stopping at 'end'.
+ *
+ * Returns        :
+ *      SUCCESS with the value stored and *pos advanced, or FAILURE if the bytes run out or the
+ *      value doesn't fit in 32 bits.
+ *****************************************************************************************************/
+static inline int decode_varint(const unsigned char **pos, const unsigned char *end, uint32_t *value)
+{
+    const unsigned char *p = *pos;
+    uint32_t v = 0;
+
+    for (int shift = 0; shift < 35 && p < end; shift += 7)
+    {
+        unsigned char byte = *p++;
+        v |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            *pos = p;
+            *value = v;
+            return SUCCESS;
+        }
+    }
+    return FAILURE;
+}
+
+
+/*****************************************************************************************************
+ * Function       : flush_posting
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Encodes the word's unencoded newest posting at the end of its block chain, starting a new
+ *      (larger) block when the current one can't hold it.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if a block couldn't be allocated.
+ *****************************************************************************************************/
+static int flush_posting(arena *pool, mainnode *mnode)
+{
+    unsigned char buf[POSTING_MAX_BYTES];
+    size_t n = encode_posting(buf, mnode->last_id - mnode->coded_id, mnode->last_count);
+    posting_block *block = mnode->tail;
+
+    if (block == NULL || (size_t)(block->size - block->used) < n)
+    {
+        unsigned int size = block ? block->size * 2 + 16 : POSTING_BLOCK_MIN;
+        if (size > POSTING_BLOCK_MAX)
+            size = POSTING_BLOCK_MAX;
+
+        posting_block *fresh = arena_alloc(pool, sizeof(posting_block) + size);
+        if (fresh == NULL)
+            return FAILURE;
+        fresh->next = NULL;
+        fresh->base = mnode->coded_id;
+        fresh->size = size;
+        fresh->used = 0;
+
+        if (block)
+            block->next = fresh;
+        else
+            mnode->block = fresh;
+        mnode->tail = block = fresh;
+    }
+
+    memcpy(block->data + block->used, buf, n);
+    block->used += n;
+    mnode->coded_id = mnode->last_id;
+    if (mnode->last_count > mnode->max_count)
+        mnode->max_count = mnode->last_count;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : add_posting
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Adds 'word_count' occurrences in document 'file_id' to the word's postings. Indexing adds
+ *      documents in id order, so the document is either the newest one (its count grows) or a new
+ *      one after it (the newest posting is encoded and the new one takes its place). A document
+ *      before the newest one is merged in by re-encoding the list, which only out-of-order callers
+ *      pay for. Positions (positions.c) are not merged by that path: positional tables are only
+ *      built by indexing, which never takes it.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+int add_posting(arena *pool, mainnode *mnode, int file_id, int word_count)
+{
+    if (mnode->file_count && mnode->last_id == file_id)     // Fast path: current file
+    {
+        mnode->last_count += word_count;
+        return SUCCESS;
+    }
+
+    if (mnode->file_count == 0 || mnode->last_id < file_id)
+    {
+        if (mnode->file_count && flush_posting(pool, mnode) == FAILURE)
+            return FAILURE;
+        mnode->last_id = file_id;
+        mnode->last_count = word_count;
+        mnode->file_count++;
+        return SUCCESS;
+    }
+
+    // Earlier document: rebuild the list with the posting merged in at its place
+    mainnode old = *mnode;
+    posting_cursor cursor;
+    int added = 0;
+
+    mnode->file_count = 0;
+    mnode->coded_id = 0;
+    mnode->max_count = 0;
+    mnode->block = mnode->tail = NULL;
+
+    postings_of(&old, &cursor);
+    while (next_posting(&cursor) == SUCCESS)
+    {
+        int count = cursor.word_count;
+
+        if (!added && cursor.file_id >= file_id)
+        {
+            if (cursor.file_id == file_id)
+                count += word_count;
+            else if (add_posting(pool, mnode, file_id, word_count) == FAILURE)
+                return FAILURE;
+            added = 1;
+        }
+        if (add_posting(pool, mnode, cursor.file_id, count) == FAILURE)
+            return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : remove_postings
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Drops every document flagged in removed[] (indexed by document id) from the word's
+ *      postings by re-encoding the list without them, and their runs from the word's positions.
+ *      The old blocks are abandoned in the arena; they are reclaimed when the index is next saved
+ *      and reloaded.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+int remove_postings(arena *pool, mainnode *mnode, const unsigned char *removed)
+{
+    if (mnode->file_count == 0)
+        return SUCCESS;
+    if (remove_positions(pool, mnode, removed) == FAILURE)   // Needs the old postings
+        return FAILURE;
+
+    if (mnode->block == NULL)                               // Only the unencoded posting
+    {
+        if (removed[mnode->last_id])
+            mnode->file_count = 0;
+        return SUCCESS;
+    }
+
+    mainnode old = *mnode;
+    posting_cursor cursor;
+
+    mnode->file_count = 0;
+    mnode->coded_id = 0;
+    mnode->max_count = 0;
+    mnode->block = mnode->tail = NULL;
+
+    postings_of(&old, &cursor);
+    while (next_posting(&cursor) == SUCCESS)
+    {
+        if (!removed[cursor.file_id] &&
+            add_posting(pool, mnode, cursor.file_id, cursor.word_count) == FAILURE)
+            return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : splice_postings
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Appends the postings of 'src' to those of 'dst' when every document of src comes after the
+ *      documents of dst (parallel indexing merges ranges of files this way). dst's newest posting
+ *      is encoded, src's blocks are linked on unchanged (their bases make the gaps decode
+ *      correctly), and src's newest posting becomes dst's.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+int splice_postings(arena *pool, mainnode *dst, mainnode *src)
+{
+    if (src->file_count == 0)
+        return SUCCESS;
+    if (dst->file_count && flush_posting(pool, dst) == FAILURE)
+        return FAILURE;
+
+    if (src->block)
+    {
+        if (dst->tail)
+            dst->tail->next = src->block;
+        else
+            dst->block = src->block;
+        dst->tail = src->tail;
+        dst->coded_id = src->coded_id;
+        if (src->max_count > dst->max_count)
+            dst->max_count = src->max_count;
+    }
+
+    dst->last_id = src->last_id;
+    dst->last_count = src->last_count;
+    dst->file_count += src->file_count;
+    splice_positions(dst, src);
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : term_max_count
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Largest occurrence count of a word in any document: max_count covers the encoded postings,
+ *      the unencoded newest one is compared here, so indexing pays nothing per occurrence.
+ *
+ * Returns        :
+ *      The count, 0 for a word without postings.
+ *****************************************************************************************************/
+int term_max_count(const mainnode *mnode)
+{
+    if (mnode->file_count == 0)
+        return 0;
+    return mnode->last_count > mnode->max_count ? mnode->last_count : mnode->max_count;
+}
+
+
+/*****************************************************************************************************
+ * Function       : postings_of / postings_in
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Start a walk over postings: postings_of() over a word's block chain and newest posting,
+ *      postings_in() over one encoded run, as stored in the index file.
+ *
+ * Returns        :
+ *      Nothing. Call next_posting() for each posting.
+ *****************************************************************************************************/
+void postings_of(const mainnode *mnode, posting_cursor *cursor)
+{
+    cursor->block = mnode->block;
+    cursor->pos = cursor->end = NULL;
+    cursor->prev = 0;
+    cursor->tail_id = mnode->last_id;
+    cursor->tail_count = mnode->last_count;
+    cursor->has_tail = mnode->file_count > 0;
+}
+
+void postings_in(const unsigned char *data, size_t len, posting_cursor *cursor)
+{
+    cursor->block = NULL;
+    cursor->pos = data;
+    cursor->end = data + len;
+    cursor->prev = 0;
+    cursor->has_tail = 0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : next_posting
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Decodes the next posting into cursor->file_id and cursor->word_count, moving on to the next
+ *      block when one is used up, and ending with the unencoded newest posting.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE at the end of the list (or on bytes that don't decode).
+ *****************************************************************************************************/
+int next_posting(posting_cursor *cursor)
+{
+    while (cursor->pos == cursor->end)
+    {
+        if (cursor->block)
+        {
+            cursor->pos = cursor->block->data;
+            cursor->end = cursor->block->data + cursor->block->used;
+            cursor->prev = cursor->block->base;
+            cursor->block = cursor->block->next;
+            continue;
+        }
+        if (cursor->has_tail)
+        {
+            cursor->has_tail = 0;
+            cursor->file_id = cursor->tail_id;
+            cursor->word_count = cursor->tail_count;
+            return SUCCESS;
+        }
+        return FAILURE;
+    }
+
+    uint32_t gap, count;
+    if (decode_varint(&cursor->pos, cursor->end, &gap) == FAILURE ||
+        decode_varint(&cursor->pos, cursor->end, &count) == FAILURE)
+    {
+        cursor->pos = cursor->end;                      // Damaged run: end the walk
+        cursor->block = NULL;
+        cursor->has_tail = 0;
+        return FAILURE;
+    }
+
+    cursor->prev += gap;
+    cursor->file_id = cursor->prev;
+    cursor->word_count = count;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : seek_posting
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Moves a walk forward to its first remaining posting whose document id is >= target. A
+ *      block's base is the last id encoded before it, so while the next block's base is below
+ *      the target the rest of the current block can be skipped without decoding it. Spliced
+ *      chains restart their bases at 0 where a worker's blocks begin; a base that isn't above
+ *      the position already reached doesn't bound the current block and is not used to skip.
+ *      Runs of the index file are a single segment and are decoded in order.
+ *
+ * Returns        :
+ *      SUCCESS with the posting in cursor->file_id / word_count, or FAILURE at the end.
+ *****************************************************************************************************/
+int seek_posting(posting_cursor *cursor, int target)
+{
+    while (cursor->block && cursor->block->base < target &&
+           (cursor->pos == cursor->end || cursor->block->base > cursor->prev))
+    {
+        cursor->pos = cursor->block->data;
+        cursor->end = cursor->block->data + cursor->block->used;
+        cursor->prev = cursor->block->base;
+        cursor->block = cursor->block->next;
+    }
+
+    while (next_posting(cursor) == SUCCESS)
+    {
+        if (cursor->file_id >= target)
+            return SUCCESS;
+    }
+    return FAILURE;
+}
@@ -0,0 +1,1270 @@
+/*****************************************************************************************************
+ * File           : query.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Boolean queries over the index: "error AND timeout NOT debug", "(disk OR network) error".
+ *      parse_query() turns the text into a small operator tree, run_query() evaluates it against
+ *      the in-memory table or a mapped index file into a sorted list of document ids.
+ *
+ * Syntax         :
+ *      Words go through the analysis steps the words were indexed with (analyzer.c), then are
+ *      matched exactly. AND, OR and NOT (upper case) are operators; words next to each other are
+ *      ANDed. A word the analysis drops (a stopword) is left out of its AND or phrase; on its own
+ *      it matches nothing. NOT binds tightest, then AND, then OR; parentheses group.
+ *      With word positions (positions.c) two more forms can stand where a word can:
+ *          - "connection reset by peer": the words next to each other, in that order;
+ *          - timeout NEAR/5 retry: both words at most 5 positions apart, in either order
+ *            (NEAR alone means NEAR/10).
+ *      A word with '*' or '?' ("connect*", "c?nnect") or ending in "~" / "~N" ("conection~2")
+ *      stands for every indexed word it matches (lexicon.c), as if they were ORed. Phrases and
+ *      NEAR take plain words only.
+ *
+ * Evaluation     :
+ *      An AND chain is flattened into its positive and negated operands. Positive operands are
+ *      ordered by size (a term's file_count, a sub-expression's result count), the smallest one
+ *      gives the candidates and every other operand only filters them:
+ *          - a term is walked with seek_posting(), which skips whole posting blocks below the
+ *            next candidate, so a common word costs about one block per candidate rather than a
+ *            decode of its whole list;
+ *          - a sub-expression's list is searched by galloping (doubling steps, then binary
+ *            search) from the previous match.
+ *      OR merges sorted lists; a NOT on its own is taken against every document. A pattern marks
+ *      the documents of each matching word in a bitmap over the document ids and lists the
+ *      marked ones, so many matches cost one pass rather than a merge each.
+ *
+ *      A phrase or NEAR walks the postings of its words together, rarest word first, and only
+ *      for documents having all of them reads their positions: each word's positions cursor
+ *      skips the runs of the postings passed over without decoding them. Queries without them
+ *      never touch the positions.
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "inverted_search.h"
+
+
+#define QUERY_MAX_OPERANDS ((QUERY_MAX_NODES + 1) / 2)   // Leaves of a tree of QUERY_MAX_NODES nodes
+
+
+// Tokens of the query language
+enum { TOKEN_END, TOKEN_WORD, TOKEN_PHRASE, TOKEN_AND, TOKEN_OR, TOKEN_NOT, TOKEN_NEAR, TOKEN_OPEN,
+       TOKEN_CLOSE };
+
+
+// State of parse_query()
+typedef struct query_parser
+{
+    query *q;                    // Tree being built
+    const char *pos;             // Next character of the text
+    int token;                   // Current token
+    const char *word;            // Current token's text (a phrase's: between the quotes)
+    size_t len;                  // Its length
+    int distance;                // TOKEN_NEAR: its distance
+    int depth;                   // NOT and ( being parsed, one inside the other
+    const char *error;           // First problem found, NULL while parsing succeeds
+} query_parser;
+
+
+// What a query is evaluated against: a mapped index if 'index' is set, else the table
+typedef struct query_source
+{
+    const query *q;
+    hashtable *table;
+    disk_index *index;
+} query_source;
+
+
+/*****************************************************************************************************
+ * Function       : scan_token
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Reads the next token: a parenthesis, a quoted phrase, an operator, or a word (a run of
+ *      characters up to whitespace, a parenthesis or a quote).
+ *
+ * Returns        :
+ *      Nothing. The token is left in the parser; a phrase without its closing quote or a bad
+ *      NEAR distance sets the parser's error and ends the query.
+ *****************************************************************************************************/
+static void scan_token(query_parser *p)
+{
+    while (isspace((unsigned char)*p->pos))
+        p->pos++;
+
+    p->word = p->pos;
+    p->len = 0;
+    if (*p->pos == '\0')
+    {
+        p->token = TOKEN_END;
+        return;
+    }
+    if (*p->pos == '(' || *p->pos == ')')
+    {
+        p->token = *p->pos++ == '(' ? TOKEN_OPEN : TOKEN_CLOSE;
+        p->len = 1;
+        return;
+    }
+    if (*p->pos == '"')
+    {
+        const char *close = strchr(p->pos + 1, '"');
+        if (close == NULL)
+        {
+            p->error = "missing closing quote";
+            p->token = TOKEN_END;
+            return;
+        }
+        p->word = p->pos + 1;
+        p->len = close - p->word;
+        p->pos = close + 1;
+        p->token = TOKEN_PHRASE;
+        return;
+    }
+
+    while (*p->pos && !isspace((unsigned char)*p->pos) && *p->pos != '(' && *p->pos != ')' &&
+           *p->pos != '"')
+        p->pos++;
+    p->len = p->pos - p->word;
+
+    if (p->len >= 4 && memcmp(p->word, "NEAR", 4) == 0 && (p->len == 4 || p->word[4] == '/'))
+    {
+        char *end;
+        long distance = p->len == 4 ? QUERY_NEAR_DEFAULT : strtol(p->word + 5, &end, 10);
+
+        if (p->len > 4 && (end != p->pos || p->len == 5 || distance < 1 || distance > 1000000))
+        {
+            p->error = "NEAR needs a distance from 1, as in NEAR/5";
+            p->token = TOKEN_END;
+            return;
+        }
+        p->distance = (int)distance;
+        p->token = TOKEN_NEAR;
+        return;
+    }
+
+    if (p->len == 3 && memcmp(p->word, "AND", 3) == 0)
+        p->token = TOKEN_AND;
+    else if (p->len == 2 && memcmp(p->word, "OR", 2) == 0)
+        p->token = TOKEN_OR;
+    else if (p->len == 3 && memcmp(p->word, "NOT", 3) == 0)
+        p->token = TOKEN_NOT;
+    else
+        p->token = TOKEN_WORD;
+}
+
+
+/*****************************************************************************************************
+ * Function       : new_node
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Appends a node to the query's array.
+ *
+ * Returns        :
+ *      Index of the node, or -1 (with the parser's error set) once QUERY_MAX_NODES are used.
+ *****************************************************************************************************/
+static int new_node(query_parser *p, int type, int left, int right)
+{
+    if (p->q->count == QUERY_MAX_NODES)
+    {
+        p->error = "query too long";
+        return -1;
+    }
+
+    query_node *n = &p->q->node[p->q->count];
+    n->type = type;
+    n->left = left;
+    n->right = right;
+    n->word = p->word;
+    n->len = p->len;
+    n->distance = 0;
+    return p->q->count++;
+}
+
+
+/*****************************************************************************************************
+ * Function       : phrase_words
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Counts the whitespace separated words of a phrase and finds the first one.
+ *
+ * Returns        :
+ *      Number of words; *first / *first_len hold the first word when there is one.
+ *****************************************************************************************************/
+static int phrase_words(const char *text, size_t len, const char **first, size_t *first_len)
+{
+    int words = 0;
+
+    for (size_t i = 0; i < len; )
+    {
+        while (i < len && isspace((unsigned char)text[i]))
+            i++;
+        size_t start = i;
+        while (i < len && !isspace((unsigned char)text[i]))
+            i++;
+        if (i == start)
+            break;
+        if (words++ == 0)
+        {
+            *first = text + start;
+            *first_len = i - start;
+        }
+    }
+    return words;
+}
+
+
+static int parse_or(query_parser *p);
+
+/*****************************************************************************************************
+ * Function       : parse_primary
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Parses a word or pattern, a phrase or "word NEAR/k word". A phrase of one word is a
+ *      plain word.
+ *
+ * Returns        :
+ *      Index of the node, or -1 on an error (the parser's error is set).
+ *****************************************************************************************************/
+static int parse_primary(query_parser *p)
+{
+    int node;
+
+    if (p->token == TOKEN_PHRASE)
+    {
+        const char *first = NULL;
+        size_t first_len = 0;
+        int words = phrase_words(p->word, p->len, &first, &first_len);
+
+        if (words == 0 || words > QUERY_MAX_PHRASE)
+        {
+            p->error = words ? "phrase too long" : "empty phrase";
+            return -1;
+        }
+        if (words == 1)
+        {
+            p->word = first;
+            p->len = first_len;
+        }
+        node = new_node(p, words == 1 ? QUERY_TERM : QUERY_PHRASE, -1, -1);
+    }
+    else
+    {
+        int pattern = is_term_pattern(p->word, p->len);
+        if (pattern < 0)
+        {
+            p->error = "a fuzzy word takes 1 to 3 edits, as in word~2";
+            return -1;
+        }
+        node = new_node(p, pattern ? QUERY_PATTERN : QUERY_TERM, -1, -1);
+    }
+    scan_token(p);
+
+    if (node < 0 || p->token != TOKEN_NEAR)
+        return node;
+    if (p->q->node[node].type != QUERY_TERM)
+    {
+        p->error = "NEAR joins two words";
+        return -1;
+    }
+
+    int distance = p->distance;
+    scan_token(p);
+    if (p->token != TOKEN_WORD || is_term_pattern(p->word, p->len))
+    {
+        if (!p->error)
+            p->error = "NEAR joins two words";
+        return -1;
+    }
+
+    int right = new_node(p, QUERY_TERM, -1, -1);
+    scan_token(p);
+    if (right < 0)
+        return -1;
+    int near = new_node(p, QUERY_NEAR, node, right);
+    if (near >= 0)
+        p->q->node[near].distance = distance;
+    return near;
+}
+
+
+/*****************************************************************************************************
+ * Function       : parse_unary / parse_and / parse_or
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Recursive descent over the grammar
+ *          or      := and { OR and }
+ *          and     := unary { [AND] unary }
+ *          unary   := NOT unary | ( or ) | primary
+ *          primary := word [ NEAR[/k] word ] | "phrase"
+ *
+ *      A NOT or ( nests one level deeper; a query nested past QUERY_MAX_NODES levels couldn't fit
+ *      its tree anyway, so it is refused there instead of recursing until the stack runs out.
+ *
+ * Returns        :
+ *      Index of the sub-tree's top node, or -1 on a syntax error (the parser's error is set).
+ *****************************************************************************************************/
+static int parse_unary(query_parser *p)
+{
+    int node;
+
+    if ((p->token == TOKEN_NOT || p->token == TOKEN_OPEN) && p->depth >= QUERY_MAX_NODES)
+    {
+        p->error = "query too deep";
+        return -1;
+    }
+
+    switch (p->token)
+    {
+        case TOKEN_NOT:
+            scan_token(p);
+            p->depth++;
+            node = parse_unary(p);
+            p->depth--;
+            return node < 0 ? -1 : new_node(p, QUERY_NOT, node, -1);
+
+        case TOKEN_OPEN:
+            scan_token(p);
+            p->depth++;
+            node = parse_or(p);
+            p->depth--;
+            if (node < 0)
+                return -1;
+            if (p->token != TOKEN_CLOSE)
+            {
+                p->error = "missing )";
+                return -1;
+            }
+            scan_token(p);
+            return node;
+
+        case TOKEN_WORD:
+        case TOKEN_PHRASE:
+            return parse_primary(p);
+
+        default:
+            if (!p->error)
+                p->error = p->token == TOKEN_END ? "query ends where a word was expected"
+                                                 : "operator where a word was expected";
+            return -1;
+    }
+}
+
+static int parse_and(query_parser *p)
+{
+    int left = parse_unary(p);
+
+    while (left >= 0)
+    {
+        if (p->token == TOKEN_AND)
+            scan_token(p);
+        else if (p->token != TOKEN_WORD && p->token != TOKEN_PHRASE && p->token != TOKEN_NOT &&
+                 p->token != TOKEN_OPEN)
+            break;                                      // Only adjacent operands are ANDed
+
+        int right = parse_unary(p);
+        left = right < 0 ? -1 : new_node(p, QUERY_AND, left, right);
+    }
+    return left;
+}
+
+static int parse_or(query_parser *p)
+{
+    int left = parse_and(p);
+
+    while (left >= 0 && p->token == TOKEN_OR)
+    {
+        scan_token(p);
+        int right = parse_and(p);
+        left = right < 0 ? -1 : new_node(p, QUERY_OR, left, right);
+    }
+    return left;
+}
+
+
+/*****************************************************************************************************
+ * Function       : compile_query
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Parses a query into q without printing anything, for callers that report errors their own
+ *      way (the query server sends them back to the client). Term nodes point into 'text', which
+ *      must outlive the query.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE with what is wrong with the query written to 'error' ('size' bytes).
+ *****************************************************************************************************/
+int compile_query(query *q, const char *text, char *error, size_t size)
+{
+    query_parser p;
+
+    memset(&p, 0, sizeof(p));
+    p.q = q;
+    p.pos = text;
+    q->count = 0;
+
+    scan_token(&p);
+    q->root = parse_or(&p);
+    if (q->root >= 0 && p.token != TOKEN_END)
+        p.error = p.token == TOKEN_CLOSE ? "unmatched )" : "unexpected word after the query";
+
+    if (p.error)
+    {
+        snprintf(error, size, "%s at \"%.20s\"", p.error, p.word ? p.word : "");
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : parse_query
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Parses a query into q (see compile_query()).
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE after printing what is wrong with the query.
+ *****************************************************************************************************/
+int parse_query(query *q, const char *text)
+{
+    char error[96];
+
+    if (compile_query(q, text, error, sizeof(error)) == FAILURE)
+    {
+        printf("ERROR : %s\n", error);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : query_positional
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Tells whether a parsed query has a phrase or a NEAR, which only an index with word
+ *      positions can answer (run_query() refuses them otherwise).
+ *
+ * Returns        :
+ *      1 if it has, 0 if not.
+ *****************************************************************************************************/
+int query_positional(const query *q)
+{
+    for (int i = 0; i < q->count; i++)
+    {
+        if (q->node[i].type == QUERY_PHRASE || q->node[i].type == QUERY_NEAR)
+            return 1;
+    }
+    return 0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : free_doc_list / append_doc
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Release a result list, and add an id to the end of one (growing it by doubling).
+ *
+ * Returns        :
+ *      append_doc(): SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+void free_doc_list(doc_list *list)
+{
+    free(list->id);
+    list->id = NULL;
+    list->count = list->capacity = 0;
+}
+
+static int append_doc(doc_list *list, int id)
+{
+    if (list->count == list->capacity)
+    {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        int *grown = realloc(list->id, capacity * sizeof(int));
+        if (grown == NULL)
+            return FAILURE;
+        list->id = grown;
+        list->capacity = capacity;
+    }
+    list->id[list->count++] = id;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : source_word
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Runs a query word through the analysis steps of the source (analyze_query()).
+ *
+ * Returns        :
+ *      The word to look up, with its length in *len, or NULL if the analysis drops it.
+ *****************************************************************************************************/
+static const char* source_word(const query_source *src, const char *word, size_t *len, char *buf)
+{
+    return analyze_query(src->index ? src->index->analysis : src->table->analysis, word, len, buf);
+}
+
+
+/*****************************************************************************************************
+ * Function       : open_term
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Looks up a term node's word in the source and starts a walk over its postings.
+ *
+ * Returns        :
+ *      The word's file_count; 0 if the word isn't indexed (the cursor is then not started), -1 if
+ *      the analysis drops it.
+ *****************************************************************************************************/
+static int open_term(const query_source *src, int node, posting_cursor *cursor)
+{
+    const query_node *n = &src->q->node[node];
+    char buf[MAX_TOKEN_LEN + 1];
+    size_t len = n->len;
+    const char *word = source_word(src, n->word, &len, buf);
+
+    if (word == NULL)
+        return -1;
+    if (src->index)
+    {
+        const disk_term *t = index_lookup(src->index, word, len);
+        if (t == NULL)
+            return 0;
+        index_postings(src->index, t, cursor);
+        return t->file_count;
+    }
+
+    mainnode *m = lookup_term(src->table, word, len);
+    if (m == NULL)
+        return 0;
+    postings_of(m, cursor);
+    return m->file_count;
+}
+
+
+/*****************************************************************************************************
+ * Function       : all_documents
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Lists every document of the source (removed documents of the table excluded), which is
+ *      what a NOT without positive operands is taken against.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+static int all_documents(const query_source *src, doc_list *out)
+{
+    if (src->index)
+    {
+        for (unsigned int id = 0; id < src->index->doc_count; id++)
+            if (append_doc(out, id) == FAILURE)
+                return FAILURE;
+        return SUCCESS;
+    }
+
+    for (int id = 0; id < src->table->docs.count; id++)
+    {
+        if (src->table->docs.name[id] && append_doc(out, id) == FAILURE)
+            return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : gallop
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Finds the first entry >= target in list->id[from..count): steps of 1, 2, 4, ... bracket
+ *      it, then a binary search inside the bracket. Cost grows with the log of the distance
+ *      moved, so walking a long list with ascending targets stays cheap.
+ *
+ * Returns        :
+ *      Index of that entry, or list->count if there is none.
+ *****************************************************************************************************/
+static int gallop(const doc_list *list, int from, int target)
+{
+    int step = 1, low = from, high = from;
+
+    while (high < list->count && list->id[high] < target)
+    {
+        low = high + 1;
+        high += step;
+        step *= 2;
+    }
+    if (high > list->count)
+        high = list->count;
+
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+        if (list->id[mid] < target)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+
+/*****************************************************************************************************
+ * Function       : filter_by_term / filter_by_list
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Keep the candidates that are ('keep' = 1) or are not ('keep' = 0) in a term's postings or
+ *      in a sorted list. Both walk forward only, since the candidates are sorted.
+ *
+ * Returns        :
+ *      Nothing. The candidates are compacted in place.
+ *****************************************************************************************************/
+static void filter_by_term(doc_list *list, posting_cursor *cursor, int found, int keep)
+{
+    int n = 0, have = 0, more = found;
+
+    for (int i = 0; i < list->count; i++)
+    {
+        int id = list->id[i];
+
+        if (more && (!have || cursor->file_id < id))
+            have = more = seek_posting(cursor, id);
+        if ((have && cursor->file_id == id) == keep)
+            list->id[n++] = id;
+    }
+    list->count = n;
+}
+
+static void filter_by_list(doc_list *list, const doc_list *other, int keep)
+{
+    int n = 0, at = 0;
+
+    for (int i = 0; i < list->count; i++)
+    {
+        int id = list->id[i];
+
+        at = gallop(other, at, id);
+        if ((at < other->count && other->id[at] == id) == keep)
+            list->id[n++] = id;
+    }
+    list->count = n;
+}
+
+
+// One word of a phrase or NEAR while it is evaluated
+typedef struct positional_term
+{
+    posting_cursor postings;     // Walk over the word's postings
+    position_cursor positions;   // Walk over its positions, behind the postings
+    long unread;                 // Positions of the postings passed over, not skipped yet
+    int size;                    // file_count
+    int offset;                  // Place of the word in the phrase
+    int *at;                     // Positions in the current document, once read
+    int capacity;                // Entries allocated in at
+} positional_term;
+
+
+/*****************************************************************************************************
+ * Function       : open_positional
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Looks a 'len'-byte word up (already analyzed) and starts its postings and positions walks,
+ *      on the first posting.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the word isn't indexed.
+ *****************************************************************************************************/
+static int open_positional(const query_source *src, const char *word, size_t len, positional_term *t)
+{
+    if (src->index)
+    {
+        const disk_term *d = index_lookup(src->index, word, len);
+        if (d == NULL)
+            return FAILURE;
+        index_postings(src->index, d, &t->postings);
+        index_positions(src->index, d, &t->positions);
+        t->size = d->file_count;
+    }
+    else
+    {
+        mainnode *m = lookup_term(src->table, word, len);
+        if (m == NULL || m->file_count == 0)
+            return FAILURE;
+        postings_of(m, &t->postings);
+        positions_of(m, &t->positions);
+        t->size = m->file_count;
+    }
+
+    t->unread = 0;
+    return next_posting(&t->postings);
+}
+
+
+/*****************************************************************************************************
+ * Function       : advance_positional
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Moves a word's walk to its first posting at or after document 'target'. Postings are
+ *      decoded one by one rather than through seek_posting(): the count of every posting passed
+ *      over is needed to skip its positions later.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE once the postings run out.
+ *****************************************************************************************************/
+static int advance_positional(positional_term *t, int target)
+{
+    while (t->postings.file_id < target)
+    {
+        t->unread += t->postings.word_count;
+        if (next_posting(&t->postings) == FAILURE)
+            return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : read_positional
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Reads the word's positions in its current document into t->at, first skipping those of
+ *      the postings passed over. 'unread' then goes negative by the posting's count, which the
+ *      next advance adds back, so the positions just read aren't skipped a second time.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out or the positions are damaged.
+ *****************************************************************************************************/
+static int read_positional(positional_term *t)
+{
+    int count = t->postings.word_count;
+
+    if (count > t->capacity)
+    {
+        int *grown = realloc(t->at, count * sizeof(int));
+        if (grown == NULL)
+            return FAILURE;
+        t->at = grown;
+        t->capacity = count;
+    }
+    if (read_positions(&t->positions, t->unread, count, t->at) == FAILURE)
+        return FAILURE;
+    t->unread = -count;                                 // Already read when the posting is passed
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : phrase_at / near_at
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Check the positions read for the current document. phrase_at(): some position p of the
+ *      first term has every term i at p - offset[first] + offset[i]. near_at(): a position of
+ *      one word is within 'distance' of a different position of the other.
+ *
+ * Returns        :
+ *      1 on a match, 0 otherwise.
+ *****************************************************************************************************/
+static int phrase_at(const positional_term *term, int terms)
+{
+    int next[QUERY_MAX_PHRASE] = { 0 };                 // Per term, first position not yet below
+
+    for (int j = 0; j < term[0].postings.word_count; j++)
+    {
+        int start = term[0].at[j] - term[0].offset, i;
+
+        for (i = 1; i < terms; i++)
+        {
+            const positional_term *t = &term[i];
+            int want = start + t->offset;
+
+            while (next[i] < t->postings.word_count && t->at[next[i]] < want)
+                next[i]++;
+            if (next[i] == t->postings.word_count)
+                return 0;
+            if (t->at[next[i]] != want)
+                break;
+        }
+        if (i == terms)
+            return 1;
+    }
+    return 0;
+}
+
+static int near_at(const positional_term *a, const positional_term *b, int distance)
+{
+    int low = 0;
+
+    for (int j = 0; j < a->postings.word_count; j++)
+    {
+        int p = a->at[j];
+
+        while (low < b->postings.word_count && b->at[low] < p - distance)
+            low++;
+        for (int i = low; i < b->postings.word_count && b->at[i] <= p + distance; i++)
+            if (b->at[i] != p)
+                return 1;
+    }
+    return 0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : compare_positional
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      qsort() comparator putting the word in the fewest documents first.
+ *
+ * Returns        :
+ *      <0, 0 or >0.
+ *****************************************************************************************************/
+static int compare_positional(const void *a, const void *b)
+{
+    const positional_term *x = a, *y = b;
+
+    return (x->size > y->size) - (x->size < y->size);
+}
+
+
+/*****************************************************************************************************
+ * Function       : eval_positional
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Evaluates a phrase or NEAR node. The words' postings are intersected leapfrog fashion,
+ *      rarest word first; in a document that has every word, their positions are read and
+ *      checked.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out or positions are damaged.
+ *****************************************************************************************************/
+static int eval_positional(const query_source *src, int node, doc_list *out)
+{
+    const query_node *n = &src->q->node[node];
+    positional_term term[QUERY_MAX_PHRASE];
+    int terms = 0, offset = 0, status = SUCCESS, found = 1;
+
+    memset(term, 0, sizeof(term));
+    if (n->type == QUERY_NEAR)
+    {
+        const query_node *side[2] = { &src->q->node[n->left], &src->q->node[n->right] };
+        for (int i = 0; i < 2 && found; i++, terms++)
+        {
+            char buf[MAX_TOKEN_LEN + 1];
+            size_t len = side[i]->len;
+            const char *word = source_word(src, side[i]->word, &len, buf);
+            found = word && open_positional(src, word, len, &term[i]) == SUCCESS;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < n->len && found; )
+        {
+            while (i < n->len && isspace((unsigned char)n->word[i]))
+                i++;
+            size_t start = i;
+            while (i < n->len && !isspace((unsigned char)n->word[i]))
+                i++;
+            if (i == start)
+                break;
+
+            char buf[MAX_TOKEN_LEN + 1];
+            size_t len = i - start;
+            const char *word = source_word(src, n->word + start, &len, buf);
+            if (word == NULL)
+                continue;                               // Dropped words took no position either
+            term[terms].offset = offset++;
+            found = open_positional(src, word, len, &term[terms++]) == SUCCESS;
+        }
+        found = found && terms > 0;
+        qsort(term, terms, sizeof(positional_term), compare_positional);
+    }
+
+    int target = found ? term[0].postings.file_id : 0;
+    while (found && status == SUCCESS)
+    {
+        int i;
+        for (i = 0; i < terms; i++)
+        {
+            if (advance_positional(&term[i], target) == FAILURE)
+                found = 0;
+            else if (term[i].postings.file_id > target)
+                target = term[i].postings.file_id;
+            else
+                continue;
+            break;
+        }
+        if (!found)
+            break;
+        if (i < terms)                                  // A word is missing: retry from the next target
+            continue;
+
+        for (i = 0; i < terms && status == SUCCESS; i++)
+            status = read_positional(&term[i]);
+        if (status == SUCCESS &&
+            (n->type == QUERY_NEAR ? near_at(&term[0], &term[1], n->distance) : phrase_at(term, terms)))
+            status = append_doc(out, target);
+        target++;
+    }
+
+    for (int i = 0; i < QUERY_MAX_PHRASE; i++)
+        free(term[i].at);
+    return status;
+}
+
+
+static int eval_node(const query_source *src, int node, doc_list *out);
+
+/*****************************************************************************************************
+ * Function       : eval_pattern
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Lists the documents holding any word matching a pattern node: each matching word's
+ *      postings set bits in a bitmap over the document ids, which is then read in order. A
+ *      single match is listed straight from its postings.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+static int eval_pattern(const query_source *src, int node, doc_list *out)
+{
+    const query_node *n = &src->q->node[node];
+    match_list found = { 0 };
+    int status = SUCCESS;
+
+    if (match_terms(src->table, src->index, n->word, n->len, &found) == FAILURE)
+        return FAILURE;
+
+    int docs = src->index ? (int)src->index->doc_count : src->table->docs.count;
+    unsigned char *seen = found.count > 1 ? calloc(docs / 8 + 1, 1) : NULL;
+    if (found.count > 1 && seen == NULL)
+    {
+        free_match_list(&found);
+        return FAILURE;
+    }
+
+    for (int i = 0; i < found.count && status == SUCCESS; i++)
+    {
+        posting_cursor cursor;
+
+        if (found.match[i].term)
+            index_postings(src->index, found.match[i].term, &cursor);
+        else
+            postings_of(found.match[i].node, &cursor);
+
+        while (next_posting(&cursor) == SUCCESS)
+        {
+            if (seen == NULL)
+                status = append_doc(out, cursor.file_id);
+            else if (cursor.file_id < docs)
+                seen[cursor.file_id / 8] |= 1 << (cursor.file_id % 8);
+            if (status == FAILURE)
+                break;
+        }
+    }
+
+    for (int id = 0; seen && id < docs && status == SUCCESS; id++)
+    {
+        if (seen[id / 8] & (1 << (id % 8)))
+            status = append_doc(out, id);
+    }
+
+    free(seen);
+    free_match_list(&found);
+    return status;
+}
+
+
+/*****************************************************************************************************
+ * Function       : collect_and
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Flattens a chain of AND nodes into its positive operands and the operands of its NOTs.
+ *
+ * Returns        :
+ *      Nothing. The operand counts are updated in *npos / *nneg.
+ *****************************************************************************************************/
+static void collect_and(const query *q, int node, int *pos, int *npos, int *neg, int *nneg)
+{
+    const query_node *n = &q->node[node];
+
+    if (n->type == QUERY_AND)
+    {
+        collect_and(q, n->left, pos, npos, neg, nneg);
+        collect_and(q, n->right, pos, npos, neg, nneg);
+    }
+    else if (n->type == QUERY_NOT)
+        neg[(*nneg)++] = n->left;
+    else
+        pos[(*npos)++] = node;
+}
+
+
+// One operand of an AND chain while it is evaluated
+typedef struct and_operand
+{
+    int node;                    // Operand's top node
+    int size;                    // file_count of a term (-1 if dropped), result count of a sub-expression
+    int found;                   // Term: 1 if the word is indexed
+    posting_cursor cursor;       // Term: walk over its postings
+    doc_list list;               // Sub-expression: its result
+} and_operand;
+
+
+/*****************************************************************************************************
+ * Function       : compare_operands
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      qsort() comparator putting the smallest operand first.
+ *
+ * Returns        :
+ *      <0, 0 or >0.
+ *****************************************************************************************************/
+static int compare_operands(const void *a, const void *b)
+{
+    const and_operand *x = a, *y = b;
+
+    return (x->size > y->size) - (x->size < y->size);
+}
+
+
+/*****************************************************************************************************
+ * Function       : prepare_operand
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Opens a term operand's postings, or evaluates any other operand to its list, and records
+ *      its size.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+static int prepare_operand(const query_source *src, and_operand *op, int node)
+{
+    memset(op, 0, sizeof(*op));
+    op->node = node;
+
+    if (src->q->node[node].type == QUERY_TERM)
+    {
+        op->size = open_term(src, node, &op->cursor);
+        op->found = op->size > 0;
+        return SUCCESS;
+    }
+    if (eval_node(src, node, &op->list) == FAILURE)
+        return FAILURE;
+    op->size = op->list.count;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : eval_and
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Evaluates an AND chain: the smallest positive operand gives the candidates (every
+ *      document if there is none, none if the analysis dropped them all), the other positive
+ *      operands keep those they contain, and the negated ones drop those they contain. Nothing
+ *      more is read once no candidate is left.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+static int eval_and(const query_source *src, int node, doc_list *out)
+{
+    int pos[QUERY_MAX_OPERANDS], neg[QUERY_MAX_OPERANDS], npos = 0, nneg = 0;
+    and_operand op[QUERY_MAX_OPERANDS];
+    int prepared = 0, status = SUCCESS;
+
+    collect_and(src->q, node, pos, &npos, neg, &nneg);
+
+    for (int i = 0; i < npos && status == SUCCESS; i++, prepared++)
+        status = prepare_operand(src, &op[i], pos[i]);
+
+    int dropped = 0;                                    // Words the analysis drops leave the chain
+    for (int i = 0; i < npos && status == SUCCESS; i++)
+    {
+        if (op[i].size < 0)
+            dropped++;
+        else
+            op[i - dropped] = op[i];
+    }
+    if (status == SUCCESS)
+    {
+        npos -= dropped;
+        prepared = npos;                                // Dropped words hold no list
+        qsort(op, npos, sizeof(and_operand), compare_operands);
+    }
+
+    if (status == SUCCESS && npos == 0 && !dropped)
+        status = all_documents(src, out);
+    else if (status == SUCCESS && npos > 0 && op[0].size > 0)
+    {
+        if (src->q->node[op[0].node].type == QUERY_TERM)
+        {
+            while (status == SUCCESS && next_posting(&op[0].cursor) == SUCCESS)
+                status = append_doc(out, op[0].cursor.file_id);
+        }
+        else
+        {
+            *out = op[0].list;                          // Hand the list over
+            memset(&op[0].list, 0, sizeof(doc_list));
+        }
+    }
+
+    for (int i = 1; i < npos && status == SUCCESS && out->count > 0; i++)
+    {
+        if (src->q->node[op[i].node].type == QUERY_TERM)
+            filter_by_term(out, &op[i].cursor, op[i].found, 1);
+        else
+            filter_by_list(out, &op[i].list, 1);
+    }
+
+    for (int i = 0; i < nneg && status == SUCCESS && out->count > 0; i++)
+    {
+        and_operand negated;
+
+        status = prepare_operand(src, &negated, neg[i]);
+        if (status == FAILURE)
+            break;
+        if (src->q->node[neg[i]].type == QUERY_TERM)
+            filter_by_term(out, &negated.cursor, negated.found, 0);
+        else
+            filter_by_list(out, &negated.list, 0);
+        free_doc_list(&negated.list);
+    }
+
+    for (int i = 0; i < prepared; i++)
+        free_doc_list(&op[i].list);
+    return status;
+}
+
+
+/*****************************************************************************************************
+ * Function       : merge_or
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Merges two sorted lists into their sorted union.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+static int merge_or(const doc_list *a, const doc_list *b, doc_list *out)
+{
+    int i = 0, j = 0, status = SUCCESS;
+
+    while (status == SUCCESS && (i < a->count || j < b->count))
+    {
+        if (j == b->count || (i < a->count && a->id[i] < b->id[j]))
+            status = append_doc(out, a->id[i++]);
+        else if (i == a->count || b->id[j] < a->id[i])
+            status = append_doc(out, b->id[j++]);
+        else
+        {
+            status = append_doc(out, a->id[i++]);
+            j++;
+        }
+    }
+    return status;
+}
+
+
+/*****************************************************************************************************
+ * Function       : eval_node
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Evaluates a sub-tree into 'out' (which must be empty).
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+static int eval_node(const query_source *src, int node, doc_list *out)
+{
+    const query_node *n = &src->q->node[node];
+    doc_list a = {0}, b = {0};
+    posting_cursor cursor;
+    int status = SUCCESS;
+
+    switch (n->type)
+    {
+        case QUERY_TERM:
+            if (open_term(src, node, &cursor) <= 0)
+                return SUCCESS;
+            while (status == SUCCESS && next_posting(&cursor) == SUCCESS)
+                status = append_doc(out, cursor.file_id);
+            return status;
+
+        case QUERY_AND:
+        case QUERY_NOT:                                 // A lone NOT is an AND of no positives
+            return eval_and(src, node, out);
+
+        case QUERY_PHRASE:
+        case QUERY_NEAR:
+            return eval_positional(src, node, out);
+
+        case QUERY_PATTERN:
+            return eval_pattern(src, node, out);
+
+        default:
+            status = eval_node(src, n->left, &a);
+            if (status == SUCCESS)
+                status = eval_node(src, n->right, &b);
+            if (status == SUCCESS)
+                status = merge_or(&a, &b, out);
+            free_doc_list(&a);
+            free_doc_list(&b);
+            return status;
+    }
+}
+
+
+/*****************************************************************************************************
+ * Function       : run_query
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Evaluates a parsed query against the mapped index if 'index' is given, otherwise against
+ *      the table.
+ *
+ * Returns        :
+ *      SUCCESS with the matching document ids in ascending order in 'result' (free it with
+ *      free_doc_list()), or FAILURE if memory ran out or the query has a phrase or NEAR and the
+ *      source has no word positions.
+ *****************************************************************************************************/
+int run_query(const query *q, hashtable *table, disk_index *index, doc_list *result)
+{
+    query_source src = { q, table, index };
+    METRIC_START(started);
+
+    memset(result, 0, sizeof(*result));
+    if (query_positional(q) && !(index ? index->positional : table->positional))
+    {
+        printf("ERROR : Phrase and NEAR queries need word positions: create the database with -p\n");
+        return FAILURE;
+    }
+    if (eval_node(&src, q->root, result) == SUCCESS)
+    {
+        METRIC_STOP(PHASE_QUERY, started);
+        return SUCCESS;
+    }
+
+    printf("ERROR : Out of memory while running the query\n");
+    free_doc_list(result);
+    return FAILURE;
+}
+
+
+/*****************************************************************************************************
+ * Function       : query_database
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Parses and runs a query typed at the menu and prints the matching files.
+ *
+ * Returns        :
+ *      Nothing. Prints directly to console.
+ *****************************************************************************************************/
+void query_database(hashtable *table, disk_index *index, const char *text)
+{
+    query q;
+    doc_list result;
+
+    if (parse_query(&q, text) == FAILURE || run_query(&q, table, index, &result) == FAILURE)
+        return;
+
+    printf("%d file(s) match \"%s\"\n", result.count, text);
+    for (int i = 0; i < result.count; i++)
+        printf(" | File:%s\n", index ? index_document(index, result.id[i])
+                                     : document_name(table, result.id[i]));
+    free_doc_list(&result);
+}
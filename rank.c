@@ -0,0 +1,474 @@
+/*****************************************************************************************************
+ * File           : rank.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Ranked search: scores the documents containing any of the query words with BM25 and keeps
+ *      the best k in a bounded min-heap.
+ *
+ * Scoring        :
+ *      score(d) = sum over query words t in d of
+ *                     idf(t) * tf * (k1 + 1) / (tf + k1 * (1 - b + b * len(d) / avg_len))
+ *      idf(t)   = ln(1 + (N - df + 0.5) / (df + 0.5))
+ *      tf is the word's count in d, df its file_count, N the number of documents, len(d) the
+ *      number of words in d (doctable.c), k1 = BM25_K1 and b = BM25_B.
+ *
+ * Pruning        :
+ *      MaxScore. The tf part above grows with tf and shrinks with len(d), and len(d) >= tf, so
+ *      idf(t) times its value at tf = len(d) = max_count(t) bounds the score any document gets
+ *      from t. Words are ordered by that bound; once the heap is full, the words whose bounds sum
+ *      to no more than the k-th best score can't make a document enter the heap on their own.
+ *      Candidates are then only drawn from the other ("essential") words, and the non-essential
+ *      ones are probed with seek_posting() only while the score plus their remaining bounds could
+ *      still beat the k-th score. Common words stop driving the scan as soon as the heap fills.
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include "inverted_search.h"
+
+
+// One query word while a ranked search runs
+typedef struct rank_term
+{
+    posting_cursor cursor;       // Walk over the word's postings
+    int current;                 // Document of the current posting, INT_MAX once exhausted
+    double idf;                  // idf(t)
+    double bound;                // Largest score the word can contribute
+} rank_term;
+
+
+// What is searched: a mapped index if 'index' is set, else the table
+typedef struct rank_source
+{
+    hashtable *table;
+    disk_index *index;
+    double avg_length;           // Mean document length
+    const unsigned char *deleted;  // Segment tombstones: documents flagged here are skipped
+} rank_source;
+
+
+/*****************************************************************************************************
+ * Function       : tf_part
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      The BM25 term frequency factor for 'tf' occurrences in a document of 'length' words.
+ *
+ * Returns        :
+ *      The factor, between 0 and k1 + 1.
+ *****************************************************************************************************/
+static inline double tf_part(int tf, int length, double avg_length)
+{
+    double norm = avg_length > 0 ? BM25_K1 * (1 - BM25_B + BM25_B * length / avg_length) : BM25_K1;
+
+    return tf * (BM25_K1 + 1) / (tf + norm);
+}
+
+
+/*****************************************************************************************************
+ * Function       : document_length
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Number of words of a document of the source.
+ *
+ * Returns        :
+ *      The length.
+ *****************************************************************************************************/
+static inline int document_length(const rank_source *src, int file_id)
+{
+    return src->index ? (int)src->index->doc[file_id].length : src->table->docs.length[file_id];
+}
+
+
+/*****************************************************************************************************
+ * Function       : open_rank_term
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Looks a 'len'-byte query word up, starts its postings walk on the first posting and works
+ *      out its idf and score bound. The idf uses 'frequency' as the word's document frequency if it
+ *      is positive (the frequency over every segment), the source's own otherwise.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the word isn't indexed.
+ *****************************************************************************************************/
+static int open_rank_term(const rank_source *src, const char *word, size_t len, double docs,
+                          int frequency, rank_term *term)
+{
+    int df, max_count;
+
+    if (src->index)
+    {
+        const disk_term *t = index_lookup(src->index, word, len);
+        if (t == NULL)
+            return FAILURE;
+        index_postings(src->index, t, &term->cursor);
+        df = t->file_count;
+        max_count = t->max_count;
+    }
+    else
+    {
+        mainnode *m = lookup_term(src->table, word, len);
+        if (m == NULL || m->file_count == 0)
+            return FAILURE;
+        postings_of(m, &term->cursor);
+        df = m->file_count;
+        max_count = term_max_count(m);
+    }
+
+    if (frequency > 0)
+        df = frequency;
+    term->idf = log(1 + (docs - df + 0.5) / (df + 0.5));
+    term->bound = term->idf * tf_part(max_count, max_count, src->avg_length);
+    term->current = next_posting(&term->cursor) == SUCCESS ? term->cursor.file_id : INT_MAX;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : compare_bounds
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      qsort() comparator putting the word with the smallest score bound first.
+ *
+ * Returns        :
+ *      <0, 0 or >0.
+ *****************************************************************************************************/
+static int compare_bounds(const void *a, const void *b)
+{
+    const rank_term *x = a, *y = b;
+
+    return (x->bound > y->bound) - (x->bound < y->bound);
+}
+
+
+/*****************************************************************************************************
+ * Function       : worse / sift_down / offer
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Bounded min-heap of the best k documents; its root is the k-th best. A lower score is
+ *      worse, and of equal scores the higher document id, so ties keep the earlier document.
+ *      offer() adds a document if the heap has room or it beats the root, which it replaces.
+ *
+ * Returns        :
+ *      worse(): 1 if a ranks below b. offer(): nothing.
+ *****************************************************************************************************/
+static inline int worse(const ranked_doc *a, const ranked_doc *b)
+{
+    return a->score < b->score || (a->score == b->score && a->file_id > b->file_id);
+}
+
+static void sift_down(ranked_doc *heap, int count, int i)
+{
+    for (;;)
+    {
+        int child = 2 * i + 1;
+        if (child >= count)
+            return;
+        if (child + 1 < count && worse(&heap[child + 1], &heap[child]))
+            child++;
+        if (!worse(&heap[child], &heap[i]))
+            return;
+        ranked_doc tmp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = tmp;
+        i = child;
+    }
+}
+
+static void offer(ranked_doc *heap, int *count, int k, ranked_doc doc)
+{
+    if (*count < k)
+    {
+        int i = (*count)++;                             // Sift the new entry up
+        heap[i] = doc;
+        while (i > 0 && worse(&heap[i], &heap[(i - 1) / 2]))
+        {
+            ranked_doc tmp = heap[i];
+            heap[i] = heap[(i - 1) / 2];
+            heap[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+        return;
+    }
+    if (worse(&heap[0], &doc))
+    {
+        heap[0] = doc;
+        sift_down(heap, *count, 0);
+    }
+}
+
+
+/*****************************************************************************************************
+ * Function       : query_words
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Splits a ranked search into its words (whitespace separated), analyzes them with 'steps'
+ *      like the indexed words, and keeps each distinct one once in word[] / len[].
+ *
+ * Returns        :
+ *      Number of words kept, or -1 if there are more than RANK_MAX_TERMS.
+ *****************************************************************************************************/
+static int query_words(unsigned int steps, const char *text, char word[][MAX_TOKEN_LEN + 1], size_t *len)
+{
+    int words = 0;
+
+    for (const char *p = text; *p; )
+    {
+        while (isspace((unsigned char)*p))
+            p++;
+        const char *start = p;
+        while (*p && !isspace((unsigned char)*p))
+            p++;
+        size_t n = p - start;
+        if (n == 0)
+            break;
+
+        char buf[MAX_TOKEN_LEN + 1];
+        const char *analyzed = analyze_query(steps, start, &n, buf);   // As the words were indexed
+        if (analyzed == NULL || n > MAX_TOKEN_LEN)
+            continue;                                   // Dropped, or too long to be indexed
+
+        int repeated = 0;
+        for (int i = 0; i < words && !repeated; i++)
+            repeated = len[i] == n && memcmp(word[i], analyzed, n) == 0;
+        if (repeated)
+            continue;
+        if (words == RANK_MAX_TERMS)
+            return -1;
+        memcpy(word[words], analyzed, n);
+        len[words++] = n;
+    }
+    return words;
+}
+
+
+/*****************************************************************************************************
+ * Function       : score_documents
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Scores the documents of the opened words and stores the best k in top[], best first.
+ *      Documents scoring no more than 'floor' can't be wanted (a segmented search already holds k
+ *      better ones), so with 'prune' they are pruned like those below the k-th best score.
+ *
+ * Returns        :
+ *      Number of documents stored (at most k).
+ *****************************************************************************************************/
+static int score_documents(const rank_source *src, rank_term *term, int terms, int k, int prune,
+                           double floor, ranked_doc *top)
+{
+    qsort(term, terms, sizeof(rank_term), compare_bounds);
+    double prefix[RANK_MAX_TERMS];                      // prefix[i]: bounds of term[0..i] summed
+    for (int i = 0; i < terms; i++)
+        prefix[i] = term[i].bound + (i ? prefix[i - 1] : 0);
+
+    int count = 0, essential = 0;                       // term[essential..] drive the scan
+    double threshold = prune ? floor : 0;               // k-th best score once the heap is full
+    while (essential < terms && prefix[essential] <= threshold && threshold > 0)
+        essential++;
+
+    while (k > 0)
+    {
+        int doc = INT_MAX;
+        for (int i = essential; i < terms; i++)
+            if (term[i].current < doc)
+                doc = term[i].current;
+        if (doc == INT_MAX)
+            break;
+
+        if (src->deleted && src->deleted[doc])          // Deleted from its segment: pass it by
+        {
+            for (int i = essential; i < terms; i++)
+                if (term[i].current == doc)
+                    term[i].current = next_posting(&term[i].cursor) == SUCCESS ? term[i].cursor.file_id : INT_MAX;
+            continue;
+        }
+
+        int length = document_length(src, doc);
+        double score = 0;
+        for (int i = essential; i < terms; i++)
+        {
+            rank_term *t = &term[i];
+            if (t->current != doc)
+                continue;
+            score += t->idf * tf_part(t->cursor.word_count, length, src->avg_length);
+            t->current = next_posting(&t->cursor) == SUCCESS ? t->cursor.file_id : INT_MAX;
+        }
+
+        // Non-essential words, largest bound first, while they could still lift the score
+        int i = essential - 1;
+        for (; i >= 0 && score + prefix[i] > threshold; i--)
+        {
+            rank_term *t = &term[i];
+            if (t->current < doc)
+                t->current = seek_posting(&t->cursor, doc) == SUCCESS ? t->cursor.file_id : INT_MAX;
+            if (t->current == doc)
+                score += t->idf * tf_part(t->cursor.word_count, length, src->avg_length);
+        }
+        if (i >= 0)
+            continue;                                   // Can't beat the k-th best: not scored fully
+
+        ranked_doc found = { doc, score };
+        offer(top, &count, k, found);
+        if (count == k && prune && top[0].score > threshold)
+        {
+            threshold = top[0].score;
+            while (essential < terms && prefix[essential] <= threshold)
+                essential++;
+        }
+    }
+
+    // Heap order to best first: repeatedly move the root behind the shrinking heap
+    for (int n = count; n > 1; n--)
+    {
+        ranked_doc tmp = top[0];
+        top[0] = top[n - 1];
+        top[n - 1] = tmp;
+        sift_down(top, n - 1, 0);
+    }
+    return count;
+}
+
+
+/*****************************************************************************************************
+ * Function       : rank_documents
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Scores the documents matching any word of 'text' (whitespace separated, analyzed like the
+ *      indexed words; repeated words count once) against the mapped index if 'index' is given, otherwise the table, and
+ *      stores the best k in top[], best first. With 'prune' = 0 every posting of every word is
+ *      scored, which gives the same ranking without MaxScore and serves as its reference.
+ *
+ * Returns        :
+ *      Number of documents stored (at most k), or -1 if the query has more than RANK_MAX_TERMS
+ *      words.
+ *****************************************************************************************************/
+int rank_documents(hashtable *table, disk_index *index, const char *text, int k, int prune,
+                   ranked_doc *top)
+{
+    rank_source src = { table, index, 0.0, NULL };
+    rank_term term[RANK_MAX_TERMS];
+    char word[RANK_MAX_TERMS][MAX_TOKEN_LEN + 1];
+    size_t len[RANK_MAX_TERMS];
+    int terms = 0;
+    double docs;
+    METRIC_START(started);
+
+    if (index)
+    {
+        docs = index->doc_count;
+        src.avg_length = index->avg_length;
+    }
+    else
+    {
+        docs = table->docs.live;
+        src.avg_length = docs > 0 ? table->docs.total_length / docs : 0.0;
+    }
+
+    int words = query_words(index ? index->analysis : table->analysis, text, word, len);
+    if (words < 0)
+        return -1;
+    for (int w = 0; w < words; w++)
+        if (open_rank_term(&src, word[w], len[w], docs, 0, &term[terms]) == SUCCESS)
+            terms++;
+
+    int count = score_documents(&src, term, terms, k, prune, 0.0, top);
+    METRIC_STOP(PHASE_RANK, started);
+    return count;
+}
+
+
+/*****************************************************************************************************
+ * Function       : rank_segments
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      rank_documents() over every segment of a view (see segment.c): the words are analyzed and
+ *      their document frequencies summed over the segments once, then each segment is scored with
+ *      the view's live documents and mean length, skipping its deleted documents, and its best k
+ *      merged into top[]. Once k documents are held, the k-th score is the floor the following
+ *      segments are pruned against. File ids in top[] are view ids.
+ *
+ * Returns        :
+ *      Number of documents stored (at most k), or -1 if the query has more than RANK_MAX_TERMS
+ *      words or memory ran out.
+ *****************************************************************************************************/
+int rank_segments(segment_view *view, const char *text, int k, int prune, ranked_doc *top)
+{
+    char word[RANK_MAX_TERMS][MAX_TOKEN_LEN + 1];
+    size_t len[RANK_MAX_TERMS];
+    int df[RANK_MAX_TERMS];
+    unsigned int steps = view->count ? view->part[0].seg->index.analysis : 0;
+    int count = 0;
+    METRIC_START(started);
+
+    int words = query_words(steps, text, word, len);
+    if (words < 0 || k <= 0)
+        return words < 0 ? -1 : 0;
+    for (int w = 0; w < words; w++)
+        df[w] = segment_frequency(view, word[w], len[w]);
+
+    ranked_doc *found = malloc(2 * k * sizeof(ranked_doc));   // A segment's best, then the merge
+    if (found == NULL)
+        return -1;
+    for (int s = 0; s < view->count; s++)
+    {
+        const segment_part *p = &view->part[s];
+        rank_source src = { NULL, &p->seg->index, view->avg_length, p->deleted ? p->deleted->flag : NULL };
+        rank_term term[RANK_MAX_TERMS];
+        int terms = 0;
+
+        for (int w = 0; w < words; w++)
+            if (df[w] > 0 && open_rank_term(&src, word[w], len[w], view->live, df[w], &term[terms]) == SUCCESS)
+                terms++;
+        if (terms == 0)
+            continue;
+        int n = score_documents(&src, term, terms, k, prune, count == k ? top[k - 1].score : 0.0, found);
+
+        // Both lists are best first; keep the best k of the two
+        ranked_doc *merged = found + k;
+        int a = 0, b = 0, m = 0;
+        for (int i = 0; i < n; i++)
+            found[i].file_id += p->base;
+        while (m < k && (a < count || b < n))
+            merged[m++] = b == n || (a < count && !worse(&top[a], &found[b])) ? top[a++] : found[b++];
+        memcpy(top, merged, m * sizeof(ranked_doc));
+        count = m;
+    }
+    free(found);
+    METRIC_STOP(PHASE_RANK, started);
+    return count;
+}
+
+
+/*****************************************************************************************************
+ * Function       : rank_database
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Runs a ranked search typed at the menu and prints the best RANK_TOP_K files with their
+ *      scores.
+ *
+ * Returns        :
+ *      Nothing. Prints directly to console.
+ *****************************************************************************************************/
+void rank_database(hashtable *table, disk_index *index, const char *text)
+{
+    ranked_doc top[RANK_TOP_K];
+    int count = rank_documents(table, index, text, RANK_TOP_K, 1, top);
+
+    if (count < 0)
+    {
+        printf("ERROR : A ranked search takes at most %d words\n", RANK_MAX_TERMS);
+        return;
+    }
+    if (count == 0)
+    {
+        printf("No file contains any of the words.\n");
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+        printf("%2d. %-20s score %.4f\n", i + 1,
+               index ? index_document(index, top[i].file_id) : document_name(table, top[i].file_id),
+               top[i].score);
+}
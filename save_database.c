@@ -3,8 +3,14 @@
  * ---------------------------------------------------------------------------------------------------
  * What it does   :
  *      Writes the entire inverted index (hash table) into a backup text file called "backup.txt".
- *      Each hash bucket is written with a bucket marker (#index;), followed by every word stored
- *      inside that bucket and all corresponding file entries (subnodes).
+ *      Each non-empty hash bucket is written with a bucket marker (#index;), followed by every word
+ *      stored inside that bucket and all corresponding file entries (postings). The marker only
+ *      groups the lines; the loader re-hashes every word, so the table size may differ on reload.
+ *
+ *      The lines are formatted into a SAVE_BUFFER-byte buffer that is written out whenever it
+ *      fills, and the file is built under a temporary name next to backup.txt, flushed to disk
+ *      and renamed over it (see create_replacement / replace_file). A save that fails or is
+ *      interrupted leaves the previous backup.txt as it was.
  *
  * Why it’s needed:
  *      Allows persistent storage of the database so it can be reloaded later using the update
@@ -15,56 +21,244 @@
  *      word; file_count; filename; word_count; filename; word_count;  #
  *
  * Returns        :
- *      Nothing. Writes data directly to backup.txt.
+ *      SUCCESS, or FAILURE if the file couldn't be created or written.
  *****************************************************************************************************/
 #include "inverted_search.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 
-void save_database(hashtable *table)
+// Output buffer of save_database: lines are formatted here and written in SAVE_BUFFER-byte blocks
+typedef struct text_writer
 {
-    FILE *fp = fopen("backup.txt","w");      // Open backup file in write mode
+    int fd;                      // Temporary file
+    char *buf;                   // Formatted bytes not yet written
+    size_t len;                  // Bytes used in buf
+    int error;                   // Set by the first failed write
+} text_writer;
+
+
+/*****************************************************************************************************
+ * Function       : write_all
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Writes 'len' bytes to the file, resuming after short writes and signals.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE on a write error.
+ *****************************************************************************************************/
+static int write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
     {
-        if(fp == NULL)                       // Check for file open failure
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FAILURE;
+        data += n;
+        len -= n;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : flush_text
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Writes out the buffered bytes. After an error nothing more is written.
+ *
+ * Returns        :
+ *      Nothing. A failed write sets writer->error.
+ *****************************************************************************************************/
+static void flush_text(text_writer *w)
+{
+    if (!w->error && w->len && write_all(w->fd, w->buf, w->len) == FAILURE)
+        w->error = 1;
+    w->len = 0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : put_text / put_number
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      put_text() appends bytes to the buffer, flushing it first if they don't fit (a string
+ *      longer than the whole buffer is written directly). put_number() appends a non-negative
+ *      integer in decimal.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void put_text(text_writer *w, const char *text, size_t len)
+{
+    if (w->len + len > SAVE_BUFFER)
+    {
+        flush_text(w);
+        if (len > SAVE_BUFFER)
         {
-            printf("ERROR : Couldn't open the file");
+            if (!w->error && write_all(w->fd, text, len) == FAILURE)
+                w->error = 1;
+            return;
         }
     }
+    memcpy(w->buf + w->len, text, len);
+    w->len += len;
+}
+
+static void put_number(text_writer *w, unsigned long value)
+{
+    char digits[24];
+    char *p = digits + sizeof(digits);
+
+    do
+    {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    put_text(w, p, digits + sizeof(digits) - p);
+}
+
+
+/*****************************************************************************************************
+ * Function       : create_replacement
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Creates an empty temporary file "<filename>.XXXXXX" in the same directory as 'filename',
+ *      so it can later be renamed over it, and stores its name in 'temp'.
+ *
+ * Returns        :
+ *      File descriptor open for writing, or -1 (with a message) if it couldn't be created.
+ *****************************************************************************************************/
+int create_replacement(const char *filename, char *temp, size_t size)
+{
+    int fd = -1;
+
+    if ((size_t)snprintf(temp, size, "%s.XXXXXX", filename) < size)
+        fd = mkstemp(temp);
+    if (fd < 0)
+    {
+        printf("ERROR : Couldn't create a temporary file for %s\n", filename);
+        return -1;
+    }
+    fchmod(fd, 0644);                    // mkstemp() makes it private to the owner
+    return fd;
+}
+
+
+/*****************************************************************************************************
+ * Function       : replace_file
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Finishes a save started with create_replacement(), whose file the caller has already
+ *      flushed to disk (fsync) and closed. If 'ok', the temporary file is renamed over 'filename'
+ *      and the directory is synced so the rename itself survives a crash; otherwise the temporary
+ *      file is removed and 'filename' is left as it was.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if 'ok' was 0 or the rename failed.
+ *****************************************************************************************************/
+int replace_file(const char *temp, const char *filename, int ok)
+{
+    if (!ok || rename(temp, filename) != 0)
+    {
+        unlink(temp);
+        return FAILURE;
+    }
 
-    for(int i=0 ; i<27 ; i++)                // Loop through all hash table buckets
+    char dir[4096];
+    const char *slash = strrchr(filename, '/');
+    if (slash == NULL)
+        strcpy(dir, ".");
+    else if ((size_t)(slash - filename) < sizeof(dir))
+        snprintf(dir, sizeof(dir), "%.*s", slash == filename ? 1 : (int)(slash - filename), filename);
+    else
+        return SUCCESS;                  // Directory name too long to sync: the file itself is safe
+
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0)
     {
-        mainnode *m = table[i].link;         // Pointer to first word in this bucket
-        if((m) == NULL)                      // Skip empty buckets
+        fsync(fd);
+        close(fd);
+    }
+    return SUCCESS;
+}
+
+
+int save_database(hashtable *table)
+{
+    METRIC_START(started);
+    char temp[4096];                         // Temporary file, renamed over TEXT_FILE at the end
+    text_writer w = { -1, malloc(SAVE_BUFFER), 0, 0 };
+
+    if (w.buf == NULL)
+    {
+        printf("ERROR : Couldn't allocate the save buffer\n");
+        return FAILURE;
+    }
+    w.fd = create_replacement(TEXT_FILE, temp, sizeof(temp));
+    if (w.fd < 0)                            // Check for file open failure
+    {
+        free(w.buf);
+        return FAILURE;
+    }
+
+    table_cursor cursor;                     // Position of the walk over all words
+    long bucket = -1;                        // Bucket of the previous word written
+
+    for(mainnode *m = first_mainnode(table, &cursor); m != NULL && !w.error;
+        m = next_mainnode(table, &cursor))   // Traverse each mainnode (word)
+    {
+        if(cursor.bucket != bucket)          // Entering a new bucket
         {
-            continue;
+            bucket = cursor.bucket;
+            put_text(&w, "#", 1);            // Write bucket marker
+            put_number(&w, bucket);
+            put_text(&w, ";\n", 2);
         }
 
-        fprintf(fp, "#%d;\n", i);            // Write bucket marker
-
-        while((m) != NULL)                   // Traverse each mainnode (word)
-        {  
-            fprintf(fp,"%s; %d;",            // Write word and file count
-                    m->word,
-                    m->file_count);         
-                    
-            subnode *s = m->sublink;         // Pointer to first file entry
-
-            while(s != NULL)                 // Traverse subnodes (file details)
-            {
-                fprintf(fp," %s; %d;",       // Write file name and occurrence count
-                        s->file_name,
-                        s->word_count);
-                s = s->sub_sublink;          // Move to next subnode
-            }
-
-            fprintf(fp," #\n");              // End marker for this word
-            m = m->main_next_link;           // Move to next word in this bucket
+        put_text(&w, m->word, m->len);       // Write word and file count
+        put_text(&w, "; ", 2);
+        put_number(&w, m->file_count);
+        put_text(&w, ";", 1);
+
+        posting_cursor s;                    // Walk over the word's postings
+        postings_of(m, &s);
+
+        while(next_posting(&s) == SUCCESS)   // Decode postings (file details)
+        {
+            const char *name = document_name(table, s.file_id);
+
+            put_text(&w, " ", 1);            // Write file name and occurrence count
+            put_text(&w, name, strlen(name));
+            put_text(&w, "; ", 2);
+            put_number(&w, s.word_count);
+            put_text(&w, ";", 1);
         }
-   }
 
-   printf("Saved Successfully in backup.txt\n");  // Status update
-   fclose(fp);                                    // Close the file
+        put_text(&w, " #\n", 3);             // End marker for this word
+    }
+
+    flush_text(&w);
+    if (fsync(w.fd) != 0)                    // On disk before it replaces the old backup
+        w.error = 1;
+    if (close(w.fd) != 0)
+        w.error = 1;
+    free(w.buf);
 
+    if (replace_file(temp, TEXT_FILE, !w.error) == FAILURE)
+    {
+        printf("ERROR : Couldn't write %s, the previous backup is unchanged\n", TEXT_FILE);
+        return FAILURE;
+    }
+    METRIC_STOP(PHASE_SAVE_TEXT, started);
+    printf("Saved Successfully in %s\n", TEXT_FILE);   // Status update
+    return SUCCESS;
 }
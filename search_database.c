@@ -3,8 +3,8 @@
  * ---------------------------------------------------------------------------------------------------
  * What it does   :
  *      Searches for a specific word inside the hash table and prints all file details associated
- *      with that word. It locates the correct hash bucket, finds the mainnode for the word, and
- *      then displays all subnodes (filenames + word counts).
+ *      with that word. It looks the word up in the hash table, and then displays all postings
+ *      (filenames + word counts).
  *
  * Why it’s needed:
  *      Enables end-users to query the inverted index and retrieve file-level information about any
@@ -12,18 +12,78 @@
  *
  * Workflow       :
  *      1. Validate input word.
- *      2. Compute hash index.
- *      3. Search mainnode in corresponding bucket.
- *      4. If found, display file counts and per-file frequency details.
+ *      2. Normalize it like the indexed words (analyzer.c) and look it up with lookup_term().
+ *      3. If found, display file counts and per-file frequency details; if not, suggest close words.
+ *
+ *      A word with '*' or '?', or ending in "~" / "~N", is a pattern: the matching words are listed
+ *      instead (lexicon.c).
  *
  * Returns        :
  *      Nothing. Prints directly to console.
  *****************************************************************************************************/
 #include <stdio.h>
+#include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
 #include "inverted_search.h"
 
+
+/*****************************************************************************************************
+ * Function       : print_node
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Prints the line of a found word: the word and its file count, then every posting (file
+ *      name and count) in document order.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void print_node(FILE *out, hashtable *table, mainnode *m)
+{
+    // Print the word summary (word, file count)
+    fprintf(out, "%-20s %-10d",
+            m->word,
+            m->file_count);
+
+    // Print all file entries (postings) for this word, decoded in document order
+    posting_cursor s;
+    postings_of(m, &s);
+    while (next_posting(&s) == SUCCESS)
+    {
+        fprintf(out, " | File:%-15s : %d",
+                document_name(table, s.file_id),
+                s.word_count);
+    }
+
+    fprintf(out, "\n");                                // Final newline for clean output
+}
+
+
+/*****************************************************************************************************
+ * Function       : print_term
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      print_node() for a word of a mapped index.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void print_term(FILE *out, disk_index *index, const disk_term *t)
+{
+    fprintf(out, "%-20s %-10u", index_word(index, t), t->file_count);
+
+    posting_cursor p;
+    index_postings(index, t, &p);
+    while (next_posting(&p) == SUCCESS)
+    {
+        fprintf(out, " | File:%-15s : %d",
+                index_document(index, p.file_id),
+                p.word_count);
+    }
+
+    fprintf(out, "\n");
+}
+
 void search_database(hashtable *table, const char *word)
 {
     if (word == NULL || word[0] == '\0')               // Validate if user entered a non-empty word
@@ -32,35 +92,155 @@ void search_database(hashtable *table, const char *word)
         return;
     }
 
-    int index = get_index(word);                       // Compute hash index for the word
-    if (index < 0 || index > 26)                       // Safety check (should not fail)
+    if (is_term_pattern(word, strlen(word)))            // Wildcard or fuzzy word
     {
+        expand_terms(table, NULL, word);
         return;
     }
 
-    // Look for the word in the corresponding bucket
-    mainnode *m = search_mainnode(table[index].link, (char *)word);
+    char term[MAX_TOKEN_LEN + 1];
+    size_t len = strlen(word);
+    const char *key = analyze_query(table->analysis, word, &len, term);
+    if (key == NULL)                                   // Dropped by the analysis
+    {
+        printf("Word %s is a stopword or punctuation and is not indexed.\n", word);
+        return;
+    }
+
+    METRIC_START(started);
+    mainnode *m = lookup_term(table, key, len);        // Hash the word and search its bucket
+    METRIC_STOP(PHASE_SEARCH, started);
     if (m == NULL)                                     // Word not found
     {
         printf("Word %s is not present in database.\n", word);
+        suggest_terms(table, NULL, key);
+        return;
+    }
+
+    print_node(stdout, table, m);
+}
+
+
+/*****************************************************************************************************
+ * Function       : search_index
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Same as search_database(), answered from a mapped index file: the word is found by binary
+ *      search of the sorted dictionary and its postings are read in place. Patterns and
+ *      suggestions walk that same dictionary.
+ *
+ * Returns        :
+ *      Nothing. Prints directly to console.
+ *****************************************************************************************************/
+void search_index(disk_index *index, const char *word)
+{
+    if (word == NULL || word[0] == '\0')               // Validate if user entered a non-empty word
+    {
+        printf("Please Provide a valid word !\n");
+        return;
+    }
+
+    if (is_term_pattern(word, strlen(word)))            // Wildcard or fuzzy word
+    {
+        expand_terms(NULL, index, word);
+        return;
+    }
+
+    char term[MAX_TOKEN_LEN + 1];
+    size_t len = strlen(word);
+    const char *key = analyze_query(index->analysis, word, &len, term);
+    if (key == NULL)                                   // Dropped by the analysis
+    {
+        printf("Word %s is a stopword or punctuation and is not indexed.\n", word);
+        return;
+    }
+
+    METRIC_START(started);
+    const disk_term *t = index_lookup(index, key, len);
+    METRIC_STOP(PHASE_SEARCH, started);
+    if (t == NULL)                                     // Word not found
+    {
+        printf("Word %s is not present in database.\n", word);
+        suggest_terms(NULL, index, key);
+        return;
+    }
+
+    print_term(stdout, index, t);
+}
+
+
+/*****************************************************************************************************
+ * Function       : search_cached
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      search_database() (index NULL) or search_index() through a result cache (cache.c). The key
+ *      is the word after analysis, so "Error" and "error" share an entry when the index folds
+ *      case; the generation is the table's, which every build, update and reload bumps (the
+ *      table is not changed while an index is mapped). A found word's line is printed from the
+ *      cache, or printed into memory, stored and then shown. Patterns, dropped words and missing
+ *      words (with their suggestions) are not cached.
+ *
+ * Returns        :
+ *      Nothing. Prints directly to console.
+ *****************************************************************************************************/
+void search_cached(result_cache *cache, hashtable *table, disk_index *index, const char *word)
+{
+    if (word == NULL || word[0] == '\0' || is_term_pattern(word, strlen(word)))
+    {
+        if (index)
+            search_index(index, word);
+        else
+            search_database(table, word);
         return;
     }
 
-    // Print the word summary (bucket index, word, file count)
-    printf("[%-2d]   %-20s %-10d",
-           table[index].index,
-           m->word,
-           m->file_count);
+    char term[MAX_TOKEN_LEN + 1], key[MAX_TOKEN_LEN + 16];
+    size_t len = strlen(word);
+    const char *found = analyze_query(index ? index->analysis : table->analysis, word, &len, term);
+    if (found == NULL)
+    {
+        printf("Word %s is a stopword or punctuation and is not indexed.\n", word);
+        return;
+    }
+    snprintf(key, sizeof(key), "SEARCH %.*s", (int)len, found);
 
-    // Print all file entries (subnodes) for this word
-    subnode *s = m->sublink;
-    while (s)
+    char *text = NULL;
+    size_t cap = 0;
+    if (cache_get(cache, key, table->generation, &text, &cap) >= 0)
     {
-        printf(" | File:%-15s : %d",
-               s->file_name,
-               s->word_count);
-        s = s->sub_sublink;                            // Move to next file entry
+        fputs(text, stdout);
+        free(text);
+        return;
+    }
+
+    METRIC_START(started);
+    mainnode *m = index ? NULL : lookup_term(table, found, len);
+    const disk_term *t = index ? index_lookup(index, found, len) : NULL;
+    METRIC_STOP(PHASE_SEARCH, started);
+    if (m == NULL && t == NULL)
+    {
+        printf("Word %s is not present in database.\n", word);
+        suggest_terms(index ? NULL : table, index, found);
+        return;
     }
 
-    printf("\n");                                      // Final newline for clean output
+    FILE *out = open_memstream(&text, &cap);
+    if (out == NULL)                                   // No memory for the copy: just print it
+    {
+        if (m)
+            print_node(stdout, table, m);
+        else
+            print_term(stdout, index, t);
+        return;
+    }
+    if (m)
+        print_node(out, table, m);
+    else
+        print_term(out, index, t);
+    if (fclose(out) == 0)
+    {
+        cache_put(cache, key, table->generation, text, cap);
+        fputs(text, stdout);
+    }
+    free(text);
 }
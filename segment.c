@@ -0,0 +1,1268 @@
+/*****************************************************************************************************
+ * File           : segment.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Segmented index: a directory of immutable index files ("segments", each written by
+ *      save_index() and mapped by open_index()) and a manifest naming the live ones. Adding files
+ *      never rewrites what is there: ingest_files() indexes the new and changed files into one new
+ *      segment, and a file indexed again or removed is only flagged as deleted (a tombstone) in
+ *      the segment holding its older copy. Queries fan out over the segments and combine their
+ *      results; view ids number the documents of all segments one after the other.
+ *
+ * Views          :
+ *      Readers work on a view: the segments and their tombstones at one moment, reference
+ *      counted. A commit (an ingest, a removal, a merge) builds a new view from the current one,
+ *      writes the manifest and makes the new view current; readers holding the old one finish on
+ *      it. A segment is unmapped once no view holds it, and its file removed then if a merge
+ *      replaced it. Tombstones are copied on write, so views that agree on a segment's deleted
+ *      documents share them.
+ *
+ * Merging        :
+ *      Tiered. A segment of fewer than SEGMENT_TIER_BASE live postings is in tier 0, each tier
+ *      above takes SEGMENT_FANIN times more. Once a tier holds SEGMENT_FANIN segments the merger
+ *      thread merges them into one of a higher tier, so at most SEGMENT_FANIN - 1 segments stay
+ *      in each tier (a logarithmic number in all) and a posting is rewritten once per tier it
+ *      climbs. A segment with more deleted documents than live ones is rewritten alone. A merge
+ *      reads its inputs from a view without holding any lock; documents deleted while it ran are
+ *      deleted again in its result when it commits.
+ *
+ * Manifest       :
+ *      Text, replaced atomically (create_replacement / replace_file) at every commit:
+ *          INVSEGMENTS 1
+ *          next <segment id> positions <0|1> analysis <steps>
+ *          segment <id> <deleted count> <deleted document id> ...
+ *      A segment file is complete before a manifest names it, so a crash leaves the previous
+ *      manifest valid; files it doesn't name are removed by the next open_segments(). One process
+ *      uses a directory at a time.
+ *
+ * Statistics     :
+ *      A ranked search scores with the live documents and mean length of the whole view, and a
+ *      word's document frequency summed over the segments. Deleted documents still count in the
+ *      frequency until a merge drops them, so scores can differ slightly from those of one index
+ *      of the same files while tombstones are pending.
+ *
+ * Threads        :
+ *      Any number of readers. Ingests, removals and the merger may run at once; their commits
+ *      take turns on 'commit'. 'lock' is only held to take or drop references and swap views.
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "inverted_search.h"
+
+
+/*****************************************************************************************************
+ * Function       : segment_path
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Writes the file name of segment 'id' of the set.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if it doesn't fit in 'size' bytes.
+ *****************************************************************************************************/
+static int segment_path(const segment_set *set, unsigned long id, char *path, size_t size)
+{
+    return (size_t)snprintf(path, size, "%s/seg_%06lu.idx", set->dir, id) < size ? SUCCESS : FAILURE;
+}
+
+
+/*****************************************************************************************************
+ * Function       : open_segment
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Maps segment 'id'. It starts with no references and marked obsolete, so it is removed
+ *      again if it is dropped before a commit names it.
+ *
+ * Returns        :
+ *      The segment, or NULL if the file couldn't be opened.
+ *****************************************************************************************************/
+static segment* open_segment(const segment_set *set, unsigned long id)
+{
+    char path[4200];
+    segment *seg = malloc(sizeof(segment));
+
+    if (seg == NULL || segment_path(set, id, path, sizeof(path)) == FAILURE ||
+        open_index(&seg->index, path) == FAILURE)
+    {
+        printf("ERROR : Couldn't open segment %lu in %s\n", id, set->dir);
+        free(seg);
+        return NULL;
+    }
+    seg->id = id;
+    seg->length = 0;
+    for (unsigned int d = 0; d < seg->index.doc_count; d++)
+        seg->length += seg->index.doc[d].length;
+    seg->refs = 0;
+    seg->obsolete = 1;
+    return seg;
+}
+
+
+/*****************************************************************************************************
+ * Function       : close_segment
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Unmaps a segment no view holds any more, removing its file if it is obsolete.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void close_segment(const segment_set *set, segment *seg)
+{
+    char path[4200];
+
+    close_index(&seg->index);
+    if (seg->obsolete && segment_path(set, seg->id, path, sizeof(path)) == SUCCESS)
+        unlink(path);
+    free(seg);
+}
+
+
+/*****************************************************************************************************
+ * Function       : new_view / copy_view
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      new_view() allocates an empty view with room for 'room' segments. copy_view() makes one
+ *      holding the segments and tombstones of 'from', with room for 'extra' more, taking a
+ *      reference to each; 'lock' is held. A view starts with one reference, its creator's.
+ *
+ * Returns        :
+ *      The view, or NULL if memory ran out.
+ *****************************************************************************************************/
+static segment_view* new_view(int room)
+{
+    segment_view *view = calloc(1, sizeof(segment_view) + (room > 0 ? room : 1) * sizeof(segment_part));
+
+    if (view == NULL)
+        printf("ERROR : Couldn't allocate a segment view\n");
+    else
+        view->refs = 1;
+    return view;
+}
+
+static segment_view* copy_view(const segment_view *from, int extra)
+{
+    segment_view *view = new_view(from->count + extra);
+
+    if (view == NULL)
+        return NULL;
+    view->count = from->count;
+    memcpy(view->part, from->part, from->count * sizeof(segment_part));
+    for (int s = 0; s < view->count; s++)
+    {
+        view->part[s].seg->refs++;
+        if (view->part[s].deleted)
+            view->part[s].deleted->refs++;
+    }
+    return view;
+}
+
+
+/*****************************************************************************************************
+ * Function       : finish_view
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Numbers the documents of the view's segments one after the other and works out the live
+ *      documents and their mean length.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void finish_view(segment_view *view)
+{
+    unsigned int docs = 0, live = 0;
+    long long length = 0;
+
+    for (int s = 0; s < view->count; s++)
+    {
+        segment_part *p = &view->part[s];
+        p->base = docs;
+        docs += p->seg->index.doc_count;
+        live += p->seg->index.doc_count - (p->deleted ? p->deleted->count : 0);
+        length += p->seg->length - (p->deleted ? p->deleted->length : 0);
+    }
+    view->docs = docs;
+    view->live = live;
+    view->avg_length = live ? (double)length / live : 0.0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : delete_document
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Flags document 'local' of a segment of a view being built as deleted, first giving the
+ *      view its own copy of the tombstones if another view shares them. 'lock' is held.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+static int delete_document(segment_part *part, int local)
+{
+    tombstones *t = part->deleted;
+    unsigned int docs = part->seg->index.doc_count;
+
+    if (t == NULL || t->refs > 1)
+    {
+        tombstones *copy = malloc(sizeof(tombstones) + docs);
+        if (copy == NULL)
+        {
+            printf("ERROR : Couldn't allocate tombstones\n");
+            return FAILURE;
+        }
+        if (t)
+        {
+            memcpy(copy, t, sizeof(tombstones) + docs);
+            t->refs--;
+        }
+        else
+            memset(copy, 0, sizeof(tombstones) + docs);
+        copy->refs = 1;
+        part->deleted = t = copy;
+    }
+    if (!t->flag[local])
+    {
+        t->flag[local] = 1;
+        t->count++;
+        t->length += part->seg->index.doc[local].length;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : acquire_segments
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Takes a reference to the current view. Its segments stay mapped and unchanged until the
+ *      reference is dropped with release_segments(), whatever is committed meanwhile.
+ *
+ * Returns        :
+ *      The view.
+ *****************************************************************************************************/
+segment_view* acquire_segments(segment_set *set)
+{
+    pthread_mutex_lock(&set->lock);
+    segment_view *view = set->current;
+    view->refs++;
+    pthread_mutex_unlock(&set->lock);
+    return view;
+}
+
+
+/*****************************************************************************************************
+ * Function       : release_segments
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Drops a reference to a view. The last one frees it, along with the segments and
+ *      tombstones no other view holds (unmapped outside the lock).
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void release_segments(segment_set *set, segment_view *view)
+{
+    pthread_mutex_lock(&set->lock);
+    int last = --view->refs == 0;
+    for (int s = 0; last && s < view->count; s++)
+    {
+        segment_part *p = &view->part[s];
+        if (--p->seg->refs > 0)
+            p->seg = NULL;                              // Still held: not this view's to close
+        if (p->deleted && --p->deleted->refs > 0)
+            p->deleted = NULL;
+    }
+    pthread_mutex_unlock(&set->lock);
+
+    if (!last)
+        return;
+    for (int s = 0; s < view->count; s++)
+    {
+        if (view->part[s].seg)
+            close_segment(set, view->part[s].seg);
+        free(view->part[s].deleted);
+    }
+    free(view);
+}
+
+
+/*****************************************************************************************************
+ * Function       : write_manifest
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Replaces the manifest with one naming the segments and tombstones of 'view'.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if it couldn't be written (the old manifest is then left as it was).
+ *****************************************************************************************************/
+static int write_manifest(segment_set *set, const segment_view *view)
+{
+    char path[4200], temp[4300];
+    snprintf(path, sizeof(path), "%s/%s", set->dir, SEGMENT_MANIFEST);
+    int fd = create_replacement(path, temp, sizeof(temp));
+    FILE *fp = fd >= 0 ? fdopen(fd, "w") : NULL;
+
+    if (fp == NULL)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(temp);
+        }
+        return FAILURE;
+    }
+
+    fprintf(fp, "INVSEGMENTS 1\nnext %lu positions %d analysis %u\n",
+            __atomic_load_n(&set->next_id, __ATOMIC_RELAXED), set->positional, set->analysis);
+    for (int s = 0; s < view->count; s++)
+    {
+        const segment_part *p = &view->part[s];
+        fprintf(fp, "segment %lu %u", p->seg->id, p->deleted ? p->deleted->count : 0);
+        for (unsigned int d = 0; p->deleted && d < p->seg->index.doc_count; d++)
+            if (p->deleted->flag[d])
+                fprintf(fp, " %u", d);
+        fputc('\n', fp);
+    }
+
+    int ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    ok = fclose(fp) == 0 && ok;
+    return replace_file(temp, path, ok);
+}
+
+
+/*****************************************************************************************************
+ * Function       : commit_view
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Finishes a view built from the current one, writes it to the manifest and makes it
+ *      current; the 'retired' segments (replaced by a merge) become obsolete. 'commit' is held.
+ *      If the manifest can't be written the view is dropped instead.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the manifest couldn't be written.
+ *****************************************************************************************************/
+static int commit_view(segment_set *set, segment_view *view, segment **retired, int count)
+{
+    finish_view(view);
+    view->generation = set->current->generation + 1;
+    if (write_manifest(set, view) == FAILURE)
+    {
+        printf("ERROR : Couldn't write the manifest of %s\n", set->dir);
+        release_segments(set, view);
+        return FAILURE;
+    }
+
+    pthread_mutex_lock(&set->lock);
+    for (int s = 0; s < view->count; s++)
+        view->part[s].seg->obsolete = 0;
+    for (int r = 0; r < count; r++)
+        retired[r]->obsolete = 1;
+    segment_view *old = set->current;
+    set->current = view;
+    pthread_cond_signal(&set->wake);                    // The merger may have work now
+    pthread_mutex_unlock(&set->lock);
+
+    release_segments(set, old);
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : segment_of
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Finds the segment of the view holding view id 'file_id', by binary search on the bases,
+ *      and stores the document's id within the segment in *local.
+ *
+ * Returns        :
+ *      The segment, or NULL if the id is outside the view.
+ *****************************************************************************************************/
+const segment_part* segment_of(segment_view *view, int file_id, int *local)
+{
+    int low = 0, high = view->count - 1;
+
+    if (file_id < 0 || (unsigned int)file_id >= view->docs)
+        return NULL;
+    while (low < high)                                  // Last segment whose base is <= file_id
+    {
+        int mid = (low + high + 1) / 2;
+        if (view->part[mid].base <= file_id)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    *local = file_id - view->part[low].base;
+    return &view->part[low];
+}
+
+
+/*****************************************************************************************************
+ * Function       : segment_document
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Looks up the file name of a view id.
+ *
+ * Returns        :
+ *      The name (in the segment's mapping), or "?" if the id is outside the view.
+ *****************************************************************************************************/
+const char* segment_document(segment_view *view, int file_id)
+{
+    int local;
+    const segment_part *p = segment_of(view, file_id, &local);
+
+    return p ? index_document(&p->seg->index, local) : "?";
+}
+
+
+/*****************************************************************************************************
+ * Function       : segment_frequency
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Adds up the file counts of an analyzed word over the segments of a view.
+ *
+ * Returns        :
+ *      The number of documents holding the word, deleted ones included.
+ *****************************************************************************************************/
+int segment_frequency(segment_view *view, const char *word, size_t len)
+{
+    int df = 0;
+
+    for (int s = 0; s < view->count; s++)
+    {
+        const disk_term *t = index_lookup(&view->part[s].seg->index, word, len);
+        if (t)
+            df += t->file_count;
+    }
+    return df;
+}
+
+
+/*****************************************************************************************************
+ * Function       : name_documents
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Registers the name of every live document of the view in the document table of 'names'
+ *      (initialized here), so files can be looked up by name with find_document().
+ *
+ * Returns        :
+ *      The view id of each document id of 'names' (free it and 'names'), or NULL if memory ran out.
+ *****************************************************************************************************/
+static int* name_documents(segment_view *view, hashtable *names)
+{
+    int *where = malloc((view->live + 1) * sizeof(int));
+
+    if (where == NULL || init_hashtable(names) == FAILURE)
+    {
+        free(where);
+        return NULL;
+    }
+    for (int s = 0; s < view->count; s++)
+    {
+        const segment_part *p = &view->part[s];
+        for (unsigned int d = 0; d < p->seg->index.doc_count; d++)
+        {
+            if (p->deleted && p->deleted->flag[d])
+                continue;
+            int id = add_document(names, index_document(&p->seg->index, d));
+            if (id < 0)
+            {
+                free_hashtable(names);
+                free(where);
+                return NULL;
+            }
+            where[id] = p->base + d;
+        }
+    }
+    return where;
+}
+
+
+/*****************************************************************************************************
+ * Function       : delete_named
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Flags as deleted, in 'view' (a copy of 'from' being built), the live document of 'from'
+ *      named 'filename', if there is one. 'lock' is held.
+ *
+ * Returns        :
+ *      1 if a document was deleted, 0 if none had the name, -1 if memory ran out.
+ *****************************************************************************************************/
+static int delete_named(segment_view *view, segment_view *from, hashtable *names, const int *where,
+                        const char *filename)
+{
+    int id = find_document(&names->docs, filename), local = 0;
+
+    if (id < 0)
+        return 0;
+    const segment_part *p = segment_of(from, where[id], &local);
+    return delete_document(&view->part[p - from->part], local) == SUCCESS ? 1 : -1;
+}
+
+
+/*****************************************************************************************************
+ * Function       : ingest_files
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Indexes the files that are new, or changed since their last ingest (size or modification
+ *      time), on 'threads' threads into one new segment, and commits it along with tombstones for
+ *      the older copies of those files. Unchanged files are skipped. The segment is built and
+ *      saved without holding any lock, so readers and the merger carry on meanwhile.
+ *
+ * Returns        :
+ *      Number of files indexed (0 if none had changed), or -1 if a step failed.
+ *****************************************************************************************************/
+int ingest_files(segment_set *set, filenode *head, int threads)
+{
+    METRIC_START(started);
+    filenode *todo = NULL, **tail = &todo;
+    hashtable names;
+    int files = 0, status = -1;
+
+    // Pick the files to index from the current view; only this ingest could undo its answer
+    segment_view *view = acquire_segments(set);
+    int *where = name_documents(view, &names);
+    if (where == NULL)
+    {
+        release_segments(set, view);
+        printf("ERROR : Couldn't list the documents of %s\n", set->dir);
+        return -1;
+    }
+    for (filenode *f = head; f != NULL; f = f->link)
+    {
+        int id = find_document(&names.docs, f->filename), local;
+        doc_stamp now;
+
+        if (id >= 0 && read_stamp(f->filename, &now) == SUCCESS)
+        {
+            const segment_part *p = segment_of(view, where[id], &local);
+            const disk_doc *doc = &p->seg->index.doc[local];
+            if (doc->size == now.size && doc->mtime == now.mtime)
+                continue;                               // Indexed as it is
+        }
+        size_t len = strlen(f->filename) + 1;
+        filenode *copy = malloc(sizeof(filenode) + len);
+        if (copy == NULL)
+            break;
+        memcpy(copy->filename, f->filename, len);
+        copy->link = NULL;
+        *tail = copy;
+        tail = &copy->link;
+    }
+    free(where);
+    free_hashtable(&names);
+    release_segments(set, view);
+
+    // Build and save the new segment
+    hashtable table;
+    segment *seg = NULL;
+    if (todo != NULL && init_hashtable(&table) == SUCCESS)
+    {
+        char path[4200];
+        table.positional = set->positional;
+        table.analysis = set->analysis;
+        files = index_files(&table, todo, threads);
+        unsigned long id = __atomic_fetch_add(&set->next_id, 1, __ATOMIC_RELAXED);
+        if (files > 0 && segment_path(set, id, path, sizeof(path)) == SUCCESS &&
+            save_index(&table, path) == SUCCESS)
+            seg = open_segment(set, id);
+        free_hashtable(&table);
+    }
+    if (todo == NULL || files == 0)
+        status = 0;
+
+    // Commit: the older copies are looked up again, a merge may have moved them meanwhile
+    if (seg != NULL)
+    {
+        pthread_mutex_lock(&set->commit);
+        segment_view *from = set->current;
+        where = name_documents(from, &names);
+        pthread_mutex_lock(&set->lock);
+        view = where ? copy_view(from, 1) : NULL;
+        int ok = view != NULL;
+        if (ok)
+        {
+            view->part[view->count].seg = seg;
+            view->part[view->count++].deleted = NULL;
+            seg->refs++;
+            for (unsigned int d = 0; ok && d < seg->index.doc_count; d++)
+                ok = delete_named(view, from, &names, where, index_document(&seg->index, d)) >= 0;
+        }
+        pthread_mutex_unlock(&set->lock);
+        if (where)
+        {
+            free(where);
+            free_hashtable(&names);
+        }
+
+        if (view == NULL)
+            close_segment(set, seg);
+        else if (!ok)
+            release_segments(set, view);
+        else if (commit_view(set, view, NULL, 0) == SUCCESS)
+            status = files;
+        pthread_mutex_unlock(&set->commit);
+    }
+
+    while (todo)
+    {
+        filenode *next = todo->link;
+        free(todo);
+        todo = next;
+    }
+    METRIC_STOP(PHASE_FLUSH, started);
+    return status;
+}
+
+
+/*****************************************************************************************************
+ * Function       : remove_files
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Deletes the named files from the index by flagging them in the segments that hold them.
+ *      The postings stay in the segment files until a merge rewrites them.
+ *
+ * Returns        :
+ *      Number of files deleted, or -1 if the commit failed.
+ *****************************************************************************************************/
+int remove_files(segment_set *set, filenode *head)
+{
+    hashtable names;
+    int removed = 0;
+
+    pthread_mutex_lock(&set->commit);
+    segment_view *from = set->current;
+    int *where = name_documents(from, &names);
+    if (where == NULL)
+    {
+        pthread_mutex_unlock(&set->commit);
+        printf("ERROR : Couldn't list the documents of %s\n", set->dir);
+        return -1;
+    }
+
+    pthread_mutex_lock(&set->lock);
+    segment_view *view = copy_view(from, 0);
+    for (filenode *f = head; view != NULL && f != NULL && removed >= 0; f = f->link)
+    {
+        int deleted = delete_named(view, from, &names, where, f->filename);
+        removed = deleted < 0 ? -1 : removed + deleted;
+    }
+    pthread_mutex_unlock(&set->lock);
+    free(where);
+    free_hashtable(&names);
+
+    if (view == NULL)
+        removed = -1;
+    else if (removed <= 0)
+        release_segments(set, view);                    // Nothing to commit
+    else if (commit_view(set, view, NULL, 0) == FAILURE)
+        removed = -1;
+    pthread_mutex_unlock(&set->commit);
+    return removed;
+}
+
+
+/*****************************************************************************************************
+ * Function       : segment_tier
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Tier of a segment from its live postings (deleted documents' share taken out): 0 below
+ *      SEGMENT_TIER_BASE, then one more for every factor of SEGMENT_FANIN.
+ *
+ * Returns        :
+ *      The tier.
+ *****************************************************************************************************/
+static int segment_tier(const segment_part *p)
+{
+    const disk_index *index = &p->seg->index;
+    double postings = (double)index->posting_count;
+    double limit = SEGMENT_TIER_BASE;
+    int tier = 0;
+
+    if (p->deleted && index->doc_count)
+        postings *= (double)(index->doc_count - p->deleted->count) / index->doc_count;
+    while (postings >= limit)
+    {
+        limit *= SEGMENT_FANIN;
+        tier++;
+    }
+    return tier;
+}
+
+
+/*****************************************************************************************************
+ * Function       : pick_merge
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Applies the merge policy to a view: a segment with more deleted documents than live ones,
+ *      else the first SEGMENT_FANIN segments of the lowest tier holding that many.
+ *
+ * Returns        :
+ *      Number of segments to merge, their positions in pick[]; 0 if no merge is due.
+ *****************************************************************************************************/
+static int pick_merge(const segment_view *view, int *pick)
+{
+    int tiers = 0;
+
+    for (int s = 0; s < view->count; s++)
+    {
+        const segment_part *p = &view->part[s];
+        if (p->deleted && p->deleted->count * 2 > p->seg->index.doc_count)
+        {
+            pick[0] = s;
+            return 1;
+        }
+        int tier = segment_tier(p);
+        if (tier >= tiers)
+            tiers = tier + 1;
+    }
+
+    for (int tier = 0; tier < tiers; tier++)
+    {
+        int n = 0;
+        for (int s = 0; s < view->count && n < SEGMENT_FANIN; s++)
+            if (segment_tier(&view->part[s]) == tier)
+                pick[n++] = s;
+        if (n == SEGMENT_FANIN)
+            return n;
+    }
+    return 0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : merge_parts
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Writes one segment holding the live documents of the segments at pick[] of the view, in
+ *      that order, and maps it. Their postings are added segment after segment, so each word's
+ *      documents arrive in id order; positions are copied as they are for a segment without
+ *      deletions and re-encoded around the deleted documents otherwise. remap[i] receives the new
+ *      id of every document of the i-th input, -1 for a deleted one.
+ *
+ * Returns        :
+ *      SUCCESS with the segment in *out (NULL if no document was live), or FAILURE.
+ *****************************************************************************************************/
+static int merge_parts(segment_set *set, segment_view *view, const int *pick, int n, segment **out,
+                       int **remap)
+{
+    hashtable table;
+    int *position = NULL;                               // Positions of one posting
+    int capacity = 0;
+    int ok = init_hashtable(&table) == SUCCESS;
+
+    *out = NULL;
+    table.positional = set->positional;
+    table.analysis = set->analysis;
+    for (int i = 0; i < n && ok; i++)
+    {
+        const segment_part *p = &view->part[pick[i]];
+        disk_index *index = &p->seg->index;
+        const unsigned char *dead = p->deleted ? p->deleted->flag : NULL;
+
+        remap[i] = malloc((index->doc_count + 1) * sizeof(int));
+        if (remap[i] == NULL)
+        {
+            ok = 0;
+            break;
+        }
+        for (unsigned int d = 0; d < index->doc_count && ok; d++)
+        {
+            remap[i][d] = -1;
+            if (dead && dead[d])
+                continue;
+            int id = add_document(&table, index_document(index, d));
+            ok = id >= 0;
+            if (!ok)
+                break;
+            table.docs.stamp[id].size = index->doc[d].size;
+            table.docs.stamp[id].mtime = index->doc[d].mtime;
+            set_document_length(&table.docs, id, index->doc[d].length);
+            remap[i][d] = id;
+        }
+
+        for (unsigned int w = 0; w < index->term_count && ok; w++)
+        {
+            const disk_term *t = &index->term[w];
+            posting_cursor cursor;
+            position_cursor positions;
+            mainnode *m = NULL;
+            long skip = 0;                              // Positions of deleted postings passed over
+
+            if (t->word_len > MAX_TOKEN_LEN)
+            {
+                ok = 0;
+                break;
+            }
+            index_postings(index, t, &cursor);
+            if (index->positional)
+                index_positions(index, t, &positions);
+            while (ok && next_posting(&cursor) == SUCCESS)
+            {
+                int id = remap[i][cursor.file_id];
+                if (id < 0)
+                {
+                    skip += cursor.word_count;
+                    continue;
+                }
+                if (m == NULL)                          // First live posting: the word's node, new or from an earlier input
+                {
+                    const char *word = index_word(index, t);
+                    m = lookup_term(&table, word, t->word_len);
+                    ok = m != NULL || (m = insert_mainnode(&table, word, t->word_len)) != NULL;
+                }
+                ok = ok && add_posting(&table.nodes, m, id, cursor.word_count) == SUCCESS;
+                if (!ok || !index->positional || dead == NULL)
+                    continue;
+
+                if (cursor.word_count > capacity)
+                {
+                    int *grown = realloc(position, cursor.word_count * sizeof(int));
+                    ok = grown != NULL;
+                    if (!ok)
+                        break;
+                    position = grown;
+                    capacity = cursor.word_count;
+                }
+                ok = read_positions(&positions, skip, cursor.word_count, position) == SUCCESS;
+                skip = 0;
+                for (int k = 0; ok && k < cursor.word_count; k++)
+                    ok = add_position(&table.nodes, m, id, position[k]) == SUCCESS;
+            }
+            if (ok && m != NULL && index->positional && dead == NULL)
+                ok = append_positions(&table.nodes, m, index->positions + t->positions_off,
+                                      t->positions_len) == SUCCESS;
+        }
+    }
+
+    if (ok && table.docs.live > 0)
+    {
+        char path[4200];
+        unsigned long id = __atomic_fetch_add(&set->next_id, 1, __ATOMIC_RELAXED);
+        ok = segment_path(set, id, path, sizeof(path)) == SUCCESS && save_index(&table, path) == SUCCESS &&
+             (*out = open_segment(set, id)) != NULL;
+    }
+    free_hashtable(&table);
+    free(position);
+    return ok ? SUCCESS : FAILURE;
+}
+
+
+/*****************************************************************************************************
+ * Function       : merge_segments
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Merges the segments at pick[] of 'view' (a view the caller holds) and commits the result in
+ *      place of the first of them, the others dropped. Documents of the inputs deleted in the
+ *      current view since 'view' are deleted in the result as well.
+ *
+ * Returns        :
+ *      SUCCESS; FAILURE if a step failed; -1 if another merge replaced an input meanwhile.
+ *****************************************************************************************************/
+static int merge_segments(segment_set *set, segment_view *view, const int *pick, int n)
+{
+    uint64_t start = metric_clock();
+    METRIC_START(started);
+    segment *merged, *retired[n];
+    int *remap[n];
+    int status = FAILURE;
+
+    memset(remap, 0, sizeof(remap));
+    if (merge_parts(set, view, pick, n, &merged, remap) == FAILURE)
+    {
+        printf("ERROR : Couldn't merge %d segments of %s\n", n, set->dir);
+        for (int i = 0; i < n; i++)
+            free(remap[i]);
+        return FAILURE;
+    }
+
+    pthread_mutex_lock(&set->commit);
+    segment_view *from = set->current;
+    int at[n];                                          // Position of each input in 'from'
+    int found = 0;
+    for (int i = 0; i < n; i++)
+    {
+        retired[i] = view->part[pick[i]].seg;
+        at[i] = -1;
+        for (int s = 0; s < from->count && at[i] < 0; s++)
+            if (from->part[s].seg == retired[i])
+                at[i] = s;
+        found += at[i] >= 0;
+    }
+
+    pthread_mutex_lock(&set->lock);
+    segment_view *next = found == n ? new_view(from->count - n + 1) : NULL;
+    int ok = next != NULL, slot = -1;
+    for (int s = 0; ok && s < from->count; s++)
+    {
+        int input = 0;
+        for (int i = 0; i < n; i++)
+            input |= at[i] == s;
+        if (!input)
+        {
+            next->part[next->count] = from->part[s];
+            next->part[next->count].seg->refs++;
+            if (next->part[next->count].deleted)
+                next->part[next->count].deleted->refs++;
+            next->count++;
+        }
+        else if (slot < 0 && merged != NULL)
+        {
+            slot = next->count++;
+            next->part[slot].seg = merged;
+            next->part[slot].deleted = NULL;
+            merged->refs++;
+        }
+    }
+    for (int i = 0; ok && slot >= 0 && i < n; i++)
+    {
+        const tombstones *then = view->part[pick[i]].deleted, *now = from->part[at[i]].deleted;
+        for (unsigned int d = 0; now && now != then && ok && d < retired[i]->index.doc_count; d++)
+            if (now->flag[d] && !(then && then->flag[d]) && remap[i][d] >= 0)
+                ok = delete_document(&next->part[slot], remap[i][d]) == SUCCESS;
+    }
+    pthread_mutex_unlock(&set->lock);
+
+    if (found < n)
+        status = -1;                                    // Lost the race: drop this merge
+    if (next != NULL && !ok)
+        release_segments(set, next);
+    else if (next != NULL && commit_view(set, next, retired, n) == SUCCESS)
+    {
+        status = SUCCESS;
+        set->merges++;
+        set->merged += n;
+        set->merge_seconds += (metric_clock() - start) / 1e9;
+    }
+    if (next == NULL && merged != NULL)
+        close_segment(set, merged);                     // Never committed: removes its file
+    pthread_mutex_unlock(&set->commit);
+
+    for (int i = 0; i < n; i++)
+        free(remap[i]);
+    METRIC_STOP(PHASE_COMPACT, started);
+    return status;
+}
+
+
+/*****************************************************************************************************
+ * Function       : merger_main
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Merger thread: whenever a commit makes a merge due, runs it; sleeps otherwise. Once
+ *      close_segments() asks it to stop, it finishes the merges still due and returns. A merge
+ *      that fails ends the thread; the segments stay as they are.
+ *
+ * Returns        :
+ *      NULL.
+ *****************************************************************************************************/
+static void* merger_main(void *arg)
+{
+    segment_set *set = arg;
+    int pick[SEGMENT_FANIN];
+
+    pthread_mutex_lock(&set->lock);
+    for (;;)
+    {
+        segment_view *view = set->current;
+        int n = pick_merge(view, pick);
+        if (n == 0)
+        {
+            if (set->stopping)
+                break;
+            pthread_cond_wait(&set->wake, &set->lock);
+            continue;
+        }
+        view->refs++;
+        pthread_mutex_unlock(&set->lock);
+
+        int status = merge_segments(set, view, pick, n);
+        release_segments(set, view);
+        pthread_mutex_lock(&set->lock);
+        if (status == FAILURE)
+            break;
+    }
+    pthread_mutex_unlock(&set->lock);
+    return NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : compact_segments
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Merges every segment into one, dropping the deleted documents for good. Tried again if the
+ *      merger replaced a segment meanwhile.
+ *
+ * Returns        :
+ *      SUCCESS (also when there was nothing to compact), or FAILURE.
+ *****************************************************************************************************/
+int compact_segments(segment_set *set)
+{
+    for (;;)
+    {
+        segment_view *view = acquire_segments(set);
+        int status = SUCCESS;
+
+        if (view->count > 1 || (view->count == 1 && view->part[0].deleted))
+        {
+            int *pick = malloc(view->count * sizeof(int));
+            if (pick == NULL)
+                status = FAILURE;
+            for (int s = 0; pick && s < view->count; s++)
+                pick[s] = s;
+            if (pick)
+                status = merge_segments(set, view, pick, view->count);
+            free(pick);
+        }
+        release_segments(set, view);
+        if (status != -1)
+            return status;
+    }
+}
+
+
+/*****************************************************************************************************
+ * Function       : read_manifest
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Maps the segments the manifest names and rebuilds their tombstones, taking the next
+ *      segment id and the positions and analysis settings from it. A missing manifest is an
+ *      empty set with the settings given to open_segments().
+ *
+ * Returns        :
+ *      The view, or NULL if the manifest or a segment couldn't be read.
+ *****************************************************************************************************/
+static segment_view* read_manifest(segment_set *set)
+{
+    char path[4200], magic[16];
+    int version, positional, room = 8;
+    unsigned int analysis, deleted;
+    unsigned long id;
+
+    snprintf(path, sizeof(path), "%s/%s", set->dir, SEGMENT_MANIFEST);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return errno == ENOENT ? new_view(0) : NULL;
+
+    segment_view *view = new_view(room);
+    if (view == NULL ||
+        fscanf(fp, "%15s %d next %lu positions %d analysis %u", magic, &version, &set->next_id, &positional,
+               &analysis) != 5 || strcmp(magic, "INVSEGMENTS") != 0 || version != 1)
+    {
+        printf("ERROR : %s is not a segment manifest\n", path);
+        free(view);
+        fclose(fp);
+        return NULL;
+    }
+    set->positional = positional;
+    set->analysis = analysis;
+
+    int ok = 1;
+    while (ok && fscanf(fp, " segment %lu %u", &id, &deleted) == 2)
+    {
+        if (view->count == room)
+        {
+            segment_view *grown = realloc(view, sizeof(segment_view) + 2 * room * sizeof(segment_part));
+            if (grown == NULL)
+                break;
+            view = grown;
+            room *= 2;
+        }
+        segment_part *p = &view->part[view->count];
+        if ((p->seg = open_segment(set, id)) == NULL)
+            break;
+        p->deleted = NULL;
+        p->seg->refs = 1;
+        p->seg->obsolete = 0;
+        view->count++;
+        ok = p->seg->index.positional == positional;
+
+        for (unsigned int k = 0; ok && k < deleted; k++)
+        {
+            unsigned int d;
+            ok = fscanf(fp, "%u", &d) == 1 && d < p->seg->index.doc_count && delete_document(p, d) == SUCCESS;
+        }
+    }
+    ok = ok && feof(fp);                                // Stopped at the end, not at a bad line
+    fclose(fp);
+    if (!ok)
+    {
+        printf("ERROR : The manifest %s doesn't match the segments\n", path);
+        release_segments(set, view);
+        return NULL;
+    }
+    return view;
+}
+
+
+/*****************************************************************************************************
+ * Function       : remove_orphans
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Removes the segment files of the directory the view doesn't hold, and temporary files left
+ *      behind: the output of an ingest or merge interrupted before its commit.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void remove_orphans(segment_set *set, const segment_view *view)
+{
+    DIR *dir = opendir(set->dir);
+    struct dirent *entry;
+
+    while (dir != NULL && (entry = readdir(dir)) != NULL)
+    {
+        unsigned long id;
+        int end = 0, held = 0;
+        char path[4400];
+
+        if (sscanf(entry->d_name, "seg_%lu.idx%n", &id, &end) == 1 && end > 0 && entry->d_name[end] == '\0')
+        {
+            for (int s = 0; s < view->count && !held; s++)
+                held = view->part[s].seg->id == id;
+        }
+        else if (strncmp(entry->d_name, "seg_", 4) != 0 &&
+                 strncmp(entry->d_name, SEGMENT_MANIFEST ".", sizeof(SEGMENT_MANIFEST)) != 0)
+            continue;                                   // Not ours
+        if (!held && (size_t)snprintf(path, sizeof(path), "%s/%s", set->dir, entry->d_name) < sizeof(path))
+            unlink(path);
+    }
+    if (dir)
+        closedir(dir);
+}
+
+
+/*****************************************************************************************************
+ * Function       : open_segments
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Opens the segmented index in 'dir', creating the directory if needed. A new index takes the
+ *      positions and analysis settings given; an existing one keeps its own. With 'merge', a merger
+ *      thread merges segments in the background from now until close_segments().
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the directory or its manifest couldn't be used.
+ *****************************************************************************************************/
+int open_segments(segment_set *set, const char *dir, int positional, unsigned int analysis, int merge)
+{
+    memset(set, 0, sizeof(*set));
+    if ((size_t)snprintf(set->dir, sizeof(set->dir), "%s", dir) >= sizeof(set->dir) ||
+        (mkdir(dir, 0755) != 0 && errno != EEXIST))
+    {
+        printf("ERROR : Can't use %s as a segment directory\n", dir);
+        return FAILURE;
+    }
+    set->positional = positional;
+    set->analysis = analysis;
+    set->next_id = 1;
+    pthread_mutex_init(&set->lock, NULL);
+    pthread_mutex_init(&set->commit, NULL);
+    pthread_cond_init(&set->wake, NULL);
+
+    set->current = read_manifest(set);
+    if (set->current == NULL)
+        return FAILURE;
+    finish_view(set->current);
+    set->current->generation = 1;
+    remove_orphans(set, set->current);
+
+    if (merge && pthread_create(&set->merger, NULL, merger_main, set) == 0)
+        set->merging = 1;
+    else if (merge)
+        printf("ERROR : Couldn't start the merger; segments won't be merged\n");
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : stop_merging
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Lets the merger finish the merges due, then stops it. Commits after this merge nothing.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void stop_merging(segment_set *set)
+{
+    if (!set->merging)
+        return;
+    pthread_mutex_lock(&set->lock);
+    set->stopping = 1;
+    pthread_cond_signal(&set->wake);
+    pthread_mutex_unlock(&set->lock);
+    pthread_join(set->merger, NULL);
+    set->merging = 0;
+}
+
+
+/*****************************************************************************************************
+ * Function       : close_segments
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Stops the merger (see stop_merging()) and closes the segments. No reader may hold a view.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void close_segments(segment_set *set)
+{
+    stop_merging(set);
+    release_segments(set, set->current);
+    set->current = NULL;
+    pthread_mutex_destroy(&set->lock);
+    pthread_mutex_destroy(&set->commit);
+    pthread_cond_destroy(&set->wake);
+}
+
+
+/*****************************************************************************************************
+ * Function       : query_segments
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Runs a parsed boolean query on each segment of the view and concatenates the matches that
+ *      aren't deleted, as view ids. A query only combines the postings of one document, so the
+ *      segments' answers need no further merging, and segments in view id order give ascending ids.
+ *
+ * Returns        :
+ *      SUCCESS with the ids in 'result' (free it with free_doc_list()), or FAILURE (see
+ *      run_query()).
+ *****************************************************************************************************/
+int query_segments(const query *q, segment_view *view, doc_list *result)
+{
+    memset(result, 0, sizeof(*result));
+    for (int s = 0; s < view->count; s++)
+    {
+        const segment_part *p = &view->part[s];
+        doc_list found;
+
+        if (run_query(q, NULL, &p->seg->index, &found) == FAILURE)
+        {
+            free_doc_list(result);
+            return FAILURE;
+        }
+        if (result->count + found.count > result->capacity)
+        {
+            int capacity = result->count + found.count;
+            int *grown = realloc(result->id, (capacity + 1) * sizeof(int));
+            if (grown == NULL)
+            {
+                printf("ERROR : Out of memory while running the query\n");
+                free_doc_list(&found);
+                free_doc_list(result);
+                return FAILURE;
+            }
+            result->id = grown;
+            result->capacity = capacity;
+        }
+        for (int i = 0; i < found.count; i++)
+            if (p->deleted == NULL || !p->deleted->flag[found.id[i]])
+                result->id[result->count++] = p->base + found.id[i];
+        free_doc_list(&found);
+    }
+    return SUCCESS;
+}
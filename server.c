@@ -0,0 +1,1011 @@
+/*****************************************************************************************************
+ * File           : server.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Query server over a mapped index file, and a load generator for it (the "serve" and
+ *      "loadgen" commands of cli.c).
+ *
+ *      The server listens on a Unix domain socket. The mapped index is never written after
+ *      open_index(), and the query, ranking and posting code keep all their state on the stack, so
+ *      any number of threads can answer from the one mapping without a lock. A fixed pool of
+ *      worker threads waits on one epoll set: every connection is registered one-shot, so exactly
+ *      one worker at a time reads it, answers the complete request lines it has received, and
+ *      re-arms it. Many idle clients therefore cost no thread, and a busy one can't starve the
+ *      others: a turn answers at most SERVER_TURN_LINES requests or SERVER_TURN_BYTES of
+ *      responses, and a connection with more to answer goes back to the end of the queue.
+ *
+ *      Responses are sent without blocking. What the client hasn't read yet is kept with the
+ *      connection, which then waits for the socket to drain before its next requests are read,
+ *      so a client that stops reading holds no worker and at most one turn of responses.
+ *
+ * Protocol       :
+ *      One request per line, one response per request, in order; a connection can send any
+ *      number of requests (and may send the next before the previous response has arrived).
+ *
+ *          QUERY error AND timeout        ->  OK 2 \n file \n file \n
+ *          RANK 10 connection reset       ->  OK 2 \n score <TAB> file \n score <TAB> file \n
+ *          PING                           ->  OK 0 \n
+ *          RELOAD                         ->  OK 0 \n     (the reload runs in the background)
+ *          STATS                          ->  OK 2 \n cache entries=.. hit_rate=.. \n server requests=.. \n
+ *          anything else, or a failure    ->  ERR reason \n     (e.g. ERR missing ) at "")
+ *
+ *      QUERY takes the boolean syntax of query.c, RANK the words of a ranked search (rank.c) with
+ *      the number of files to list, at most SERVER_TOP_K.
+ *
+ * Caching        :
+ *      The response of a QUERY or RANK is kept in a result cache (cache.c) under the request with
+ *      its whitespace collapsed, tagged with the snapshot epoch the worker entered at, so once a
+ *      reload is published the old version's responses are dropped rather than served. A worker
+ *      that entered just before a publish may tag a response of the new version with the old
+ *      epoch; it is only ever served to requests entered at that epoch, never the reverse. Hot
+ *      requests are answered with one copy; "serve --cache 0" turns the cache off.
+ *
+ * Reloading      :
+ *      The index is served through an index_snapshot (snapshot.c), one reader slot per worker,
+ *      entered for each request. RELOAD or SIGHUP wakes a reloader thread that makes the next
+ *      version while the workers keep answering from the current one: it indexes the files given
+ *      to "serve" again on one thread and saves them over the index file, or, with no files, maps
+ *      the index file again (after "output index -o" replaced it). It then publishes the version;
+ *      requests already running finish on the old mapping, which is unmapped after them. Reloads
+ *      asked for during a rebuild are folded into one more.
+ *
+ * Stopping       :
+ *      SIGINT or SIGTERM: a running rebuild is finished, the workers finish the request they are
+ *      on, the connections still open are closed, the socket file is removed and the request and
+ *      connection counts are printed.
+ *
+ *      The server's own messages (start, reloads, stop) go to standard error; a request that
+ *      fails is reported to its client only.
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "inverted_search.h"
+
+
+// One client connection: the bytes received that don't form a complete line yet, and the
+// responses the client hasn't read yet
+typedef struct connection
+{
+    int fd;
+    size_t len;                  // Bytes used in line
+    char *out;                   // Responses not sent yet, from out_sent to out_len
+    size_t out_sent;
+    size_t out_len;
+    size_t out_cap;
+    int more;                    // 1 if the turn ended with requests left to answer
+    int closing;                 // 1 once the client closed its side; closed when out is sent
+    struct connection *prev;     // Every open connection, for closing them when the server stops
+    struct connection *next;
+    char line[SERVER_LINE_MAX];
+} connection;
+
+// A response being built; each worker reuses its own
+typedef struct reply
+{
+    char *data;
+    size_t len;
+    size_t cap;
+    char *hit;                   // A cached response, copied out of the cache
+    size_t hit_cap;
+} reply;
+
+// State shared by the server's workers
+typedef struct server
+{
+    index_snapshot snapshot;     // Version every request is answered from; slot = worker id
+    result_cache cache;          // Responses of recent QUERY and RANK requests
+    const char *index_file;      // Mapped again, or rebuilt, on a reload
+    filenode *files;             // Files a reload indexes; NULL to map index_file again
+    int epoll_fd;
+    int listen_fd;
+    int stop_fd;                 // eventfd, readable once the server is stopping
+    connection *open;            // Connections not closed yet
+    pthread_mutex_t open_lock;   // Guards open and the links of its connections
+    unsigned long requests;      // Requests answered (updated atomically)
+    unsigned long connections;   // Connections accepted (updated atomically)
+    pthread_mutex_t reload_lock; // Guards reload_pending and stopping
+    pthread_cond_t reload_wanted;
+    int reload_pending;          // 1 if a reload was asked for since the last one started
+    int stopping;                // 1 once the reloader must exit
+} server;
+
+// One thread of the worker pool
+typedef struct worker
+{
+    server *srv;
+    int id;                      // Reader slot in srv->snapshot
+    pthread_t tid;
+} worker;
+
+// One client thread of the load generator
+typedef struct load_client
+{
+    const char *path;            // Socket of the server
+    char **request;              // Request lines, newline included
+    int count;                   // Entries in request
+    int first;                   // Request this client starts with
+    long sends;                  // Requests to send
+    double *latency;             // Microseconds of each request
+    long done;                   // Requests answered
+    long errors;                 // ERR responses, or requests lost to a failed connection
+    pthread_t tid;
+    int running;                 // 1 if tid must be joined
+} load_client;
+
+
+/*****************************************************************************************************
+ * Function       : put_reply
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Appends printf-formatted text to a response, growing it as needed.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+static int put_reply(reply *r, const char *format, ...)
+{
+    for (;;)
+    {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(r->data + r->len, r->cap - r->len, format, args);
+        va_end(args);
+
+        if (n < 0)
+            return FAILURE;
+        if ((size_t)n < r->cap - r->len)
+        {
+            r->len += n;
+            return SUCCESS;
+        }
+
+        size_t cap = r->cap * 2 > r->len + n + 1 ? r->cap * 2 : r->len + n + 1;
+        char *grown = realloc(r->data, cap);
+        if (grown == NULL)
+            return FAILURE;
+        r->data = grown;
+        r->cap = cap;
+    }
+}
+
+
+/*****************************************************************************************************
+ * Function       : request_reload
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Asks the reloader thread for a new version of the index.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void request_reload(server *srv)
+{
+    pthread_mutex_lock(&srv->reload_lock);
+    srv->reload_pending = 1;
+    pthread_cond_signal(&srv->reload_wanted);
+    pthread_mutex_unlock(&srv->reload_lock);
+}
+
+
+/*****************************************************************************************************
+ * Function       : answer_stats
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Appends the response of a STATS request: the cache's counters, and the server's requests,
+ *      connections and index version.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+static int answer_stats(server *srv, reply *r)
+{
+    char *line = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&line, &len);
+
+    if (out == NULL)
+        return FAILURE;
+    print_cache_stats(&srv->cache, out);
+    int status = fclose(out) == 0 ? SUCCESS : FAILURE;
+    if (status == SUCCESS)
+        status = put_reply(r, "OK 2\n%sserver requests=%lu connections=%lu version=%lu\n", line,
+                           __atomic_load_n(&srv->requests, __ATOMIC_RELAXED),
+                           __atomic_load_n(&srv->connections, __ATOMIC_RELAXED),
+                           __atomic_load_n(&srv->snapshot.epoch, __ATOMIC_RELAXED) - 1);
+    free(line);
+    return status;
+}
+
+
+/*****************************************************************************************************
+ * Function       : answer_request
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Runs one request, split into its name and text, against a version of the index and appends
+ *      its response (see Protocol above).
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out while building the response.
+ *****************************************************************************************************/
+static int answer_request(server *srv, disk_index *index, const char *line, char *text, ranked_doc *top,
+                          reply *r)
+{
+    if (strcmp(line, "PING") == 0)
+        return put_reply(r, "OK 0\n");
+
+    if (strcmp(line, "RELOAD") == 0)
+    {
+        request_reload(srv);
+        return put_reply(r, "OK 0\n");
+    }
+
+    if (strcmp(line, "STATS") == 0)
+        return answer_stats(srv, r);
+
+    if (strcmp(line, "QUERY") == 0)
+    {
+        query q;
+        doc_list result;
+        char error[96];
+
+        if (compile_query(&q, text, error, sizeof(error)) == FAILURE)
+            return put_reply(r, "ERR %s\n", error);
+        if (query_positional(&q) && !index->positional)
+            return put_reply(r, "ERR phrase and NEAR queries need an index built with -p\n");
+        if (run_query(&q, NULL, index, &result) == FAILURE)
+            return put_reply(r, "ERR out of memory\n");
+        int status = put_reply(r, "OK %d\n", result.count);
+        for (int i = 0; i < result.count && status == SUCCESS; i++)
+            status = put_reply(r, "%s\n", index_document(index, result.id[i]));
+        free_doc_list(&result);
+        return status;
+    }
+
+    if (strcmp(line, "RANK") == 0)
+    {
+        char *words;
+        long k = strtol(text, &words, 10);
+
+        if (words == text || k <= 0 || k > SERVER_TOP_K)
+            return put_reply(r, "ERR RANK needs a count from 1 to %d\n", SERVER_TOP_K);
+        int count = rank_documents(NULL, index, words, (int)k, 1, top);
+        if (count < 0)
+            return put_reply(r, "ERR a ranked search takes at most %d words\n", RANK_MAX_TERMS);
+        int status = put_reply(r, "OK %d\n", count);
+        for (int i = 0; i < count && status == SUCCESS; i++)
+            status = put_reply(r, "%.4f\t%s\n", top[i].score, index_document(index, top[i].file_id));
+        return status;
+    }
+
+    return put_reply(r, "ERR unknown request\n");
+}
+
+
+/*****************************************************************************************************
+ * Function       : answer
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Answers one request line from a version of the index entered at epoch 'generation'. The
+ *      response of a QUERY or RANK is taken from the result cache when it holds one for that
+ *      epoch, and stored there otherwise (unless it is an ERR).
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out while building the response.
+ *****************************************************************************************************/
+static int answer(server *srv, disk_index *index, unsigned long generation, char *line, ranked_doc *top,
+                  reply *r)
+{
+    char *text = line + strcspn(line, " ");
+    if (*text)
+        *text++ = '\0';
+
+    char key[CACHE_KEY_MAX];
+    int cached = srv->cache.limit > 0 && (strcmp(line, "QUERY") == 0 || strcmp(line, "RANK") == 0);
+    if (cached)
+    {
+        normalize_request(strcmp(line, "QUERY") == 0 ? "QUERY " : "RANK ", text, key, sizeof(key));
+        if (cache_get(&srv->cache, key, generation, &r->hit, &r->hit_cap) >= 0)
+            return put_reply(r, "%s", r->hit);
+    }
+
+    size_t start = r->len;
+    int status = answer_request(srv, index, line, text, top, r);
+    if (cached && status == SUCCESS && strncmp(r->data + start, "OK", 2) == 0)
+        cache_put(&srv->cache, key, generation, r->data + start, r->len - start);
+    return status;
+}
+
+
+/*****************************************************************************************************
+ * Function       : send_all
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Sends every byte of a buffer on a blocking socket, resuming after short writes and signals
+ *      (the load generator's clients).
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the connection failed.
+ *****************************************************************************************************/
+static int send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FAILURE;
+        data += n;
+        len -= n;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : send_ready
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Sends as much of a buffer as the socket takes without blocking, resuming after short
+ *      writes and signals, and advances *data and *len past what was sent.
+ *
+ * Returns        :
+ *      SUCCESS (with *len > 0 if the socket is full), or FAILURE if the connection failed.
+ *****************************************************************************************************/
+static int send_ready(int fd, const char **data, size_t *len)
+{
+    while (*len > 0)
+    {
+        ssize_t n = send(fd, *data, *len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return SUCCESS;
+        if (n <= 0)
+            return FAILURE;
+        *data += n;
+        *len -= n;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : send_output
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Sends the responses the connection still holds, then 'len' more bytes of 'data', and keeps
+ *      in the connection whatever the client isn't reading yet.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the connection failed or memory ran out.
+ *****************************************************************************************************/
+static int send_output(connection *conn, const char *data, size_t len)
+{
+    const char *held = conn->out + conn->out_sent;
+    size_t left = conn->out_len - conn->out_sent;
+
+    if (send_ready(conn->fd, &held, &left) == FAILURE)
+        return FAILURE;
+    conn->out_sent = conn->out_len - left;
+    if (left > 0)
+    {
+        memmove(conn->out, held, left);                 // Keep only the unsent part, then add to it
+        conn->out_sent = 0;
+        conn->out_len = left;
+    }
+    else
+    {
+        conn->out_sent = conn->out_len = 0;
+        if (send_ready(conn->fd, &data, &len) == FAILURE)
+            return FAILURE;
+    }
+    if (len == 0)
+        return SUCCESS;
+
+    if (conn->out_len + len > conn->out_cap)
+    {
+        char *grown = realloc(conn->out, conn->out_len + len);
+        if (grown == NULL)
+            return FAILURE;
+        conn->out = grown;
+        conn->out_cap = conn->out_len + len;
+    }
+    memcpy(conn->out + conn->out_len, data, len);
+    conn->out_len += len;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : serve_connection
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      One turn of a connection: sends what the client didn't read last time and, once that is
+ *      gone, answers the complete lines it has sent, up to SERVER_TURN_LINES of them or
+ *      SERVER_TURN_BYTES of responses, then sends the responses. Only the worker that received
+ *      the connection's one-shot event runs this. Each request is answered from the version
+ *      current when it starts; the response holds copies of the file names, so nothing points
+ *      into the mapping once the worker leaves it.
+ *
+ * Returns        :
+ *      SUCCESS to keep the connection (conn->more and conn->out_len say what to wait for), FAILURE
+ *      if it failed, or was closed, or sent a line longer than SERVER_LINE_MAX, and has nothing
+ *      left to send.
+ *****************************************************************************************************/
+static int serve_connection(server *srv, int id, connection *conn, ranked_doc *top, reply *r)
+{
+    int lines = 0;
+
+    if (send_output(conn, NULL, 0) == FAILURE)
+        return FAILURE;
+    conn->more = 0;
+    if (conn->out_len > 0)
+        return SUCCESS;                                 // The client still isn't reading
+    if (conn->closing)
+        return FAILURE;
+
+    r->len = 0;
+    for (;;)
+    {
+        char *start = conn->line, *newline;
+        while (lines < SERVER_TURN_LINES && r->len < SERVER_TURN_BYTES &&
+               (newline = memchr(start, '\n', conn->line + conn->len - start)) != NULL)
+        {
+            *newline = '\0';
+            if (newline > start && newline[-1] == '\r')
+                newline[-1] = '\0';
+            disk_index *index = enter_snapshot(&srv->snapshot, id);
+            unsigned long epoch = srv->snapshot.reader[id].epoch;   // Our own slot, just written
+            int status = answer(srv, index, epoch, start, top, r);
+            leave_snapshot(&srv->snapshot, id);
+            if (status == FAILURE)
+                return FAILURE;
+            __atomic_fetch_add(&srv->requests, 1, __ATOMIC_RELAXED);
+            start = newline + 1;
+            lines++;
+        }
+        conn->len -= start - conn->line;
+        memmove(conn->line, start, conn->len);
+
+        if (lines >= SERVER_TURN_LINES || r->len >= SERVER_TURN_BYTES)
+        {
+            conn->more = 1;                             // Let the other connections have a turn
+            break;
+        }
+        if (conn->len == sizeof(conn->line))
+        {
+            put_reply(r, "ERR request longer than %d bytes\n", SERVER_LINE_MAX - 1);
+            conn->closing = 1;
+            break;
+        }
+
+        ssize_t n = recv(conn->fd, conn->line + conn->len, sizeof(conn->line) - conn->len, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+        {
+            conn->closing = 1;                          // Closed by the client, or failed
+            break;
+        }
+        conn->len += n;
+    }
+
+    if (send_output(conn, r->data, r->len) == FAILURE || (conn->closing && conn->out_len == 0))
+        return FAILURE;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : close_connection
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Takes a connection off the epoll set and the list of open ones, closes it and frees it.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void close_connection(server *srv, connection *conn)
+{
+    epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    pthread_mutex_lock(&srv->open_lock);
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        srv->open = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+    pthread_mutex_unlock(&srv->open_lock);
+    close(conn->fd);
+    free(conn->out);
+    free(conn);
+}
+
+
+/*****************************************************************************************************
+ * Function       : accept_clients
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Accepts every pending connection and registers it one-shot in the epoll set. The listening
+ *      socket is non-blocking, so when several workers are woken for the same client, all but one
+ *      simply find nothing to accept.
+ *
+ * Returns        :
+ *      Nothing. A connection that can't be set up is closed.
+ *****************************************************************************************************/
+static void accept_clients(server *srv)
+{
+    int fd;
+
+    while ((fd = accept(srv->listen_fd, NULL, NULL)) >= 0)
+    {
+        connection *conn = calloc(1, sizeof(connection));
+        struct epoll_event event;
+
+        if (conn == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        pthread_mutex_lock(&srv->open_lock);            // Listed before a worker can see it
+        conn->next = srv->open;
+        if (srv->open)
+            srv->open->prev = conn;
+        srv->open = conn;
+        pthread_mutex_unlock(&srv->open_lock);
+
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        event.data.ptr = conn;
+        if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            close_connection(srv, conn);
+            continue;
+        }
+        __atomic_fetch_add(&srv->connections, 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+/*****************************************************************************************************
+ * Function       : server_worker
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Thread body of the pool: waits on the epoll set, accepting clients on the listening socket
+ *      and serving connections that have data, until the stop eventfd becomes readable.
+ *
+ * Returns        :
+ *      NULL.
+ *****************************************************************************************************/
+static void* server_worker(void *arg)
+{
+    worker *self = arg;
+    server *srv = self->srv;
+    ranked_doc top[SERVER_TOP_K];
+    reply r = { malloc(4096), 0, 4096, NULL, 0 };
+
+    if (r.data == NULL)
+        return NULL;
+
+    for (;;)
+    {
+        struct epoll_event event;
+        int n = epoll_wait(srv->epoll_fd, &event, 1, -1);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 || event.data.ptr == &srv->stop_fd)
+            break;                                      // Stopping: the eventfd stays readable for all
+        if (event.data.ptr == &srv->listen_fd)
+        {
+            accept_clients(srv);
+            continue;
+        }
+
+        connection *conn = event.data.ptr;
+        if (serve_connection(srv, self->id, conn, top, &r) == FAILURE)
+        {
+            close_connection(srv, conn);
+            continue;
+        }
+        // Hand it back to the pool: once the client reads what it was sent, at once if requests
+        // are left (a socket with room to write is ready), else when it sends more
+        if (conn->out_len > 0 || conn->closing)
+            event.events = EPOLLOUT | EPOLLONESHOT;
+        else if (conn->more)
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLONESHOT;
+        else
+            event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        epoll_ctl(srv->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    }
+
+    free(r.data);
+    free(r.hit);
+    return NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : reload_worker
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Thread body of the reloader: waits for reload requests and makes and publishes each new
+ *      version (see Reloading above). It is the only publisher, so the current version it builds
+ *      like can't be unmapped under it.
+ *
+ * Returns        :
+ *      NULL.
+ *****************************************************************************************************/
+static void* reload_worker(void *arg)
+{
+    server *srv = arg;
+
+    pthread_mutex_lock(&srv->reload_lock);
+    for (;;)
+    {
+        while (!srv->reload_pending && !srv->stopping)
+            pthread_cond_wait(&srv->reload_wanted, &srv->reload_lock);
+        if (srv->stopping)
+            break;
+        srv->reload_pending = 0;
+        pthread_mutex_unlock(&srv->reload_lock);
+
+        uint64_t start = metric_clock();
+        disk_index *index = srv->files ? build_version(srv->files, srv->index_file, srv->snapshot.current, 1)
+                                       : open_version(srv->index_file);
+        if (index == NULL)
+            fprintf(stderr, "ERROR : Couldn't reload %s; still serving the previous version\n", srv->index_file);
+        else
+        {
+            unsigned int docs = index->doc_count;
+            unsigned long epoch = publish_snapshot(&srv->snapshot, index);
+            fprintf(stderr, "Reloaded %s: version %lu, %u file(s), %.3f s\n", srv->index_file, epoch - 1, docs,
+                    (metric_clock() - start) / 1e9);
+        }
+
+        pthread_mutex_lock(&srv->reload_lock);
+    }
+    pthread_mutex_unlock(&srv->reload_lock);
+    return NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : open_socket
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Creates a Unix stream socket and either binds and listens on 'path' (server, replacing a
+ *      stale socket file) or connects to it (client).
+ *
+ * Returns        :
+ *      The socket, or -1 (with a message) on failure.
+ *****************************************************************************************************/
+static int open_socket(const char *path, int listening)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        printf("ERROR : Socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | (listening ? SOCK_NONBLOCK : 0), 0);   // accept() mustn't block
+    if (fd >= 0 && listening)
+    {
+        unlink(path);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 && listen(fd, SOMAXCONN) == 0)
+            return fd;
+    }
+    else if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        return fd;
+
+    printf("ERROR : Couldn't %s %s: %s\n", listening ? "listen on" : "connect to", path, strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+
+/*****************************************************************************************************
+ * Function       : serve_index
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Maps the index file and serves queries on it from a socket at 'path' with 'threads'
+ *      workers until SIGINT or SIGTERM; SIGHUP asks for a reload, like a RELOAD request. 'files'
+ *      (may be NULL) are what a reload indexes; responses are cached within 'cache_bytes' (0 for
+ *      no cache). The signals are blocked in every thread and taken
+ *      by sigwait() here, so no worker is interrupted half way through a request; the stop eventfd
+ *      then wakes them all.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the index, the socket or the workers couldn't be set up.
+ *****************************************************************************************************/
+int serve_index(const char *index_file, filenode *files, const char *path, int threads, size_t cache_bytes)
+{
+    server srv = { .index_file = index_file, .files = files, .epoll_fd = -1, .listen_fd = -1, .stop_fd = -1,
+                   .open_lock = PTHREAD_MUTEX_INITIALIZER, .reload_lock = PTHREAD_MUTEX_INITIALIZER,
+                   .reload_wanted = PTHREAD_COND_INITIALIZER };
+    disk_index *index = open_version(index_file);
+    worker *pool = calloc(threads, sizeof(worker));
+    struct epoll_event listen_event = { EPOLLIN, { .ptr = &srv.listen_fd } };   // Level-triggered, so
+    struct epoll_event stop_event = { EPOLLIN, { .ptr = &srv.stop_fd } };       // every worker sees them
+    sigset_t signals;
+    pthread_t reloader;
+    int started = 0, reloading = 0, sig;
+
+    if (index == NULL)
+    {
+        printf("ERROR : Couldn't open the index %s\n", index_file);
+        free(pool);
+        return FAILURE;
+    }
+    if (pool == NULL || init_cache(&srv.cache, cache_bytes) == FAILURE)
+    {
+        close_index(index);
+        free(index);
+        free(pool);
+        return FAILURE;
+    }
+    if (init_snapshot(&srv.snapshot, index, threads) == FAILURE)
+    {
+        close_index(index);
+        free(index);
+        free(pool);
+        free_cache(&srv.cache);
+        return FAILURE;
+    }
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);        // Inherited by the workers
+
+    srv.listen_fd = open_socket(path, 1);
+    srv.epoll_fd = epoll_create1(0);
+    srv.stop_fd = eventfd(0, 0);
+    if (srv.listen_fd >= 0 && srv.epoll_fd >= 0 && srv.stop_fd >= 0 &&
+        epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, srv.listen_fd, &listen_event) == 0 &&
+        epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, srv.stop_fd, &stop_event) == 0)
+    {
+        for (; started < threads; started++)
+        {
+            pool[started].srv = &srv;
+            pool[started].id = started;
+            if (pthread_create(&pool[started].tid, NULL, server_worker, &pool[started]) != 0)
+                break;
+        }
+        reloading = started && pthread_create(&reloader, NULL, reload_worker, &srv) == 0;
+    }
+
+    if (started)
+    {
+        uint64_t one = 1;
+
+        fprintf(stderr, "Serving %s on %s with %d thread(s)\n", index_file, path, started);
+        while (sigwait(&signals, &sig) == 0 && sig == SIGHUP)
+            request_reload(&srv);
+
+        pthread_mutex_lock(&srv.reload_lock);
+        srv.stopping = 1;
+        pthread_cond_signal(&srv.reload_wanted);
+        pthread_mutex_unlock(&srv.reload_lock);
+        if (reloading)
+            pthread_join(reloader, NULL);
+
+        if (write(srv.stop_fd, &one, sizeof(one)) != sizeof(one))
+            fprintf(stderr, "ERROR : Couldn't stop the workers\n");
+        for (int t = 0; t < started; t++)
+            pthread_join(pool[t].tid, NULL);
+        while (srv.open)                                // The workers are gone: nobody else holds one
+            close_connection(&srv, srv.open);
+        fprintf(stderr, "Stopped: %lu request(s) on %lu connection(s)\n", srv.requests, srv.connections);
+        print_cache_stats(&srv.cache, stderr);
+    }
+    else
+        fprintf(stderr, "ERROR : Couldn't start the server\n");
+
+    if (srv.listen_fd >= 0)
+    {
+        close(srv.listen_fd);
+        unlink(path);
+    }
+    if (srv.epoll_fd >= 0)
+        close(srv.epoll_fd);
+    if (srv.stop_fd >= 0)
+        close(srv.stop_fd);
+    free_snapshot(&srv.snapshot);
+    free_cache(&srv.cache);
+    free(pool);
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+    return started ? SUCCESS : FAILURE;
+}
+
+
+/*****************************************************************************************************
+ * Function       : read_reply
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Reads one response from the server: the "OK n" line and its n result lines, or an "ERR"
+ *      line.
+ *
+ * Returns        :
+ *      Number of results, -1 for an ERR response, or -2 if the connection failed.
+ *****************************************************************************************************/
+static int read_reply(FILE *in, char **line, size_t *cap)
+{
+    int count;
+
+    if (getline(line, cap, in) < 0)
+        return -2;
+    if (strncmp(*line, "ERR", 3) == 0)
+        return -1;
+    if (sscanf(*line, "OK %d", &count) != 1)
+        return -2;
+    for (int i = 0; i < count; i++)
+    {
+        if (getline(line, cap, in) < 0)
+            return -2;
+    }
+    return count;
+}
+
+
+/*****************************************************************************************************
+ * Function       : load_worker
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Thread body of one load generator client: connects, then sends its requests one at a time
+ *      (the next once the previous response is complete), cycling through the request list from
+ *      its own starting point, and records the latency of each.
+ *
+ * Returns        :
+ *      NULL.
+ *****************************************************************************************************/
+static void* load_worker(void *arg)
+{
+    load_client *c = arg;
+    int fd = open_socket(c->path, 0);
+    FILE *in = fd >= 0 ? fdopen(fd, "r") : NULL;
+    char *line = NULL;
+    size_t cap = 0;
+
+    if (in == NULL)
+    {
+        if (fd >= 0)
+            close(fd);
+        c->errors = c->sends;
+        return NULL;
+    }
+
+    for (long i = 0; i < c->sends; i++)
+    {
+        const char *request = c->request[(c->first + i) % c->count];
+        uint64_t start = metric_clock();
+
+        if (send_all(fd, request, strlen(request)) == FAILURE)
+        {
+            c->errors += c->sends - i;
+            break;
+        }
+        int count = read_reply(in, &line, &cap);
+        if (count == -2)
+        {
+            c->errors += c->sends - i;
+            break;
+        }
+        if (count < 0)
+            c->errors++;
+        c->latency[c->done++] = (metric_clock() - start) / 1e3;
+    }
+
+    free(line);
+    fclose(in);
+    return NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : compare_doubles
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      qsort() comparator for latencies.
+ *
+ * Returns        :
+ *      <0, 0 or >0.
+ *****************************************************************************************************/
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/*****************************************************************************************************
+ * Function       : run_load
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Load generator: 'clients' threads, each on its own connection, send 'requests' requests in
+ *      total to the server at 'path', taken in turn from request[] (lines ending in a newline).
+ *      Writes one line to 'out':
+ *          bench=serve clients=N requests=N errors=N seconds=x qps=x p50_us=x p90_us=x p99_us=x max_us=x
+ *      Latencies are per request, from sending it to reading the end of its response.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out or any request failed.
+ *****************************************************************************************************/
+int run_load(const char *path, char **request, int count, int clients, long requests, FILE *out)
+{
+    load_client *client = calloc(clients, sizeof(load_client));
+    double *latency = malloc((requests + 1) * sizeof(double));
+    long done = 0, errors = 0;
+
+    if (client == NULL || latency == NULL || count <= 0)
+    {
+        free(client);
+        free(latency);
+        return FAILURE;
+    }
+
+    uint64_t start = metric_clock();
+    long given = 0;
+    for (int i = 0; i < clients; i++)
+    {
+        client[i].path = path;
+        client[i].request = request;
+        client[i].count = count;
+        client[i].first = (int)((long)i * count / clients);
+        client[i].sends = requests * (i + 1) / clients - given;
+        client[i].latency = latency + given;
+        given += client[i].sends;
+        client[i].running = pthread_create(&client[i].tid, NULL, load_worker, &client[i]) == 0;
+        if (!client[i].running)
+            load_worker(&client[i]);                    // Run inline if no thread
+    }
+    for (int i = 0; i < clients; i++)
+    {
+        if (client[i].running)
+            pthread_join(client[i].tid, NULL);
+    }
+    double seconds = (metric_clock() - start) / 1e9;
+
+    // Each client filled the front of its own stretch: pack them together
+    for (int i = 0; i < clients; i++)
+    {
+        memmove(latency + done, client[i].latency, client[i].done * sizeof(double));
+        done += client[i].done;
+        errors += client[i].errors;
+    }
+    qsort(latency, done, sizeof(double), compare_doubles);
+#define PERCENTILE(p) (done ? latency[((p) * done + 99) / 100 - 1] : 0.0)     // Nearest rank
+    fprintf(out, "bench=serve clients=%d requests=%ld errors=%ld seconds=%.3f qps=%.0f p50_us=%.1f "
+                 "p90_us=%.1f p99_us=%.1f max_us=%.1f\n",
+            clients, done, errors, seconds, seconds > 0 ? done / seconds : 0.0,
+            PERCENTILE(50), PERCENTILE(90), PERCENTILE(99), PERCENTILE(100));
+#undef PERCENTILE
+    fflush(out);
+
+    free(client);
+    free(latency);
+    return errors ? FAILURE : SUCCESS;
+}
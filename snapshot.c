@@ -0,0 +1,188 @@
+/*****************************************************************************************************
+ * File           : snapshot.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Versions of a mapped index that readers use without taking a lock while a new version is
+ *      built. A version is an open disk_index, which is never written after open_index(); the
+ *      snapshot holds a pointer to the current one. A reader enters, gets the current version,
+ *      answers its request from it and leaves. A rebuild makes the next version on the side (index
+ *      the files, save_index() to a temporary file renamed over the old one, open_index()) and
+ *      publishes it with one atomic pointer swap; requests that start after the swap see the new
+ *      version, the ones already running finish on the old.
+ *
+ * Reclaiming     :
+ *      Epoch based. Every reader thread has a slot on its own cache line. Entering stores the
+ *      current epoch in the slot, then reads the version pointer; leaving stores 0. A publish
+ *      swaps the pointer, bumps the epoch, and waits until every slot is 0 or holds the new epoch:
+ *      a reader still on an older epoch may hold the old version, one that entered after the bump
+ *      can only have read the new pointer. Once the wait is over the old version is unmapped.
+ *      Entering and leaving are a store each and never wait; only the publisher waits, for the
+ *      requests that were running when it swapped (the grace period).
+ *
+ *      Each reader must have its own slot number, and must not enter twice without leaving. Any
+ *      number of publishers may run: each frees only the version its own swap replaced.
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include "inverted_search.h"
+
+
+/*****************************************************************************************************
+ * Function       : init_snapshot
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Makes 'index' (allocated with malloc and open) the first version, for 'readers' reader
+ *      slots numbered from 0. The snapshot owns the version from here on.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the slots couldn't be allocated.
+ *****************************************************************************************************/
+int init_snapshot(index_snapshot *snap, disk_index *index, int readers)
+{
+    snap->reader = calloc(readers > 0 ? readers : 1, sizeof(snapshot_reader));
+    if (snap->reader == NULL)
+    {
+        printf("ERROR : Couldn't allocate the snapshot readers\n");
+        return FAILURE;
+    }
+    snap->current = index;
+    snap->epoch = 1;                                    // 0 marks a reader outside
+    snap->readers = readers;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : enter_snapshot
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Starts a read by reader slot 'reader'. The version returned stays mapped until the same
+ *      reader calls leave_snapshot(), however many versions are published meanwhile.
+ *
+ * Returns        :
+ *      The current version.
+ *****************************************************************************************************/
+disk_index* enter_snapshot(index_snapshot *snap, int reader)
+{
+    unsigned long epoch = __atomic_load_n(&snap->epoch, __ATOMIC_SEQ_CST);
+
+    // Announce before reading the pointer: a publisher that misses the announcement swapped first
+    __atomic_store_n(&snap->reader[reader].epoch, epoch, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&snap->current, __ATOMIC_SEQ_CST);
+}
+
+
+/*****************************************************************************************************
+ * Function       : leave_snapshot
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Ends the read of reader slot 'reader'; the version it entered may be unmapped from here on.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void leave_snapshot(index_snapshot *snap, int reader)
+{
+    __atomic_store_n(&snap->reader[reader].epoch, 0, __ATOMIC_RELEASE);
+}
+
+
+/*****************************************************************************************************
+ * Function       : publish_snapshot
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Makes 'index' (allocated with malloc and open) the current version, waits for the readers
+ *      that may still hold the version it replaced, then closes and frees that one.
+ *
+ * Returns        :
+ *      The new epoch: 2 for the first version published after init_snapshot(), and so on.
+ *****************************************************************************************************/
+unsigned long publish_snapshot(index_snapshot *snap, disk_index *index)
+{
+    disk_index *old = __atomic_exchange_n(&snap->current, index, __ATOMIC_SEQ_CST);
+    unsigned long epoch = __atomic_add_fetch(&snap->epoch, 1, __ATOMIC_SEQ_CST);
+    METRIC_START(started);
+
+    for (int r = 0; r < snap->readers; r++)
+    {
+        for (;;)
+        {
+            unsigned long seen = __atomic_load_n(&snap->reader[r].epoch, __ATOMIC_SEQ_CST);
+            if (seen == 0 || seen >= epoch)
+                break;
+            sched_yield();                              // Let the reader finish its request
+        }
+    }
+    METRIC_STOP(PHASE_GRACE, started);
+
+    close_index(old);
+    free(old);
+    return epoch;
+}
+
+
+/*****************************************************************************************************
+ * Function       : free_snapshot
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Closes the current version and frees the reader slots. No reader may be inside.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void free_snapshot(index_snapshot *snap)
+{
+    close_index(snap->current);
+    free(snap->current);
+    free(snap->reader);
+    snap->current = NULL;
+    snap->reader = NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : open_version
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Maps an index file as a new version for init_snapshot() / publish_snapshot().
+ *
+ * Returns        :
+ *      The version, or NULL if the file couldn't be opened.
+ *****************************************************************************************************/
+disk_index* open_version(const char *filename)
+{
+    disk_index *index = malloc(sizeof(disk_index));
+
+    if (index != NULL && open_index(index, filename) == SUCCESS)
+        return index;
+    free(index);
+    return NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : build_version
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Indexes the files into a private table on 'threads' threads, with the positions and
+ *      analysis steps of 'like' (the version being replaced), saves it over 'filename' and maps
+ *      the result. Readers of the old version keep their mapping: save_index() renames a new file
+ *      into place rather than writing into the old one.
+ *
+ * Returns        :
+ *      The new version, or NULL if a step failed (the old file is then left as it was).
+ *****************************************************************************************************/
+disk_index* build_version(filenode *head, const char *filename, const disk_index *like, int threads)
+{
+    hashtable table;
+
+    if (init_hashtable(&table) == FAILURE)
+        return NULL;
+    table.positional = like->positional;
+    table.analysis = like->analysis;
+
+    int saved = index_files(&table, head, threads) >= 0 && save_index(&table, filename) == SUCCESS;
+    free_hashtable(&table);
+    return saved ? open_version(filename) : NULL;
+}
@@ -0,0 +1,390 @@
+/*****************************************************************************************************
+ * File           : term_dict.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Open-addressing term dictionary used in place of the chained hash table when the project is
+ *      built with -DFLAT_DICT (make DICT=flat). It provides the same table functions as common.c
+ *      (init_hashtable, lookup_term, link_mainnode, first_mainnode, next_mainnode), so the rest of
+ *      the program does not know which layout it is running on.
+ *
+ * Layout         :
+ *      slot[]      - Robin Hood probe array of 16-byte slots: hash, term id, first word bytes.
+ *      node[]      - Mainnode pointer of each term id, NULL once the word has been unlinked.
+ *      word_off[]  - Offset of each term's bytes in pool.
+ *      pool        - Every word, NUL-terminated, packed back to back.
+ *
+ *      A lookup probes contiguous slots comparing hashes and inline prefixes; words of fewer than
+ *      DICT_PREFIX_LEN bytes are fully decided inside the slot, longer ones finish the compare in
+ *      the pool. No mainnode is touched until the word has been found.
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "inverted_search.h"
+
+#ifdef FLAT_DICT
+
+
+/*****************************************************************************************************
+ * Function       : load_prefix
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Copies the first DICT_PREFIX_LEN bytes of the 'len'-byte word into 'prefix', zero padding
+ *      short words.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void load_prefix(char *prefix, const char *word, size_t len)
+{
+    size_t i = 0;
+
+    for (; i < DICT_PREFIX_LEN && i < len; i++)
+        prefix[i] = word[i];
+    for (; i < DICT_PREFIX_LEN; i++)
+        prefix[i] = '\0';
+}
+
+
+/*****************************************************************************************************
+ * Function       : place_slot
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Robin Hood insertion: walks the probe sequence of the entry and, whenever the resident slot
+ *      is closer to its home position than the entry is, swaps them and carries on with the
+ *      evicted slot. This keeps probe lengths short and nearly uniform.
+ *
+ * Returns        :
+ *      Nothing. The caller guarantees a free slot exists.
+ *****************************************************************************************************/
+static void place_slot(dict_slot *slots, unsigned int mask, dict_slot entry)
+{
+    unsigned int pos = entry.hash & mask;
+    unsigned int dist = 0;
+
+    while (slots[pos].id != DICT_EMPTY)
+    {
+        unsigned int resident = (pos - slots[pos].hash) & mask;   // Resident's probe distance
+
+        if (resident < dist)                                      // Take from the rich
+        {
+            dict_slot evicted = slots[pos];
+            slots[pos] = entry;
+            entry = evicted;
+            dist = resident;
+        }
+        pos = (pos + 1) & mask;
+        dist++;
+    }
+    slots[pos] = entry;
+}
+
+
+/*****************************************************************************************************
+ * Function       : grow_slots
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Doubles the probe array and re-places every slot. Only the stored hashes are used, so no
+ *      word bytes are read.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the new array couldn't be allocated.
+ *****************************************************************************************************/
+static int grow_slots(hashtable *table)
+{
+    unsigned int size = (table->mask + 1) * 2;
+    dict_slot *slots = malloc(size * sizeof(dict_slot));
+
+    if (slots == NULL)
+    {
+        printf("ERROR: Couldn't grow term dictionary\n");
+        return FAILURE;
+    }
+
+    METRIC_COUNT(METRIC_RESIZES, 1);
+    for (unsigned int i = 0; i < size; i++)
+        slots[i].id = DICT_EMPTY;
+
+    for (unsigned int i = 0; i <= table->mask; i++)
+    {
+        if (table->slot[i].id != DICT_EMPTY)
+            place_slot(slots, size - 1, table->slot[i]);
+    }
+
+    free(table->slot);
+    table->slot = slots;
+    table->mask = size - 1;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : reserve_entry
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Makes room for one more term id and 'len' more pool bytes, doubling the arrays as needed.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if an allocation failed (the table is left unchanged).
+ *****************************************************************************************************/
+static int reserve_entry(hashtable *table, size_t len)
+{
+    if (table->next_id == table->capacity)
+    {
+        unsigned int capacity = table->capacity ? table->capacity * 2 : DICT_INITIAL_SLOTS;
+        mainnode **node = realloc(table->node, capacity * sizeof(mainnode *));
+        if (node == NULL)
+            return FAILURE;
+        table->node = node;
+
+        unsigned int *word_off = realloc(table->word_off, capacity * sizeof(unsigned int));
+        if (word_off == NULL)
+            return FAILURE;
+        table->word_off = word_off;
+        table->capacity = capacity;
+    }
+
+    if (table->pool_len + len > table->pool_cap)
+    {
+        size_t cap = table->pool_cap ? table->pool_cap : 1024;
+        while (table->pool_len + len > cap)
+            cap *= 2;
+
+        char *pool = realloc(table->pool, cap);
+        if (pool == NULL)
+            return FAILURE;
+        table->pool = pool;
+        table->pool_cap = cap;
+    }
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : init_hashtable
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Allocates DICT_INITIAL_SLOTS empty probe slots. Term arrays and the pool are allocated on
+ *      the first insert.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the slots couldn't be allocated.
+ *****************************************************************************************************/
+int init_hashtable(hashtable *table)
+{
+    memset(table, 0, sizeof(*table));
+
+    table->slot = malloc(DICT_INITIAL_SLOTS * sizeof(dict_slot));
+    if (table->slot == NULL)
+    {
+        printf("ERROR: Couldn't allocate term dictionary\n");
+        return FAILURE;
+    }
+
+    for (int i = 0; i < DICT_INITIAL_SLOTS; i++)
+        table->slot[i].id = DICT_EMPTY;
+    table->mask = DICT_INITIAL_SLOTS - 1;
+    arena_init(&table->nodes);
+    init_doctable(&table->docs);
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : free_hashtable
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Frees the probe array, term arrays, pool and document table, and every node and file name
+ *      through the arena.
+ *
+ * Returns        :
+ *      Nothing. The table must be initialized again before reuse.
+ *****************************************************************************************************/
+void free_hashtable(hashtable *table)
+{
+    drop_lexicon(table);
+    free(table->slot);
+    free(table->node);
+    free(table->word_off);
+    free(table->pool);
+    free_doctable(&table->docs);
+    arena_free(&table->nodes);
+    memset(table, 0, sizeof(*table));
+}
+
+
+/*****************************************************************************************************
+ * Function       : lookup_term
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Probes from the home slot of the 'len'-byte word. A slot matches when hash and inline prefix agree and, for
+ *      words of DICT_PREFIX_LEN bytes or more, the rest of the word matches in the pool. The probe
+ *      stops at an empty slot or at a slot closer to home than the probe is (Robin Hood order
+ *      guarantees the word can't be further along).
+ *
+ * Returns        :
+ *      Pointer to the matching mainnode, or NULL if the word is not in the table.
+ *****************************************************************************************************/
+mainnode* lookup_term(hashtable *table, const char *word, size_t len)
+{
+    unsigned int hash = hash_bytes(word, len);
+    unsigned int pos = hash & table->mask;
+    char prefix[DICT_PREFIX_LEN];
+
+    load_prefix(prefix, word, len);
+    METRIC_COUNT(METRIC_LOOKUPS, 1);
+
+    for (unsigned int dist = 0; ; dist++, pos = (pos + 1) & table->mask)
+    {
+        dict_slot *slot = &table->slot[pos];
+
+        if (slot->id == DICT_EMPTY || ((pos - slot->hash) & table->mask) < dist)
+        {
+            METRIC_SAMPLE(METRIC_PROBE_LENGTH, dist + 1);
+            return NULL;
+        }
+
+        if (slot->hash == hash && memcmp(slot->prefix, prefix, DICT_PREFIX_LEN) == 0)
+        {
+            const char *stored = table->pool + table->word_off[slot->id];
+
+            METRIC_COUNT(METRIC_KEY_COMPARES, 1);
+            if (len < DICT_PREFIX_LEN ||                        // Whole word fits in the slot
+                (memcmp(stored + DICT_PREFIX_LEN, word + DICT_PREFIX_LEN, len - DICT_PREFIX_LEN) == 0 &&
+                 stored[len] == '\0'))
+            {
+                METRIC_SAMPLE(METRIC_PROBE_LENGTH, dist + 1);
+                return table->node[slot->id];
+            }
+        }
+    }
+}
+
+
+/*****************************************************************************************************
+ * Function       : link_mainnode
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Adds an existing mainnode whose word is not yet in the table: appends the word to the pool
+ *      (NUL-terminated), gives it the next term id and places its slot. The probe array doubles
+ *      once it is 7/8 full. Ids of unlinked words are not reused.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if an allocation failed.
+ *****************************************************************************************************/
+int link_mainnode(hashtable *table, mainnode *mnode)
+{
+    size_t len = mnode->len;
+
+    drop_lexicon(table);                                        // The sorted words no longer cover the table
+    if ((table->count + 1) * 8 > (table->mask + 1) * 7 && grow_slots(table) == FAILURE)
+        return FAILURE;
+
+    if (reserve_entry(table, len + 1) == FAILURE)
+    {
+        printf("ERROR: Couldn't grow term dictionary\n");
+        return FAILURE;
+    }
+
+    dict_slot entry;
+    entry.hash = mnode->hash;
+    entry.id = table->next_id++;
+    load_prefix(entry.prefix, mnode->word, len);
+
+    memcpy(table->pool + table->pool_len, mnode->word, len + 1);
+    table->word_off[entry.id] = table->pool_len;
+    table->pool_len += len + 1;
+    table->node[entry.id] = mnode;
+    table->count++;
+
+    place_slot(table->slot, table->mask, entry);
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : unlink_mainnode
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Takes a word out of the dictionary with Robin Hood backward-shift deletion: the slots after
+ *      it move back one place until a slot that is empty or already at its home position, so no
+ *      tombstone is left in the probe sequences. The term id's node entry becomes NULL; its pool
+ *      bytes stay until the table is rebuilt.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void unlink_mainnode(hashtable *table, mainnode *mnode)
+{
+    unsigned int pos = mnode->hash & table->mask;
+
+    drop_lexicon(table);
+    for (unsigned int dist = 0; ; dist++, pos = (pos + 1) & table->mask)
+    {
+        dict_slot *slot = &table->slot[pos];
+
+        if (slot->id == DICT_EMPTY || ((pos - slot->hash) & table->mask) < dist)
+            return;                                             // Not in the table
+        if (table->node[slot->id] == mnode)
+            break;
+    }
+
+    table->node[table->slot[pos].id] = NULL;
+    table->count--;
+
+    for (;;)
+    {
+        unsigned int next = (pos + 1) & table->mask;
+        dict_slot *slot = &table->slot[next];
+
+        if (slot->id == DICT_EMPTY || ((next - slot->hash) & table->mask) == 0)
+            break;
+        table->slot[pos] = *slot;
+        pos = next;
+    }
+    table->slot[pos].id = DICT_EMPTY;
+}
+
+
+/*****************************************************************************************************
+ * Function       : first_mainnode / next_mainnode
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Walk every word in term id (insertion) order, skipping unlinked ids. The cursor's bucket
+ *      field groups ids into sections of 1 << DICT_SECTION_SHIFT words, which save_database()
+ *      writes as its markers.
+ *
+ * Returns        :
+ *      The next mainnode, or NULL once the walk is complete.
+ *****************************************************************************************************/
+mainnode* first_mainnode(hashtable *table, table_cursor *cursor)
+{
+    cursor->array = 0;
+    cursor->position = 0;
+    cursor->node = NULL;
+
+    return next_mainnode(table, cursor);
+}
+
+mainnode* next_mainnode(hashtable *table, table_cursor *cursor)
+{
+    if (cursor->node)
+        cursor->position++;
+
+    while (cursor->position < table->next_id && table->node[cursor->position] == NULL)
+        cursor->position++;
+
+    if (cursor->position >= table->next_id)
+    {
+        cursor->node = NULL;
+        cursor->position = table->next_id;
+        return NULL;
+    }
+
+    cursor->bucket = cursor->position >> DICT_SECTION_SHIFT;
+    cursor->node = table->node[cursor->position];
+    return cursor->node;
+}
+
+#endif
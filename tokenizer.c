@@ -0,0 +1,260 @@
+/*****************************************************************************************************
+ * File           : tokenizer.c
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Splits an input file into whitespace-separated tokens without copying them. Regular files are
+ *      mapped with mmap(); anything that can't be mapped (pipes, FIFOs, empty or special files) is
+ *      read into one heap buffer instead. Tokens are returned as pointer + length slices of that
+ *      buffer, which insert_word() hashes and compares in place.
+ *
+ * Token rules    :
+ *      As fscanf("%s"): a token is a run of bytes that are not ' ', '\t', '\n', '\v', '\f' or '\r'.
+ *      Runs longer than MAX_TOKEN_LEN bytes are split into pieces of at most MAX_TOKEN_LEN bytes,
+ *      each ending before a UTF-8 lead byte, so a multi-byte character is never cut in two.
+ *
+ * Classifier     :
+ *      A 256-entry table marks the delimiter bytes. When compiled for SSE2 (every x86-64 target),
+ *      boundaries are found 16 bytes at a time: each block is compared against ' ' and range
+ *      checked against '\t'..'\r', and the first set bit of the resulting mask is the boundary.
+ *      The table handles the tail of the buffer and is also used when use_simd is cleared.
+ *****************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "inverted_search.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define READ_CHUNK (64 * 1024)          // Growth step of the read fallback buffer
+
+
+// 1 for the bytes isspace() accepts in the C locale, 0 for token bytes
+static const unsigned char delimiter[256] =
+{
+    ['\t'] = 1, ['\n'] = 1, ['\v'] = 1, ['\f'] = 1, ['\r'] = 1, [' '] = 1
+};
+
+
+/*****************************************************************************************************
+ * Function       : read_all
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Streams the whole descriptor into a growing heap buffer. Used when the input can't be mapped.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE on a read or allocation error.
+ *****************************************************************************************************/
+static int read_all(tokenizer *tok, int fd)
+{
+    size_t cap = 0, len = 0;
+    char *buf = NULL;
+
+    for (;;)
+    {
+        if (cap - len < READ_CHUNK)
+        {
+            cap = cap ? cap * 2 : READ_CHUNK;
+            char *grown = realloc(buf, cap);
+            if (grown == NULL)
+            {
+                free(buf);
+                return FAILURE;
+            }
+            buf = grown;
+        }
+
+        ssize_t got = read(fd, buf + len, cap - len);
+        if (got < 0)
+        {
+            free(buf);
+            return FAILURE;
+        }
+        if (got == 0)
+            break;
+        len += got;
+    }
+
+    tok->data = buf;
+    tok->size = len;
+    tok->mapped = 0;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : open_tokenizer
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Opens the file and makes its bytes available: mapped read-only if it is a non-empty regular
+ *      file, otherwise read into memory.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if the file couldn't be opened or read.
+ *****************************************************************************************************/
+int open_tokenizer(tokenizer *tok, const char *filename)
+{
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+
+    tok->data = NULL;
+    tok->size = 0;
+    tok->pos = 0;
+    tok->mapped = 0;
+#ifdef __SSE2__
+    tok->use_simd = 1;
+#else
+    tok->use_simd = 0;
+#endif
+
+    if (fd < 0)
+        return FAILURE;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);     // One front-to-back pass
+            tok->data = map;
+            tok->size = st.st_size;
+            tok->mapped = 1;
+            close(fd);
+            return SUCCESS;
+        }
+    }
+
+    int status = read_all(tok, fd);                         // Pipe, FIFO or failed mmap
+    close(fd);
+    return status;
+}
+
+
+/*****************************************************************************************************
+ * Function       : close_tokenizer
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Unmaps or frees the input buffer. Token slices handed out earlier become invalid.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+void close_tokenizer(tokenizer *tok)
+{
+    if (tok->mapped)
+        munmap((void *)tok->data, tok->size);
+    else
+        free((void *)tok->data);
+
+    tok->data = NULL;
+    tok->size = 0;
+    tok->pos = 0;
+}
+
+
+#ifdef __SSE2__
+/*****************************************************************************************************
+ * Function       : delimiter_mask
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Classifies 16 bytes at once: bit i of the result is set if p[i] is a delimiter.
+ *
+ * Returns        :
+ *      16-bit delimiter mask.
+ *****************************************************************************************************/
+static inline unsigned int delimiter_mask(const char *p)
+{
+    __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+    __m128i space = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '));
+    __m128i shifted = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));            // '\t'..'\r' -> 0..4
+    __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+
+    return (unsigned int)_mm_movemask_epi8(_mm_or_si128(space, control));
+}
+#endif
+
+
+/*****************************************************************************************************
+ * Function       : next_token
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Skips delimiters, then scans to the end of the token (or MAX_TOKEN_LEN bytes, whichever
+ *      comes first, moved back to the start of a UTF-8 character) and returns it as a slice of the
+ *      input buffer.
+ *
+ * Returns        :
+ *      SUCCESS with the slice stored in word and len, or FAILURE at the end of the input.
+ *****************************************************************************************************/
+int next_token(tokenizer *tok, const char **word, size_t *len)
+{
+    const char *data = tok->data;
+    size_t pos = tok->pos, size = tok->size;
+
+#ifdef __SSE2__
+    if (tok->use_simd)                                  // Skip delimiters 16 bytes at a time
+    {
+        while (pos + 16 <= size)
+        {
+            unsigned int tokens = ~delimiter_mask(data + pos) & 0xFFFF;
+            if (tokens)
+            {
+                pos += __builtin_ctz(tokens);
+                break;
+            }
+            pos += 16;
+        }
+    }
+#endif
+    while (pos < size && delimiter[(unsigned char)data[pos]])
+        pos++;
+
+    if (pos >= size)
+    {
+        tok->pos = size;
+        return FAILURE;
+    }
+
+    size_t start = pos;
+    size_t limit = size - start > MAX_TOKEN_LEN ? start + MAX_TOKEN_LEN : size;
+
+#ifdef __SSE2__
+    if (tok->use_simd)                                  // Find the token end 16 bytes at a time
+    {
+        while (pos + 16 <= limit)
+        {
+            unsigned int ends = delimiter_mask(data + pos);
+            if (ends)
+            {
+                pos += __builtin_ctz(ends);
+                goto found;
+            }
+            pos += 16;
+        }
+    }
+#endif
+    while (pos < limit && !delimiter[(unsigned char)data[pos]])
+        pos++;
+
+    // Split inside a run: don't leave a character's continuation bytes (10xxxxxx) to the next piece
+    if (pos == limit && pos < size && !delimiter[(unsigned char)data[pos]])
+    {
+        size_t back = pos;
+        while (back > start + 1 && back > pos - 3 && ((unsigned char)data[back] & 0xC0) == 0x80)
+            back--;
+        if (((unsigned char)data[back] & 0xC0) != 0x80)
+            pos = back;
+    }
+
+#ifdef __SSE2__
+found:
+#endif
+    *word = data + start;
+    *len = pos - start;
+    tok->pos = pos;
+    return SUCCESS;
+}
@@ -2,20 +2,39 @@
  * Function       : update_database
  * ---------------------------------------------------------------------------------------------------
  * What it does   :
- *      Reconstructs the hash table by reading previously saved data from "backup.txt". Each bucket
- *      index, word, file count, and associated file details (subnodes) are parsed and loaded back
- *      into the in-memory data structure.
+ *      Reconstructs the hash table by reading previously saved data from "backup.txt". Each word,
+ *      file count, and associated file details (postings) are parsed and loaded back into the
+ *      in-memory data structure. Words are re-hashed on insert, so the table may end up with a
+ *      different number of buckets than when it was saved.
+ *
+ *      The file is mapped (tokenizer.c) and cut at bucket markers into one chunk per thread; no
+ *      word spans a marker, so the chunks are parsed independently by a hand-written scanner:
+ *          1. parse (threads)  - each chunk's words become nodes in the chunk's own arena, its file
+ *                                names get ids in its own document table, and its postings are
+ *                                kept as (id, count) pairs;
+ *          2. link             - the nodes are linked into the table in file order; a word seen
+ *                                before is skipped, with its postings;
+ *          3. documents        - the chunks' file names with a posting of a kept word are
+ *                                registered in the table chunk by chunk, which gives the ids the
+ *                                order of first appearance in the file, as a sequential load would;
+ *          4. encode (threads) - each chunk maps its postings to the table's ids and encodes them
+ *                                into its nodes, and the chunks' arenas are adopted by the table,
+ *                                so nothing is copied and no step takes a lock.
  *
  * Why it’s needed:
  *      Enables persistent storage and later restoration of the inverted index. Without this routine,
  *      the database would be lost between executions.
  *
  * Input Format (backup.txt):
- *      #index; word; file_count;
+ *      #index;
+ *      word; file_count;
  *         file_name; word_count;
  *         file_name; word_count;
  *      #
  *
+ *      A word is everything before the ';' that ends its whitespace-delimited field (so "else;;"
+ *      is the word "else;"), and a file name everything before the ';' followed by its count.
+ *
  * Returns:
  *      Nothing. Constructs hash table directly.
  *****************************************************************************************************/
@@ -23,52 +42,645 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
 #include "inverted_search.h"
 
-void update_database(hashtable *table)
+
+// One "file_name; word_count;" entry of a word, after mapping the name to an id
+typedef struct loaded_posting
+{
+    int file_id;
+    int word_count;
+} loaded_posting;
+
+// A file name of the record being parsed, in the mapped file, until the record is known to be whole
+typedef struct loaded_name
+{
+    const char *start;
+    size_t len;
+} loaded_name;
+
+// One word of a chunk: its node and its run of postings in the chunk's list
+typedef struct loaded_word
+{
+    mainnode *node;
+    size_t first;                // Index of its first posting in the chunk's postings
+    int count;                   // Postings of the word
+} loaded_word;
+
+// A range of backup.txt and what was parsed from it
+typedef struct load_job
+{
+    const char *start;           // First byte of the chunk (a bucket marker, or the file start)
+    const char *end;             // First byte after the chunk
+    hashtable partial;           // Arena of the chunk's nodes; its documents under local ids
+    loaded_word *word;
+    size_t words, word_cap;
+    loaded_posting *posting;     // Postings of every word of the chunk, local ids until encoded
+    size_t postings, posting_cap;
+    loaded_name *name;           // File names of the record being parsed, one per posting
+    size_t name_cap;
+    int *global;                 // Table id of each local document id
+    const char *error;           // First malformed record, NULL if there was none
+    const char *reason;          // What was wrong with it
+    long skipped;                // Malformed lines skipped
+    int failed;                  // 1 if encoding its postings ran out of memory
+    pthread_t tid;
+    int running;                 // 1 if tid must be joined
+} load_job;
+
+
+/*****************************************************************************************************
+ * Function       : compare_postings
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      qsort() comparator ordering a word's loaded postings by document id.
+ *
+ * Returns        :
+ *      <0, 0 or >0.
+ *****************************************************************************************************/
+static int compare_postings(const void *a, const void *b)
+{
+    const loaded_posting *x = a, *y = b;
+
+    return (x->file_id > y->file_id) - (x->file_id < y->file_id);
+}
+
+
+/*****************************************************************************************************
+ * Function       : skip_space / scan_number
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      skip_space() moves past white space. scan_number() reads "digits;" after optional white
+ *      space, as fscanf(" %d;") would for a non-negative number.
+ *
+ * Returns        :
+ *      skip_space: the first byte that isn't white space (or end).
+ *      scan_number: the byte after the ';', or NULL if there is no number up to INT_MAX there.
+ *****************************************************************************************************/
+static const char* skip_space(const char *p, const char *end)
 {
-    FILE *fp = fopen("backup.txt", "r");        // Open saved database file
-    if (fp == NULL)
+    while (p < end && isspace((unsigned char)*p))
+        p++;
+    return p;
+}
+
+static const char* scan_number(const char *p, const char *end, int *value)
+{
+    long long n = 0;
+    const char *digits;
+
+    p = skip_space(p, end);
+    for (digits = p; p < end && *p >= '0' && *p <= '9'; p++)
     {
-        printf("ERROR: backup.txt not found!\n");
-        return;
+        n = n * 10 + (*p - '0');
+        if (n > INT_MAX)
+            return NULL;
     }
+    if (p == digits || p == end || *p != ';')
+        return NULL;
+    *value = (int)n;
+    return p + 1;
+}
+
 
-    init_hashtable(table);                      // Reset table before loading
+/*****************************************************************************************************
+ * Function       : is_marker
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Checks for a bucket marker line at 'p': '#', digits, ';' and nothing else up to the end of
+ *      the line. A word such as "#12" is written as "#12; 1; ..." on one line, so it isn't one.
+ *
+ * Returns        :
+ *      The start of the next line (or end) if it is a marker, NULL otherwise.
+ *****************************************************************************************************/
+static const char* is_marker(const char *p, const char *end)
+{
+    const char *digits;
 
-    int index;
-    char word[50];
+    if (p == end || *p != '#')
+        return NULL;
+    for (digits = ++p; p < end && *p >= '0' && *p <= '9'; p++)
+        ;
+    if (p == digits || p == end || *p++ != ';')
+        return NULL;
+    while (p < end && *p != '\n')
+    {
+        if (!isspace((unsigned char)*p++))
+            return NULL;
+    }
+    return p < end ? p + 1 : p;
+}
+
+
+/*****************************************************************************************************
+ * Function       : chunk_boundary
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Finds the first bucket marker that starts a line at or after 'from'.
+ *
+ * Returns        :
+ *      The marker's first byte, or 'end' if there is none.
+ *****************************************************************************************************/
+static const char* chunk_boundary(const char *start, const char *from, const char *end)
+{
+    const char *p = from;
+
+    if (p > start && p[-1] != '\n')                    // Not at a line start: go to the next one
+    {
+        p = memchr(p, '\n', end - p);
+        p = p ? p + 1 : end;
+    }
+    while (p < end && !is_marker(p, end))
+    {
+        p = memchr(p, '\n', end - p);
+        p = p ? p + 1 : end;
+    }
+    return p;
+}
+
+
+/*****************************************************************************************************
+ * Function       : grow_array
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Makes room for one more element of 'size' bytes in a growing array, doubling it when full.
+ *
+ * Returns        :
+ *      SUCCESS, or FAILURE if memory ran out (the array is left as it was).
+ *****************************************************************************************************/
+static int grow_array(void **array, size_t used, size_t *cap, size_t size)
+{
+    if (used < *cap)
+        return SUCCESS;
+
+    size_t grown_cap = *cap ? *cap * 2 : 1024;
+    void *grown = realloc(*array, grown_cap * size);
+    if (grown == NULL)
+        return FAILURE;
+    *array = grown;
+    *cap = grown_cap;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************************************
+ * Function       : parse_word
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Parses the word record at 'p' ("word; file_count; name; count; ... #") into a new node in the
+ *      chunk's arena and the chunk's posting list. File names are only noted while the record is
+ *      parsed; once its closing '#' is found they are registered in the chunk's own document
+ *      table, so a malformed record adds no document. Document lengths are added up later, from
+ *      the words that are kept.
+ *
+ * Returns        :
+ *      The byte after the record, or NULL if it is malformed (job->reason says why; the word and
+ *      its postings are then dropped again).
+ *****************************************************************************************************/
+static const char* parse_word(load_job *job, const char *p, const char *end)
+{
+    char name[PATH_MAX];
+    const char *word = p;
     int file_count;
 
-    // Read "#index; word; file_count;"
-    while (fscanf(fp, "#%d; %[^;]; %d;", &index, word, &file_count) == 3)
+    while (p < end && !isspace((unsigned char)*p))     // The word's field, ';' included
+        p++;
+    if (p - word < 2 || p[-1] != ';')
     {
-        mainnode *m = create_mainnode(word);    // Create word node
-        m->file_count = file_count;             // Set number of files for this word
+        job->reason = "expected \"word;\"";
+        return NULL;
+    }
+    size_t len = p - word - 1;
+    if (len > MAX_TOKEN_LEN)
+    {
+        job->reason = "word longer than MAX_TOKEN_LEN bytes";
+        return NULL;
+    }
+    if ((p = scan_number(p, end, &file_count)) == NULL)
+    {
+        job->reason = "expected the file count";
+        return NULL;
+    }
 
-        // Insert mainnode into bucket at head
-        m->main_next_link = table[index].link;
-        table[index].link = m;
+    mainnode *m = create_mainnode(&job->partial.nodes, word, len);
+    if (m == NULL || grow_array((void **)&job->word, job->words, &job->word_cap, sizeof(loaded_word)) == FAILURE)
+    {
+        job->reason = "out of memory";
+        return NULL;
+    }
+    loaded_word *w = &job->word[job->words++];
+    w->node = m;
+    w->first = job->postings;
+    w->count = 0;
 
-        char file_name[100];
-        int word_count;
+    // 'file_count' entries of "file_name; word_count;"
+    for (int i = 0; i < file_count; i++)
+    {
+        const char *start = skip_space(p, end), *semi = start;
+        int count;
 
-        // Read 'file_count' number of "file_name; word_count;" entries
-        for (int i = 0; i < file_count; i++)
+        for (;;)                                        // The ';' followed by the count
         {
-            if (fscanf(fp, " %[^;]; %d;", file_name, &word_count) != 2)
+            semi = memchr(semi, ';', end - semi);
+            if (semi == NULL || (p = scan_number(semi + 1, end, &count)) != NULL)
                 break;
+            semi++;
+        }
+        if (semi == NULL || semi == start || (size_t)(semi - start) >= sizeof(name))
+        {
+            job->reason = "expected \"file_name; word_count;\"";
+            return NULL;
+        }
+        if (grow_array((void **)&job->name, w->count, &job->name_cap, sizeof(loaded_name)) == FAILURE ||
+            grow_array((void **)&job->posting, job->postings, &job->posting_cap, sizeof(loaded_posting)) == FAILURE)
+        {
+            job->reason = "out of memory";
+            return NULL;
+        }
+        job->name[w->count].start = start;
+        job->name[w->count].len = semi - start;
+        job->posting[job->postings].file_id = -1;       // Set once the record is whole
+        job->posting[job->postings++].word_count = count;
+        w->count++;
+    }
+
+    p = skip_space(p, end);
+    if (p == end || *p != '#')
+    {
+        job->reason = "expected '#' after the postings";
+        return NULL;
+    }
+
+    for (int i = 0; i < w->count; i++)
+    {
+        loaded_posting *posting = &job->posting[w->first + i];
+        memcpy(name, job->name[i].start, job->name[i].len);
+        name[job->name[i].len] = '\0';
+
+        int id = add_document(&job->partial, name);
+        if (id < 0)
+        {
+            job->reason = "out of memory";
+            return NULL;
+        }
+        posting->file_id = id;
+    }
+    return p + 1;
+}
+
+
+/*****************************************************************************************************
+ * Function       : parse_chunk
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Thread body of step 1: parses every bucket marker and word record of the job's chunk. A
+ *      malformed record is dropped and parsing resumes on the next line, so the result doesn't
+ *      depend on how the file was cut into chunks.
+ *
+ * Returns        :
+ *      NULL.
+ *****************************************************************************************************/
+static void* parse_chunk(void *arg)
+{
+    load_job *job = arg;
+    const char *p = job->start, *next;
+
+    while ((p = skip_space(p, job->end)) < job->end)
+    {
+        size_t words = job->words, postings = job->postings;
+
+        if ((next = is_marker(p, job->end)) == NULL && (next = parse_word(job, p, job->end)) == NULL)
+        {
+            if (job->error == NULL)
+                job->error = p;
+            job->skipped++;
+            job->words = words;                         // Drop what the record added
+            job->postings = postings;
+            next = memchr(p, '\n', job->end - p);
+            next = next ? next + 1 : job->end;
+        }
+        p = next;
+    }
+    return NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : encode_chunk
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Thread body of step 4: maps each posting of the chunk to its table id, sorts a word's
+ *      postings if that order differs from the saved one, and encodes them into the word's node.
+ *      Words skipped as duplicates (node NULL) are passed over.
+ *
+ * Returns        :
+ *      NULL. Sets job->failed if memory ran out.
+ *****************************************************************************************************/
+static void* encode_chunk(void *arg)
+{
+    load_job *job = arg;
 
-            subnode *s = create_subnode(file_name);  // Create file entry node
-            s->word_count = word_count;             // Assign stored count
+    for (size_t i = 0; i < job->words; i++)
+    {
+        loaded_word *w = &job->word[i];
+        loaded_posting *list = job->posting + w->first;
+        int sorted = 1;
+
+        if (w->node == NULL)
+            continue;
 
-            s->sub_sublink = m->sublink;            // Insert at head of subnode list
-            m->sublink = s;
+        for (int j = 0; j < w->count; j++)
+        {
+            list[j].file_id = job->global[list[j].file_id];
+            if (j && list[j - 1].file_id > list[j].file_id)
+                sorted = 0;
         }
+        if (!sorted)
+            qsort(list, w->count, sizeof(loaded_posting), compare_postings);
+        for (int j = 0; j < w->count; j++)
+        {
+            if (add_posting(&job->partial.nodes, w->node, list[j].file_id, list[j].word_count) == FAILURE)
+            {
+                job->failed = 1;
+                return NULL;
+            }
+        }
+    }
+    return NULL;
+}
+
+
+/*****************************************************************************************************
+ * Function       : run_jobs
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Runs 'body' on every job, one thread each (inline if a thread can't be started), and waits
+ *      for all of them.
+ *
+ * Returns        :
+ *      Nothing.
+ *****************************************************************************************************/
+static void run_jobs(load_job *jobs, int count, void *(*body)(void *))
+{
+    for (int t = 0; t < count; t++)
+    {
+        jobs[t].running = count > 1 && pthread_create(&jobs[t].tid, NULL, body, &jobs[t]) == 0;
+        if (!jobs[t].running)
+            body(&jobs[t]);
+    }
+    for (int t = 0; t < count; t++)
+    {
+        if (jobs[t].running)
+            pthread_join(jobs[t].tid, NULL);
+    }
+}
+
+
+/*****************************************************************************************************
+ * Function       : line_of
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Counts the lines of the file up to 'p', for error messages.
+ *
+ * Returns        :
+ *      The 1-based line number of 'p'.
+ *****************************************************************************************************/
+static long line_of(const char *start, const char *p)
+{
+    long line = 1;
+
+    for (const char *q = start; (q = memchr(q, '\n', p - q)) != NULL; q++)
+        line++;
+    return line;
+}
+
+
+void update_database(hashtable *table, int threads)
+{
+    tokenizer file;                             // Mapped backup.txt (only its data and size are used)
+    if (open_tokenizer(&file, TEXT_FILE) == FAILURE)
+    {
+        printf("ERROR: backup.txt not found!\n");
+        return;
+    }
+    METRIC_START(started);
+
+    unsigned int analysis = table->analysis;    // backup.txt doesn't record it: keep the "-a" steps
+    int positional = table->positional;         // Nor positions: keep "-p" for the next sync and save
+    unsigned long generation = table->generation;
+    free_hashtable(table);                      // Drop the previous generation in one call
+    if (threads < 1)
+        threads = 1;
+    load_job *jobs = calloc(threads, sizeof(load_job));
+    if (init_hashtable(table) == FAILURE || jobs == NULL)     // Reset table before loading
+    {
+        free(jobs);
+        close_tokenizer(&file);
+        return;
+    }
+    table->analysis = analysis;
+    table->positional = positional;
+    table->generation = generation + 1;         // Never reuse one a cached result was tagged with
 
-        fscanf(fp, " #\n");                         // Consume trailing '#'
+    // Chunks of about size/threads bytes, each starting at a bucket marker
+    const char *start = file.data, *end = file.data + file.size, *p = start;
+    int count = 0;
+    for (int t = 0; t < threads && p < end; t++)
+    {
+        const char *next = t == threads - 1 ? end : chunk_boundary(start, start + file.size * (t + 1) / threads, end);
+        if (next <= p)
+            continue;
+        jobs[count].start = p;
+        jobs[count].end = next;
+        if (init_hashtable(&jobs[count].partial) == FAILURE)
+            break;
+        count++;
+        p = next;
+    }
+    if (p < end && count > 0)                   // A chunk's table couldn't be set up: the last one takes the rest
+        jobs[count - 1].end = end;
+
+    run_jobs(jobs, count, parse_chunk);
+
+    // Words into the table in file order; a word seen before is skipped before it adds documents
+    for (int t = 0; t < count; t++)
+    {
+        for (size_t i = 0; i < jobs[t].words; i++)
+        {
+            mainnode *m = jobs[t].word[i].node;
+            if (lookup_term(table, m->word, m->len) == NULL)
+                link_mainnode(table, m);                // Its postings are encoded in step 4
+            else
+            {
+                printf("ERROR : Word %s appears twice in backup.txt, the second one is skipped\n", m->word);
+                jobs[t].word[i].node = NULL;
+            }
+        }
+    }
+
+    // Documents in order of first appearance, chunk by chunk, if a kept word has a posting in them
+    int status = SUCCESS;
+    for (int t = 0; t < count && status == SUCCESS; t++)
+    {
+        load_job *job = &jobs[t];
+        doctable *local = &job->partial.docs;
+        int *length = calloc(local->count + 1, sizeof(int));
+        job->global = malloc((local->count + 1) * sizeof(int));
+        if (job->global == NULL || length == NULL)
+            status = FAILURE;
+        for (int id = 0; status == SUCCESS && id < local->count; id++)
+            job->global[id] = -1;
+        for (size_t i = 0; status == SUCCESS && i < job->words; i++)
+        {
+            const loaded_word *w = &job->word[i];
+            for (int j = 0; w->node != NULL && j < w->count; j++)
+            {
+                const loaded_posting *posting = &job->posting[w->first + j];
+                job->global[posting->file_id] = 0;
+                length[posting->file_id] += posting->word_count;
+            }
+        }
+        for (int id = 0; status == SUCCESS && id < local->count; id++)
+        {
+            if (job->global[id] < 0)
+                continue;                               // Named only by skipped words
+            int global = add_document(table, local->name[id]);
+            if (global < 0)
+                status = FAILURE;
+            else
+            {
+                job->global[id] = global;
+                set_document_length(&table->docs, global, table->docs.length[global] + length[id]);
+            }
+        }
+        free(length);
+    }
+
+    if (status == SUCCESS)
+        run_jobs(jobs, count, encode_chunk);
+
+    for (int t = 0; t < count; t++)
+    {
+        load_job *job = &jobs[t];
+
+        if (job->failed)
+            status = FAILURE;
+        if (job->error)
+            printf("ERROR : backup.txt line %ld: %s; %ld malformed line(s) skipped\n",
+                   line_of(start, job->error), job->reason, job->skipped);
+
+        arena_adopt(&table->nodes, &job->partial.nodes);      // The nodes live on in the table
+        free_hashtable(&job->partial);
+        free(job->word);
+        free(job->posting);
+        free(job->name);
+        free(job->global);
+    }
+    free(jobs);
+    close_tokenizer(&file);
+    METRIC_STOP(PHASE_LOAD_TEXT, started);
+
+    if (status == SUCCESS)
+        printf("Database updated from backup.txt successfully!\n");
+    else
+        printf("ERROR: Out of memory while loading backup.txt, the database is incomplete\n");
+}
+
+
+/*****************************************************************************************************
+ * Function       : sync_database
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Brings a loaded index in line with the files given on the command line, without rebuilding
+ *      it:
+ *          - a document whose file is no longer given, or can't be examined, is removed;
+ *          - a document whose file size or modification time differs from its stamp is removed
+ *            and indexed again under a new id;
+ *          - a file the index doesn't have yet is indexed.
+ *      Only the changed files are read, and only the words they contain are touched.
+ *
+ * Why it’s needed:
+ *      Re-indexing the whole collection because one file changed costs as much as the first build.
+ *
+ * Returns:
+ *      SUCCESS, or FAILURE if memory ran out.
+ *****************************************************************************************************/
+int sync_database(hashtable *table, filenode *head, int threads)
+{
+    doctable *docs = &table->docs;
+    unsigned char *keep = calloc(docs->count + 1, 1);   // Documents still given and unchanged
+    int *gone = malloc((docs->count + 1) * sizeof(int)); // Documents to remove
+    filenode *added = NULL, **tail = &added;            // Files to index, in command-line order
+    int removed = 0, changed = 0, fresh = 0, status = SUCCESS;
+    METRIC_START(started);
+
+    table->generation++;                                // Cached results are stale from here
+    if (keep == NULL || gone == NULL)
+    {
+        printf("ERROR: Couldn't allocate update state\n");
+        free(keep);
+        free(gone);
+        return FAILURE;
+    }
+
+    for (filenode *temp = head; temp != NULL; temp = temp->link)
+    {
+        int id = find_document(docs, temp->filename);
+        doc_stamp now;
+
+        if (read_stamp(temp->filename, &now) == FAILURE)
+            continue;                                   // Vanished since validation: drop it
+        if (id >= 0 && docs->stamp[id].size == now.size && docs->stamp[id].mtime == now.mtime)
+        {
+            keep[id] = 1;
+            continue;
+        }
+
+        filenode *copy = malloc(sizeof(filenode) + strlen(temp->filename) + 1);
+        if (copy == NULL)
+        {
+            status = FAILURE;
+            break;
+        }
+        strcpy(copy->filename, temp->filename);
+        copy->link = NULL;
+        *tail = copy;
+        tail = &copy->link;
+        if (id >= 0)
+            changed++;
+        else
+            fresh++;
+    }
+
+    if (status == SUCCESS)
+    {
+        for (int id = 0; id < docs->count; id++)
+        {
+            if (docs->name[id] != NULL && !keep[id])
+                gone[removed++] = id;
+        }
+        status = remove_documents(table, gone, removed);
+    }
+
+    if (status == SUCCESS && added != NULL && index_files(table, added, threads) < 0)
+        status = FAILURE;
+
+    while (added)
+    {
+        filenode *next = added->link;
+        free(added);
+        added = next;
     }
+    free(keep);
+    free(gone);
+    METRIC_STOP(PHASE_SYNC, started);
 
-    fclose(fp);                                     // Close backup file
-    printf("Database updated from backup.txt successfully!\n");
+    if (status == SUCCESS)
+        printf("Indexed %d new, re-indexed %d changed and removed %d missing file(s)\n",
+               fresh, changed, removed - changed);
+    else
+        printf("ERROR: Update stopped, the index may be incomplete\n");
+    return status;
 }
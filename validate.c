@@ -13,6 +13,7 @@
  *      FAILURE otherwise (and prints an error).
  *****************************************************************************************************/
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "inverted_search.h"
 
@@ -65,7 +66,142 @@ int validate(int argc, char *argv[])
 
 
 
+/*****************************************************************************************************
+ * Function       : parse_threads
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Looks for a "-j N" (or "-jN") option among the arguments, removes it from argv and adjusts
+ *      argc, so the remaining arguments are file names only.
+ *
+ * Why it’s needed:
+ *      create_database() can index files on several threads; the thread count comes from the
+ *      command line but must not reach validate() or the file list as a file name.
+ *
+ * Returns:
+ *      The requested thread count (at least 1), or 1 if the option isn't given.
+ *****************************************************************************************************/
+int parse_threads(int *argc, char *argv[])
+{
+    int threads = 1;
+
+    for (int i = 1; i < *argc; i++)
+    {
+        if (strncmp(argv[i], "-j", 2) != 0)
+            continue;
+
+        int used = 1;                                 // Arguments taken by the option
+        const char *value = argv[i] + 2;
+        if (*value == '\0' && i + 1 < *argc)
+        {
+            value = argv[i + 1];
+            used = 2;
+        }
+
+        threads = atoi(value);
+        if (threads < 1)
+        {
+            printf("ERROR : Invalid thread count '%s', using 1\n", value);
+            threads = 1;
+        }
+
+        for (int j = i; j + used <= *argc; j++)       // Shift the rest (and the NULL) down
+            argv[j] = argv[j + used];
+        *argc -= used;
+        i--;
+    }
+    return threads;
+}
+
+
+/*****************************************************************************************************
+ * Function       : parse_positions
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Looks for a "-p" option among the arguments and removes it from argv, like parse_threads().
+ *
+ * Why it’s needed:
+ *      Recording word positions (for phrase and NEAR queries) makes the index larger, so a
+ *      database is only built with them when asked.
+ *
+ * Returns:
+ *      1 if the option was given, 0 otherwise.
+ *****************************************************************************************************/
+int parse_positions(int *argc, char *argv[])
+{
+    int found = 0;
+
+    for (int i = 1; i < *argc; i++)
+    {
+        if (strcmp(argv[i], "-p") != 0)
+            continue;
+
+        found = 1;
+        for (int j = i; j < *argc; j++)               // Shift the rest (and the NULL) down
+            argv[j] = argv[j + 1];
+        (*argc)--;
+        i--;
+    }
+    return found;
+}
+
+
+/*****************************************************************************************************
+ * Function       : parse_analysis
+ * ---------------------------------------------------------------------------------------------------
+ * What it does   :
+ *      Looks for an "-a steps" (or "-asteps") option among the arguments and removes it from
+ *      argv, like parse_threads(). Steps is a comma separated list of fold, trim, stop and stem,
+ *      or all; unknown names are reported and ignored.
+ *
+ * Why it’s needed:
+ *      Normalizing tokens (analyzer.c) changes which words are indexed, so it is chosen when the
+ *      database is built; the index file records the choice for later searches.
+ *
+ * Returns:
+ *      The ANALYZE_* steps named, 0 if the option wasn't given.
+ *****************************************************************************************************/
+unsigned int parse_analysis(int *argc, char *argv[])
+{
+    static const char *name[] = { "fold", "trim", "stop", "stem" };
+    unsigned int steps = 0;
+
+    for (int i = 1; i < *argc; i++)
+    {
+        if (strncmp(argv[i], "-a", 2) != 0)
+            continue;
 
+        int used = 1;                                 // Arguments taken by the option
+        const char *value = argv[i] + 2;
+        if (*value == '\0' && i + 1 < *argc)
+        {
+            value = argv[i + 1];
+            used = 2;
+        }
 
+        while (*value)
+        {
+            size_t len = strcspn(value, ",");
+            int known = len == 3 && strncmp(value, "all", 3) == 0;
 
-   
+            if (known)
+                steps |= ANALYZE_ALL;
+            for (int k = 0; k < 4 && !known; k++)
+            {
+                if (strlen(name[k]) == len && strncmp(value, name[k], len) == 0)
+                {
+                    steps |= 1u << k;
+                    known = 1;
+                }
+            }
+            if (!known && len > 0)
+                printf("ERROR : Unknown analysis step '%.*s' (use fold, trim, stop, stem or all)\n", (int)len, value);
+            value += len + (value[len] == ',');
+        }
+
+        for (int j = i; j + used <= *argc; j++)       // Shift the rest (and the NULL) down
+            argv[j] = argv[j + used];
+        *argc -= used;
+        i--;
+    }
+    return steps;
+}